@@ -0,0 +1,84 @@
+#include "LocationCache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// [static]
+uint32_t LocationCacheBase::crc32(const void *data, size_t len, uint32_t crc) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    crc = ~crc;
+    for(size_t ii = 0; ii < len; ii++) {
+        crc ^= p[ii];
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// [static]
+uint32_t LocationCacheBase::hash(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t hash = 2166136261;
+
+    for(size_t ii = 0; ii < len; ii++) {
+        hash ^= p[ii];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+// [static]
+int LocationCacheBase::writeFile(const char *path, uint32_t magic, uint32_t clock, const void *records, size_t recordSize, size_t count) {
+    FileHeader header = {};
+    header.magic = magic;
+    header.version = FILE_VERSION;
+    header.recordSize = (uint16_t)recordSize;
+    header.count = (uint32_t)count;
+    header.clock = clock;
+    header.crc = crc32(records, recordSize * count);
+
+    // Write a new file and rename it over the old one so a reset leaves either the old or new cache
+    String tempPath = String::format("%s.tmp", path);
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return SYSTEM_ERROR_FILE;
+    }
+    size_t dataLen = recordSize * count;
+    bool written = (write(fd, &header, sizeof(header)) == sizeof(header)) &&
+        (dataLen == 0 || write(fd, records, dataLen) == (ssize_t)dataLen);
+    fsync(fd);
+    close(fd);
+    if (!written || rename(tempPath.c_str(), path) != 0) {
+        return SYSTEM_ERROR_FILE;
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
+// [static]
+uint8_t *LocationCacheBase::readFile(const char *path, uint32_t magic, size_t recordSize, uint32_t &clock, size_t &count) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    uint8_t *data = nullptr;
+    FileHeader header;
+    if (read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == magic &&
+        header.version == FILE_VERSION && header.recordSize == recordSize && header.count <= 0xffff) {
+        size_t dataLen = recordSize * header.count;
+        data = new uint8_t[dataLen ? dataLen : 1];
+        if (data && (size_t)read(fd, data, dataLen) == dataLen && crc32(data, dataLen) == header.crc) {
+            clock = header.clock;
+            count = header.count;
+        }
+        else {
+            delete[] data;
+            data = nullptr;
+        }
+    }
+    close(fd);
+
+    return data;
+}
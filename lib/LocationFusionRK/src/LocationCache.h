@@ -0,0 +1,331 @@
+#ifndef __LOCATIONCACHE_H
+#define __LOCATIONCACHE_H
+
+#include "Particle.h"
+
+#include <type_traits>
+
+// Repository: https://github.com/rickkas7/LocationFusionRK
+// License: MIT
+
+/**
+ * @brief Non-template parts of LocationCache: hashing, CRC, and the file format. Added in 0.0.5.
+ */
+class LocationCacheBase {
+public:
+    /**
+     * @brief Cache counters
+     */
+    struct Stats {
+        uint32_t hits; //!< find() calls that found the key
+        uint32_t misses; //!< find() calls that did not find the key
+        uint32_t inserts; //!< New keys added
+        uint32_t evictions; //!< Least recently used keys removed to make room
+    };
+
+    /**
+     * @brief CRC-32 (IEEE 802.3)
+     *
+     * @param data Data to check
+     * @param len Length of data in bytes
+     * @param crc Result from the previous block to continue a calculation, 0 to start
+     * @return uint32_t
+     */
+    static uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+
+    /**
+     * @brief FNV-1a hash
+     */
+    static uint32_t hash(const void *data, size_t len);
+
+protected:
+    /**
+     * @brief Start of a cache file, followed by count records of recordSize bytes
+     */
+    struct FileHeader {
+        uint32_t magic; //!< Identifies the kind of cache
+        uint16_t version; //!< FILE_VERSION
+        uint16_t recordSize; //!< sizeof the record, so a change in layout is detected
+        uint32_t count; //!< Number of records
+        uint32_t clock; //!< LRU clock when saved
+        uint32_t crc; //!< CRC-32 of the records
+    };
+
+    static const uint16_t FILE_VERSION = 1;
+
+    /**
+     * @brief Write records to a file, replacing it atomically with rename()
+     *
+     * @return int SYSTEM_ERROR_NONE (0) or an error code
+     */
+    static int writeFile(const char *path, uint32_t magic, uint32_t clock, const void *records, size_t recordSize, size_t count);
+
+    /**
+     * @brief Read and validate a file written by writeFile()
+     *
+     * @param path File to read
+     * @param magic Expected magic number
+     * @param recordSize Expected record size
+     * @param clock Set to the saved LRU clock
+     * @param count Set to the number of records
+     * @return uint8_t* Records, allocated with new[]. The caller must delete[] them. nullptr if the file is missing or invalid.
+     */
+    static uint8_t *readFile(const char *path, uint32_t magic, size_t recordSize, uint32_t &clock, size_t &count);
+};
+
+/**
+ * @brief Fixed-capacity hash table with least recently used eviction, saved to a file. Added in 0.0.5.
+ *
+ * @tparam Key Key type. Must be trivially copyable with no padding, as keys are hashed and compared as bytes.
+ * @tparam Value Value type. Must be trivially copyable.
+ * @tparam SLOTS Number of slots, a power of 2. Up to 3/4 of them are used.
+ *
+ * Uses open addressing with linear probing, so the table is one array and never allocates. When it is full, the entry
+ * that was least recently found or inserted is removed. The caller is responsible for locking if it is used from
+ * more than one thread.
+ */
+template<typename Key, typename Value, size_t SLOTS>
+class LocationCache : public LocationCacheBase {
+public:
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of 2");
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value, "Key and Value must be trivially copyable");
+
+    /**
+     * @brief Maximum number of entries
+     */
+    static const size_t CAPACITY = SLOTS * 3 / 4;
+
+    /**
+     * @brief Look up a key, marking it as recently used
+     *
+     * @param key Key to find
+     * @param value Set to the value if found
+     * @return true if found
+     */
+    bool find(const Key &key, Value &value) {
+        int index = indexOf(key);
+        if (index < 0) {
+            stats.misses++;
+            return false;
+        }
+        slots[index].lastUsed = nextClock();
+        value = slots[index].value;
+        stats.hits++;
+        return true;
+    }
+
+    /**
+     * @brief Get the most recently used entry, for example to know the last place the device was before a reset
+     *
+     * @param key Set to the key
+     * @param value Set to the value
+     * @return true if the cache is not empty
+     */
+    bool mostRecent(Key &key, Value &value) const {
+        size_t newest = SLOTS;
+        for(size_t ii = 0; ii < SLOTS; ii++) {
+            if (slots[ii].lastUsed && (newest == SLOTS || (int32_t)(slots[ii].lastUsed - slots[newest].lastUsed) > 0)) {
+                newest = ii;
+            }
+        }
+        if (newest == SLOTS) {
+            return false;
+        }
+        key = slots[newest].key;
+        value = slots[newest].value;
+        return true;
+    }
+
+    /**
+     * @brief Get the value for a key, adding it if it is not in the cache
+     *
+     * @param key Key to find or add
+     * @param isNew Set to true if the key was added, with a value-initialized value
+     * @return Value& The value, which can be modified. Valid until the next insert().
+     *
+     * Marks the cache as needing to be saved.
+     */
+    Value &insert(const Key &key, bool &isNew) {
+        dirty = true;
+
+        int index = indexOf(key);
+        isNew = (index < 0);
+        if (isNew) {
+            if (count >= CAPACITY) {
+                evictLeastRecentlyUsed();
+            }
+            size_t slot = hash(&key, sizeof(Key)) & (SLOTS - 1);
+            while(slots[slot].lastUsed) {
+                slot = (slot + 1) & (SLOTS - 1);
+            }
+            slots[slot].key = key;
+            slots[slot].value = Value();
+            count++;
+            stats.inserts++;
+            index = (int)slot;
+        }
+        slots[index].lastUsed = nextClock();
+        return slots[index].value;
+    }
+
+    /**
+     * @brief Number of entries
+     */
+    size_t size() const { return count; };
+
+    /**
+     * @brief true if insert() has been called since the last save() or load()
+     */
+    bool isDirty() const { return dirty; };
+
+    /**
+     * @brief Get the cache counters
+     */
+    const Stats &getStats() const { return stats; };
+
+    /**
+     * @brief Save the entries to a file
+     *
+     * @param path Path to the file. It is written to a temporary file first and renamed.
+     * @param magic Identifies the kind of cache, checked by load()
+     * @return int SYSTEM_ERROR_NONE (0) or an error code
+     */
+    int save(const char *path, uint32_t magic) {
+        Record *records = new Record[count ? count : 1];
+        if (!records) {
+            return SYSTEM_ERROR_NO_MEMORY;
+        }
+        size_t numRecords = 0;
+        for(size_t ii = 0; ii < SLOTS; ii++) {
+            if (slots[ii].lastUsed) {
+                records[numRecords].key = slots[ii].key;
+                records[numRecords].value = slots[ii].value;
+                records[numRecords].lastUsed = slots[ii].lastUsed;
+                numRecords++;
+            }
+        }
+        int res = writeFile(path, magic, clock, records, sizeof(Record), numRecords);
+        delete[] records;
+
+        if (res == SYSTEM_ERROR_NONE) {
+            dirty = false;
+        }
+        return res;
+    }
+
+    /**
+     * @brief Replace the entries with those saved by save()
+     *
+     * @param path Path to the file
+     * @param magic Must match the value passed to save()
+     * @return int SYSTEM_ERROR_NONE (0) or an error code. The cache is empty if the file is missing or invalid.
+     */
+    int load(const char *path, uint32_t magic) {
+        for(size_t ii = 0; ii < SLOTS; ii++) {
+            slots[ii].lastUsed = 0;
+        }
+        count = 0;
+        dirty = false;
+
+        size_t numRecords = 0;
+        uint8_t *data = readFile(path, magic, sizeof(Record), clock, numRecords);
+        if (!data) {
+            clock = 0;
+            return SYSTEM_ERROR_NOT_FOUND;
+        }
+        for(size_t ii = 0; ii < numRecords && count < CAPACITY; ii++) {
+            Record record;
+            memcpy(&record, &data[ii * sizeof(Record)], sizeof(Record));
+
+            bool isNew;
+            insert(record.key, isNew) = record.value;
+            if (record.lastUsed) {
+                slots[indexOf(record.key)].lastUsed = record.lastUsed;
+            }
+        }
+        delete[] data;
+        dirty = false;
+        stats.inserts = 0;
+
+        return SYSTEM_ERROR_NONE;
+    }
+
+protected:
+    /**
+     * @brief Entry in the table
+     */
+    struct Slot {
+        Key key;
+        Value value;
+        uint32_t lastUsed; //!< clock value when last found or inserted, 0 if the slot is free
+    };
+
+    /**
+     * @brief Entry in the file
+     */
+    struct Record {
+        Key key;
+        Value value;
+        uint32_t lastUsed;
+    };
+
+    int indexOf(const Key &key) const {
+        size_t slot = hash(&key, sizeof(Key)) & (SLOTS - 1);
+        while(slots[slot].lastUsed) {
+            if (memcmp(&slots[slot].key, &key, sizeof(Key)) == 0) {
+                return (int)slot;
+            }
+            slot = (slot + 1) & (SLOTS - 1);
+        }
+        return -1;
+    }
+
+    uint32_t nextClock() {
+        // 0 marks a free slot, so skip it if the clock wraps
+        if (++clock == 0) {
+            clock = 1;
+        }
+        return clock;
+    }
+
+    void evictLeastRecentlyUsed() {
+        size_t oldest = SLOTS;
+        for(size_t ii = 0; ii < SLOTS; ii++) {
+            if (slots[ii].lastUsed && (oldest == SLOTS || (int32_t)(slots[ii].lastUsed - slots[oldest].lastUsed) < 0)) {
+                oldest = ii;
+            }
+        }
+        if (oldest < SLOTS) {
+            removeAt(oldest);
+            stats.evictions++;
+        }
+    }
+
+    /**
+     * @brief Remove an entry, moving later entries in the same probe sequence back so lookups still find them
+     */
+    void removeAt(size_t index) {
+        slots[index].lastUsed = 0;
+        count--;
+
+        size_t next = (index + 1) & (SLOTS - 1);
+        while(slots[next].lastUsed) {
+            size_t home = hash(&slots[next].key, sizeof(Key)) & (SLOTS - 1);
+            // Move it into the hole if its home slot is not between the hole and its current position
+            if (((next - home) & (SLOTS - 1)) >= ((next - index) & (SLOTS - 1))) {
+                slots[index] = slots[next];
+                slots[next].lastUsed = 0;
+                index = next;
+            }
+            next = (next + 1) & (SLOTS - 1);
+        }
+    }
+
+    Slot slots[SLOTS] = {};
+    size_t count = 0;
+    uint32_t clock = 0;
+    bool dirty = false;
+    Stats stats = {};
+};
+
+#endif /* __LOCATIONCACHE_H */
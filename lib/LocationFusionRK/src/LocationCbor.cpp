@@ -0,0 +1,372 @@
+#include "LocationCbor.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+struct FixedPointField {
+    const char *key;
+    int decimals;
+};
+
+static const FixedPointField _fixedPointFields[] = {
+    { "lat", 7 },
+    { "lon", 7 },
+    { "alt", 3 },
+    { "hd", 2 },
+    { "spd", 2 },
+    { "hdop", 1 },
+    { "h_acc", 3 },
+    { "v_acc", 3 },
+    { "ttff", 1 },
+};
+
+LocationCbor::Writer &LocationCbor::Writer::text(const char *str) {
+    size_t len = strlen(str);
+    head(3, len);
+    return append((const uint8_t *)str, len);
+}
+
+LocationCbor::Writer &LocationCbor::Writer::bytes(const uint8_t *data, size_t len) {
+    head(2, len);
+    return append(data, len);
+}
+
+LocationCbor::Writer &LocationCbor::Writer::integer(int64_t value) {
+    if (value >= 0) {
+        return head(0, (uint64_t)value);
+    }
+    else {
+        return head(1, (uint64_t)(-1 - value));
+    }
+}
+
+LocationCbor::Writer &LocationCbor::Writer::floating(double value) {
+    float f = (float)value;
+    if ((double)f == value || isnan(value)) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        uint8_t data[5] = { 0xfa, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits };
+        return append(data, sizeof(data));
+    }
+    else {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint8_t data[9];
+        data[0] = 0xfb;
+        for(int ii = 0; ii < 8; ii++) {
+            data[1 + ii] = (uint8_t)(bits >> (56 - 8 * ii));
+        }
+        return append(data, sizeof(data));
+    }
+}
+
+LocationCbor::Writer &LocationCbor::Writer::head(uint8_t majorType, uint64_t value) {
+    uint8_t data[9];
+    size_t len;
+
+    data[0] = (uint8_t)(majorType << 5);
+    if (value < 24) {
+        data[0] |= (uint8_t)value;
+        len = 1;
+    }
+    else if (value <= 0xff) {
+        data[0] |= 24;
+        len = 2;
+    }
+    else if (value <= 0xffff) {
+        data[0] |= 25;
+        len = 3;
+    }
+    else if (value <= 0xffffffff) {
+        data[0] |= 26;
+        len = 5;
+    }
+    else {
+        data[0] |= 27;
+        len = 9;
+    }
+    // Big-endian argument following the initial byte
+    for(size_t ii = 1; ii < len; ii++) {
+        data[ii] = (uint8_t)(value >> (8 * (len - 1 - ii)));
+    }
+    return append(data, len);
+}
+
+LocationCbor::Writer &LocationCbor::Writer::append(uint8_t b) {
+    return append(&b, 1);
+}
+
+LocationCbor::Writer &LocationCbor::Writer::append(const uint8_t *data, size_t len) {
+    if (overflowed || offset + len > bufSize) {
+        overflowed = true;
+    }
+    else {
+        memcpy(&buf[offset], data, len);
+        offset += len;
+    }
+    return *this;
+}
+
+// [static]
+int LocationCbor::fixedPointDecimals(const char *key) {
+    if (key) {
+        for(size_t ii = 0; ii < sizeof(_fixedPointFields) / sizeof(_fixedPointFields[0]); ii++) {
+            if (strcmp(key, _fixedPointFields[ii].key) == 0) {
+                return _fixedPointFields[ii].decimals;
+            }
+        }
+    }
+    return -1;
+}
+
+//
+// CBOR to JSON
+//
+
+class CborJsonDecoder {
+public:
+    CborJsonDecoder(const uint8_t *cbor, size_t cborLen, char *json, size_t jsonSize) :
+        p(cbor), end(cbor + cborLen), json(json), jsonSize(jsonSize) {};
+
+    bool decodeItem(const char *key, int depth);
+    bool atEnd() const { return p == end; };
+    size_t length() const { return len; };
+
+    bool ok = true;
+
+protected:
+    bool readHead(uint8_t &majorType, uint8_t &additional, uint64_t &value);
+    void put(const char *str, size_t n);
+    void put(const char *str) { put(str, strlen(str)); };
+    void putString(const uint8_t *str, size_t n);
+    void putInteger(bool negative, uint64_t magnitude, int decimals);
+
+    const uint8_t *p;
+    const uint8_t *end;
+    char *json;
+    size_t jsonSize;
+    size_t len = 0;
+};
+
+bool CborJsonDecoder::readHead(uint8_t &majorType, uint8_t &additional, uint64_t &value) {
+    if (p >= end) {
+        return false;
+    }
+    majorType = *p >> 5;
+    additional = *p & 0x1f;
+    p++;
+
+    size_t n;
+    if (additional < 24) {
+        value = additional;
+        return true;
+    }
+    else if (additional <= 27) {
+        n = (size_t)1 << (additional - 24);
+    }
+    else {
+        // Indefinite lengths are not used by the encoder
+        return false;
+    }
+    if ((size_t)(end - p) < n) {
+        return false;
+    }
+    value = 0;
+    for(size_t ii = 0; ii < n; ii++) {
+        value = (value << 8) | *p++;
+    }
+    return true;
+}
+
+void CborJsonDecoder::put(const char *str, size_t n) {
+    if (len + n + 1 > jsonSize) {
+        ok = false;
+        return;
+    }
+    memcpy(&json[len], str, n);
+    len += n;
+    json[len] = 0;
+}
+
+void CborJsonDecoder::putString(const uint8_t *str, size_t n) {
+    put("\"");
+    for(size_t ii = 0; ii < n; ii++) {
+        char c = (char)str[ii];
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', c };
+            put(esc, 2);
+        }
+        else if ((uint8_t)c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", (unsigned)(uint8_t)c);
+            put(esc);
+        }
+        else {
+            put(&c, 1);
+        }
+    }
+    put("\"");
+}
+
+void CborJsonDecoder::putInteger(bool negative, uint64_t magnitude, int decimals) {
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%llu", (unsigned long long)magnitude);
+
+    if (negative) {
+        put("-");
+    }
+    if (decimals <= 0) {
+        put(digits, n);
+        return;
+    }
+    // Insert the decimal point, padding with leading zeros as needed: 5 with 3 decimals is 0.005
+    if (n <= decimals) {
+        put("0.");
+        for(int ii = n; ii < decimals; ii++) {
+            put("0");
+        }
+        put(digits, n);
+    }
+    else {
+        put(digits, n - decimals);
+        put(".");
+        put(&digits[n - decimals], decimals);
+    }
+}
+
+bool CborJsonDecoder::decodeItem(const char *key, int depth) {
+    uint8_t majorType, additional;
+    uint64_t value;
+
+    if (depth > LocationCbor::MAX_DEPTH || !readHead(majorType, additional, value)) {
+        return false;
+    }
+
+    switch(majorType) {
+        case 0: // unsigned integer
+            putInteger(false, value, LocationCbor::fixedPointDecimals(key));
+            break;
+
+        case 1: // negative integer, -1 - value
+            putInteger(true, value + 1, LocationCbor::fixedPointDecimals(key));
+            break;
+
+        case 2: // byte string, a 6 byte BSSID is formatted as aa:bb:cc:dd:ee:ff, anything else as hex
+            if ((uint64_t)(end - p) < value) {
+                return false;
+            }
+            put("\"");
+            for(size_t ii = 0; ii < (size_t)value; ii++) {
+                char hex[4];
+                snprintf(hex, sizeof(hex), (value == 6 && ii > 0) ? ":%02x" : "%02x", p[ii]);
+                put(hex);
+            }
+            put("\"");
+            p += value;
+            break;
+
+        case 3: // text string
+            if ((uint64_t)(end - p) < value) {
+                return false;
+            }
+            putString(p, (size_t)value);
+            p += value;
+            break;
+
+        case 4: // array
+            put("[");
+            for(uint64_t ii = 0; ii < value; ii++) {
+                if (ii > 0) {
+                    put(",");
+                }
+                if (!decodeItem(nullptr, depth + 1)) {
+                    return false;
+                }
+            }
+            put("]");
+            break;
+
+        case 5: // map, keys must be text strings
+            put("{");
+            for(uint64_t ii = 0; ii < value; ii++) {
+                uint8_t keyType, keyAdditional;
+                uint64_t keyLen;
+                if (!readHead(keyType, keyAdditional, keyLen) || keyType != 3 || (uint64_t)(end - p) < keyLen) {
+                    return false;
+                }
+                char keyBuf[32];
+                size_t copyLen = (keyLen < sizeof(keyBuf) - 1) ? (size_t)keyLen : sizeof(keyBuf) - 1;
+                memcpy(keyBuf, p, copyLen);
+                keyBuf[copyLen] = 0;
+
+                if (ii > 0) {
+                    put(",");
+                }
+                putString(p, (size_t)keyLen);
+                put(":");
+                p += keyLen;
+
+                if (!decodeItem(keyBuf, depth + 1)) {
+                    return false;
+                }
+            }
+            put("}");
+            break;
+
+        case 6: // tag, not used by the encoder, so output the tagged item
+            return decodeItem(key, depth + 1);
+
+        case 7: { // simple values and floating point
+            char num[32];
+            if (additional == 20) {
+                put("false");
+            }
+            else if (additional == 21) {
+                put("true");
+            }
+            else if (additional == 22 || additional == 23) {
+                put("null");
+            }
+            else if (additional == 25) {
+                // Half precision
+                int exponent = (int)((value >> 10) & 0x1f);
+                double mantissa = (double)(value & 0x3ff);
+                double d = (exponent == 0) ? ldexp(mantissa, -24) : ldexp(mantissa + 1024, exponent - 25);
+                snprintf(num, sizeof(num), "%.5g", (value & 0x8000) ? -d : d);
+                put(num);
+            }
+            else if (additional == 26) {
+                uint32_t bits = (uint32_t)value;
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                snprintf(num, sizeof(num), "%.9g", (double)f);
+                put(num);
+            }
+            else if (additional == 27) {
+                double d;
+                memcpy(&d, &value, sizeof(d));
+                snprintf(num, sizeof(num), "%.17g", d);
+                put(num);
+            }
+            else {
+                return false;
+            }
+            break;
+        }
+    }
+    return ok;
+}
+
+// [static]
+size_t LocationCbor::toJson(const uint8_t *cbor, size_t cborLen, char *json, size_t jsonSize) {
+    CborJsonDecoder decoder(cbor, cborLen, json, jsonSize);
+
+    if (jsonSize > 0) {
+        json[0] = 0;
+    }
+    if (!decoder.decodeItem(nullptr, 0) || !decoder.atEnd() || !decoder.ok) {
+        return 0;
+    }
+    return decoder.length();
+}
@@ -0,0 +1,128 @@
+#ifndef __LOCATIONCBOR_H
+#define __LOCATIONCBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Repository: https://github.com/rickkas7/LocationFusionRK
+// License: MIT
+
+/**
+ * @brief Compact CBOR (RFC 8949) form of the loc event. Added in 0.0.5.
+ *
+ * The maps, arrays, and key names are the same as the JSON loc event, with two changes that make it smaller:
+ *
+ * - Keys listed in fixedPointDecimals() hold integers scaled by a power of 10 instead of floating point numbers.
+ *   For example "lat" is degrees * 10^7.
+ * - "bssid" values are 6-byte byte strings instead of "aa:bb:cc:dd:ee:ff".
+ *
+ * toJson() reverses both, producing the JSON loc event. This file does not depend on Device OS so the same code
+ * can be compiled on a computer to decode events.
+ */
+class LocationCbor {
+public:
+    /**
+     * @brief Writes CBOR items to a caller-supplied buffer
+     *
+     * Maps and arrays use definite lengths, so the number of entries must be known when they are started.
+     * If the buffer fills, later items are dropped and overflow() returns true.
+     */
+    class Writer {
+    public:
+        /**
+         * @brief Construct a writer
+         *
+         * @param buf Buffer to write to
+         * @param bufSize Size of the buffer in bytes
+         */
+        Writer(uint8_t *buf, size_t bufSize) : buf(buf), bufSize(bufSize) {};
+
+        /**
+         * @brief Start a map. Follow with numEntries pairs of key and value items.
+         */
+        Writer &beginMap(size_t numEntries) { return head(5, numEntries); };
+
+        /**
+         * @brief Start an array. Follow with numItems items.
+         */
+        Writer &beginArray(size_t numItems) { return head(4, numItems); };
+
+        /**
+         * @brief Write a UTF-8 text string, which must be null terminated
+         */
+        Writer &text(const char *str);
+
+        /**
+         * @brief Write a byte string
+         */
+        Writer &bytes(const uint8_t *data, size_t len);
+
+        /**
+         * @brief Write an integer
+         */
+        Writer &integer(int64_t value);
+
+        /**
+         * @brief Write a floating point number, as 32-bit if that does not lose precision, otherwise 64-bit
+         */
+        Writer &floating(double value);
+
+        /**
+         * @brief Write true or false
+         */
+        Writer &boolean(bool value) { return append(value ? 0xf5 : 0xf4); };
+
+        /**
+         * @brief Write null
+         */
+        Writer &null() { return append(0xf6); };
+
+        /**
+         * @brief Number of bytes written
+         */
+        size_t size() const { return offset; };
+
+        /**
+         * @brief true if the buffer was too small for everything written
+         */
+        bool overflow() const { return overflowed; };
+
+    protected:
+        Writer &head(uint8_t majorType, uint64_t value);
+        Writer &append(uint8_t b);
+        Writer &append(const uint8_t *data, size_t len);
+
+        uint8_t *buf;
+        size_t bufSize;
+        size_t offset = 0;
+        bool overflowed = false;
+    };
+
+    /**
+     * @brief Number of decimal places a key is scaled by, or -1 if it is not a fixed-point key
+     *
+     * @param key Map key, may be null
+     * @return int
+     *
+     * lat and lon are 7 (about 1 cm). The other GNSS values use the same number of decimal places as the JSON loc event.
+     */
+    static int fixedPointDecimals(const char *key);
+
+    /**
+     * @brief Convert a CBOR loc event back to JSON
+     *
+     * @param cbor CBOR data
+     * @param cborLen Length of CBOR data
+     * @param json Buffer to write the null terminated JSON to
+     * @param jsonSize Size of the buffer
+     * @return size_t Length of the JSON, or 0 if the CBOR is invalid or the buffer is too small
+     */
+    static size_t toJson(const uint8_t *cbor, size_t cborLen, char *json, size_t jsonSize);
+
+    /**
+     * @brief Maximum nesting of maps and arrays accepted by toJson()
+     */
+    static const int MAX_DEPTH = 8;
+};
+
+#endif /* __LOCATIONCBOR_H */
@@ -0,0 +1,434 @@
+#include "LocationCellParser.h"
+
+#include <string.h>
+
+void LocationCellParser::clear() {
+    numCells = 0;
+    numDropped = 0;
+}
+
+bool LocationCellParser::parseLine(const char *line) {
+    while(*line == '\r' || *line == '\n' || *line == ' ') {
+        line++;
+    }
+    if (strncmp(line, "+QENG:", 6) != 0) {
+        return false;
+    }
+    line += 6;
+
+    size_t len = strlen(line);
+    if (len > MAX_LINE_LENGTH) {
+        return false;
+    }
+    char buf[MAX_LINE_LENGTH + 1];
+    memcpy(buf, line, len + 1);
+
+    char *fields[MAX_FIELDS];
+    size_t numFields = split(buf, fields, MAX_FIELDS);
+    if (numFields == 0) {
+        return false;
+    }
+
+    if (strcmp(fields[0], "servingcell") == 0) {
+        return parseServing(fields, numFields);
+    }
+    // "neighbourcell intra", "neighbourcell inter" (LTE), or "neighbourcell" (GSM and WCDMA)
+    if (strncmp(fields[0], "neighbourcell", 13) == 0) {
+        return parseNeighbor(fields, numFields);
+    }
+    return false;
+}
+
+void LocationCellParser::finish() {
+    // Insertion sort of the neighbors, strongest first. There are at most MAX_CELLS.
+    size_t first = hasServing() ? 1 : 0;
+    for(size_t ii = first + 1; ii < numCells; ii++) {
+        Cell cell = cells[ii];
+        size_t jj = ii;
+        while(jj > first && cells[jj - 1].str < cell.str) {
+            cells[jj] = cells[jj - 1];
+            jj--;
+        }
+        cells[jj] = cell;
+    }
+}
+
+// [static]
+const char *LocationCellParser::ratName(Rat rat) {
+    switch(rat) {
+        case Rat::lte:
+            return "lte";
+        case Rat::wcdma:
+            return "wcdma";
+        case Rat::gsm:
+            return "gsm";
+        default:
+            return "";
+    }
+}
+
+bool LocationCellParser::parseServing(char **fields, size_t numFields) {
+    // "servingcell",<state>,<rat>,... While searching there is only the state.
+    if (numFields < 3) {
+        return numFields == 2;
+    }
+
+    bool nbiot;
+    Cell cell = emptyCell();
+    cell.serving = true;
+    cell.rat = parseRat(fields[2], nbiot);
+
+    int32_t value;
+    switch(cell.rat) {
+        case Rat::lte: {
+            // <is_tdd>,<mcc>,<mnc>,<cellid>,<pcid>,<earfcn>,<band>,<ul_bw>,<dl_bw>,<tac>,<rsrp>,<rsrq>,<rssi>,<sinr>,...
+            // NB-IoT has no bandwidth fields.
+            size_t tacIndex = nbiot ? 10 : 12;
+            if (numFields < tacIndex + 3) {
+                return false;
+            }
+            if (parseInt(fields[4], value)) {
+                cell.mcc = (uint16_t)value;
+            }
+            if (parseInt(fields[5], value)) {
+                cell.mnc = (uint16_t)value;
+            }
+            parseHex(fields[6], cell.cid);
+            if (parseInt(fields[7], value)) {
+                cell.nid = (uint16_t)value;
+            }
+            if (parseInt(fields[8], value)) {
+                cell.ch = (uint32_t)value;
+            }
+            parseHex(fields[tacIndex], cell.lac);
+            cell.str = parseSignal(fields[tacIndex + 1]);
+            cell.rsrq = parseSignal(fields[tacIndex + 2]);
+            break;
+        }
+
+        case Rat::gsm:
+            // <mcc>,<mnc>,<lac>,<cellid>,<bsic>,<arfcn>,<band>,<rxlev>,<txp>,<rla>,<drx>,<c1>,<c2>,<gprs>,<tch>,<ts>,<ta>,...
+            if (numFields < 11) {
+                return false;
+            }
+            if (parseInt(fields[3], value)) {
+                cell.mcc = (uint16_t)value;
+            }
+            if (parseInt(fields[4], value)) {
+                cell.mnc = (uint16_t)value;
+            }
+            parseHex(fields[5], cell.lac);
+            parseHex(fields[6], cell.cid);
+            if (parseInt(fields[7], value)) {
+                cell.nid = (uint16_t)value;
+            }
+            if (parseInt(fields[8], value)) {
+                cell.ch = (uint32_t)value;
+            }
+            cell.str = parseRxLev(fields[10]);
+            if (numFields > 19) {
+                cell.ta = parseSignal(fields[19]);
+            }
+            break;
+
+        case Rat::wcdma:
+            // <mcc>,<mnc>,<lac>,<cellid>,<uarfcn>,<psc>,<rac>,<rscp>,<ecio>,...
+            if (numFields < 11) {
+                return false;
+            }
+            if (parseInt(fields[3], value)) {
+                cell.mcc = (uint16_t)value;
+            }
+            if (parseInt(fields[4], value)) {
+                cell.mnc = (uint16_t)value;
+            }
+            parseHex(fields[5], cell.lac);
+            parseHex(fields[6], cell.cid);
+            if (parseInt(fields[7], value)) {
+                cell.ch = (uint32_t)value;
+            }
+            if (parseInt(fields[8], value)) {
+                cell.nid = (uint16_t)value;
+            }
+            cell.str = parseSignal(fields[10]);
+            break;
+
+        default:
+            return false;
+    }
+
+    addServing(cell);
+    return true;
+}
+
+bool LocationCellParser::parseNeighbor(char **fields, size_t numFields) {
+    if (numFields < 2) {
+        return false;
+    }
+
+    bool nbiot;
+    Cell cell = emptyCell();
+    cell.rat = parseRat(fields[1], nbiot);
+
+    int32_t value;
+    switch(cell.rat) {
+        case Rat::lte:
+            // <earfcn>,<pcid>,<rsrq>,<rsrp>,<rssi>,<sinr>,...
+            if (numFields < 6) {
+                return false;
+            }
+            if (parseInt(fields[2], value)) {
+                cell.ch = (uint32_t)value;
+            }
+            if (parseInt(fields[3], value)) {
+                cell.nid = (uint16_t)value;
+            }
+            cell.rsrq = parseSignal(fields[4]);
+            cell.str = parseSignal(fields[5]);
+            break;
+
+        case Rat::gsm:
+            // <mcc>,<mnc>,<lac>,<cellid>,<bsic>,<arfcn>,<rxlev>,...
+            if (numFields < 9) {
+                return false;
+            }
+            if (parseInt(fields[2], value)) {
+                cell.mcc = (uint16_t)value;
+            }
+            if (parseInt(fields[3], value)) {
+                cell.mnc = (uint16_t)value;
+            }
+            parseHex(fields[4], cell.lac);
+            parseHex(fields[5], cell.cid);
+            if (parseInt(fields[6], value)) {
+                cell.nid = (uint16_t)value;
+            }
+            if (parseInt(fields[7], value)) {
+                cell.ch = (uint32_t)value;
+            }
+            cell.str = parseRxLev(fields[8]);
+            break;
+
+        case Rat::wcdma:
+            // <uarfcn>,<cell_resel_priority>,<thresh_Xhigh>,<thresh_Xlow>,<psc>,<rscp>,<ecno>,...
+            if (numFields < 8) {
+                return false;
+            }
+            if (parseInt(fields[2], value)) {
+                cell.ch = (uint32_t)value;
+            }
+            if (parseInt(fields[6], value)) {
+                cell.nid = (uint16_t)value;
+            }
+            cell.str = parseSignal(fields[7]);
+            break;
+
+        default:
+            return false;
+    }
+
+    addNeighbor(cell);
+    return true;
+}
+
+void LocationCellParser::addServing(const Cell &cell) {
+    if (hasServing()) {
+        cells[0] = cell;
+        return;
+    }
+    if (numCells == MAX_CELLS) {
+        // Make room by dropping a neighbor. finish() has not sorted them yet, so drop the weakest.
+        size_t weakest = 0;
+        for(size_t ii = 1; ii < numCells; ii++) {
+            if (cells[ii].str < cells[weakest].str) {
+                weakest = ii;
+            }
+        }
+        cells[weakest] = cells[--numCells];
+        numDropped++;
+    }
+    memmove(&cells[1], &cells[0], numCells * sizeof(Cell));
+    cells[0] = cell;
+    numCells++;
+}
+
+void LocationCellParser::addNeighbor(const Cell &cell) {
+    size_t first = hasServing() ? 1 : 0;
+
+    // The same cell can be listed more than once, for example as intra and inter frequency. Keep the stronger.
+    for(size_t ii = first; ii < numCells; ii++) {
+        if (cells[ii].rat == cell.rat && cells[ii].ch == cell.ch && cells[ii].nid == cell.nid) {
+            if (cell.str > cells[ii].str) {
+                cells[ii] = cell;
+            }
+            return;
+        }
+    }
+
+    if (numCells < MAX_CELLS) {
+        cells[numCells++] = cell;
+        return;
+    }
+
+    size_t weakest = first;
+    for(size_t ii = first + 1; ii < numCells; ii++) {
+        if (cells[ii].str < cells[weakest].str) {
+            weakest = ii;
+        }
+    }
+    if (weakest < numCells && cell.str > cells[weakest].str) {
+        cells[weakest] = cell;
+    }
+    numDropped++;
+}
+
+// [static]
+LocationCellParser::Cell LocationCellParser::emptyCell() {
+    Cell cell = {};
+    cell.str = UNKNOWN;
+    cell.rsrq = UNKNOWN;
+    cell.ta = UNKNOWN;
+    return cell;
+}
+
+// [static]
+LocationCellParser::Rat LocationCellParser::parseRat(const char *str, bool &nbiot) {
+    static const char * const lteNames[] = { "LTE", "eMTC", "CAT-M", "CAT-M1", "NBIoT", "NB-IoT", "CAT-NB" };
+
+    nbiot = (strcmp(str, "NBIoT") == 0 || strcmp(str, "NB-IoT") == 0 || strcmp(str, "CAT-NB") == 0);
+    for(size_t ii = 0; ii < sizeof(lteNames) / sizeof(lteNames[0]); ii++) {
+        if (strcmp(str, lteNames[ii]) == 0) {
+            return Rat::lte;
+        }
+    }
+    if (strcmp(str, "WCDMA") == 0) {
+        return Rat::wcdma;
+    }
+    if (strcmp(str, "GSM") == 0) {
+        return Rat::gsm;
+    }
+    return Rat::unknown;
+}
+
+// [static]
+size_t LocationCellParser::split(char *buf, char **fields, size_t maxFields) {
+    size_t numFields = 0;
+    char *p = buf;
+
+    while(numFields < maxFields) {
+        while(*p == ' ') {
+            p++;
+        }
+        char *start = p;
+        char *end;
+        if (*p == '"') {
+            // Quoted field, which may contain a space ("neighbourcell intra")
+            start = ++p;
+            while(*p && *p != '"') {
+                p++;
+            }
+            end = p;
+            if (*p == '"') {
+                p++;
+            }
+            while(*p && *p != ',') {
+                p++;
+            }
+        }
+        else {
+            while(*p && *p != ',' && *p != '\r' && *p != '\n') {
+                p++;
+            }
+            end = p;
+            while(end > start && end[-1] == ' ') {
+                end--;
+            }
+        }
+
+        bool more = (*p == ',');
+        *end = 0;
+        fields[numFields++] = start;
+        if (!more) {
+            break;
+        }
+        p++;
+    }
+    return numFields;
+}
+
+// [static]
+bool LocationCellParser::parseInt(const char *str, int32_t &value) {
+    bool negative = (*str == '-');
+    if (negative) {
+        str++;
+    }
+    if (*str < '0' || *str > '9') {
+        return false;
+    }
+    int64_t result = 0;
+    while(*str >= '0' && *str <= '9') {
+        result = result * 10 + (*str++ - '0');
+        if (result > 0x7fffffff) {
+            return false;
+        }
+    }
+    if (*str) {
+        return false;
+    }
+    value = (int32_t)(negative ? -result : result);
+    return true;
+}
+
+// [static]
+bool LocationCellParser::parseHex(const char *str, uint32_t &value) {
+    uint32_t result = 0;
+    size_t digits = 0;
+    for(; *str; str++, digits++) {
+        char c = *str;
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        }
+        else
+        if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        }
+        else
+        if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        }
+        else {
+            return false;
+        }
+        if (digits >= 8) {
+            return false;
+        }
+        result = (result << 4) | digit;
+    }
+    if (digits == 0) {
+        return false;
+    }
+    value = result;
+    return true;
+}
+
+// [static]
+int16_t LocationCellParser::parseSignal(const char *str) {
+    // Values the modem does not know are reported as "-" or left empty
+    int32_t value;
+    if (!parseInt(str, value) || value < -32767 || value > 32767) {
+        return UNKNOWN;
+    }
+    return (int16_t)value;
+}
+
+// [static]
+int16_t LocationCellParser::parseRxLev(const char *str) {
+    // The Quectel manuals show GSM rxlev already in dBm (-73), but it is named after the 3GPP RxLev index, where 0 is
+    // -110 dBm or less and 63 is -48 dBm or more. Neither form has been seen in an EG91 capture, so both are accepted.
+    int32_t value;
+    if (!parseInt(str, value) || value < -150 || value > 63) {
+        return UNKNOWN;
+    }
+    return (int16_t)((value < 0) ? value : value - 111);
+}
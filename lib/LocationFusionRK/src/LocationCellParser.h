@@ -0,0 +1,134 @@
+#ifndef __LOCATIONCELLPARSER_H
+#define __LOCATIONCELLPARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Repository: https://github.com/rickkas7/LocationFusionRK
+// License: MIT
+
+/**
+ * @brief Parser for Quectel engineering mode responses (AT+QENG="servingcell" and AT+QENG="neighbourcell"). Added in 0.0.5.
+ *
+ * Collects the serving cell with its signal metrics and a bounded list of neighbor cells. Feed each +QENG: line
+ * to parseLine(), then call finish(). The serving cell is always first, followed by the neighbors in order of
+ * decreasing signal strength. If there are more neighbors than fit, the weakest are dropped.
+ *
+ * The field layouts are those of the BG95 (eMTC and NB-IoT) and EG91 (LTE, WCDMA, and GSM). This file does not
+ * depend on Device OS so the same code can be compiled on a computer to test it against captured responses.
+ */
+class LocationCellParser {
+public:
+    /**
+     * @brief Radio access technology. eMTC and NB-IoT cells are LTE cells.
+     */
+    enum class Rat : uint8_t {
+        unknown = 0,
+        gsm,
+        wcdma,
+        lte
+    };
+
+    /**
+     * @brief Value of str, rsrq, and ta when the modem did not report it
+     */
+    static const int16_t UNKNOWN = -32768;
+
+    /**
+     * @brief One cell
+     */
+    struct Cell {
+        Rat rat; //!< Radio access technology
+        bool serving; //!< true for the serving cell
+        uint16_t mcc; //!< Mobile country code, 0 if not reported (LTE and WCDMA neighbors)
+        uint16_t mnc; //!< Mobile network code, 0 if not reported
+        uint32_t lac; //!< Location area code (tracking area code for LTE)
+        uint32_t cid; //!< Cell ID, 0 if not reported
+        uint32_t ch; //!< Channel: EARFCN (LTE), UARFCN (WCDMA), or ARFCN (GSM)
+        uint16_t nid; //!< Physical cell ID (LTE), primary scrambling code (WCDMA), or BSIC (GSM)
+        int16_t str; //!< Signal strength in dBm: RSRP (LTE), RSCP (WCDMA), or RxLev converted to dBm (GSM)
+        int16_t rsrq; //!< RSRQ in dB (LTE only)
+        int16_t ta; //!< Timing advance (GSM only, not reported for LTE by these modems)
+
+        /**
+         * @brief true if mcc, mnc, lac, and cid identify the cell, so it can be looked up on its own
+         */
+        bool hasGlobalId() const { return mcc != 0 && cid != 0; };
+    };
+
+    /**
+     * @brief Maximum number of cells, including the serving cell
+     */
+    static const size_t MAX_CELLS = 8;
+
+    /**
+     * @brief Longest +QENG: line that is parsed. Longer lines are ignored.
+     */
+    static const size_t MAX_LINE_LENGTH = 192;
+
+    /**
+     * @brief Remove all cells before parsing new responses
+     */
+    void clear();
+
+    /**
+     * @brief Parse one response line
+     *
+     * @param line A line starting with +QENG:, with or without a trailing CR LF
+     * @return true if it was a serving or neighbor cell line that was understood. A serving cell line while
+     * searching (no cell) returns true but adds nothing.
+     */
+    bool parseLine(const char *line);
+
+    /**
+     * @brief Sort the neighbors by signal strength. Call after the last parseLine().
+     */
+    void finish();
+
+    /**
+     * @brief Number of cells, including the serving cell
+     */
+    size_t size() const { return numCells; };
+
+    /**
+     * @brief Get a cell. The serving cell is at 0 if hasServing() is true.
+     */
+    const Cell &at(size_t index) const { return cells[index]; };
+
+    /**
+     * @brief true if a serving cell was parsed
+     */
+    bool hasServing() const { return numCells > 0 && cells[0].serving; };
+
+    /**
+     * @brief Neighbors that were dropped because the list was full of stronger cells
+     */
+    size_t dropped() const { return numDropped; };
+
+    /**
+     * @brief Name of a radio access technology as used in the loc event: "lte", "wcdma", "gsm", or "" for unknown
+     */
+    static const char *ratName(Rat rat);
+
+protected:
+    bool parseServing(char **fields, size_t numFields);
+    bool parseNeighbor(char **fields, size_t numFields);
+    void addServing(const Cell &cell);
+    void addNeighbor(const Cell &cell);
+
+    static Cell emptyCell();
+    static Rat parseRat(const char *str, bool &nbiot);
+    static size_t split(char *buf, char **fields, size_t maxFields);
+    static bool parseInt(const char *str, int32_t &value);
+    static bool parseHex(const char *str, uint32_t &value);
+    static int16_t parseSignal(const char *str);
+    static int16_t parseRxLev(const char *str);
+
+    static const size_t MAX_FIELDS = 32;
+
+    Cell cells[MAX_CELLS];
+    size_t numCells = 0;
+    size_t numDropped = 0;
+};
+
+#endif /* __LOCATIONCELLPARSER_H */
@@ -1,5 +1,10 @@
 #include "LocationFusionRK.h"
 
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 static Logger _locfLog("app.locf");
 
 LocationFusionRK *LocationFusionRK::_instance;
@@ -23,235 +28,1588 @@ LocationFusionRK &LocationFusionRK::withCmdHandler(const char *cmd, std::functio
     cmdHandler.cmd = cmd;
     cmdHandler.handler = handler;
 
-    commandHandlers.push_back(cmdHandler);
-    return *this;
-}
+    commandHandlers.push_back(cmdHandler);
+    return *this;
+}
+
+
+void LocationFusionRK::setup() {
+    os_mutex_create(&mutex);
+    os_queue_create(&wakeQueue, sizeof(uint8_t), 4, 0);
+    wakeupStartMs = System.millis();
+    System.on(cloud_status, cloudStatusHandlerStatic);
+
+#if Wiring_WiFi
+    WAPList *wapLists[2] = { &prefetchWapList, &gatherWapList };
+    for(size_t ii = 0; ii < 2; ii++) {
+        wapLists[ii]->setMaxEntries(wifiMaxAccessPoints);
+        wapLists[ii]->setMinRssi(wifiMinRssi);
+        wapLists[ii]->setDropLocallyAdministered(wifiDropHotspots);
+    }
+
+    if (bssidCacheMinMatches) {
+        mkdir("/usr/locfusion", 0777);
+        bssidCache = new BssidCache();
+        if (bssidCache) {
+            bssidCache->load("/usr/locfusion/bssid.bin", POSITION_CACHE_MAGIC);
+            bssidCacheStats.entries = (uint32_t)bssidCache->size();
+            bssidCacheStats.memoryBytes = sizeof(BssidCache);
+            _locfLog.info("BSSID cache %u access points", (unsigned)bssidCache->size());
+        }
+    }
+#endif // Wiring_WiFi
+
+#if Wiring_Cellular
+    if (cellCacheEnabled) {
+        mkdir("/usr/locfusion", 0777);
+        cellCache = new CellCache();
+        if (cellCache) {
+            cellCache->load("/usr/locfusion/cell.bin", POSITION_CACHE_MAGIC);
+            cellCacheStats.entries = (uint32_t)cellCache->size();
+            cellCacheStats.memoryBytes = sizeof(CellCache);
+            _locfLog.info("cell cache %u cells", (unsigned)cellCache->size());
+        }
+    }
+#endif // Wiring_Cellular
+
+    thread = new Thread("LocationFusionRK", [this]() { return threadFunction(); }, OS_THREAD_PRIORITY_DEFAULT, threadStackSize);
+
+    if (concurrentGather) {
+        os_queue_create(&gatherQueue, sizeof(int), 1, 0);
+        os_semaphore_create(&gatherDoneSemaphore, 1, 0);
+        gatherThread = new Thread("LocationFusionGather", [this]() { return gatherThreadFunction(); }, OS_THREAD_PRIORITY_DEFAULT, 3072);
+    }
+
+    if (trackLogCapacity) {
+        int res = trackLog.begin("/usr/locfusion", trackLogCapacity);
+        trackLogReady = (res == SYSTEM_ERROR_NONE);
+        if (trackLogReady) {
+            _locfLog.info("track log %u records pending", (unsigned)trackLog.pending());
+        }
+        else {
+            _locfLog.error("track log open failed %d", res);
+        }
+    }
+
+    if (enableCmdFunction) {
+        Particle.function("cmd", functionHandlerStatic);
+
+        
+        withCmdHandler("loc-enhanced", locEnhancedStatic);
+    }
+}
+
+void LocationFusionRK::updateStatus(Status status, int error) {
+    if (this->status.load() != status) {
+        reportStatus(status, error, currentReqId);
+    }
+}
+
+void LocationFusionRK::reportStatus(Status status, int error, int reqId) {
+    this->status.store(status);
+
+    // If the consumer has fallen a full queue behind, keep the older transitions and count the newer ones as dropped
+    uint32_t head = statusHead.load(std::memory_order_relaxed);
+    if (head - statusTail.load(std::memory_order_acquire) < STATUS_QUEUE_SIZE) {
+        StatusTransition &transition = statusRing[head % STATUS_QUEUE_SIZE];
+        transition.status = status;
+        transition.timeMs = System.millis();
+        transition.reqId = reqId;
+        transition.error = error;
+        statusHead.store(head + 1, std::memory_order_release);
+    }
+    else {
+        statusDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    for(auto it = statusHandlers.begin(); it != statusHandlers.end(); it++) {
+        auto handler = *it;
+
+        handler(status);
+    }
+}
+
+
+
+os_thread_return_t LocationFusionRK::threadFunction(void) {
+    while(true) {
+        // Report loc-enhanced responses and timeouts before the state handler so they are not held up by a publish
+        uint64_t inFlightDeadline = serviceInFlight();
+        savePositionCaches();
+
+        // State handlers that need to wait set waitMs. A state change leaves it at 0 so the next state runs immediately.
+        waitMs = 0;
+        stateHandler(*this);
+        if (waitMs == 0) {
+            continue;
+        }
+        if (trackLogReady && trackLog.pending() && Particle.connected()) {
+            // Records waiting to be replayed. stateConnected decides whether a publish takes priority.
+            uint64_t now = System.millis();
+            system_tick_t replayMs = (nextReplayMs > now) ? (system_tick_t)(nextReplayMs - now) : 1;
+            if (replayMs < waitMs) {
+                waitMs = replayMs;
+            }
+        }
+        if (inFlightDeadline) {
+            uint64_t now = System.millis();
+            system_tick_t inFlightMs = (inFlightDeadline > now) ? (system_tick_t)(inFlightDeadline - now) : 1;
+            if (inFlightMs < waitMs) {
+                waitMs = inFlightMs;
+            }
+        }
+
+        // Block until the wait expires or wake() is called. The cap is a backstop in case an event is missed.
+        uint8_t reason = 0;
+        bool woken = os_queue_take(wakeQueue, &reason, (waitMs < MAX_WAIT_MS) ? waitMs : MAX_WAIT_MS, 0) == 0;
+
+        wakeupStats.wakeups++;
+        if (woken) {
+            wakeupStats.eventWakeups++;
+        }
+        if (status.load() == Status::idle) {
+            wakeupStats.idleWakeups++;
+        }
+        uint64_t elapsedMs = System.millis() - wakeupStartMs;
+        if (elapsedMs) {
+            wakeupStats.idleWakeupsPerHour = (uint32_t)((uint64_t)wakeupStats.idleWakeups * 3600000 / elapsedMs);
+        }
+    }
+}
+
+void LocationFusionRK::wake(WakeReason reason) {
+    if (wakeQueue) {
+        // If the queue is full the worker is already going to wake
+        uint8_t value = (uint8_t)reason;
+        os_queue_put(wakeQueue, &value, 0, 0);
+    }
+}
+
+void LocationFusionRK::waitUntil(uint64_t ms) {
+    uint64_t now = System.millis();
+    waitMs = (ms > now) ? (system_tick_t)(((ms - now) < MAX_WAIT_MS) ? (ms - now) : MAX_WAIT_MS) : 1;
+}
+
+// [static]
+void LocationFusionRK::cloudStatusHandlerStatic(system_event_t event, int param) {
+    if (param == cloud_status_connected || param == cloud_status_disconnected) {
+        instance().wake(WakeReason::cloudStatus);
+    }
+}
+
+bool LocationFusionRK::takeStatusTransition(StatusTransition &transition) {
+    uint32_t tail = statusTail.load(std::memory_order_relaxed);
+    if (tail == statusHead.load(std::memory_order_acquire)) {
+        return false;
+    }
+    transition = statusRing[tail % STATUS_QUEUE_SIZE];
+    statusTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void LocationFusionRK::stateIdle() {
+    updateStatus(Status::idle);
+
+    if (Particle.connected()) {
+        stateHandler = &LocationFusionRK::stateConnected;
+        return;
+    }
+
+    if (trackLogReady && publishFrequency == PublishFrequency::periodic) {
+        // Keep sampling on the publish schedule while offline so the track can be replayed later
+        if (System.millis() >= nextPublishMs) {
+            recordOffline();
+            nextPublishMs += publishPeriod.count();
+            if (nextPublishMs <= System.millis()) {
+                nextPublishMs = System.millis() + publishPeriod.count();
+            }
+        }
+        // Also woken by the cloud_status system event
+        waitUntil(nextPublishMs);
+        return;
+    }
+
+    // Woken by the cloud_status system event
+    waitMs = MAX_WAIT_MS;
+}
+
+void LocationFusionRK::stateConnected() {
+    updateStatus(prefetchStarted ? Status::prefetching : Status::idle);
+
+    if (!Particle.connected()) {
+        stateHandler = &LocationFusionRK::stateIdle;
+        return;
+    }
+
+    if (trackLogReady && !manualPublishRequested && !prefetchStarted && trackLog.pending() && System.millis() >= nextReplayMs) {
+        // Replay between regular publishes, not in place of one
+        bool publishDue = (publishFrequency == PublishFrequency::periodic && System.millis() >= nextPublishMs) ||
+            (publishFrequency == PublishFrequency::once && publishCount == 0);
+        if (!publishDue) {
+            stateHandler = &LocationFusionRK::stateReplay;
+            return;
+        }
+    }
+
+    if (!manualPublishRequested) {
+        switch(publishFrequency) {
+            case PublishFrequency::manual:
+                // If we get here, manual publish mode and publish not requested. requestPublish() wakes the thread.
+                waitMs = MAX_WAIT_MS;
+                return;
+
+            case PublishFrequency::once: 
+                if (publishCount > 0) {
+                    // Already published and not manually requested
+                    waitMs = MAX_WAIT_MS;
+                    return;
+                }
+                break;   
+                
+            case PublishFrequency::periodic:
+                // nextPublishMs is a uint64_t, so it's safe to compare this way as it never wraps
+                if (System.millis() < nextPublishMs) {
+                    // Not time to publish, but it may be time to start the slow location sources
+                    if (prefetchEnabled && !prefetchStarted) {
+                        uint64_t leadMs = prefetchLeadMs();
+                        if (System.millis() + leadMs >= nextPublishMs) {
+                            startPrefetch();
+                        }
+                        else {
+                            waitUntil(nextPublishMs - leadMs);
+                            return;
+                        }
+                    }
+                    waitUntil(nextPublishMs);
+                    return;
+                }
+                break;
+        }
+
+    }
+
+    // If we get here. it's time to publish a location event
+    scheduledPublishMs = (!manualPublishRequested && publishFrequency == PublishFrequency::periodic) ? nextPublishMs : 0;
+    stateHandler = &LocationFusionRK::stateBuildPublish;
+}
+
+uint64_t LocationFusionRK::prefetchLeadMs() const {
+    uint64_t leadMs = prefetchLeadTime.count();
+
+    for(auto it = prefetchHandlers.begin(); it != prefetchHandlers.end(); it++) {
+        if (it->leadTimeHandler) {
+            uint64_t handlerMs = it->leadTimeHandler().count();
+            if (handlerMs > leadMs) {
+                leadMs = handlerMs;
+            }
+        }
+    }
+    return leadMs;
+}
+
+#if Wiring_WiFi
+void LocationFusionRK::scanWiFi(WAPList &list, bool cellReadOk) {
+    if (wifiCacheMaxAge.count() == 0) {
+        list.scan();
+        return;
+    }
+
+    uint64_t now = System.millis();
+    bool fresh = wifiCacheTimeMs != 0 && (now - wifiCacheTimeMs) < (uint64_t)wifiCacheMaxAge.count();
+#if Wiring_Cellular
+    // A different serving cell means the device has probably moved
+    bool sameCell = cellReadOk && wifiCellTower.isSameCell(wifiCacheTower);
+#else
+    bool sameCell = true;
+#endif // Wiring_Cellular
+
+    if (fresh && sameCell) {
+        list = wifiCacheList;
+        wifiCacheStats.hits++;
+        wifiCacheStats.scanMsSaved += wifiCacheStats.lastScanMs;
+        _locfLog.trace("Wi-Fi cache hit, age %lu ms", (uint32_t)(now - wifiCacheTimeMs));
+    }
+    else {
+        list.scan();
+        wifiCacheStats.misses++;
+        wifiCacheStats.lastScanMs = (uint32_t)(System.millis() - now);
+
+        // An empty scan is not cached so the next publish tries again
+        wifiCacheTimeMs = list.size() ? now : 0;
+        wifiCacheList = list;
+#if Wiring_Cellular
+        wifiCacheTower = wifiCellTower;
+#endif // Wiring_Cellular
+    }
+    wifiCacheStats.hitRatePercent = wifiCacheStats.hits * 100 / (wifiCacheStats.hits + wifiCacheStats.misses);
+}
+#endif // Wiring_WiFi
+
+void LocationFusionRK::startPrefetch() {
+    prefetchStarted = true;
+    publishTiming.lastLeadMs = (uint32_t)(nextPublishMs - System.millis());
+    updateStatus(Status::prefetching);
+    _locfLog.info("prefetch starting %lu ms before publish", publishTiming.lastLeadMs);
+
+#if Wiring_WiFi
+    // A timed out gather request still owns wifiCellTower and the Wi-Fi cache, so do not wait for it here
+    bool prefetchWiFi = addWiFi && !gatherThreadBusy(0);
+    if (addWiFi && !prefetchWiFi) {
+        _locfLog.info("gather thread still busy, not prefetching Wi-Fi");
+    }
+
+    // The prefetch handlers may start using the modem (GNSS), so read the cell for the Wi-Fi cache first
+    bool cellReadOk = false;
+#if Wiring_Cellular
+    if (prefetchWiFi && wifiCacheMaxAge.count()) {
+        cellReadOk = (wifiCellTower.get() == SYSTEM_ERROR_NONE);
+    }
+#endif // Wiring_Cellular
+#endif // Wiring_WiFi
+
+    for(auto it = prefetchHandlers.begin(); it != prefetchHandlers.end(); it++) {
+        if (it->handler) {
+            it->handler();
+        }
+    }
+
+#if Wiring_WiFi 
+    if (prefetchWiFi) {
+        scanWiFi(prefetchWapList, cellReadOk);
+        prefetchWapValid = true;
+    }
+#endif // Wiring_WiFi 
+}
+
+void LocationFusionRK::stateBuildPublish() {
+    currentReqId = locRequestId++;
+    updateStatus(Status::publishing);
+
+    uint32_t freeMemoryStart = System.freeMemory();
+    auto gatherStart = System.millis();
+    gatherTiming = {};
+
+    // Until a timed out request finishes, the gather thread owns every object gather() uses, so this event is
+    // published without Wi-Fi, tower, and cells. Wait for it as long as a gather is allowed to take.
+    bool gatherBusy = gatherThreadBusy((system_tick_t)gatherTimeout.count());
+    if (gatherBusy) {
+        gatherTiming.timedOut = true;
+#if Wiring_WiFi
+        prefetchWapValid = false;
+#endif // Wiring_WiFi
+        _locfLog.info("gather thread still busy, publishing without Wi-Fi/tower");
+    }
+
+    // sources still to gather, and gathered sources that completed
+    int sources = 0;
+    int gathered = 0;
+#if Wiring_WiFi 
+    if (addWiFi && !gatherBusy) {
+        if (prefetchWapValid) {
+            gatherWapList = prefetchWapList;
+            prefetchWapValid = false;
+            gathered |= GATHER_WIFI;
+        }
+        else {
+            sources |= GATHER_WIFI;
+        }
+    }
+#endif // Wiring_WiFi 
+#if Wiring_Cellular
+    if (addTower && !gatherBusy) {
+        sources |= GATHER_TOWER;
+        if (addNeighborCells) {
+            sources |= GATHER_CELLS;
+        }
+    }
+#endif // Wiring_Cellular
+
+    wifiCacheCellReadOk = false;
+#if Wiring_Cellular && Wiring_WiFi
+    if ((sources & GATHER_WIFI) && wifiCacheMaxAge.count()) {
+        // The Wi-Fi cache compares the serving cell, so read it before the handlers can tie up the modem
+        auto start = System.millis();
+        wifiCacheCellReadOk = (wifiCellTower.get() == SYSTEM_ERROR_NONE);
+        if (sources & GATHER_TOWER) {
+            gatherTower = wifiCellTower;
+            gathered |= GATHER_TOWER;
+            sources &= ~GATHER_TOWER;
+        }
+        gatherTiming.towerMs = (uint32_t)(System.millis() - start);
+    }
+#endif // Wiring_Cellular && Wiring_WiFi
+
+    bool gatherAsync = false;
+    if (gatherThread && sources) {
+        // The tower and cell queries need the modem. If the handlers will block it (GNSS on BG95), read them first.
+        int modemSources = sources & (GATHER_TOWER | GATHER_CELLS);
+        if (modemSources && concurrentCellularCheck && !concurrentCellularCheck()) {
+            gather(modemSources, gatherTiming);
+            gathered |= modemSources;
+            sources &= ~modemSources;
+        }
+        if (sources) {
+            gatherAsync = startGather(sources);
+            gatherTiming.concurrent = gatherAsync;
+        }
+    }
+    if (!gatherAsync) {
+        gather(sources, gatherTiming);
+        gathered |= sources;
+        sources = 0;
+    }
+
+    // Variant handlers and CBOR need the Variant tree. With only writer handlers (or none) the event is written directly.
+    buildStats.cbor = cborEncoding;
+    buildStats.streaming = !cborEncoding && addToEventHandlers.empty();
+    size_t streamLen = 0;
+    if (buildStats.streaming) {
+        streamLen = buildStreamingEvent(gatherAsync, sources, gathered, gatherStart);
+    }
+    else {
+        buildVariantEvent(gatherAsync, sources, gathered, gatherStart);
+        if (buildStats.cbor) {
+            streamLen = encodeCborEvent();
+        }
+    }
+
+    gatherTiming.totalMs = (uint32_t)(System.millis() - gatherStart);
+    _locfLog.info("gather %lu ms (wifi %lu ms, tower %lu ms, cells %lu ms, handlers %lu ms, %s)", gatherTiming.totalMs, 
+        gatherTiming.wifiMs, gatherTiming.towerMs, gatherTiming.cellsMs, gatherTiming.handlersMs, gatherTiming.concurrent ? "concurrent" : "sequential");
+
+    prefetchStarted = false;
+    if (scheduledPublishMs) {
+        // Lateness relative to the schedule, not to when this state was entered
+        uint32_t lateMs = (uint32_t)(System.millis() - scheduledPublishMs);
+        publishTiming.lastLateMs = lateMs;
+        if (lateMs > publishTiming.maxLateMs) {
+            publishTiming.maxLateMs = lateMs;
+        }
+        publishLateTotalMs += lateMs;
+        publishTiming.count++;
+        publishTiming.meanLateMs = (uint32_t)(publishLateTotalMs / publishTiming.count);
+        _locfLog.info("publish %lu ms after schedule (mean %lu ms, max %lu ms)", lateMs, publishTiming.meanLateMs, publishTiming.maxLateMs);
+    }
+
+    if ((buildStats.streaming || buildStats.cbor) && streamLen == 0) {
+        // The handlers wrote more than fits in an event
+        updateStatus(Status::publishFail, SYSTEM_ERROR_TOO_LARGE);
+        _locfLog.error("loc event too large");
+        stateHandler = &LocationFusionRK::stateConnected;
+        nextPublishMs = System.millis() + publishFailureRetry.count();
+        return;
+    }
+
+    Log.info("Publishing loc event...");
+    event.name("loc");
+    if (buildStats.streaming) {
+        event.data(streamBuffer, streamLen, ContentType::JSON);
+    }
+    else
+    if (buildStats.cbor) {
+        event.data(streamBuffer, streamLen, ContentType::BINARY);
+    }
+    else {
+        event.data(eventData);
+    }
+
+    // The event data copy in CloudEvent is included in both cases
+    uint32_t freeMemoryEnd = System.freeMemory();
+    buildStats.heapBytes = (freeMemoryStart > freeMemoryEnd) ? (freeMemoryStart - freeMemoryEnd) : 0;
+    if (buildStats.heapBytes > buildStats.maxHeapBytes) {
+        buildStats.maxHeapBytes = buildStats.heapBytes;
+    }
+    // CloudEvent already holds the encoded data, so take its size rather than serializing the Variant again
+    buildStats.eventBytes = (uint32_t)event.size();
+    _locfLog.info("loc event %lu bytes, %lu bytes of heap (%s)", buildStats.eventBytes, buildStats.heapBytes, 
+        buildStats.streaming ? "streaming" : (buildStats.cbor ? "cbor" : "variant"));
+
+    Particle.publish(event);
+
+    stateHandler = &LocationFusionRK::statePublishWait;
+}
+
+int LocationFusionRK::finishGather(bool gatherAsync, int sources, uint64_t gatherStart) {
+    if (!gatherAsync) {
+        return 0;
+    }
+
+    uint64_t deadline = gatherStart + gatherTimeout.count();
+    uint64_t now = System.millis();
+    system_tick_t waitMs = (deadline > now) ? (system_tick_t)(deadline - now) : 0;
+    if (os_semaphore_take(gatherDoneSemaphore, waitMs, false) == 0) {
+        gatherTiming.wifiMs = gatherThreadTiming.wifiMs;
+        gatherTiming.towerMs = gatherThreadTiming.towerMs;
+        gatherTiming.cellsMs = gatherThreadTiming.cellsMs;
+        return sources;
+    }
+
+    // Leave the gather thread's objects alone until it gives the semaphore
+    gatherTiming.timedOut = true;
+    gatherPending = true;
+    _locfLog.info("gather timed out, publishing without Wi-Fi/tower");
+    return 0;
+}
+
+int LocationFusionRK::buildVariantEvent(bool gatherAsync, int sources, int gathered, uint64_t gatherStart) {
+    eventData = Variant();
+
+    eventData.set("cmd", Variant("loc"));
+    if (Time.isValid()) {
+        eventData.set("time", Time.now());
+    }
+
+    Variant locVariant;
+    locVariant.set("lck", 0);
+
+    // Call handlers to add custom data (such as GNSS). GNSS gets added to an inner loc key.
+    auto handlersStart = System.millis();
+    for(auto it = addToEventHandlers.begin(); it != addToEventHandlers.end(); it++) {
+        auto handler = *it;
+
+        handler(eventData, locVariant);
+    }
+    if (addToEventHandlers.empty()) {
+        addWriterHandlersToVariant(eventData, locVariant);
+    }
+    gatherTiming.handlersMs = (uint32_t)(System.millis() - handlersStart);
+
+    gathered |= finishGather(gatherAsync, sources, gatherStart);
+    addGatheredToEvent(gathered);
+
+    if (requestLocEnhanced(gathered, locVariant.get("lck").toInt() == 1)) {
+        eventData.set("loc_cb", 1);
+    }
+
+    eventData.set("loc", locVariant);
+
+    eventData.set("req_id", currentReqId);
+
+    return gathered;
+}
+
+size_t LocationFusionRK::buildStreamingEvent(bool gatherAsync, int sources, int gathered, uint64_t gatherStart) {
+    if (!streamBuffer) {
+        streamBuffer = new char[STREAM_BUFFER_SIZE];
+    }
+    eventData = Variant();
+
+    // One byte is kept for a null terminator
+    JSONBufferWriter writer(streamBuffer, STREAM_BUFFER_SIZE - 1);
+    writer.beginObject();
+
+    writer.name("cmd").value("loc");
+    if (Time.isValid()) {
+        writer.name("time").value((int)Time.now());
+    }
+
+    // Call handlers to add custom data (such as GNSS), first in the inner loc object and then the outer object
+    auto handlersStart = System.millis();
+    bool hasFix = writeLocObject(writer);
+    for(auto it = addToEventWriterHandlers.begin(); it != addToEventWriterHandlers.end(); it++) {
+        auto handler = *it;
+
+        handler(writer, false);
+    }
+    gatherTiming.handlersMs = (uint32_t)(System.millis() - handlersStart);
+
+    gathered |= finishGather(gatherAsync, sources, gatherStart);
+
+    // ,"loc_cb":1,"req_id":-2147483648} 
+    const size_t tailSize = 36;
+    writeGathered(writer, gathered, tailSize);
+
+    if (requestLocEnhanced(gathered, hasFix)) {
+        writer.name("loc_cb").value(1);
+    }
+
+    writer.name("req_id").value(currentReqId);
+    writer.endObject();
+
+    size_t len = writer.dataSize();
+    if (len >= writer.bufferSize()) {
+        return 0;
+    }
+    streamBuffer[len] = 0;
+
+    return len;
+}
+
+void LocationFusionRK::addWriterHandlersToVariant(Variant &eventData, Variant &locVariant) {
+    if (addToEventWriterHandlers.empty()) {
+        return;
+    }
+    if (!streamBuffer) {
+        streamBuffer = new char[STREAM_BUFFER_SIZE];
+    }
+
+    JSONBufferWriter writer(streamBuffer, STREAM_BUFFER_SIZE - 1);
+    writer.beginObject();
+    writeLocObject(writer);
+    for(auto it = addToEventWriterHandlers.begin(); it != addToEventWriterHandlers.end(); it++) {
+        auto handler = *it;
+
+        handler(writer, false);
+    }
+    writer.endObject();
+    if (writer.dataSize() >= writer.bufferSize()) {
+        _locfLog.error("add to event writer handlers data too large");
+        return;
+    }
+    streamBuffer[writer.dataSize()] = 0;
+
+    Variant written = Variant::fromJSON(streamBuffer);
+    const auto &entries = written.value<VariantMap>().entries();
+    for(auto it = entries.begin(); it != entries.end(); it++) {
+        if (strcmp(it->first.c_str(), "loc") == 0) {
+            locVariant = it->second;
+        }
+        else {
+            eventData.set(it->first.c_str(), it->second);
+        }
+    }
+}
+
+size_t LocationFusionRK::encodeCborEvent() {
+    if (!streamBuffer) {
+        streamBuffer = new char[STREAM_BUFFER_SIZE];
+    }
+
+    buildStats.wapsOmitted = 0;
+    buildStats.cellsOmitted = 0;
+    while(true) {
+        LocationCbor::Writer writer((uint8_t *)streamBuffer, STREAM_BUFFER_SIZE);
+        variantToCbor(eventData, writer, nullptr);
+        if (!writer.overflow()) {
+            return writer.size();
+        }
+
+        // Too large, so leave out the last quarter of the Wi-Fi access points and try again
+        Variant wps = eventData.get("wps");
+        int numWaps = wps.isArray() ? wps.size() : 0;
+        if (numWaps == 0) {
+            return 0;
+        }
+        int numToInclude = numWaps - (numWaps + 3) / 4;
+        Variant fewer;
+        for(int ii = 0; ii < numToInclude; ii++) {
+            fewer.append(wps.at(ii));
+        }
+        eventData.set("wps", fewer);
+        buildStats.wapsOmitted += (uint32_t)(numWaps - numToInclude);
+    }
+}
+
+// [static]
+void LocationFusionRK::variantToCbor(const Variant &value, LocationCbor::Writer &writer, const char *key) {
+    if (value.isMap()) {
+        const auto &entries = value.value<VariantMap>().entries();
+        writer.beginMap(entries.size());
+        for(auto it = entries.begin(); it != entries.end(); it++) {
+            writer.text(it->first.c_str());
+            variantToCbor(it->second, writer, it->first.c_str());
+        }
+    }
+    else
+    if (value.isArray()) {
+        const auto &array = value.value<VariantArray>();
+        writer.beginArray(array.size());
+        for(auto it = array.begin(); it != array.end(); it++) {
+            variantToCbor(*it, writer, nullptr);
+        }
+    }
+    else
+    if (value.isString()) {
+        const char *str = value.value<String>().c_str();
+        uint8_t bssid[6];
+        if (key && strcmp(key, "bssid") == 0 && parseBssid(str, bssid)) {
+            writer.bytes(bssid, sizeof(bssid));
+        }
+        else {
+            writer.text(str);
+        }
+    }
+    else
+    if (value.isBool()) {
+        writer.boolean(value.toBool());
+    }
+    else
+    if (value.isNumber()) {
+        int decimals = LocationCbor::fixedPointDecimals(key);
+        if (decimals >= 0) {
+            writer.integer(llround(value.toDouble() * pow(10, decimals)));
+        }
+        else
+        if (value.isDouble()) {
+            writer.floating(value.toDouble());
+        }
+        else
+        if (value.isUInt64()) {
+            writer.integer((int64_t)value.toUInt64());
+        }
+        else {
+            writer.integer(value.toInt64());
+        }
+    }
+    else {
+        writer.null();
+    }
+}
+
+// [static]
+bool LocationFusionRK::parseBssid(const char *str, uint8_t *bssid) {
+    for(size_t ii = 0; ii < 6; ii++) {
+        uint8_t b = 0;
+        for(size_t jj = 0; jj < 2; jj++) {
+            char c = *str++;
+            if (c >= '0' && c <= '9') {
+                b = (b << 4) | (c - '0');
+            }
+            else
+            if (c >= 'a' && c <= 'f') {
+                b = (b << 4) | (c - 'a' + 10);
+            }
+            else
+            if (c >= 'A' && c <= 'F') {
+                b = (b << 4) | (c - 'A' + 10);
+            }
+            else {
+                return false;
+            }
+        }
+        bssid[ii] = b;
+        if (*str++ != ((ii < 5) ? ':' : 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LocationFusionRK::writeLocObject(JSONBufferWriter &writer) {
+    writer.name("loc").beginObject();
+
+    size_t startSize = writer.dataSize();
+    for(auto it = addToEventWriterHandlers.begin(); it != addToEventWriterHandlers.end(); it++) {
+        auto handler = *it;
+
+        handler(writer, true);
+    }
+    if (writer.dataSize() == startSize) {
+        writer.name("lck").value(0);
+    }
+
+    // Look for the fix in what the handlers wrote, as there is no Variant to check
+    static const char fix[] = "\"lck\":1";
+    const size_t fixLen = sizeof(fix) - 1;
+    size_t endSize = (writer.dataSize() < writer.bufferSize()) ? writer.dataSize() : writer.bufferSize();
+    bool hasFix = false;
+    for(size_t ii = startSize; !hasFix && ii + fixLen <= endSize; ii++) {
+        hasFix = (memcmp(&writer.buffer()[ii], fix, fixLen) == 0);
+    }
+
+    writer.endObject();
+
+    return hasFix;
+}
+
+void LocationFusionRK::writeGathered(JSONBufferWriter &writer, int sources, size_t reserve) {
+    buildStats.wapsOmitted = 0;
+    buildStats.cellsOmitted = 0;
+
+#if Wiring_Cellular
+    bool cellsServing = servingFromCells(sources);
+    if (cellsServing || ((sources & GATHER_TOWER) && gatherTower.getLastResult() == SYSTEM_ERROR_NONE)) {
+        writer.name("towers").beginArray();
+        if (cellsServing) {
+            gatherCells.servingToJsonWriter(writer);
+        }
+        else {
+            gatherTower.toJsonWriter(writer, true);
+        }
+        if ((sources & GATHER_CELLS) && gatherCells.getLastResult() == SYSTEM_ERROR_NONE) {
+            // Neighbors are bounded by LocationCellParser::MAX_CELLS but still leave room for the rest of the event
+            size_t used = writer.dataSize() + reserve + 2;
+            size_t numFit = (used < writer.bufferSize()) ? (writer.bufferSize() - used) / CELL_JSON_SIZE : 0;
+            size_t numNeighbors = gatherCells.getNumNeighbors();
+            size_t numToInclude = (numNeighbors < numFit) ? numNeighbors : numFit;
+
+            buildStats.cellsOmitted = (uint32_t)(numNeighbors - numToInclude);
+            gatherCells.neighborsToJsonWriter(writer, numToInclude);
+        }
+        writer.endArray();
+    }
+#endif // Wiring_Cellular
+
+#if Wiring_WiFi 
+    if ((sources & GATHER_WIFI) && gatherWapList.size()) {
+        // Include as many access points as fit, leaving room for the rest of the event
+        const size_t wpsSize = 10; // ,"wps":[]
+        size_t used = writer.dataSize() + reserve + wpsSize;
+        size_t numFit = (used < writer.bufferSize()) ? (writer.bufferSize() - used) / WAP_JSON_SIZE : 0;
+        size_t numToInclude = ((size_t)gatherWapList.size() < numFit) ? (size_t)gatherWapList.size() : numFit;
+
+        buildStats.wapsOmitted = (uint32_t)(gatherWapList.size() - numToInclude);
+        if (numToInclude) {
+            writer.name("wps");
+            gatherWapList.toJsonWriter(writer, (int)numToInclude);
+        }
+    }
+#endif // Wiring_WiFi 
+}
+
+
+
+void LocationFusionRK::statePublishWait() {
+    if (event.isSent()) {
+        updateStatus(Status::publishSuccess);
+        _locfLog.info("publish succeeded");
+        event.clear();
+
+#if Wiring_WiFi
+        if (cachedReplyPending) {
+            // Answered from the BSSID cache, so there is no response to wait for
+            deliverCachedReply();
+        }
+        else
+#endif // Wiring_WiFi
+        if (locEnhancedHandlers.size() && !buildStats.cbor) {
+            // The response is matched by req_id in serviceInFlight(), so the next publish does not have to wait for it
+            addInFlight(currentReqId);
+            updateStatus(Status::locEnhancedWait);
+        }
+        stateHandler = &LocationFusionRK::stateConnected;
+
+        manualPublishRequested = false;
+        publishCount++;
+
+        // Stay on the original schedule so building the event does not make the period drift
+        nextPublishMs = scheduledPublishMs + publishPeriod.count();
+        if (nextPublishMs <= System.millis()) {
+            nextPublishMs = System.millis() + publishPeriod.count();
+        }
+    }
+    else 
+    if (!event.isOk()) {
+        updateStatus(Status::publishFail, event.error());
+        _locfLog.info("publish failed error=%d", event.error());
+        event.clear();
+
+        if (trackLogReady) {
+            Variant data = buildStats.streaming ? Variant::fromJSON(streamBuffer) : eventData;
+            recordLoc(data.get("loc"));
+        }
+        stateHandler = &LocationFusionRK::stateConnected;
+        
+        nextPublishMs = System.millis() + publishFailureRetry.count();
+    }
+    else {
+        waitMs = PUBLISH_WAIT_POLL_MS;
+    }
+}
+
+void LocationFusionRK::stateReplay() {
+    updateStatus(Status::replaying);
+
+    TrackLog::Record records[MAX_BATCH_RECORDS];
+    size_t count = trackLog.read(records, MAX_BATCH_RECORDS);
+    if (count == 0) {
+        stateHandler = &LocationFusionRK::stateConnected;
+        return;
+    }
+
+    // Rows are positional arrays rather than objects to fit more fixes in an event: [time, lat, lon, alt, h_acc, spd, hd]
+    while(true) {
+        Variant rows;
+        for(size_t ii = 0; ii < count; ii++) {
+            const TrackLog::Record &rec = records[ii];
+
+            Variant row;
+            row.append(Variant((unsigned int)rec.time));
+            row.append(Variant((double)rec.lat / 10000000.0));
+            row.append(Variant((double)rec.lon / 10000000.0));
+            row.append(Variant((double)rec.alt / 100.0));
+            row.append(Variant((double)rec.hAcc / 10.0));
+            row.append(Variant((double)rec.spd / 100.0));
+            row.append(Variant((double)rec.hd / 100.0));
+            rows.append(row);
+        }
+
+        eventData = Variant();
+        eventData.set("cmd", Variant("loc-batch"));
+        eventData.set("locs", rows);
+
+        if (count == 1 || eventData.toJSON().length() <= particle::protocol::MAX_EVENT_DATA_LENGTH) {
+            break;
+        }
+        // The rest are sent in the next batch
+        count -= (count + 3) / 4;
+    }
+    replayLastSeq = records[count - 1].seq;
+
+    _locfLog.info("replaying %u of %u track log records", (unsigned)count, (unsigned)trackLog.pending());
+    event.name("loc-batch");
+    event.data(eventData);
+    Particle.publish(event);
+
+    stateHandler = &LocationFusionRK::stateReplayWait;
+}
+
+void LocationFusionRK::stateReplayWait() {
+    if (event.isSent()) {
+        event.clear();
+        trackLog.ack(replayLastSeq);
+        nextReplayMs = System.millis() + trackLogReplayInterval.count();
+        stateHandler = &LocationFusionRK::stateConnected;
+    }
+    else 
+    if (!event.isOk()) {
+        updateStatus(Status::publishFail, event.error());
+        _locfLog.info("loc-batch publish failed error=%d", event.error());
+        event.clear();
+        nextReplayMs = System.millis() + publishFailureRetry.count();
+        stateHandler = &LocationFusionRK::stateConnected;
+    }
+    else {
+        waitMs = PUBLISH_WAIT_POLL_MS;
+    }
+}
+
+void LocationFusionRK::recordOffline() {
+    Variant offlineEvent;
+    Variant locVariant;
+    locVariant.set("lck", 0);
+
+    for(auto it = addToEventHandlers.begin(); it != addToEventHandlers.end(); it++) {
+        auto handler = *it;
+
+        handler(offlineEvent, locVariant);
+    }
+
+    if (addToEventHandlers.empty()) {
+        addWriterHandlersToVariant(offlineEvent, locVariant);
+    }
+    recordLoc(locVariant);
+}
+
+void LocationFusionRK::recordLoc(const Variant &locVariant) {
+    if (locVariant.get("lck").toInt() != 1) {
+        return;
+    }
+
+    TrackLog::Record rec = {};
+    rec.time = locVariant.has("time") ? locVariant.get("time").toUInt() : (uint32_t)Time.now();
+    rec.lat = (int32_t)lround(locVariant.get("lat").toDouble() * 10000000.0);
+    rec.lon = (int32_t)lround(locVariant.get("lon").toDouble() * 10000000.0);
+    rec.alt = (int32_t)lround(locVariant.get("alt").toDouble() * 100.0);
+    rec.spd = (uint16_t)constrain(lround(locVariant.get("spd").toDouble() * 100.0), 0L, 65535L);
+    rec.hd = (uint16_t)constrain(lround(locVariant.get("hd").toDouble() * 100.0), 0L, 35999L);
+    if (locVariant.has("h_acc")) {
+        double hAcc = locVariant.get("h_acc").toDouble() * 10.0;
+        rec.hAcc = (hAcc < 65535.0) ? (uint16_t)lround(hAcc) : 65535;
+    }
+
+    int res = trackLog.append(rec);
+    if (res != SYSTEM_ERROR_NONE) {
+        _locfLog.error("track log append failed %d", res);
+    }
+}
+
+void LocationFusionRK::addInFlight(int reqId) {
+    InFlightRequest evicted = {};
+
+    lock();
+    InFlightRequest *slot = nullptr;
+    for(size_t ii = 0; ii < MAX_IN_FLIGHT; ii++) {
+        if (inFlight[ii].reqId == 0) {
+            slot = &inFlight[ii];
+            break;
+        }
+        if (!slot || inFlight[ii].publishedMs < slot->publishedMs) {
+            slot = &inFlight[ii];
+        }
+    }
+    if (slot->reqId != 0) {
+        // Table full, give up on the oldest request
+        evicted = *slot;
+    }
+    slot->reqId = reqId;
+    slot->publishedMs = System.millis();
+    slot->receivedMs = 0;
+#if Wiring_WiFi
+    // Remember which access points were sent so the response can be learned. Those left out of a full event are the weakest.
+    slot->numBssids = 0;
+    if (bssidCache && locEnhancedWiFi) {
+        size_t numSent = gatherWapList.size();
+        if ((buildStats.streaming || buildStats.cbor) && buildStats.wapsOmitted < numSent) {
+            numSent -= buildStats.wapsOmitted;
+        }
+        for(size_t ii = 0; ii < numSent; ii++) {
+            memcpy(slot->bssids[ii], gatherWapList.at(ii).bssid, sizeof(slot->bssids[ii]));
+        }
+        slot->numBssids = (uint8_t)numSent;
+    }
+#endif // Wiring_WiFi
+#if Wiring_Cellular
+    slot->hasCell = cellCache && locEnhancedTower;
+    if (slot->hasCell) {
+        slot->cell = cellKey(gatherTower);
+    }
+#endif // Wiring_Cellular
+    unlock();
+
+    if (evicted.reqId != 0) {
+        _locfLog.info("loc-enhanced req_id=%d abandoned, too many in flight", evicted.reqId);
+        locEnhancedStats.timeouts++;
+        reportStatus(Status::locEnhancedFail, SYSTEM_ERROR_LIMIT_EXCEEDED, evicted.reqId);
+    }
+}
+
+uint64_t LocationFusionRK::serviceInFlight() {
+    InFlightRequest done[MAX_IN_FLIGHT];
+    size_t numDone = 0;
+    uint64_t nextDeadline = 0;
+    uint64_t now = System.millis();
+
+    lock();
+    for(size_t ii = 0; ii < MAX_IN_FLIGHT; ii++) {
+        InFlightRequest &entry = inFlight[ii];
+        if (entry.reqId == 0) {
+            continue;
+        }
+        uint64_t deadline = entry.publishedMs + locEnhancedTimeout.count();
+        if (entry.receivedMs || now >= deadline) {
+            done[numDone++] = entry;
+            entry.reqId = 0;
+        }
+        else if (nextDeadline == 0 || deadline < nextDeadline) {
+            nextDeadline = deadline;
+        }
+    }
+    unlock();
+
+    // Each completed request gets its own transition, even if several complete at once
+    for(size_t ii = 0; ii < numDone; ii++) {
+        if (done[ii].receivedMs) {
+            uint32_t rttMs = (uint32_t)(done[ii].receivedMs - done[ii].publishedMs);
+            locEnhancedStats.lastRttMs = rttMs;
+            if (rttMs > locEnhancedStats.maxRttMs) {
+                locEnhancedStats.maxRttMs = rttMs;
+            }
+            locEnhancedRttTotalMs += rttMs;
+            locEnhancedStats.count++;
+            locEnhancedStats.meanRttMs = (uint32_t)(locEnhancedRttTotalMs / locEnhancedStats.count);
+            _locfLog.info("loc-enhanced req_id=%d rtt %lu ms", done[ii].reqId, rttMs);
+            reportStatus(Status::locEnhancedSuccess, 0, done[ii].reqId);
+        }
+        else {
+            _locfLog.info("loc-enhanced req_id=%d timed out", done[ii].reqId);
+            locEnhancedStats.timeouts++;
+            reportStatus(Status::locEnhancedFail, SYSTEM_ERROR_TIMEOUT, done[ii].reqId);
+        }
+    }
+
+    return nextDeadline;
+}
+
+
+void LocationFusionRK::gather(int sources, GatherTiming &timing) {
+#if Wiring_WiFi 
+    if (sources & GATHER_WIFI) {
+        auto start = System.millis();
+        scanWiFi(gatherWapList, wifiCacheCellReadOk);
+        timing.wifiMs = (uint32_t)(System.millis() - start);
+    }
+#endif // Wiring_WiFi 
+
+#if Wiring_Cellular
+    if (sources & GATHER_TOWER) {
+        auto start = System.millis();
+        gatherTower.get();
+        timing.towerMs = (uint32_t)(System.millis() - start);
+    }
+    if (sources & GATHER_CELLS) {
+        auto start = System.millis();
+        gatherCells.get();
+        timing.cellsMs = (uint32_t)(System.millis() - start);
+    }
+#endif // Wiring_Cellular
+}
+
+bool LocationFusionRK::gatherThreadBusy(system_tick_t waitMs) {
+    if (!gatherPending) {
+        return false;
+    }
+    if (os_semaphore_take(gatherDoneSemaphore, waitMs, false) != 0) {
+        return true;
+    }
+    gatherPending = false;
+    return false;
+}
+
+bool LocationFusionRK::startGather(int sources) {
+    gatherThreadTiming = {};
+    return os_queue_put(gatherQueue, &sources, 0, 0) == 0;
+}
+
+os_thread_return_t LocationFusionRK::gatherThreadFunction(void) {
+    while(true) {
+        int sources = 0;
+        if (os_queue_take(gatherQueue, &sources, CONCURRENT_WAIT_FOREVER, 0) == 0) {
+            gather(sources, gatherThreadTiming);
+            os_semaphore_give(gatherDoneSemaphore, false);
+        }
+    }
+}
+
+void LocationFusionRK::addGatheredToEvent(int sources) {
+#if Wiring_WiFi 
+    if ((sources & GATHER_WIFI) && gatherWapList.size()) {
+        Variant arrayVariant;
+
+        gatherWapList.toVariant(arrayVariant);
+        
+        eventData.set("wps", arrayVariant);
+    }
+#endif // Wiring_WiFi 
+
+#if Wiring_Cellular
+    bool cellsServing = servingFromCells(sources);
+    if (cellsServing || ((sources & GATHER_TOWER) && gatherTower.getLastResult() == SYSTEM_ERROR_NONE)) {
+        Variant servingTowerVariant;
+        if (cellsServing) {
+            gatherCells.servingToVariant(servingTowerVariant);
+        }
+        else {
+            gatherTower.toVariant(servingTowerVariant);
+        }
+
+        Variant arrayVariant;
+        arrayVariant.append(servingTowerVariant);
+        if ((sources & GATHER_CELLS) && gatherCells.getLastResult() == SYSTEM_ERROR_NONE) {
+            gatherCells.neighborsToVariant(arrayVariant);
+        }
 
+        eventData.set("towers", arrayVariant);
+    }
+#endif // Wiring_Cellular
+}
 
-void LocationFusionRK::setup() {
-    os_mutex_create(&mutex);
+#if Wiring_Cellular
+bool LocationFusionRK::servingFromCells(int sources) const {
+    if (!(sources & GATHER_CELLS) || gatherCells.getLastResult() != SYSTEM_ERROR_NONE || !gatherCells.getServing().hasGlobalId()) {
+        return false;
+    }
+    // The two queries are moments apart, but the modem could have changed cells between them. The tower
+    // is what the cell cache learns from, so it wins if they differ.
+    if ((sources & GATHER_TOWER) && gatherTower.getLastResult() == SYSTEM_ERROR_NONE) {
+        return gatherTower.getCellularGlobalIdentity().cell_id == gatherCells.getServing().cid;
+    }
+    return true;
+}
+#endif // Wiring_Cellular
 
-    thread = new Thread("LocationFusionRK", [this]() { return threadFunction(); }, OS_THREAD_PRIORITY_DEFAULT, threadStackSize);
+int LocationFusionRK::functionHandler(const Variant &eventData) {
+     _locfLog.trace("cmd function %s", eventData.toJSON().c_str());
 
-    if (enableCmdFunction) {
-        Particle.function("cmd", functionHandlerStatic);
+     String cmd = eventData.get("cmd").toString();
 
+    for(auto it = commandHandlers.begin(); it != commandHandlers.end(); it++) {
+        CmdHandler cmdHandler = *it;
         
-        withCmdHandler("loc-enhanced", locEnhancedStatic);
+        if (cmd == cmdHandler.cmd) {
+            cmdHandler.handler(eventData);
+        }
     }
+    return 0;
 }
 
-void LocationFusionRK::updateStatus(Status status) {
-    if (this->status != status) {
-        this->status = status;
 
-        for(auto it = statusHandlers.begin(); it != statusHandlers.end(); it++) {
-            auto handler = *it;
+// [static]
+int LocationFusionRK::functionHandlerStatic(String cmd) {
 
-            handler(status);
-        }
-    }
+    Variant eventData = Variant::fromJSON(cmd.c_str());
+
+    return instance().functionHandler(eventData);
 }
 
+void LocationFusionRK::locEnhanced(const Variant &eventData) {
+    // Match the response to its publish. Responses without a req_id are credited to the oldest request.
+    int reqId = eventData.has("req_id") ? eventData.get("req_id").toInt() : 0;
+    bool matched = false;
+
+    CachedPosition position;
+    bool parsed = parseLocEnhanced(eventData, position);
+
+    lock();
+    InFlightRequest *match = nullptr;
+    InFlightRequest *oldest = nullptr;
+    for(size_t ii = 0; ii < MAX_IN_FLIGHT; ii++) {
+        InFlightRequest &entry = inFlight[ii];
+        if (entry.reqId == 0 || entry.receivedMs) {
+            continue;
+        }
+        if (reqId != 0 && entry.reqId == reqId) {
+            match = &entry;
+            break;
+        }
+        if (!oldest || entry.publishedMs < oldest->publishedMs) {
+            oldest = &entry;
+        }
+    }
+    if (!match && reqId == 0) {
+        match = oldest;
+    }
+    if (match) {
+        match->receivedMs = System.millis();
+        matched = true;
+#if Wiring_WiFi
+        if (bssidCache && parsed && position.hAcc <= bssidCacheMaxLearnAccuracy) {
+            learnBssids(match->bssids, match->numBssids, position);
+        }
+#endif // Wiring_WiFi
+#if Wiring_Cellular
+        if (cellCache && parsed && match->hasCell) {
+            learnCell(match->cell, position);
+        }
+#endif // Wiring_Cellular
+    }
+    unlock();
 
+    if (!matched) {
+        // Late (already timed out) or not from this device's publishes. The data is still passed to the handlers.
+        _locfLog.info("loc-enhanced req_id=%d does not match a request in flight", reqId);
+        locEnhancedStats.unmatched++;
+    }
 
-os_thread_return_t LocationFusionRK::threadFunction(void) {
-    while(true) {
-        // Put your code to run in the worker thread here
-        stateHandler(*this);
-        delay(1);
+    for(auto it = locEnhancedHandlers.begin(); it != locEnhancedHandlers.end(); it++) {
+        (*it)(eventData);
     }
+    wake(WakeReason::locEnhanced);
 }
 
-void LocationFusionRK::stateIdle() {
-    updateStatus(Status::idle);
-
-    if (Particle.connected()) {
-        stateHandler = &LocationFusionRK::stateConnected;
-        return;
+// [static]
+bool LocationFusionRK::parseLocEnhanced(const Variant &eventData, CachedPosition &position) {
+    Variant locEnhanced = eventData.get("loc-enhanced");
+    if (!locEnhanced.has("lat") || !locEnhanced.has("lon") || !locEnhanced.has("h_acc")) {
+        return false;
     }
+
+    position = {};
+    position.lat = (int32_t)lround(locEnhanced.get("lat").toDouble() * 10000000.0);
+    position.lon = (int32_t)lround(locEnhanced.get("lon").toDouble() * 10000000.0);
+    double hAcc = locEnhanced.get("h_acc").toDouble();
+    position.hAcc = (hAcc < 65535.0) ? (uint16_t)lround(hAcc) : 65535;
+    position.time = Time.isValid() ? (uint32_t)Time.now() : 0;
+
+    return true;
 }
 
-void LocationFusionRK::stateConnected() {
-    updateStatus(Status::idle);
+bool LocationFusionRK::requestLocEnhanced(int gathered, bool hasFix) {
+#if Wiring_WiFi
+    cachedReplyPending = false;
+    locEnhancedWiFi = (gathered & GATHER_WIFI) != 0;
+#endif // Wiring_WiFi
+#if Wiring_Cellular
+    locEnhancedTower = (gathered & GATHER_TOWER) && gatherTower.getLastResult() == SYSTEM_ERROR_NONE;
+#endif // Wiring_Cellular
 
-    if (!Particle.connected()) {
-        stateHandler = &LocationFusionRK::stateIdle;
-        return;
+    // The cloud only answers JSON loc events, so a CBOR event would only ever time out as locEnhancedFail
+    if (locEnhancedHandlers.empty() || cborEncoding) {
+        return false;
     }
 
-    if (!manualPublishRequested) {
-        switch(publishFrequency) {
-            case PublishFrequency::manual:
-                // If we get here, manual publish mode and publish not requested
-                return;
-
-            case PublishFrequency::once: 
-                if (publishCount > 0) {
-                    // Already published and not manually requested
-                    return;
-                }
-                break;   
-                
-            case PublishFrequency::periodic:
-                // nextPublishMs is a uint64_t, so it's safe to compare this way as it never wraps
-                if (System.millis() < nextPublishMs) {
-                    // Not time to publish
-                    return;
-                }
-                break;
+#if Wiring_WiFi
+    if (bssidCache && locEnhancedWiFi && !hasFix) {
+        bssidCacheStats.lookups++;
+        cachedReplyPending = estimateFromBssidCache(gatherWapList, cachedReply);
+        if (cachedReplyPending) {
+            bssidCacheStats.hits++;
+        }
+        bssidCacheStats.hitRatePercent = bssidCacheStats.hits * 100 / bssidCacheStats.lookups;
+        if (cachedReplyPending) {
+            return false;
         }
-
     }
+#else
+    (void)gathered;
+    (void)hasFix;
+#endif // Wiring_WiFi
 
-    // If we get here. it's time to publish a location event
-    stateHandler = &LocationFusionRK::stateBuildPublish;
+    return true;
 }
 
-void LocationFusionRK::stateBuildPublish() {
-    updateStatus(Status::publishing);
-    eventData = Variant();
-    locEnhancedReceived = false;
-
-    eventData.set("cmd", Variant("loc"));
-    if (Time.isValid()) {
-        eventData.set("time", Time.now());
+#if Wiring_WiFi
+bool LocationFusionRK::estimateFromBssidCache(const WAPList &list, CachedPosition &position) {
+    struct Match {
+        CachedPosition position;
+        double weight;
+    };
+    Match matches[WAPList::CAPACITY];
+    size_t numMatches = 0;
+    size_t misses[WAPList::CAPACITY];
+    size_t numMisses = 0;
+
+    // Stronger access points are closer, and a position with a smaller h_acc is more reliable
+    auto weight = [](int rssi, const CachedPosition &position) {
+        double signal = (double)constrain(rssi + 110, 1, 80);
+        return signal * signal / (double)((position.hAcc > 1) ? position.hAcc : 1);
+    };
+
+    lock();
+    for(size_t ii = 0; ii < list.size(); ii++) {
+        BssidKey key;
+        memcpy(key.bssid, list.at(ii).bssid, sizeof(key.bssid));
+
+        Match &match = matches[numMatches];
+        if (bssidCache->find(key, match.position)) {
+            match.weight = weight(list.at(ii).rssi, match.position);
+            numMatches++;
+        }
+        else {
+            misses[numMisses++] = ii;
+        }
+    }
+    unlock();
+
+    // Not called with the mutex locked because it may read from the file system
+    if (bssidLookup) {
+        for(size_t ii = 0; ii < numMisses; ii++) {
+            Match &match = matches[numMatches];
+            match.position = {};
+            if (bssidLookup(list.at(misses[ii]).bssid, match.position)) {
+                match.weight = weight(list.at(misses[ii]).rssi, match.position);
+                numMatches++;
+            }
+        }
     }
 
-    if (locEnhancedHandlers.size() > 0) {
-        eventData.set("loc_cb", 1);
+    if (numMatches < bssidCacheMinMatches) {
+        return false;
     }
 
-    Variant locVariant;
-    locVariant.set("lck", 0);
+    // Average the offsets from the first match so the sums stay small. Subtract as double, as the difference of two
+    // int32_t values does not always fit in an int32_t.
+    double totalWeight = 0, lat = 0, lon = 0, hAcc = 0;
+    for(size_t ii = 0; ii < numMatches; ii++) {
+        const Match &match = matches[ii];
+        totalWeight += match.weight;
+        lat += match.weight * ((double)match.position.lat - matches[0].position.lat);
+        lon += match.weight * ((double)match.position.lon - matches[0].position.lon);
+        hAcc += match.weight * (double)match.position.hAcc;
+    }
+    lat = matches[0].position.lat + lat / totalWeight;
+    lon = matches[0].position.lon + lon / totalWeight;
+    hAcc /= totalWeight;
+
+    // Weighted RMS distance of the access points from the result. A large spread means an access point has moved.
+    const double metersPerUnit = 0.0111319; // meters per 10^-7 degree of latitude
+    double lonScale = metersPerUnit * cos(lat / 10000000.0 * M_PI / 180.0);
+    double sumSquares = 0;
+    for(size_t ii = 0; ii < numMatches; ii++) {
+        const Match &match = matches[ii];
+        double dy = ((double)match.position.lat - lat) * metersPerUnit;
+        double dx = ((double)match.position.lon - lon) * lonScale;
+        sumSquares += match.weight * (dx * dx + dy * dy);
+    }
+    double spread = sqrt(sumSquares / totalWeight);
+    if (spread > BSSID_CACHE_MAX_SPREAD) {
+        _locfLog.info("BSSID cache access points disagree by %d m", (int)spread);
+        return false;
+    }
 
-#if Wiring_WiFi 
-    if (addWiFi) {
-        LocationFusionRK::WAPList wapList;
+    position = {};
+    position.lat = (int32_t)lround(lat);
+    position.lon = (int32_t)lround(lon);
+    position.hAcc = (uint16_t)constrain(lround(hAcc + spread), 1L, 65535L);
+    position.samples = (uint16_t)numMatches;
+    position.time = Time.isValid() ? (uint32_t)Time.now() : 0;
 
-        wapList.scan();
-        if (wapList.size()) {
-            Variant arrayVariant;
+    return true;
+}
 
-            wapList.toVariant(arrayVariant);
-            
-            eventData.set("wps", arrayVariant);
-        }
+void LocationFusionRK::learnBssids(const uint8_t (*bssids)[6], size_t numBssids, const CachedPosition &position) {
+    for(size_t ii = 0; ii < numBssids; ii++) {
+        BssidKey key;
+        memcpy(key.bssid, bssids[ii], sizeof(key.bssid));
 
+        bool isNew;
+        CachedPosition &entry = bssidCache->insert(key, isNew);
+        averagePosition(entry, isNew, position);
+        bssidCacheStats.learned++;
     }
-#endif // Wiring_WiFi 
+    bssidCacheStats.entries = (uint32_t)bssidCache->size();
+    bssidCacheStats.evictions = bssidCache->getStats().evictions;
+}
 
-#if Wiring_Cellular
-    if (addTower) {
-        LocationFusionRK::ServingTower servingTower;
-        if (servingTower.get() == SYSTEM_ERROR_NONE) {
-            Variant servingTowerVariant;
-            servingTower.toVariant(servingTowerVariant);
+void LocationFusionRK::deliverCachedReply() {
+    cachedReplyPending = false;
 
-            Variant arrayVariant;
-            arrayVariant.append(servingTowerVariant);
+    Variant src;
+    src.append(Variant("wifi-cache"));
 
-            eventData.set("towers", arrayVariant);
-        }
-    }
-#endif // Wiring_Cellular
+    Variant locEnhanced;
+    locEnhanced.set("lat", cachedReply.lat / 10000000.0);
+    locEnhanced.set("lon", cachedReply.lon / 10000000.0);
+    locEnhanced.set("h_acc", (int)cachedReply.hAcc);
+    locEnhanced.set("src", src);
 
-    // Call handlers to add custom data (such as GNSS). GNSS gets added to an inner loc key.
-    for(auto it = addToEventHandlers.begin(); it != addToEventHandlers.end(); it++) {
-        auto handler = *it;
+    Variant data;
+    data.set("cmd", Variant("loc-enhanced"));
+    data.set("req_id", currentReqId);
+    data.set("loc-enhanced", locEnhanced);
 
-        handler(eventData, locVariant);
+    // The handlers run on the worker thread here rather than the system thread
+    for(auto it = locEnhancedHandlers.begin(); it != locEnhancedHandlers.end(); it++) {
+        (*it)(data);
     }
-    eventData.set("loc", locVariant);
-
-    eventData.set("req_id", locRequestId++);
-
-    Log.info("Publishing loc event...");
-    event.name("loc");
-    event.data(eventData);
-    Particle.publish(event);
 
-    stateHandler = &LocationFusionRK::statePublishWait;
+    bssidCacheStats.latencySavedMs += locEnhancedStats.meanRttMs;
+    _locfLog.info("loc-enhanced req_id=%d from BSSID cache, %u access points", currentReqId, (unsigned)cachedReply.samples);
+    reportStatus(Status::locEnhancedSuccess, 0, currentReqId);
 }
 
+#endif // Wiring_WiFi
 
+#if Wiring_Cellular
+// [static]
+LocationFusionRK::CellKey LocationFusionRK::cellKey(const ServingTower &tower) {
+    const CellularGlobalIdentity &cgi = tower.getCellularGlobalIdentity();
+
+    CellKey key = {};
+    key.mcc = cgi.mobile_country_code;
+    key.mnc = cgi.mobile_network_code;
+    key.lac = cgi.location_area_code;
+    key.cid = cgi.cell_id;
+    return key;
+}
 
-void LocationFusionRK::statePublishWait() {
-    if (event.isSent()) {
-        updateStatus(Status::publishSuccess);
-        _locfLog.info("publish succeeded");
-        event.clear();
+void LocationFusionRK::learnCell(const CellKey &cell, const CachedPosition &position) {
+    bool isNew;
+    CachedPosition &entry = cellCache->insert(cell, isNew);
 
-        if (locEnhancedHandlers.size()) {
-            stateTime = millis();
-            stateHandler = &LocationFusionRK::stateLocEnhancedWait;
-        }
-        else {
-            stateHandler = &LocationFusionRK::stateConnected;
+    // A cell covers a large area, so the accuracy must include how far apart the responses in it have been
+    CachedPosition sample = position;
+    if (!isNew) {
+        double distance = distanceMeters(entry, position);
+        if (distance > sample.hAcc) {
+            sample.hAcc = (distance < 65535.0) ? (uint16_t)lround(distance) : 65535;
         }
+    }
+    averagePosition(entry, isNew, sample);
 
-        manualPublishRequested = false;
-        publishCount++;
+    cellCacheStats.learned++;
+    cellCacheStats.entries = (uint32_t)cellCache->size();
+    cellCacheStats.evictions = cellCache->getStats().evictions;
+}
+#endif // Wiring_Cellular
 
-        nextPublishMs = System.millis() + publishPeriod.count();
+bool LocationFusionRK::getCellPosition(CachedPosition &position) {
+#if Wiring_Cellular
+    if (!cellCache) {
+        return false;
     }
-    else 
-    if (!event.isOk()) {
-        updateStatus(Status::publishFail);
-        _locfLog.info("publish failed error=%d", event.error());
-        event.clear();
-        stateHandler = &LocationFusionRK::stateConnected;
-        
-        nextPublishMs = System.millis() + publishFailureRetry.count();
+    ServingTower tower;
+    if (tower.get() != SYSTEM_ERROR_NONE) {
+        return false;
     }
+    CellKey key = cellKey(tower);
 
-}
-
-void LocationFusionRK::stateLocEnhancedWait() {
-    updateStatus(Status::locEnhancedWait);
+    unsigned long start = micros();
+    lock();
+    bool found = cellCache->find(key, position);
+    unlock();
+    cellCacheStats.lookupMicros = (uint32_t)(micros() - start);
 
-    if (locEnhancedReceived) {
-        updateStatus(Status::locEnhancedSuccess);
-        stateHandler = &LocationFusionRK::stateConnected;
-        return;
-    }
-    if (millis() - stateTime >= locEnhancedTimeout.count()) {
-        updateStatus(Status::locEnhancedFail);
-        stateHandler = &LocationFusionRK::stateConnected;
-        return;
+    cellCacheStats.lookups++;
+    if (found) {
+        cellCacheStats.hits++;
     }
+    cellCacheStats.hitRatePercent = cellCacheStats.hits * 100 / cellCacheStats.lookups;
+    return found;
+#else
+    (void)position;
+    return false;
+#endif // Wiring_Cellular
 }
 
+bool LocationFusionRK::getLastCellPosition(CachedPosition &position) {
+#if Wiring_Cellular
+    if (!cellCache) {
+        return false;
+    }
+    CellKey key;
+    lock();
+    bool found = cellCache->mostRecent(key, position);
+    unlock();
+    return found;
+#else
+    (void)position;
+    return false;
+#endif // Wiring_Cellular
+}
 
-int LocationFusionRK::functionHandler(const Variant &eventData) {
-     _locfLog.trace("cmd function %s", eventData.toJSON().c_str());
-
-     String cmd = eventData.get("cmd").toString();
+void LocationFusionRK::savePositionCaches() {
+    if (System.millis() < nextPositionCacheSaveMs) {
+        return;
+    }
 
-    for(auto it = commandHandlers.begin(); it != commandHandlers.end(); it++) {
-        CmdHandler cmdHandler = *it;
-        
-        if (cmd == cmdHandler.cmd) {
-            cmdHandler.handler(eventData);
+    bool saved = false;
+    lock();
+#if Wiring_WiFi
+    if (bssidCache && bssidCache->isDirty()) {
+        int res = bssidCache->save("/usr/locfusion/bssid.bin", POSITION_CACHE_MAGIC);
+        if (res != SYSTEM_ERROR_NONE) {
+            _locfLog.error("BSSID cache save failed %d", res);
         }
+        saved = true;
     }
-    return 0;
-}
+#endif // Wiring_WiFi
+#if Wiring_Cellular
+    if (cellCache && cellCache->isDirty()) {
+        int res = cellCache->save("/usr/locfusion/cell.bin", POSITION_CACHE_MAGIC);
+        if (res != SYSTEM_ERROR_NONE) {
+            _locfLog.error("cell cache save failed %d", res);
+        }
+        saved = true;
+    }
+#endif // Wiring_Cellular
+    unlock();
 
+    if (saved) {
+        nextPositionCacheSaveMs = System.millis() + POSITION_CACHE_SAVE_INTERVAL_MS;
+    }
+}
 
 // [static]
-int LocationFusionRK::functionHandlerStatic(String cmd) {
+void LocationFusionRK::averagePosition(CachedPosition &entry, bool isNew, const CachedPosition &position) {
+    if (isNew) {
+        entry = position;
+        entry.samples = 1;
+        return;
+    }
 
-    Variant eventData = Variant::fromJSON(cmd.c_str());
+    // Running average of recent responses, so a position that changed is relearned
+    if (entry.samples < POSITION_CACHE_MAX_SAMPLES) {
+        entry.samples++;
+    }
+    entry.lat += (int32_t)(((int64_t)position.lat - entry.lat) / entry.samples);
+    entry.lon += (int32_t)(((int64_t)position.lon - entry.lon) / entry.samples);
+    entry.hAcc = (uint16_t)(entry.hAcc + ((int)position.hAcc - (int)entry.hAcc) / (int)entry.samples);
+    entry.time = position.time;
+}
 
-    return instance().functionHandler(eventData);
+// [static]
+double LocationFusionRK::distanceMeters(const CachedPosition &a, const CachedPosition &b) {
+    // Equirectangular approximation, positions are in 10^-7 degrees
+    const double metersPerUnit = 0.0111319;
+    double dy = ((double)a.lat - b.lat) * metersPerUnit;
+    double dx = ((double)a.lon - b.lon) * metersPerUnit * cos((a.lat + (double)b.lat) / 2 / 10000000.0 * M_PI / 180.0);
+    return sqrt(dx * dx + dy * dy);
 }
 
-void LocationFusionRK::locEnhanced(const Variant &eventData) {
-    locEnhancedReceived = true;
-    for(auto it = locEnhancedHandlers.begin(); it != locEnhancedHandlers.end(); it++) {
-        (*it)(eventData);
-    }
+void LocationFusionRK::requestPublish() {
+    manualPublishRequested = true;
+    wake(WakeReason::requestPublish);
 }
 
 
@@ -267,7 +1625,7 @@ void LocationFusionRK::locEnhancedStatic(const Variant &eventData) {
 //
 // WAPEntry
 //
-LocationFusionRK::WAPEntry::WAPEntry() {
+LocationFusionRK::WAPEntry::WAPEntry() : bssid{}, channel(0), reserved(0), rssi(0), bssidHex{} {
 }
 
 LocationFusionRK::WAPEntry::WAPEntry(const WiFiAccessPoint *wap) {
@@ -278,6 +1636,14 @@ void LocationFusionRK::WAPEntry::fromWiFiAccessPoint(const WiFiAccessPoint *wap)
     memcpy(bssid, wap->bssid, sizeof(bssid));
     channel = wap->channel;
     rssi = wap->rssi;
+
+    // Formatted once here rather than each time the event is built
+    static const char hexDigits[] = "0123456789abcdef";
+    for(size_t ii = 0; ii < sizeof(bssid); ii++) {
+        bssidHex[ii * 3] = hexDigits[bssid[ii] >> 4];
+        bssidHex[ii * 3 + 1] = hexDigits[bssid[ii] & 0xf];
+        bssidHex[ii * 3 + 2] = (ii < sizeof(bssid) - 1) ? ':' : 0;
+    }
 }
 
 void LocationFusionRK::WAPEntry::toJsonWriter(JSONWriter &writer, bool wrapInObject) const {
@@ -285,7 +1651,7 @@ void LocationFusionRK::WAPEntry::toJsonWriter(JSONWriter &writer, bool wrapInObj
         writer.beginObject();
     }
 
-    writer.name("bssid").value(bssidString().c_str());
+    writer.name("bssid").value(bssidHex);
     writer.name("ch").value((unsigned)channel);
     writer.name("str").value(rssi);
 
@@ -295,13 +1661,13 @@ void LocationFusionRK::WAPEntry::toJsonWriter(JSONWriter &writer, bool wrapInObj
 }
 
 void LocationFusionRK::WAPEntry::toVariant(Variant &obj) const {
-    obj.set("bssid", Variant(bssidString().c_str()));
+    obj.set("bssid", Variant(bssidHex));
     obj.set("ch", Variant((unsigned)channel));
     obj.set("str", Variant(rssi));
 }
 
 String LocationFusionRK::WAPEntry::bssidString() const {
-    return String::format("%02x:%02x:%02x:%02x:%02x:%02x", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+    return String(bssidHex);
 }
 #endif // Wiring_WiFi 
 
@@ -315,53 +1681,100 @@ String LocationFusionRK::WAPEntry::bssidString() const {
 // 
 
 void LocationFusionRK::WAPList::scan() {
-    wapArray.clear();
+    numEntries = 0;
+    scanStats = {};
 
     _locfLog.trace("WAPList::scan called");
 
     int res = WiFi.scan(scanCallbackStatic, this);
 
-    _locfLog.trace("WAPList::scan returned %d", res);
+    // Heap order to strongest first. At most CAPACITY entries, so this is quick.
+    std::sort(entries, entries + numEntries, [](const WAPEntry &a, const WAPEntry &b) { return a.rssi > b.rssi; });
+
+    _locfLog.trace("WAPList::scan returned %d, kept %u of %u", res, (unsigned)numEntries, (unsigned)scanStats.seen);
 
 }
 
 void LocationFusionRK::WAPList::appendEntry(const WAPEntry &entry) {
-    wapArray.push_back(entry);
+    if (numEntries < maxEntries) {
+        // Add at the end and sift up
+        size_t index = numEntries++;
+        entries[index] = entry;
+        while(index > 0) {
+            size_t parent = (index - 1) / 2;
+            if (entries[parent].rssi <= entries[index].rssi) {
+                break;
+            }
+            std::swap(entries[parent], entries[index]);
+            index = parent;
+        }
+    }
+    else
+    if (entry.rssi > entries[0].rssi) {
+        // Replace the weakest, which is at the root
+        entries[0] = entry;
+        siftDown(0);
+        scanStats.displaced++;
+    }
+    else {
+        scanStats.displaced++;
+    }
 }
 
 void LocationFusionRK::WAPList::appendEntry(const WiFiAccessPoint *wap) {
+    scanStats.seen++;
+
     LocationFusionRK::WAPEntry entry(wap);
+    if (dropLocallyAdministered && entry.isLocallyAdministered()) {
+        scanStats.hotspots++;
+        return;
+    }
+    if (entry.rssi < minRssi) {
+        scanStats.weak++;
+        return;
+    }
     appendEntry(entry);
 }
 
+void LocationFusionRK::WAPList::siftDown(size_t index) {
+    while(true) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        size_t right = left + 1;
+        if (left < numEntries && entries[left].rssi < entries[smallest].rssi) {
+            smallest = left;
+        }
+        if (right < numEntries && entries[right].rssi < entries[smallest].rssi) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        std::swap(entries[index], entries[smallest]);
+        index = smallest;
+    }
+}
+
 
 void LocationFusionRK::WAPList::toJsonWriter(JSONWriter &writer, int numToInclude) const {
-    int numAdded = 0;
+    size_t numAdded = (numToInclude > 0 && (size_t)numToInclude < numEntries) ? (size_t)numToInclude : numEntries;
 
     writer.beginArray();
 
-    for(auto it = wapArray.begin(); it != wapArray.end(); ++it) {
-        if (numToInclude != 0 && numAdded >= numToInclude) {
-            break;
-        }
-        (*it).toJsonWriter(writer, true);
-        numAdded++;
+    for(size_t ii = 0; ii < numAdded; ii++) {
+        entries[ii].toJsonWriter(writer, true);
     }
 
     writer.endArray();
 }
 
 void LocationFusionRK::WAPList::toVariant(Variant &obj, int numToInclude) const {
-    int numAdded = 0;
+    size_t numAdded = (numToInclude > 0 && (size_t)numToInclude < numEntries) ? (size_t)numToInclude : numEntries;
 
-    for(auto it = wapArray.begin(); it != wapArray.end(); ++it) {
-        if (numToInclude != 0 && numAdded >= numToInclude) {
-            break;
-        }
+    for(size_t ii = 0; ii < numAdded; ii++) {
         Variant obj2;
-        (*it).toVariant(obj2);
+        entries[ii].toVariant(obj2);
         obj.append(obj2);
-        numAdded++;
     }
 }
 
@@ -416,6 +1829,102 @@ void LocationFusionRK::ServingTower::toVariant(Variant &obj) const {
     obj.set("lac", cgi.location_area_code);
 }
 
-#endif // Wiring_Cellular
+int LocationFusionRK::CellList::get() {
+    parser.clear();
+    Cellular.command(commandCallback, &parser, 1000, R"(AT+QENG="servingcell")");
+    if (parser.hasServing()) {
+        Cellular.command(commandCallback, &parser, 2000, R"(AT+QENG="neighbourcell")");
+    }
+    parser.finish();
+
+    lastResult = parser.hasServing() ? SYSTEM_ERROR_NONE : SYSTEM_ERROR_NOT_FOUND;
+    _locfLog.trace("cells %d neighbors, %d dropped", (int)getNumNeighbors(), (int)parser.dropped());
 
+    return lastResult;
+}
+
+void LocationFusionRK::CellList::servingToJsonWriter(JSONWriter &writer) const {
+    cellToJsonWriter(writer, getServing());
+}
+
+void LocationFusionRK::CellList::neighborsToJsonWriter(JSONWriter &writer, size_t maxNeighbors) const {
+    for(size_t ii = parser.hasServing() ? 1 : 0; ii < parser.size() && maxNeighbors > 0; ii++, maxNeighbors--) {
+        cellToJsonWriter(writer, parser.at(ii));
+    }
+}
+
+void LocationFusionRK::CellList::servingToVariant(Variant &obj) const {
+    cellToVariant(obj, getServing());
+}
+
+void LocationFusionRK::CellList::neighborsToVariant(Variant &array) const {
+    for(size_t ii = parser.hasServing() ? 1 : 0; ii < parser.size(); ii++) {
+        Variant obj;
+        cellToVariant(obj, parser.at(ii));
+        array.append(obj);
+    }
+}
+
+// [static]
+void LocationFusionRK::CellList::cellToJsonWriter(JSONWriter &writer, const LocationCellParser::Cell &cell) {
+    writer.beginObject();
+
+    writer.name("rat").value(LocationCellParser::ratName(cell.rat));
+    if (cell.hasGlobalId()) {
+        writer.name("mcc").value(cell.mcc);
+        writer.name("mnc").value(cell.mnc);
+        writer.name("lac").value(cell.lac);
+        writer.name("cid").value(cell.cid);
+    }
+    writer.name("nid").value(cell.nid);
+    writer.name("ch").value(cell.ch);
+    if (cell.str != LocationCellParser::UNKNOWN) {
+        writer.name("str").value((int)cell.str);
+    }
+    if (cell.rsrq != LocationCellParser::UNKNOWN) {
+        writer.name("rsrq").value((int)cell.rsrq);
+    }
+    if (cell.ta != LocationCellParser::UNKNOWN) {
+        writer.name("ta").value((int)cell.ta);
+    }
+
+    writer.endObject();
+}
+
+// [static]
+void LocationFusionRK::CellList::cellToVariant(Variant &obj, const LocationCellParser::Cell &cell) {
+    obj.set("rat", Variant(LocationCellParser::ratName(cell.rat)));
+    if (cell.hasGlobalId()) {
+        obj.set("mcc", cell.mcc);
+        obj.set("mnc", cell.mnc);
+        obj.set("lac", cell.lac);
+        obj.set("cid", cell.cid);
+    }
+    obj.set("nid", cell.nid);
+    obj.set("ch", cell.ch);
+    if (cell.str != LocationCellParser::UNKNOWN) {
+        obj.set("str", (int)cell.str);
+    }
+    if (cell.rsrq != LocationCellParser::UNKNOWN) {
+        obj.set("rsrq", (int)cell.rsrq);
+    }
+    if (cell.ta != LocationCellParser::UNKNOWN) {
+        obj.set("ta", (int)cell.ta);
+    }
+}
+
+// [static]
+int LocationFusionRK::CellList::commandCallback(int type, const char *buf, int len, LocationCellParser *parser) {
+    if (type == TYPE_PLUS) {
+        // buf is not null terminated. Allow for the CR LF before the line; longer lines are not parsed.
+        char line[LocationCellParser::MAX_LINE_LENGTH + 8];
+        if (len > 0 && (size_t)len < sizeof(line)) {
+            memcpy(line, buf, len);
+            line[len] = 0;
+            parser->parseLine(line);
+        }
+    }
+    return WAIT;
+}
 
+#endif // Wiring_Cellular
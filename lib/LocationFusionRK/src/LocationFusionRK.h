@@ -3,6 +3,11 @@
 
 #include "Particle.h"
 
+#include "LocationCache.h"
+#include "LocationCbor.h"
+#include "LocationCellParser.h"
+#include "LocationTrackLog.h"
+
 // Repository: https://github.com/rickkas7/LocationFusionRK
 // License: MIT
 
@@ -11,6 +16,7 @@
 #error "The LocationFusionRK library requires Device OS 6.2.0 or later because it requires Variant and CloudEvent"
 #endif
 
+#include <atomic>
 #include <vector>
 
 /**
@@ -62,19 +68,67 @@ public:
          */
         String bssidString() const;
 
+        /**
+         * @brief true if the BSSID is locally administered, as used by phone and vehicle hotspots. Added in 0.0.5.
+         * 
+         * These move around with their owner, so they are not useful for geolocation.
+         */
+        bool isLocallyAdministered() const { return (bssid[0] & 0x02) != 0; };
+
         uint8_t bssid[6]; //!< BSSID (base station MAC address)
         uint8_t channel; //!< Wi-Fi channel number
         uint8_t reserved; //!< reserved for future use and for structure alignment 
         int rssi; //!< The signal strength (RSSI) 
+        char bssidHex[18]; //!< bssid in aa:bb:cc:dd:ee:ff format, set by fromWiFiAccessPoint(). Added in 0.0.5.
     };
 #endif // Wiring_WiFi
 
 #if Wiring_WiFi 
     /**
      * @brief Container for a list of Wi-Fi access points, along with methods for scanning and converting to JSON or Variant
+     * 
+     * As of 0.0.5 this has a fixed capacity and does not allocate memory. During the scan it keeps the strongest
+     * access points in a min-heap, so a weaker access point is dropped in favor of a stronger one when it is full.
+     * After the scan, the entries are in order of decreasing RSSI.
      */
     class WAPList {
     public:
+        /**
+         * @brief Maximum number of access points that can be kept
+         */
+        static const size_t CAPACITY = 16;
+
+        /**
+         * @brief Counts from the last scan
+         */
+        struct ScanStats {
+            uint16_t seen; //!< Access points reported by the scan
+            uint16_t hotspots; //!< Dropped because the BSSID is locally administered
+            uint16_t weak; //!< Dropped because the RSSI is below the minimum
+            uint16_t displaced; //!< Dropped because the list was full of stronger access points
+        };
+
+        /**
+         * @brief Set the number of strongest access points to keep
+         * 
+         * @param maxEntries 1 to CAPACITY. Default is CAPACITY.
+         */
+        void setMaxEntries(size_t maxEntries) { this->maxEntries = (maxEntries > 0 && maxEntries < CAPACITY) ? maxEntries : CAPACITY; };
+
+        /**
+         * @brief Set the weakest RSSI to keep
+         * 
+         * @param minRssi RSSI in dBm. Default is -100 (keep everything).
+         */
+        void setMinRssi(int minRssi) { this->minRssi = minRssi; };
+
+        /**
+         * @brief Set whether to drop access points with locally administered BSSIDs (mobile hotspots)
+         * 
+         * @param drop Default is true
+         */
+        void setDropLocallyAdministered(bool drop) { dropLocallyAdministered = drop; };
+
         /**
          * @brief Scan for Wi-Fi access points.
          * 
@@ -89,7 +143,20 @@ public:
          * 
          * @return size_t 
          */
-        size_t size() const { return wapArray.size(); };
+        size_t size() const { return numEntries; };
+
+        /**
+         * @brief Get an entry. Entries are in order of decreasing RSSI.
+         * 
+         * @param index 0 to size() - 1
+         * @return const WAPEntry& 
+         */
+        const WAPEntry &at(size_t index) const { return entries[index]; };
+
+        /**
+         * @brief Get the counts from the last scan
+         */
+        const ScanStats &getScanStats() const { return scanStats; };
 
 
         /**
@@ -110,19 +177,24 @@ public:
 
     protected:
         /**
-         * @brief Used internally to add an entry to wapArray
+         * @brief Used internally to add an entry, replacing the weakest if full
          * 
          * @param entry 
          */
         void appendEntry(const WAPEntry &entry);
 
         /**
-         * @brief Used internally to add an entry to wapArray from a WiFiAccessPoint structure
+         * @brief Used internally to add an entry from a WiFiAccessPoint structure, if it passes the filters
          * 
          * @param entry 
          */
         void appendEntry(const WiFiAccessPoint *wap);
 
+        /**
+         * @brief Move entries[index] down the min-heap to restore the heap order
+         */
+        void siftDown(size_t index);
+
         /**
          * @brief Eventually called to process entries from WiFi.scan().
          * 
@@ -138,9 +210,15 @@ public:
         static void scanCallbackStatic(WiFiAccessPoint* wap, void *context);
 
         /**
-         * @brief Array of access points found by Wifi.scan()
+         * @brief Access points found by Wifi.scan(). A min-heap on rssi during the scan, sorted strongest first after.
          */
-        std::vector<WAPEntry> wapArray;
+        WAPEntry entries[CAPACITY];
+
+        size_t numEntries = 0; //!< Number of valid entries
+        size_t maxEntries = CAPACITY; //!< Set by setMaxEntries()
+        int minRssi = -100; //!< Set by setMinRssi()
+        bool dropLocallyAdministered = true; //!< Set by setDropLocallyAdministered()
+        ScanStats scanStats = {};
     };
 #endif // Wiring_WiFi
 
@@ -184,12 +262,101 @@ public:
          */
         const CellularGlobalIdentity &getCellularGlobalIdentity() const { return cgi; };
 
+        /**
+         * @brief true if both get() calls succeeded and returned the same cell. Added in 0.0.5.
+         * 
+         * @param other 
+         */
+        bool isSameCell(const ServingTower &other) const {
+            return cellularResult == 0 && other.cellularResult == 0 &&
+                cgi.mobile_country_code == other.cgi.mobile_country_code && cgi.mobile_network_code == other.cgi.mobile_network_code &&
+                cgi.location_area_code == other.cgi.location_area_code && cgi.cell_id == other.cgi.cell_id;
+        };
+
     protected:
         CellularGlobalIdentity cgi = {0}; //!< Filled in by cellular_global_identity()
         cellular_result_t cellularResult = -1; //!< Result from cellular_global_identity()
 
     };
+
+    /**
+     * @brief Serving cell signal metrics and neighbor cells from the modem engineering mode. Added in 0.0.5.
+     *
+     * Uses AT+QENG="servingcell" and AT+QENG="neighbourcell", so it only works on Quectel modems. Holds at most
+     * LocationCellParser::MAX_CELLS cells, the serving cell first and then the strongest neighbors.
+     */
+    class CellList {
+    public:
+        /**
+         * @brief Query the modem for the serving and neighbor cells
+         *
+         * @return int A system error code. SYSTEM_ERROR_NONE (0) if the modem returned a serving cell.
+         *
+         * Blocks the modem for up to 3 seconds. Only works when the modem is on.
+         */
+        int get();
+
+        /**
+         * @brief Get the result from the last get() call.
+         *
+         * @return int A system error code. -1 if get() has not been called.
+         */
+        int getLastResult() const { return lastResult; };
+
+        /**
+         * @brief The serving cell, valid if getLastResult() is SYSTEM_ERROR_NONE
+         */
+        const LocationCellParser::Cell &getServing() const { return parser.at(0); };
+
+        /**
+         * @brief Number of neighbor cells
+         */
+        size_t getNumNeighbors() const { return parser.hasServing() ? parser.size() - 1 : parser.size(); };
+
+        /**
+         * @brief Write the serving cell, including signal metrics, as a tower object
+         *
+         * @param writer JSONWriter to write the data to
+         */
+        void servingToJsonWriter(JSONWriter &writer) const;
+
+        /**
+         * @brief Write neighbor cells as tower objects, strongest first
+         *
+         * @param writer JSONWriter to write the data to, inside the towers array
+         * @param maxNeighbors Maximum number to write
+         */
+        void neighborsToJsonWriter(JSONWriter &writer, size_t maxNeighbors) const;
+
+        /**
+         * @brief Save the serving cell, including signal metrics, as a tower object
+         *
+         * @param obj Variant object to add to
+         */
+        void servingToVariant(Variant &obj) const;
+
+        /**
+         * @brief Append the neighbor cells as tower objects, strongest first
+         *
+         * @param array Variant array to append to
+         */
+        void neighborsToVariant(Variant &array) const;
+
+    protected:
+        static void cellToJsonWriter(JSONWriter &writer, const LocationCellParser::Cell &cell);
+        static void cellToVariant(Variant &obj, const LocationCellParser::Cell &cell);
+        static int commandCallback(int type, const char *buf, int len, LocationCellParser *parser);
+
+        LocationCellParser parser;
+        int lastResult = -1;
+    };
 #endif // Wiring_Cellular
+
+    /**
+     * @brief Append-only log of location fixes in flash, used by withTrackLog(). Added in 0.0.5.
+     */
+    typedef LocationTrackLog TrackLog;
+
     /**
      * @brief How often to publish location 
      */
@@ -220,7 +387,133 @@ public:
         publishFail = 3, //!< publish failed
         locEnhancedWait = 4, //!< waiting for a loc-enhanced reply
         locEnhancedSuccess = 5, //!< loc-enhanced reply received
-        locEnhancedFail = 6 //!< loc-enhanced reply timed out        
+        locEnhancedFail = 6, //!< loc-enhanced reply timed out        
+        prefetching = 7, //!< location sources started ahead of a scheduled publish, waiting for the publish time
+        replaying = 8 //!< publishing a loc-batch event from the track log
+    };
+
+    /**
+     * @brief Worker thread wakeup counts, to verify it sleeps while idle. Added in 0.0.5.
+     */
+    struct WakeupStats {
+        uint32_t wakeups; //!< Times the worker thread returned from a wait
+        uint32_t eventWakeups; //!< Wakeups caused by an event (cloud status, requestPublish, loc-enhanced) rather than a timer
+        uint32_t idleWakeups; //!< Wakeups while the status was idle
+        uint32_t idleWakeupsPerHour; //!< idleWakeups scaled to one hour since setup()
+    };
+
+    /**
+     * @brief Round trip times for loc-enhanced responses. Added in 0.0.5.
+     */
+    struct LocEnhancedStats {
+        uint32_t lastRttMs; //!< Time from publish success to the loc-enhanced response for the most recent match
+        uint32_t maxRttMs; //!< Largest round trip time
+        uint32_t meanRttMs; //!< Mean round trip time
+        unsigned int count; //!< Responses matched to a request
+        unsigned int timeouts; //!< Requests that got no response within the timeout, or were evicted from a full table
+        unsigned int unmatched; //!< Responses whose req_id was not in flight, typically because they arrived late
+    };
+
+    /**
+     * @brief Number of loc publishes that can be waiting for loc-enhanced at once. Added in 0.0.5.
+     */
+    static const size_t MAX_IN_FLIGHT = 4;
+
+    /**
+     * @brief A status change, as returned by takeStatusTransition(). Added in 0.0.5.
+     */
+    struct StatusTransition {
+        Status status; //!< The new status
+        uint64_t timeMs; //!< System.millis() when the status changed
+        int reqId; //!< req_id of the loc event this status applies to, 0 before the first publish
+        int error; //!< System error code for publishFail (publish error) and locEnhancedFail (SYSTEM_ERROR_TIMEOUT), otherwise 0
+    };
+
+    /**
+     * @brief Number of status transitions buffered for takeStatusTransition(). Added in 0.0.5.
+     */
+    static const size_t STATUS_QUEUE_SIZE = 16;
+
+    /**
+     * @brief Wi-Fi scan cache counters, from getWiFiCacheStats(). Added in 0.0.5.
+     */
+    struct WiFiCacheStats {
+        uint32_t hits; //!< Scans skipped by using the cached results
+        uint32_t misses; //!< Scans done because the cache was empty, too old, or the cell changed
+        uint32_t hitRatePercent; //!< hits * 100 / (hits + misses)
+        uint32_t lastScanMs; //!< Duration of the most recent real scan
+        uint32_t scanMsSaved; //!< Sum of lastScanMs at each hit, an estimate of the scan time saved
+    };
+
+    /**
+     * @brief A position learned from loc-enhanced responses, as stored in a position cache. Added in 0.0.5.
+     */
+    struct CachedPosition {
+        int32_t lat; //!< Latitude in degrees * 10^7
+        int32_t lon; //!< Longitude in degrees * 10^7
+        uint16_t hAcc; //!< Horizontal accuracy in meters
+        uint16_t samples; //!< Number of responses averaged, up to POSITION_CACHE_MAX_SAMPLES
+        uint32_t time; //!< Time.now() of the most recent response, 0 if the time was not valid
+    };
+
+    /**
+     * @brief Number of responses averaged into a CachedPosition. Later responses replace 1/8 of the position. Added in 0.0.5.
+     */
+    static const uint16_t POSITION_CACHE_MAX_SAMPLES = 8;
+
+    /**
+     * @brief Position cache counters, from getBssidCacheStats() and getCellCacheStats(). Added in 0.0.5.
+     */
+    struct PositionCacheStats {
+        uint32_t lookups; //!< Lookups: loc events checked for the BSSID cache, getCellPosition() calls for the cell cache
+        uint32_t hits; //!< Lookups that returned a position. For the BSSID cache, loc events answered without a loc-enhanced round trip.
+        uint32_t hitRatePercent; //!< hits * 100 / lookups
+        uint32_t latencySavedMs; //!< Sum of the mean loc-enhanced round trip time at each hit, an estimate of the time saved
+        uint32_t learned; //!< Positions added or updated from loc-enhanced responses
+        uint32_t entries; //!< Positions currently in the cache
+        uint32_t evictions; //!< Least recently used positions removed to make room
+        uint32_t lookupMicros; //!< Duration of the most recent lookup in microseconds, including locking
+        uint32_t memoryBytes; //!< RAM used by the table
+    };
+
+    /**
+     * @brief Size and memory use of building the most recent loc event, from getBuildStats(). Added in 0.0.5.
+     */
+    struct BuildStats {
+        bool streaming; //!< Event was written directly to a buffer rather than built as a Variant
+        bool cbor; //!< Event was encoded as CBOR
+        uint32_t eventBytes; //!< Size of the event data in bytes, from CloudEvent::size()
+        uint32_t heapBytes; //!< Decrease in free heap from the start of the build to the publish, the memory held by the event
+        uint32_t maxHeapBytes; //!< Largest heapBytes since setup()
+        uint32_t wapsOmitted; //!< Wi-Fi access points left out because the event would have been too large (streaming and CBOR)
+        uint32_t cellsOmitted; //!< Neighbor cells left out because the event would have been too large (streaming)
+    };
+
+    /**
+     * @brief Time spent gathering each source for the most recent loc event. Added in 0.0.5.
+     */
+    struct GatherTiming {
+        uint32_t wifiMs; //!< Wi-Fi scan, 0 if not done or prefetched
+        uint32_t towerMs; //!< Serving tower query
+        uint32_t cellsMs; //!< Serving cell metrics and neighbor cell query, 0 if not done
+        uint32_t handlersMs; //!< All add to event handlers
+        uint32_t totalMs; //!< From the start of building the event until all sources were merged
+        bool concurrent; //!< Wi-Fi and tower ran on the gather thread alongside the handlers
+        bool timedOut; //!< The gather deadline passed before Wi-Fi and tower finished, so they were left out
+    };
+
+    /**
+     * @brief How close periodic publishes are to their schedule. Added in 0.0.5.
+     *
+     * Lateness is measured from the scheduled publish time to when Particle.publish() is called, so it includes the
+     * time to scan Wi-Fi, read the tower, and run the add to event handlers.
+     */
+    struct PublishTiming {
+        uint32_t lastLateMs; //!< Lateness of the most recent scheduled publish
+        uint32_t maxLateMs; //!< Largest lateness seen
+        uint32_t meanLateMs; //!< Mean lateness
+        unsigned int count; //!< Number of scheduled publishes measured
+        uint32_t lastLeadMs; //!< Lead time used for the most recent prefetch, 0 if prefetch did not run
     };
      
 
@@ -284,6 +577,82 @@ public:
      */
     LocationFusionRK &withAddWiFi(bool enable = true) { addWiFi = enable; return *this; };
 
+    /**
+     * @brief Reuse the previous Wi-Fi scan when the device has probably not moved. Added in 0.0.5.
+     * 
+     * @param maxAge Never reuse a scan older than this. 0 (the default) disables the cache.
+     * @return LocationFusionRK& 
+     * 
+     * On cellular devices the serving tower is read before the Wi-Fi scan. If it is the same cell as the last scan
+     * and the scan is newer than maxAge, the last results are used instead of scanning. On Wi-Fi only devices only
+     * the age is checked. See getWiFiCacheStats().
+     */
+    LocationFusionRK &withWiFiCache(std::chrono::milliseconds maxAge) { wifiCacheMaxAge = maxAge; return *this; };
+
+    /**
+     * @brief Learn access point positions from loc-enhanced responses and use them instead of a round trip. Added in 0.0.5.
+     * 
+     * @param minMatches Number of access points in the scan that must be in the cache to use it. Default is 3.
+     * @param maxLearnAccuracy Only learn from responses with h_acc up to this many meters. Default is 150.
+     * @return LocationFusionRK& 
+     * 
+     * Must be called before setup(). Requires withAddWiFi() and withLocEnhancedHandler(). Each loc-enhanced response
+     * is stored against the BSSIDs that were sent in its loc event, in a table of up to BssidCache::CAPACITY access
+     * points saved in /usr/locfusion. When a later scan has minMatches cached access points that agree with each
+     * other, and the loc has no GNSS fix, the position is calculated on-device. The loc event is still published,
+     * but without loc_cb, and the loc-enhanced handlers are called as soon as the publish succeeds with
+     * "src":["wifi-cache"] in the loc-enhanced object. See getBssidCacheStats().
+     */
+    LocationFusionRK &withBssidCache(size_t minMatches = 3, unsigned int maxLearnAccuracy = 150) { 
+        bssidCacheMinMatches = minMatches; 
+        bssidCacheMaxLearnAccuracy = maxLearnAccuracy; 
+        return *this; 
+    };
+
+    /**
+     * @brief Look up access points that are not in the BSSID cache in a database of known positions. Added in 0.0.5.
+     * 
+     * @param lookup Called with a 6-byte BSSID. Fill in position (lat, lon, and hAcc) and return true if it is known.
+     * @return LocationFusionRK& 
+     * 
+     * Must be called before setup(). Requires withBssidCache(). Access points found by lookup count toward minMatches
+     * the same as learned ones, but are not added to the cache. The lookup is called from the location thread without
+     * the mutex locked, so it can read from the file system, for example with GeoBlob::findAccessPoint().
+     */
+    LocationFusionRK &withBssidLookup(std::function<bool(const uint8_t *bssid, CachedPosition &position)> lookup) { bssidLookup = lookup; return *this; };
+
+    /**
+     * @brief Learn cell positions from loc-enhanced responses for an immediate coarse fix. Added in 0.0.5.
+     * 
+     * @param enable 
+     * @return LocationFusionRK& 
+     * 
+     * Must be called before setup(). Requires withAddTower() and withLocEnhancedHandler(). Each loc-enhanced response
+     * is stored against the serving cell (mcc, mnc, lac, cid) sent in its loc event, in a table of up to
+     * CellCache::CAPACITY cells saved in /usr/locfusion. The accuracy is widened to cover the spread of the responses
+     * seen in the cell. Use getCellPosition() for the position of the current cell and getLastCellPosition() for the
+     * most recent cell, which is available from flash right after setup(). This can be called on devices without
+     * cellular and it will be ignored.
+     */
+    LocationFusionRK &withCellCache(bool enable = true) { cellCacheEnabled = enable; return *this; };
+
+    /**
+     * @brief Choose which Wi-Fi access points are added to the loc event. Added in 0.0.5.
+     * 
+     * @param maxAccessPoints Number of strongest access points to include, up to WAPList::CAPACITY (16, the default)
+     * @param minRssi Leave out access points weaker than this, in dBm. Default is -100 (no limit).
+     * @param dropHotspots Leave out locally administered BSSIDs, typically phone and vehicle hotspots that move. Default is true.
+     * @return LocationFusionRK& 
+     * 
+     * Must be called before setup().
+     */
+    LocationFusionRK &withWiFiFilter(size_t maxAccessPoints, int minRssi = -100, bool dropHotspots = true) { 
+        wifiMaxAccessPoints = maxAccessPoints; 
+        wifiMinRssi = minRssi; 
+        wifiDropHotspots = dropHotspots; 
+        return *this; 
+    };
+
     /**
      * @brief Add serving cellular tower information to the loc event. Default is false.
      * 
@@ -294,6 +663,19 @@ public:
      */
     LocationFusionRK &withAddTower(bool enable = true) { addTower = enable; return *this; };
 
+    /**
+     * @brief Add serving cell signal metrics and neighbor cells to the towers array. Default is false. Added in 0.0.5.
+     *
+     * @param enable
+     * @return LocationFusionRK&
+     *
+     * Requires withAddTower(). The serving tower gains "str" (RSRP for LTE, RSCP for WCDMA, RxLev in dBm for GSM),
+     * "rsrq", "ch", "nid", and "ta" (GSM only), and up to 7 neighbor cells follow it, strongest first. More cells
+     * give loc-enhanced a tighter fix without GNSS. Uses AT+QENG, so it only works on Quectel modems (BG95, EG91),
+     * and uses the modem for up to 3 seconds per publish. See getGatherTiming().
+     */
+    LocationFusionRK &withAddNeighborCells(bool enable = true) { addNeighborCells = enable; return *this; };
+
     /**
      * @brief Add an "add to event" handler
      * 
@@ -312,8 +694,130 @@ public:
      * 
      */
     LocationFusionRK &withAddToEventHandler(std::function<void(Variant &eventData, Variant &locVariant)> handler) { addToEventHandlers.push_back(handler); return *this; };
+
+    /**
+     * @brief Add an "add to event" handler that writes JSON directly into the event. Added in 0.0.5.
+     * 
+     * @param handler 
+     * @return LocationFusionRK& 
+     * 
+     * The handler can be a C function or C++11 lambda and has the following prototype:
+     * 
+     * void handler(JSONWriter &writer, bool inLoc)
+     * 
+     * It is called twice for each event. First with inLoc true, positioned inside the inner loc object, then with
+     * inLoc false, positioned in the outer event object. Write name/value pairs with writer.name().value(). If no
+     * handler writes anything into the inner loc object, "lck":0 is added.
+     * 
+     * If only writer handlers are registered, the loc event is written straight into a fixed buffer instead of
+     * building a Variant, which avoids heap allocations for each publish. If any withAddToEventHandler() handlers
+     * are registered the Variant method is used and writer handlers are not called. See getBuildStats().
+     */
+    LocationFusionRK &withAddToEventWriterHandler(std::function<void(JSONWriter &writer, bool inLoc)> handler) { addToEventWriterHandlers.push_back(handler); return *this; };
+
+    /**
+     * @brief Publish the loc event as CBOR with the binary content type instead of JSON. Added in 0.0.5.
+     * 
+     * @param enable true to use CBOR. Default is false (JSON).
+     * @return LocationFusionRK& 
+     * 
+     * The event has the same structure as the JSON event, encoded as described in LocationCbor: latitude, longitude,
+     * and the other GNSS values are scaled integers and BSSIDs are 6-byte binary values. Tower fields are already
+     * integers. This typically makes the event less than half the size, leaving room for more Wi-Fi access points.
+     * 
+     * The Particle cloud location fusion service only accepts JSON, so this is for events processed by your own
+     * server, which can use LocationCbor::toJson() to get the JSON event. loc_cb is not added to CBOR events, so the
+     * loc-enhanced handlers are not called and there is no locEnhancedWait. Both kinds of add to event handler can be used.
+     */
+    LocationFusionRK &withCborEncoding(bool enable = true) { cborEncoding = enable; return *this; };
     
 
+    /**
+     * @brief Start location sources ahead of each periodic publish so the event goes out on schedule. Added in 0.0.5.
+     *
+     * @param leadTime Minimum time before the scheduled publish to start. Prefetch handlers can ask for more.
+     * @return LocationFusionRK& 
+     *
+     * Only used with withPublishPeriodic(). When the lead time is reached the prefetch handlers are called and,
+     * if enabled with withAddWiFi(), the Wi-Fi scan is done. The status is prefetching until the publish time, when
+     * the event is built using the prefetched data.
+     */
+    LocationFusionRK &withPrefetch(std::chrono::milliseconds leadTime) { prefetchEnabled = true; prefetchLeadTime = leadTime; return *this; };
+
+    /**
+     * @brief Add a prefetch handler to start a slow location source early. Added in 0.0.5.
+     *
+     * @param handler Called from the worker thread when prefetch starts. It should start work and return.
+     * @param leadTimeHandler Optional function returning how long before the publish the handler needs to run.
+     * The largest of these and the withPrefetch() lead time is used.
+     * @return LocationFusionRK& 
+     *
+     * QuectelGnssRK provides QuectelGnssRK::prefetchHandler and QuectelGnssRK::prefetchLeadTime, which learns the
+     * lead time from recent acquisitions. Adding a handler enables prefetch.
+     */
+    LocationFusionRK &withPrefetchHandler(std::function<void()> handler, std::function<std::chrono::milliseconds()> leadTimeHandler = nullptr) { 
+        prefetchEnabled = true;
+        prefetchHandlers.push_back(PrefetchHandler{handler, leadTimeHandler});
+        return *this; 
+    };
+
+    /**
+     * @brief Gather Wi-Fi and tower information on a separate thread while the add to event handlers run. Added in 0.0.5.
+     *
+     * @param enable true to gather concurrently. Must be set before setup().
+     * @param concurrentCellularCheck Optional function returning false if the cellular modem cannot answer a tower query
+     * while the add to event handlers are using it, such as GNSS on the BG95. The tower is then read first, before the
+     * handlers start, and only Wi-Fi runs concurrently. QuectelGnssRK::concurrentGatherSupported can be used here.
+     * @return LocationFusionRK& 
+     *
+     * Without this the Wi-Fi scan, tower query, and handlers run one after another, so building the event takes
+     * the sum of their times. See getGatherTiming().
+     */
+    LocationFusionRK &withConcurrentGather(bool enable = true, std::function<bool()> concurrentCellularCheck = nullptr) {
+        concurrentGather = enable;
+        this->concurrentCellularCheck = concurrentCellularCheck;
+        return *this;
+    };
+
+    /**
+     * @brief Maximum time to build an event when using concurrent gather. Added in 0.0.5.
+     *
+     * @param timeout Default is 30 seconds
+     * @return LocationFusionRK& 
+     *
+     * Measured from the start of building the event. If Wi-Fi or the tower are not done by then the event is published
+     * without them. The add to event handlers run on the worker thread and are expected to bound their own time.
+     * 
+     * A gather that timed out still owns the Wi-Fi list and tower objects until it finishes. The next event waits up
+     * to the timeout for it, and is published without Wi-Fi and tower if it is still running.
+     */
+    LocationFusionRK &withGatherTimeout(std::chrono::milliseconds timeout) { gatherTimeout = timeout; return *this; };
+
+    /**
+     * @brief Keep a track log in flash of fixes that could not be published, and replay them later. Added in 0.0.5.
+     * 
+     * @param capacity Maximum number of records to keep. Each uses 32 bytes of flash. Default is 1000.
+     * @param replayInterval Minimum time between loc-batch events while replaying. Default is 2 seconds.
+     * @return LocationFusionRK& 
+     * 
+     * Must be called before setup(). In periodic mode, while the cloud is not connected the add to event handlers still
+     * run at each publish time and the fix is written to the log. The fix from a failed publish is also written.
+     * When connected, pending records are sent as loc-batch events between regular publishes, up to
+     * MAX_BATCH_RECORDS per event. Only records with a fix (lck:1) are kept.
+     */
+    LocationFusionRK &withTrackLog(size_t capacity = 1000, std::chrono::milliseconds replayInterval = 2s) { 
+        trackLogCapacity = capacity; 
+        trackLogReplayInterval = replayInterval; 
+        return *this; 
+    };
+
+    /**
+     * @brief Get the track log throughput and loss counters. Added in 0.0.5.
+     * 
+     * @return const TrackLog::Stats& 
+     */
+    const TrackLog::Stats &getTrackLogStats() const { return trackLog.getStats(); };
+
     /**
      * @brief Adds a handler when the Particle function "cmd" is received.
      * 
@@ -401,7 +905,7 @@ public:
      * Works in all modes (manual, once, and periodic). Can be called when offline; it will only be calculated
      * when connected to the cloud (breathing cyan).
      */
-    void requestPublish() { manualPublishRequested = true; };
+    void requestPublish();
 
 
     /**
@@ -411,7 +915,108 @@ public:
      * 
      * This method is used for polling. The be called when the status changes, see withStatusHandler.
      */
-    Status getStatus() const { return status; };
+    Status getStatus() const { return status.load(); };
+
+    /**
+     * @brief Get the loc-enhanced round trip statistics. Added in 0.0.5.
+     * 
+     * @return const LocEnhancedStats& 
+     */
+    const LocEnhancedStats &getLocEnhancedStats() const { return locEnhancedStats; };
+
+    /**
+     * @brief Get the worker thread wakeup counts. Added in 0.0.5.
+     * 
+     * @return const WakeupStats& 
+     * 
+     * The worker thread blocks until the next scheduled action or an event, instead of running every millisecond.
+     */
+    const WakeupStats &getWakeupStats() const { return wakeupStats; };
+
+    /**
+     * @brief Get the oldest status transition that has not been taken yet. Added in 0.0.5.
+     * 
+     * @param transition Filled in with the transition
+     * @return true if a transition was returned, false if there are none
+     * 
+     * Every status change is queued, so by calling this until it returns false (typically from loop()) you see each
+     * transition exactly once and in order, even the short-lived publishSuccess. Unlike withStatusHandler(), nothing
+     * runs on the worker thread.
+     * 
+     * The queue holds STATUS_QUEUE_SIZE transitions. This must only be called from one thread.
+     */
+    bool takeStatusTransition(StatusTransition &transition);
+
+    /**
+     * @brief Number of status transitions discarded because the queue was full. Added in 0.0.5.
+     * 
+     * @return uint32_t 
+     */
+    uint32_t getStatusTransitionsDropped() const { return statusDropped.load(); };
+
+    /**
+     * @brief Get how close periodic publishes have been to their schedule. Added in 0.0.5.
+     *
+     * @return const PublishTiming& 
+     */
+    const PublishTiming &getPublishTiming() const { return publishTiming; };
+
+    /**
+     * @brief Get the time spent gathering each source for the most recent loc event. Added in 0.0.5.
+     *
+     * @return const GatherTiming& 
+     */
+    const GatherTiming &getGatherTiming() const { return gatherTiming; };
+
+    /**
+     * @brief Get the size and heap use of the most recent loc event. Added in 0.0.5.
+     *
+     * @return const BuildStats& 
+     */
+    const BuildStats &getBuildStats() const { return buildStats; };
+
+    /**
+     * @brief Get the Wi-Fi scan cache counters. Added in 0.0.5.
+     *
+     * @return const WiFiCacheStats& 
+     */
+    const WiFiCacheStats &getWiFiCacheStats() const { return wifiCacheStats; };
+
+    /**
+     * @brief Get the BSSID position cache counters. Added in 0.0.5.
+     *
+     * @return const PositionCacheStats& 
+     */
+    const PositionCacheStats &getBssidCacheStats() const { return bssidCacheStats; };
+
+    /**
+     * @brief Get the cell position cache counters. Added in 0.0.5.
+     *
+     * @return const PositionCacheStats& 
+     */
+    const PositionCacheStats &getCellCacheStats() const { return cellCacheStats; };
+
+    /**
+     * @brief Get the learned position of the current serving cell. Added in 0.0.5.
+     * 
+     * @param position Filled in with the position. hAcc is the accuracy of the cell, typically hundreds to thousands of meters.
+     * @return true if the serving cell could be read and is in the cell cache
+     * 
+     * Requires withCellCache(). Reads the serving cell from the modem, so it works while the cloud is disconnected
+     * as long as the modem is registered. Can be called from any thread, but not with the mutex locked.
+     */
+    bool getCellPosition(CachedPosition &position);
+
+    /**
+     * @brief Get the learned position of the most recently seen cell. Added in 0.0.5.
+     * 
+     * @param position Filled in with the position
+     * @return true if the cell cache is not empty
+     * 
+     * Requires withCellCache(). This does not use the modem, so right after setup() it returns where the device was
+     * before it was reset, from the cache saved in flash.
+     */
+    bool getLastCellPosition(CachedPosition &position);
 
     /**
      * @brief Locks the mutex that protects shared resources
@@ -436,6 +1041,17 @@ public:
 
 protected:
 
+    /**
+     * @brief Key for the cell cache. reserved is always 0 so there are no uninitialized bytes to hash.
+     */
+    struct CellKey {
+        uint16_t mcc; //!< Mobile country code
+        uint16_t mnc; //!< Mobile network code
+        uint16_t lac; //!< Location area code
+        uint16_t reserved; //!< 0
+        uint32_t cid; //!< Cell ID
+    };
+
     /**
      * @brief The constructor is protected because the class is a singleton
      * 
@@ -462,13 +1078,25 @@ protected:
      * @brief Update the status and call the status handlers. Used internally. Added in 0.0.3.
      * 
      * @param status 
+     * @param error System error code to report with the transition, 0 for none
      * 
-     * This only calls the status handlers if the status changes.
+     * This only calls the status handlers and queues a StatusTransition if the status changes.
      */
-    void updateStatus(Status status);
+    void updateStatus(Status status, int error = 0);
 
     /**
-     * @brief Worker thread function
+     * @brief Set the status, queue a StatusTransition, and call the status handlers, even if the status is unchanged
+     * 
+     * @param status 
+     * @param error System error code, 0 for none
+     * @param reqId req_id the status applies to
+     * 
+     * Used for loc-enhanced results, where two requests can complete back to back.
+     */
+    void reportStatus(Status status, int error, int reqId);
+
+    /**
+     * @brief Worker thread function
      * 
      * This method is called to perform operations in the worker thread.
      * 
@@ -476,6 +1104,34 @@ protected:
      */
     os_thread_return_t threadFunction(void);
 
+    /**
+     * @brief Why the worker thread was woken, passed through wakeQueue
+     */
+    enum class WakeReason : uint8_t {
+        cloudStatus = 1, //!< Cloud connected or disconnected
+        requestPublish, //!< requestPublish() was called
+        locEnhanced //!< loc-enhanced was received
+    };
+
+    /**
+     * @brief Wake the worker thread if it is waiting. Can be called from any thread.
+     * 
+     * @param reason 
+     */
+    void wake(WakeReason reason);
+
+    /**
+     * @brief Called from a state handler to wait until System.millis() reaches ms, or wake() is called
+     * 
+     * @param ms 
+     */
+    void waitUntil(uint64_t ms);
+
+    /**
+     * @brief System event handler for cloud_status. Wakes the worker thread.
+     */
+    static void cloudStatusHandlerStatic(system_event_t event, int param);
+
     /**
      * @brief Internal state handler for idle and not connected to the cloud
      * 
@@ -508,8 +1164,8 @@ protected:
      * @brief Internal state handler for waiting for the publish to complete
      * 
      * Exit conditions: 
-     * - When publish completes -> stateConnected if not receiving loc-enhanced on-device
-     *                          -> stateLocEnhancedWait if receiving loc-enhanced on-device
+     * - When publish completes -> stateConnected. If receiving loc-enhanced on-device the request is added to
+     *   the in-flight table and the status goes to locEnhancedWait first.
      * 
      * May set
      * - manualPublishRequested (set to false on success)
@@ -519,12 +1175,293 @@ protected:
     void statePublishWait();
 
     /**
-     * @brief Internal state handler for waiting for the loc-enhanced to be received
+     * @brief Internal state handler for publishing a loc-batch event from the track log
      * 
      * Exit conditions: 
-     * - When loc-enhanced is received or times out  -> stateConnected
+     * - When the publish is started -> stateReplayWait
+     * - If there is nothing to send -> stateConnected
+     */
+    void stateReplay();
+
+    /**
+     * @brief Internal state handler for waiting for a loc-batch publish to complete
+     * 
+     * Exit conditions: 
+     * - When the publish completes -> stateConnected. On success the records are acknowledged.
+     */
+    void stateReplayWait();
+
+    /**
+     * @brief Run the add to event handlers while offline and write the result to the track log
+     */
+    void recordOffline();
+
+    /**
+     * @brief Write the fix from an inner loc object to the track log, if it has one
+     * 
+     * @param locVariant 
+     */
+    void recordLoc(const Variant &locVariant);
+
+    /**
+     * @brief Add a published request to the in-flight table to wait for its loc-enhanced response
+     * 
+     * @param reqId 
+     * 
+     * If the table is full the oldest request is reported as locEnhancedFail.
+     */
+    void addInFlight(int reqId);
+
+    /**
+     * @brief Decide whether to request loc-enhanced for the loc event being built
+     * 
+     * @param gathered Sources included in the event
+     * @param hasFix The loc has a GNSS fix (lck:1)
+     * @return true to add loc_cb to the event
+     * 
+     * Returns false and sets cachedReplyPending if the BSSID cache can answer instead. Always false for CBOR events.
+     */
+    bool requestLocEnhanced(int gathered, bool hasFix);
+
+#if Wiring_WiFi
+    /**
+     * @brief Calculate a position from the access points in list that are in the BSSID cache
+     * 
+     * @param list Scan results
+     * @param position Set to the position. samples is set to the number of access points used.
+     * @return true if at least bssidCacheMinMatches access points were found and they agree
+     * 
+     * The position is the average of the cached positions weighted by signal strength and accuracy. The accuracy
+     * is the weighted accuracy plus the RMS distance of the access points from the result.
+     */
+    bool estimateFromBssidCache(const WAPList &list, CachedPosition &position);
+
+    /**
+     * @brief Store a loc-enhanced position against the BSSIDs that were sent. Called with the mutex locked.
+     * 
+     * @param bssids BSSIDs from the InFlightRequest
+     * @param numBssids Number of BSSIDs
+     * @param position Position from the response
+     */
+    void learnBssids(const uint8_t (*bssids)[6], size_t numBssids, const CachedPosition &position);
+
+    /**
+     * @brief Call the loc-enhanced handlers with the position from the BSSID cache, after the publish succeeds
+     */
+    void deliverCachedReply();
+
+#endif // Wiring_WiFi
+
+#if Wiring_Cellular
+    /**
+     * @brief Make a cell cache key from a serving tower
+     */
+    static CellKey cellKey(const ServingTower &tower);
+
+    /**
+     * @brief Store a loc-enhanced position against the cell that was sent. Called with the mutex locked.
      */
-    void stateLocEnhancedWait();
+    void learnCell(const CellKey &cell, const CachedPosition &position);
+#endif // Wiring_Cellular
+
+    /**
+     * @brief Save the position caches to flash if they have changed, at most every POSITION_CACHE_SAVE_INTERVAL_MS
+     */
+    void savePositionCaches();
+
+    /**
+     * @brief Average a new response into a cached position
+     * 
+     * @param entry Cached position to update
+     * @param isNew entry was just added to the cache, so it is replaced
+     * @param position Position from the response
+     */
+    static void averagePosition(CachedPosition &entry, bool isNew, const CachedPosition &position);
+
+    /**
+     * @brief Approximate distance between two positions in meters. Accurate for the short distances within a cell.
+     */
+    static double distanceMeters(const CachedPosition &a, const CachedPosition &b);
+
+    /**
+     * @brief Parse the position from a loc-enhanced response
+     * 
+     * @param eventData loc-enhanced response
+     * @param position Filled in with lat, lon, hAcc, and time
+     * @return true if the response has lat, lon, and h_acc
+     */
+    static bool parseLocEnhanced(const Variant &eventData, CachedPosition &position);
+
+    /**
+     * @brief Report in-flight requests that have received a response or timed out. Called from the worker thread.
+     * 
+     * @return uint64_t System.millis() of the earliest remaining timeout, or 0 if none are in flight
+     */
+    uint64_t serviceInFlight();
+
+    /**
+     * @brief Calculate the prefetch lead time from withPrefetch() and the prefetch lead time handlers
+     * 
+     * @return uint64_t Milliseconds
+     */
+    uint64_t prefetchLeadMs() const;
+
+    /**
+     * @brief Bit in the sources mask for gather() and startGather()
+     */
+    static const int GATHER_WIFI = 0x01;
+
+    /**
+     * @brief Bit in the sources mask for gather() and startGather()
+     */
+    static const int GATHER_TOWER = 0x02;
+
+    /**
+     * @brief Bit in the sources mask for gather() and startGather()
+     */
+    static const int GATHER_CELLS = 0x04;
+
+    /**
+     * @brief Scan Wi-Fi, read the serving tower, and/or read the neighbor cells into gatherWapList, gatherTower,
+     * and gatherCells
+     * 
+     * @param sources Mask of GATHER_WIFI, GATHER_TOWER, and GATHER_CELLS
+     * @param timing Receives wifiMs, towerMs, and cellsMs. gatherTiming on the worker thread, gatherThreadTiming
+     * on the gather thread.
+     * 
+     * Runs on the calling thread. Also uses wifiCellTower and the Wi-Fi cache.
+     */
+    void gather(int sources, GatherTiming &timing);
+
+    /**
+     * @brief Check whether a timed out gather request is still running
+     * 
+     * @param waitMs How long to wait for it to finish
+     * @return true if it is still running, so the worker thread must not use anything gather() uses
+     */
+    bool gatherThreadBusy(system_tick_t waitMs);
+
+    /**
+     * @brief Hand sources to the gather thread. gatherDoneSemaphore is given when they are done.
+     * 
+     * @param sources Mask of GATHER_WIFI, GATHER_TOWER, and GATHER_CELLS
+     * @return true if the gather thread accepted the request
+     * 
+     * Call only when gatherThreadBusy() is false.
+     */
+    bool startGather(int sources);
+
+    /**
+     * @brief Gather thread function. Waits for requests from startGather().
+     */
+    os_thread_return_t gatherThreadFunction(void);
+
+    /**
+     * @brief Add the gathered Wi-Fi and tower data to eventData
+     * 
+     * @param sources Mask of GATHER_WIFI, GATHER_TOWER, and GATHER_CELLS that completed
+     */
+    void addGatheredToEvent(int sources);
+
+#if Wiring_Cellular
+    /**
+     * @brief true if the serving tower in the event should come from gatherCells, which includes signal metrics,
+     * rather than gatherTower
+     * 
+     * @param sources Mask of GATHER_TOWER and GATHER_CELLS that completed
+     */
+    bool servingFromCells(int sources) const;
+#endif // Wiring_Cellular
+
+    /**
+     * @brief Wait for the gather thread if it is running
+     * 
+     * @param gatherAsync true if startGather() was called
+     * @param sources Sources passed to startGather()
+     * @param gatherStart System.millis() when the build started
+     * @return int Mask of sources that completed
+     */
+    int finishGather(bool gatherAsync, int sources, uint64_t gatherStart);
+
+    /**
+     * @brief Build the loc event as a Variant in eventData, for withAddToEventHandler() handlers
+     */
+    int buildVariantEvent(bool gatherAsync, int sources, int gathered, uint64_t gatherStart);
+
+    /**
+     * @brief Write the loc event directly into streamBuffer, for withAddToEventWriterHandler() handlers
+     * 
+     * @return size_t Length of the event data
+     */
+    size_t buildStreamingEvent(bool gatherAsync, int sources, int gathered, uint64_t gatherStart);
+
+    /**
+     * @brief Call the writer handlers and add what they write to Variant objects
+     * 
+     * @param eventData Outer event object
+     * @param locVariant Inner loc object, replaced by what the handlers wrote
+     * 
+     * Used when the event is built as a Variant, for CBOR encoding and the track log.
+     */
+    void addWriterHandlersToVariant(Variant &eventData, Variant &locVariant);
+
+    /**
+     * @brief Encode eventData as CBOR into streamBuffer
+     * 
+     * @return size_t Length of the encoded event, 0 if it did not fit
+     */
+    size_t encodeCborEvent();
+
+    /**
+     * @brief Recursively encode a Variant as CBOR
+     * 
+     * @param value Value to encode
+     * @param writer 
+     * @param key Key of the value if it is in a map, used for fixed-point values and BSSIDs. May be null.
+     */
+    static void variantToCbor(const Variant &value, LocationCbor::Writer &writer, const char *key);
+
+    /**
+     * @brief Parse a BSSID string in the form aa:bb:cc:dd:ee:ff
+     * 
+     * @param str String to parse
+     * @param bssid Filled in with 6 bytes
+     * @return true if valid
+     */
+    static bool parseBssid(const char *str, uint8_t *bssid);
+
+    /**
+     * @brief Call the writer handlers, adding "lck":0 if none of them write into the inner loc object
+     * 
+     * @return true if the handlers wrote "lck":1 (a GNSS fix)
+     */
+    bool writeLocObject(JSONBufferWriter &writer);
+
+    /**
+     * @brief Write the gathered Wi-Fi and tower data, leaving room for the rest of the event
+     * 
+     * @param writer 
+     * @param sources Mask of GATHER_WIFI, GATHER_TOWER, and GATHER_CELLS that completed
+     * @param reserve Bytes to leave free for the end of the event
+     */
+    void writeGathered(JSONBufferWriter &writer, int sources, size_t reserve);
+
+#if Wiring_WiFi
+    /**
+     * @brief Scan for Wi-Fi access points, or copy the cached results if the cache is enabled and valid
+     * 
+     * @param list List to fill in
+     * @param cellReadOk true if the serving tower was read (into wifiCellTower) just before this call. Ignored on Wi-Fi only devices.
+     */
+    void scanWiFi(WAPList &list, bool cellReadOk);
+#endif // Wiring_WiFi
+
+    /**
+     * @brief Call the prefetch handlers and scan Wi-Fi ahead of the scheduled publish
+     * 
+     * Called from stateConnected. Sets prefetchStarted.
+     */
+    void startPrefetch();
 
 
     /**
@@ -606,14 +1543,101 @@ protected:
     std::chrono::milliseconds locEnhancedTimeout = 1min;
 
     /**
-     * @brief Used to handle loc-enhanced state changes
+     * @brief Maximum records in one loc-batch event. Fewer are sent if the event would exceed the maximum event size.
+     */
+    static const size_t MAX_BATCH_RECORDS = 16;
+
+    /**
+     * @brief Set by withTrackLog(), 0 if the track log is disabled
+     */
+    size_t trackLogCapacity = 0;
+
+    /**
+     * @brief Set by withTrackLog()
+     */
+    std::chrono::milliseconds trackLogReplayInterval = 2s;
+
+    /**
+     * @brief Track log, opened in setup() if trackLogCapacity is set
+     */
+    TrackLog trackLog;
+
+    /**
+     * @brief true if trackLog was opened successfully
+     */
+    bool trackLogReady = false;
+
+    /**
+     * @brief Do not start another loc-batch publish before this System.millis() value
      */
-    bool locEnhancedReceived = false;
+    uint64_t nextReplayMs = 0;
 
     /**
-     * @brief Used for calculating the locEnhancedTimeout
+     * @brief Sequence number of the last record in the loc-batch being published
      */
-    unsigned long stateTime = 0;
+    uint32_t replayLastSeq = 0;
+
+    /**
+     * @brief A loc publish waiting for its loc-enhanced response
+     */
+    struct InFlightRequest {
+        int reqId; //!< req_id of the publish, 0 if this entry is free
+        uint64_t publishedMs; //!< System.millis() when the publish succeeded
+        uint64_t receivedMs; //!< System.millis() when the response arrived, 0 if not yet
+#if Wiring_WiFi
+        uint8_t numBssids; //!< Access points sent in the publish, when the BSSID cache is enabled
+        uint8_t bssids[WAPList::CAPACITY][6]; //!< BSSIDs to learn the response's position for
+#endif // Wiring_WiFi
+#if Wiring_Cellular
+        bool hasCell; //!< The serving cell was sent in the publish, when the cell cache is enabled
+        CellKey cell; //!< Cell to learn the response's position for
+#endif // Wiring_Cellular
+    };
+
+    /**
+     * @brief Requests waiting for loc-enhanced. Protected by mutex because responses arrive on the system thread.
+     */
+    InFlightRequest inFlight[MAX_IN_FLIGHT] = {};
+
+    /**
+     * @brief loc-enhanced round trip statistics
+     */
+    LocEnhancedStats locEnhancedStats = {};
+
+    /**
+     * @brief Sum of round trip times, used to calculate locEnhancedStats.meanRttMs
+     */
+    uint64_t locEnhancedRttTotalMs = 0;
+
+    /**
+     * @brief Longest time the worker thread blocks, even with nothing scheduled, in case an event was missed
+     */
+    static const system_tick_t MAX_WAIT_MS = 60000;
+
+    /**
+     * @brief How often to check the CloudEvent while waiting for a publish to complete
+     */
+    static const system_tick_t PUBLISH_WAIT_POLL_MS = 50;
+
+    /**
+     * @brief Wakes the worker thread. Created in setup().
+     */
+    os_queue_t wakeQueue = 0;
+
+    /**
+     * @brief Set by a state handler to block for this many milliseconds after it returns. 0 runs the next state immediately.
+     */
+    system_tick_t waitMs = 0;
+
+    /**
+     * @brief System.millis() when setup() was called, for WakeupStats::idleWakeupsPerHour
+     */
+    uint64_t wakeupStartMs = 0;
+
+    /**
+     * @brief Worker thread wakeup counts
+     */
+    WakeupStats wakeupStats = {};
 
     /**
      * @brief State handler. Run from the worker thread.
@@ -627,6 +1651,85 @@ protected:
      */
     bool addWiFi = false;
 
+    size_t wifiMaxAccessPoints = 0; //!< Set by withWiFiFilter(), 0 for WAPList::CAPACITY
+    int wifiMinRssi = -100; //!< Set by withWiFiFilter()
+    bool wifiDropHotspots = true; //!< Set by withWiFiFilter()
+
+    std::chrono::milliseconds wifiCacheMaxAge = 0ms; //!< Set by withWiFiCache(), 0 if disabled
+    WiFiCacheStats wifiCacheStats = {}; //!< Returned by getWiFiCacheStats()
+    bool wifiCacheCellReadOk = false; //!< wifiCellTower was read for the event being built
+#if Wiring_WiFi
+    WAPList wifiCacheList; //!< Results of the last real scan
+    uint64_t wifiCacheTimeMs = 0; //!< System.millis() of the last real scan, 0 if wifiCacheList is not valid
+#endif // Wiring_WiFi
+
+    size_t bssidCacheMinMatches = 0; //!< Set by withBssidCache(), 0 if disabled
+    unsigned int bssidCacheMaxLearnAccuracy = 150; //!< Set by withBssidCache()
+    PositionCacheStats bssidCacheStats = {}; //!< Returned by getBssidCacheStats()
+    std::function<bool(const uint8_t *bssid, CachedPosition &position)> bssidLookup; //!< Set by withBssidLookup()
+#if Wiring_WiFi
+    /**
+     * @brief Key for the BSSID cache
+     */
+    struct BssidKey {
+        uint8_t bssid[6];
+    };
+
+    /**
+     * @brief BSSID cache type. 256 slots hold 192 access points in 7 Kbytes of RAM.
+     */
+    typedef LocationCache<BssidKey, CachedPosition, 256> BssidCache;
+
+    /**
+     * @brief Access point positions, allocated in setup() if withBssidCache() was used. Protected by mutex because
+     * responses are learned on the system thread.
+     */
+    BssidCache *bssidCache = nullptr;
+
+    bool locEnhancedWiFi = false; //!< The loc event being published includes Wi-Fi access points
+    bool cachedReplyPending = false; //!< The loc event being published was answered from the cache
+    CachedPosition cachedReply = {}; //!< Position for the loc event being published, valid if cachedReplyPending
+#endif // Wiring_WiFi
+
+    bool cellCacheEnabled = false; //!< Set by withCellCache()
+    PositionCacheStats cellCacheStats = {}; //!< Returned by getCellCacheStats()
+#if Wiring_Cellular
+    /**
+     * @brief Cell cache type. 256 slots hold 192 cells in 8 Kbytes of RAM.
+     */
+    typedef LocationCache<CellKey, CachedPosition, 256> CellCache;
+
+    /**
+     * @brief Cell positions, allocated in setup() if withCellCache() was used. Protected by mutex because
+     * responses are learned on the system thread.
+     */
+    CellCache *cellCache = nullptr;
+
+    bool locEnhancedTower = false; //!< The loc event being published includes the serving tower
+#endif // Wiring_Cellular
+
+    uint64_t nextPositionCacheSaveMs = 0; //!< Do not save the position caches to flash before this System.millis() value
+
+    /**
+     * @brief Minimum time between saves of a changed position cache, to limit flash wear
+     */
+    static const uint64_t POSITION_CACHE_SAVE_INTERVAL_MS = 5 * 60 * 1000;
+
+    /**
+     * @brief Cached access points further than this many meters (RMS) from their average are not used
+     */
+    static const unsigned int BSSID_CACHE_MAX_SPREAD = 500;
+
+    /**
+     * @brief Position cache file magic number, "LFPC"
+     */
+    static const uint32_t POSITION_CACHE_MAGIC = 0x4350464c;
+
+#if Wiring_Cellular && Wiring_WiFi
+    ServingTower wifiCellTower; //!< Serving cell read just before the Wi-Fi scan
+    ServingTower wifiCacheTower; //!< Serving cell at the time of the last real scan
+#endif // Wiring_Cellular && Wiring_WiFi
+
     /**
      * @brief When building a location publish, add serving tower information
      * 
@@ -634,6 +1737,11 @@ protected:
      */
     bool addTower = false;
 
+    /**
+     * @brief Add serving cell metrics and neighbor cells to the towers array. Set using withAddNeighborCells().
+     */
+    bool addNeighborCells = false;
+
     /**
      * @brief Vector of handlers to add more information to the location event.
      * 
@@ -641,6 +1749,13 @@ protected:
      */
     std::vector<std::function<void(Variant &eventData, Variant &locVariant)>> addToEventHandlers;
 
+    /**
+     * @brief Handlers that write directly into the event
+     * 
+     * Add using withAddToEventWriterHandler(). Only used if addToEventHandlers is empty.
+     */
+    std::vector<std::function<void(JSONWriter &writer, bool inLoc)>> addToEventWriterHandlers;
+
     /**
      * @brief Add a function handler for "cmd"
      * 
@@ -690,6 +1805,31 @@ protected:
      */
     Variant eventData;
 
+    /**
+     * @brief Size of streamBuffer, the largest event data that can be published
+     */
+    static const size_t STREAM_BUFFER_SIZE = particle::protocol::MAX_EVENT_DATA_LENGTH;
+
+    /**
+     * @brief Bytes a Wi-Fi access point takes in the event: {"bssid":"00:00:00:00:00:00","ch":11,"str":-100},
+     */
+    static const size_t WAP_JSON_SIZE = 48;
+
+    /**
+     * @brief Most bytes a neighbor cell takes in the event: {"rat":"gsm","mcc":999,"mnc":999,"lac":65535,"cid":65535,"nid":63,"ch":1023,"str":-110},
+     */
+    static const size_t CELL_JSON_SIZE = 88;
+
+    /**
+     * @brief Buffer the streaming loc event is written to. Allocated on first use.
+     */
+    char *streamBuffer = nullptr;
+
+    /**
+     * @brief Set in stateBuildPublish()
+     */
+    BuildStats buildStats = {};
+
     /**
      * @brief When to publish next in periodic mode. Compare to System.millis().
      * 
@@ -697,15 +1837,168 @@ protected:
      */
     uint64_t nextPublishMs = 0;
 
+    /**
+     * @brief The nextPublishMs value the current publish was scheduled for, 0 for manual or unscheduled publishes
+     */
+    uint64_t scheduledPublishMs = 0;
+
+    /**
+     * @brief Set by withPrefetch() or withPrefetchHandler()
+     */
+    bool prefetchEnabled = false;
+
+    /**
+     * @brief Minimum prefetch lead time set by withPrefetch()
+     */
+    std::chrono::milliseconds prefetchLeadTime = 0ms;
+
+    /**
+     * @brief This class is used internally for withPrefetchHandler
+     */
+    struct PrefetchHandler {
+        std::function<void()> handler; //!< Starts the source
+        std::function<std::chrono::milliseconds()> leadTimeHandler; //!< Lead time the source needs, may be empty
+    };
+
+    /**
+     * @brief Prefetch handlers added with withPrefetchHandler()
+     */
+    std::vector<PrefetchHandler> prefetchHandlers;
+
+    /**
+     * @brief true from when prefetch starts until the event is built
+     */
+    bool prefetchStarted = false;
+
+#if Wiring_WiFi
+    /**
+     * @brief Wi-Fi scan done during prefetch, used in place of a new scan when the event is built
+     */
+    WAPList prefetchWapList;
+
+    /**
+     * @brief true if prefetchWapList holds a scan that has not been used yet
+     */
+    bool prefetchWapValid = false;
+#endif // Wiring_WiFi
+
+    /**
+     * @brief Set by withConcurrentGather(). Must be set before setup().
+     */
+    bool concurrentGather = false;
+
+    /**
+     * @brief Set by withCborEncoding()
+     */
+    bool cborEncoding = false;
+
+    /**
+     * @brief Set by withConcurrentGather(), may be empty
+     */
+    std::function<bool()> concurrentCellularCheck;
+
+    /**
+     * @brief Set by withGatherTimeout()
+     */
+    std::chrono::milliseconds gatherTimeout = 30s;
+
+    /**
+     * @brief Gather thread, only created by setup() if concurrentGather is set
+     */
+    Thread *gatherThread = 0;
+
+    /**
+     * @brief Requests (a sources mask) from startGather() to the gather thread
+     */
+    os_queue_t gatherQueue = 0;
+
+    /**
+     * @brief Given by the gather thread when a request is complete
+     */
+    os_semaphore_t gatherDoneSemaphore = 0;
+
+    /**
+     * @brief true if a gather request timed out and the gather thread has not yet given gatherDoneSemaphore
+     * 
+     * From startGather() until the semaphore is given, the gather thread owns gatherWapList, gatherTower,
+     * gatherCells, gatherThreadTiming, wifiCellTower, and the Wi-Fi cache. The worker thread does not touch them,
+     * including in startPrefetch(), and publishes without Wi-Fi, tower, and cells while gatherThreadBusy() is true.
+     */
+    bool gatherPending = false;
+
+    /**
+     * @brief Gather times measured by the gather thread, copied to gatherTiming by finishGather()
+     */
+    GatherTiming gatherThreadTiming = {};
+
+#if Wiring_WiFi
+    /**
+     * @brief Wi-Fi access points for the event being built. Written by the gather thread while a request is active.
+     */
+    WAPList gatherWapList;
+#endif // Wiring_WiFi
+
+#if Wiring_Cellular
+    /**
+     * @brief Serving tower for the event being built. Written by the gather thread while a request is active.
+     */
+    ServingTower gatherTower;
+
+    /**
+     * @brief Neighbor cells for the event being built. Written by the gather thread while a request is active.
+     */
+    CellList gatherCells;
+#endif // Wiring_Cellular
+
+    /**
+     * @brief Per-source timing of the most recent event build
+     */
+    GatherTiming gatherTiming = {};
+
+    /**
+     * @brief Publish lateness statistics
+     */
+    PublishTiming publishTiming = {};
+
+    /**
+     * @brief Sum of lateness, used to calculate publishTiming.meanLateMs
+     */
+    uint64_t publishLateTotalMs = 0;
+
     /**
      * @brief loc events contain a request ID, this is the next one to use
      */
     int locRequestId = 1;
 
     /**
-     * @brief Current status pof the library
+     * @brief req_id of the loc event being built or most recently published
+     */
+    int currentReqId = 0;
+
+    /**
+     * @brief Current status pof the library. Written by the worker thread, may be read from any thread.
+     */
+    std::atomic<Status> status{Status::idle};
+
+    /**
+     * @brief Single producer (worker thread), single consumer ring of status transitions
+     */
+    StatusTransition statusRing[STATUS_QUEUE_SIZE];
+
+    /**
+     * @brief Count of transitions written to statusRing. Only written by the worker thread.
+     */
+    std::atomic<uint32_t> statusHead{0};
+
+    /**
+     * @brief Count of transitions taken from statusRing. Only written by the consumer.
+     */
+    std::atomic<uint32_t> statusTail{0};
+
+    /**
+     * @brief Transitions discarded because statusRing was full
      */
-    Status status = Status::idle;
+    std::atomic<uint32_t> statusDropped{0};
 
     /**
      * @brief Handlers to call when the status changes
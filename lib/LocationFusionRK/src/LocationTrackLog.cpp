@@ -0,0 +1,178 @@
+#include "LocationTrackLog.h"
+#include "LocationCache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int LocationTrackLog::begin(const char *dir, size_t capacity) {
+    static_assert(sizeof(Record) == 32, "LocationTrackLog::Record must be 32 bytes");
+
+    this->capacity = capacity;
+    stats = {};
+
+    mkdir(dir, 0777);
+
+    String path = String::format("%s/track.bin", dir);
+    ackPath = String::format("%s/track.ack", dir);
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        return SYSTEM_ERROR_FILE;
+    }
+
+    // Recover the newest sequence number. Records with a bad CRC are from an interrupted write.
+    uint32_t lastSeq = 0;
+    Record record;
+    lseek(fd, 0, SEEK_SET);
+    for(size_t ii = 0; ii < capacity; ii++) {
+        if (::read(fd, &record, sizeof(Record)) != sizeof(Record)) {
+            break;
+        }
+        if (record.seq == 0 || record.crc != crc32(&record, offsetof(Record, crc))) {
+            continue;
+        }
+        if (record.seq % capacity != ii) {
+            stats.recordsCorrupt++;
+            continue;
+        }
+        if (record.seq > lastSeq) {
+            lastSeq = record.seq;
+        }
+    }
+    nextSeq = lastSeq + 1;
+
+    struct {
+        uint32_t seq;
+        uint32_t crc;
+    } ackData;
+    ackSeq = 0;
+    int ackFd = open(ackPath.c_str(), O_RDONLY);
+    if (ackFd >= 0) {
+        if (::read(ackFd, &ackData, sizeof(ackData)) == sizeof(ackData) && ackData.crc == crc32(&ackData.seq, sizeof(ackData.seq))) {
+            ackSeq = ackData.seq;
+        }
+        close(ackFd);
+    }
+
+    // Records older than one capacity have been overwritten, and an ack past the end means the log was lost
+    if (ackSeq > lastSeq) {
+        ackSeq = lastSeq;
+    }
+    if (lastSeq - ackSeq > capacity) {
+        ackSeq = lastSeq - capacity;
+    }
+
+    return SYSTEM_ERROR_NONE;
+}
+
+int LocationTrackLog::append(Record &record) {
+    if (fd < 0) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+    uint64_t start = System.millis();
+
+    record.seq = nextSeq;
+    record.reserved = 0;
+    record.crc = crc32(&record, offsetof(Record, crc));
+
+    if (lseek(fd, (off_t)((record.seq % capacity) * sizeof(Record)), SEEK_SET) < 0 || 
+        write(fd, &record, sizeof(Record)) != sizeof(Record)) {
+        return SYSTEM_ERROR_FILE;
+    }
+    fsync(fd);
+    nextSeq++;
+
+    if (pending() > capacity) {
+        // Wrapped onto a record that was never sent
+        ackSeq = nextSeq - 1 - capacity;
+        stats.recordsOverwritten++;
+    }
+
+    stats.recordsWritten++;
+    stats.writeMs += (uint32_t)(System.millis() - start);
+    updateRates();
+
+    return SYSTEM_ERROR_NONE;
+}
+
+size_t LocationTrackLog::read(Record *records, size_t maxRecords) {
+    uint64_t start = System.millis();
+    size_t count = 0;
+
+    for(uint32_t seq = ackSeq + 1; seq < nextSeq && count < maxRecords; seq++) {
+        if (readSlot(seq, records[count]) == SYSTEM_ERROR_NONE) {
+            count++;
+        }
+        else {
+            stats.recordsCorrupt++;
+            if (count == 0) {
+                // Skip it so a bad record does not stall the replay
+                ackSeq = seq;
+            }
+        }
+    }
+
+    stats.replayMs += (uint32_t)(System.millis() - start);
+    return count;
+}
+
+int LocationTrackLog::ack(uint32_t seq) {
+    if (seq <= ackSeq || seq >= nextSeq) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    uint64_t start = System.millis();
+
+    struct {
+        uint32_t seq;
+        uint32_t crc;
+    } ackData;
+    ackData.seq = seq;
+    ackData.crc = crc32(&ackData.seq, sizeof(ackData.seq));
+
+    // Write a new file and rename it over the old one so a reset leaves either the old or new ack
+    String tempPath = String::format("%s.tmp", ackPath.c_str());
+    int ackFd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (ackFd < 0) {
+        return SYSTEM_ERROR_FILE;
+    }
+    bool written = (write(ackFd, &ackData, sizeof(ackData)) == sizeof(ackData));
+    fsync(ackFd);
+    close(ackFd);
+    if (!written || rename(tempPath.c_str(), ackPath.c_str()) != 0) {
+        return SYSTEM_ERROR_FILE;
+    }
+
+    stats.recordsReplayed += seq - ackSeq;
+    ackSeq = seq;
+
+    stats.replayMs += (uint32_t)(System.millis() - start);
+    updateRates();
+
+    return SYSTEM_ERROR_NONE;
+}
+
+int LocationTrackLog::readSlot(uint32_t seq, Record &record) {
+    if (lseek(fd, (off_t)((seq % capacity) * sizeof(Record)), SEEK_SET) < 0 || 
+        ::read(fd, &record, sizeof(Record)) != sizeof(Record)) {
+        return SYSTEM_ERROR_FILE;
+    }
+    if (record.seq != seq || record.crc != crc32(&record, offsetof(Record, crc))) {
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
+void LocationTrackLog::updateRates() {
+    if (stats.writeMs) {
+        stats.writeRecordsPerSec = (uint32_t)((uint64_t)stats.recordsWritten * 1000 / stats.writeMs);
+    }
+    if (stats.replayMs) {
+        stats.replayRecordsPerSec = (uint32_t)((uint64_t)stats.recordsReplayed * 1000 / stats.replayMs);
+    }
+}
+
+// [static]
+uint32_t LocationTrackLog::crc32(const void *data, size_t len) {
+    return LocationCacheBase::crc32(data, len);
+}
@@ -0,0 +1,112 @@
+#ifndef __LOCATIONTRACKLOG_H
+#define __LOCATIONTRACKLOG_H
+
+#include "Particle.h"
+
+// Repository: https://github.com/rickkas7/LocationFusionRK
+// License: MIT
+
+/**
+ * @brief Append-only log of location fixes in a fixed-size file on the flash file system. Added in 0.0.5.
+ * 
+ * The file holds a fixed number of 32-byte records and wraps, overwriting the oldest, so flash use is bounded.
+ * Each record has a sequence number and CRC, so a record torn by a reset is ignored when the log is reopened.
+ * The sequence number of the last record sent to the cloud is kept in a separate file that is replaced
+ * atomically with rename().
+ *
+ * Apart from POSIX file functions it only uses String::format() and System.millis(), so it can also be tested on a computer.
+ */
+class LocationTrackLog {
+public:
+    /**
+     * @brief One fix as stored in flash
+     */
+    struct Record {
+        uint32_t seq; //!< Sequence number, assigned by append(). 0 is never used.
+        uint32_t time; //!< Unix time of the fix
+        int32_t lat; //!< Latitude in degrees * 10^7
+        int32_t lon; //!< Longitude in degrees * 10^7
+        int32_t alt; //!< Altitude in centimeters
+        uint16_t hAcc; //!< Horizontal accuracy in decimeters, 0 if unknown
+        uint16_t spd; //!< Speed in cm/sec
+        uint16_t hd; //!< Heading in hundredths of a degree
+        uint16_t reserved; //!< Reserved, written as 0
+        uint32_t crc; //!< CRC-32 of the preceding fields, assigned by append()
+    };
+
+    /**
+     * @brief Throughput and loss counters
+     */
+    struct Stats {
+        uint32_t recordsWritten; //!< Records appended since begin()
+        uint32_t recordsReplayed; //!< Records acknowledged since begin()
+        uint32_t recordsOverwritten; //!< Records overwritten before they were replayed
+        uint32_t recordsCorrupt; //!< Records skipped because of a bad CRC or sequence number
+        uint32_t writeMs; //!< Total time spent in append(), including fsync()
+        uint32_t replayMs; //!< Total time spent in read() and ack()
+        uint32_t writeRecordsPerSec; //!< recordsWritten / writeMs
+        uint32_t replayRecordsPerSec; //!< recordsReplayed / replayMs
+    };
+
+    /**
+     * @brief Open or create the log and recover its position
+     * 
+     * @param dir Directory to store the log in. Created if necessary.
+     * @param capacity Number of records. The file is capacity * 32 bytes.
+     * @return int SYSTEM_ERROR_NONE (0) or an error code
+     */
+    int begin(const char *dir, size_t capacity);
+
+    /**
+     * @brief Append a record. The seq and crc fields are set by this method.
+     * 
+     * @param record 
+     * @return int SYSTEM_ERROR_NONE (0) or an error code
+     */
+    int append(Record &record);
+
+    /**
+     * @brief Number of records not yet acknowledged
+     */
+    size_t pending() const { return (size_t)(nextSeq - 1 - ackSeq); };
+
+    /**
+     * @brief Read the oldest records that have not been acknowledged
+     * 
+     * @param records Array to fill
+     * @param maxRecords Size of the array
+     * @return size_t Number of records read
+     */
+    size_t read(Record *records, size_t maxRecords);
+
+    /**
+     * @brief Mark records up to and including seq as sent
+     * 
+     * @param seq 
+     * @return int SYSTEM_ERROR_NONE (0) or an error code
+     */
+    int ack(uint32_t seq);
+
+    /**
+     * @brief Get the throughput and loss counters
+     */
+    const Stats &getStats() const { return stats; };
+
+    /**
+     * @brief CRC-32 (IEEE 802.3)
+     */
+    static uint32_t crc32(const void *data, size_t len);
+
+protected:
+    int readSlot(uint32_t seq, Record &record);
+    void updateRates();
+
+    int fd = -1; //!< Open file descriptor for the record file
+    String ackPath; //!< Path to the ack file
+    size_t capacity = 0; //!< Number of record slots in the file
+    uint32_t nextSeq = 1; //!< Sequence number for the next append()
+    uint32_t ackSeq = 0; //!< Last acknowledged sequence number
+    Stats stats = {};
+};
+
+#endif /* __LOCATIONTRACKLOG_H */
@@ -59,12 +59,42 @@ unsigned long stateTime = 0;
 const std::chrono::milliseconds retryPeriod = 30s;
 
 
+void trackingCallback(const QuectelGnssRK::LocationPoint& point) {
+    static unsigned long lastPublishMs = 0;
+
+    Log.info("%s", point.toStringSimple().c_str());
+
+    // Skip this fix if the previous event is still being sent
+    if (publishLocation && Particle.connected() && state != State::PUBLISH_WAIT) {
+        if (millis() - lastPublishMs >= publishPeriod.count()) {
+            lastPublishMs = millis();
+
+            Variant eventData;
+            QuectelGnssRK::instance().getLocationEventVariant(eventData, &point);
+
+            Log.info("Publishing loc event...");
+            event.name("loc");
+            event.data(eventData);
+            Particle.publish(event);
+
+            state = State::PUBLISH_WAIT;
+        }
+    }
+}
+
 void getLocationCallback(QuectelGnssRK::LocationResults results, const QuectelGnssRK::LocationPoint& point) {
     
     Log.info("async callback returned %d %s", (int)results, point.toStringSimple().c_str());
     
     if (point.fix) {
         Particle.connect();
+
+        // On the EG91 the GNSS can stay on while cellular is in use, so track continuously. On the BG95
+        // this returns Unsupported and the IDLE state falls back to periodic acquisitions instead.
+        if (QuectelGnssRK::LocationResults::Acquiring == QuectelGnssRK::instance().startTracking(1000)) {
+            Log.info("continuous tracking started");
+            QuectelGnssRK::instance().subscribe(trackingCallback, (unsigned int)(checkPeriod.count() / 1000));
+        }
         state = State::IDLE;
     }
     else {
@@ -90,33 +120,15 @@ void loop() {
         }
     }
     else 
-    if (state == State::IDLE) {
+    if (state == State::IDLE && !QuectelGnssRK::instance().isTracking()) {
         static unsigned long lastCheckMs = 0;
-        static unsigned long lastPublishMs = 0;
 
         if (millis() - lastCheckMs >= checkPeriod.count()) {
             lastCheckMs = millis();
 
             QuectelGnssRK::instance().getLocationAsync([](QuectelGnssRK::LocationResults results, const QuectelGnssRK::LocationPoint& point) {
-
                 if (point.fix) {
-                    Log.info("%s", point.toStringSimple().c_str());
-                    
-                    if (publishLocation && Particle.connected()) {
-                        if (millis() - lastPublishMs >= publishPeriod.count()) {
-                            lastPublishMs = millis();
-                            
-                            Variant eventData;
-                            QuectelGnssRK::instance().getLocationEventVariant(eventData);
-                            
-                            Log.info("Publishing loc event...");
-                            event.name("loc");
-                            event.data(eventData);
-                            Particle.publish(event);
-
-                            state = State::PUBLISH_WAIT;
-                        }
-                    }
+                    trackingCallback(point);
                 }
                 else {
                     Log.info("lost fix");
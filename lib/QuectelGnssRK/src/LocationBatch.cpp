@@ -0,0 +1,145 @@
+#include "LocationBatch.h"
+
+#include <string.h>
+
+static const char _base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+LocationBatch::Encoder::Encoder(uint8_t *buf, size_t bufSize) : buf(buf), bufSize(bufSize) {
+    reset();
+}
+
+void LocationBatch::Encoder::reset() {
+    offset = 0;
+    numFixes = 0;
+    prev = {};
+    if (bufSize > 0) {
+        buf[offset++] = FORMAT_VERSION;
+    }
+}
+
+bool LocationBatch::Encoder::add(const Fix &fix) {
+    // Encode to a temporary buffer first so a fix that does not fit leaves the batch intact
+    uint8_t temp[MAX_FIX_SIZE];
+    size_t len = 0;
+
+    len += writeVarint(zigzagEncode((int64_t)fix.time - (int64_t)prev.time), &temp[len]);
+    len += writeVarint(zigzagEncode((int64_t)fix.lat - (int64_t)prev.lat), &temp[len]);
+    len += writeVarint(zigzagEncode((int64_t)fix.lon - (int64_t)prev.lon), &temp[len]);
+    len += writeVarint(zigzagEncode((int64_t)fix.alt - (int64_t)prev.alt), &temp[len]);
+
+    if (offset == 0 || offset + len > bufSize) {
+        return false;
+    }
+    memcpy(&buf[offset], temp, len);
+    offset += len;
+    numFixes++;
+    prev = fix;
+
+    return true;
+}
+
+LocationBatch::Decoder::Decoder(const uint8_t *buf, size_t bufSize) : buf(buf), bufSize(bufSize) {
+    if (bufSize < 1 || buf[0] != FORMAT_VERSION) {
+        valid = false;
+    }
+    offset = 1;
+}
+
+bool LocationBatch::Decoder::next(Fix &fix) {
+    if (!valid || offset >= bufSize) {
+        return false;
+    }
+
+    uint64_t values[4];
+    for(size_t ii = 0; ii < 4; ii++) {
+        if (!readVarint(values[ii])) {
+            valid = false;
+            return false;
+        }
+    }
+
+    // Truncating back to 32 bits undoes the 64-bit difference exactly
+    fix.time = (uint32_t)((int64_t)prev.time + zigzagDecode(values[0]));
+    fix.lat = (int32_t)((int64_t)prev.lat + zigzagDecode(values[1]));
+    fix.lon = (int32_t)((int64_t)prev.lon + zigzagDecode(values[2]));
+    fix.alt = (int32_t)((int64_t)prev.alt + zigzagDecode(values[3]));
+    prev = fix;
+
+    return true;
+}
+
+bool LocationBatch::Decoder::readVarint(uint64_t &value) {
+    value = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        if (offset >= bufSize) {
+            return false;
+        }
+        uint8_t b = buf[offset++];
+        value |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// [static]
+size_t LocationBatch::writeVarint(uint64_t value, uint8_t *buf) {
+    size_t len = 0;
+    while(value >= 0x80) {
+        buf[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (uint8_t)value;
+    return len;
+}
+
+// [static]
+size_t LocationBatch::base64Encode(const uint8_t *src, size_t srcLen, char *dst, size_t dstSize) {
+    if (dstSize < base64Size(srcLen)) {
+        return 0;
+    }
+
+    size_t len = 0;
+    for(size_t ii = 0; ii < srcLen; ii += 3) {
+        uint32_t n = (uint32_t)src[ii] << 16;
+        if (ii + 1 < srcLen) {
+            n |= (uint32_t)src[ii + 1] << 8;
+        }
+        if (ii + 2 < srcLen) {
+            n |= src[ii + 2];
+        }
+        dst[len++] = _base64Chars[(n >> 18) & 0x3f];
+        dst[len++] = _base64Chars[(n >> 12) & 0x3f];
+        dst[len++] = (ii + 1 < srcLen) ? _base64Chars[(n >> 6) & 0x3f] : '=';
+        dst[len++] = (ii + 2 < srcLen) ? _base64Chars[n & 0x3f] : '=';
+    }
+    dst[len] = 0;
+
+    return len;
+}
+
+// [static]
+size_t LocationBatch::base64Decode(const char *src, size_t srcLen, uint8_t *dst, size_t dstSize) {
+    size_t len = 0;
+    uint32_t n = 0;
+    int bits = 0;
+
+    for(size_t ii = 0; ii < srcLen && src[ii] != '='; ii++) {
+        const char *p = strchr(_base64Chars, src[ii]);
+        if (!p || !src[ii]) {
+            return 0;
+        }
+        n = (n << 6) | (uint32_t)(p - _base64Chars);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (len >= dstSize) {
+                return 0;
+            }
+            dst[len++] = (uint8_t)(n >> bits);
+        }
+    }
+
+    return len;
+}
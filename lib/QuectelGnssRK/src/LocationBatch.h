@@ -0,0 +1,176 @@
+#ifndef __LOCATIONBATCH_H
+#define __LOCATIONBATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Repository: https://github.com/rickkas7/QuectelGnssRK
+// License: Apache 2.0
+
+/**
+ * @brief Compact encoding of a sequence of fixes for a single event
+ *
+ * The first fix is stored in full and each following fix as the difference from the one before it. Values are
+ * fixed-point integers, zigzag encoded so small negative differences are small, then written as little-endian
+ * base-128 varints (7 bits per byte, high bit set if more bytes follow). A fix a second apart while moving usually
+ * takes 5 to 8 bytes.
+ *
+ * Layout:
+ * - 1 byte FORMAT_VERSION
+ * - For each fix: varint zigzag(time), zigzag(lat), zigzag(lon), zigzag(alt), each relative to the previous fix (0 for the first)
+ *
+ * The number of fixes is not stored; the decoder reads until the end of the buffer. Differences are taken in 64 bits,
+ * so decoding gives back exactly the values that were encoded.
+ *
+ * This file does not depend on Device OS so the same code can be compiled on a computer to decode events.
+ */
+class LocationBatch {
+public:
+    /**
+     * @brief Value of the first byte of an encoded batch
+     */
+    static const uint8_t FORMAT_VERSION = 1;
+
+    /**
+     * @brief Maximum bytes one fix can take
+     */
+    static const size_t MAX_FIX_SIZE = 4 * 10;
+
+    /**
+     * @brief One fix in fixed-point form
+     */
+    struct Fix {
+        uint32_t time;                  /**< Unix time in seconds */
+        int32_t lat;                    /**< Latitude in degrees * 10^7 */
+        int32_t lon;                    /**< Longitude in degrees * 10^7 */
+        int32_t alt;                    /**< Altitude in centimeters */
+    };
+
+    /**
+     * @brief Writes fixes to a caller-supplied buffer
+     */
+    class Encoder {
+    public:
+        /**
+         * @brief Construct an encoder. The version byte is written immediately.
+         *
+         * @param buf Buffer to write to
+         * @param bufSize Size of the buffer in bytes
+         */
+        Encoder(uint8_t *buf, size_t bufSize);
+
+        /**
+         * @brief Start a new batch in the same buffer
+         */
+        void reset();
+
+        /**
+         * @brief Add a fix
+         *
+         * @param fix Fix to add
+         * @return true if added, false if it does not fit. The buffer is unchanged when false is returned.
+         */
+        bool add(const Fix &fix);
+
+        /**
+         * @brief Number of bytes used in the buffer, including the version byte
+         */
+        size_t size() const { return offset; };
+
+        /**
+         * @brief Number of fixes added since construction or reset()
+         */
+        size_t count() const { return numFixes; };
+
+    protected:
+        uint8_t *buf;
+        size_t bufSize;
+        size_t offset = 0;
+        size_t numFixes = 0;
+        Fix prev = {};
+    };
+
+    /**
+     * @brief Reads fixes from an encoded batch
+     */
+    class Decoder {
+    public:
+        /**
+         * @brief Construct a decoder
+         *
+         * @param buf Encoded batch
+         * @param bufSize Size of the encoded batch in bytes
+         */
+        Decoder(const uint8_t *buf, size_t bufSize);
+
+        /**
+         * @brief Get the next fix
+         *
+         * @param fix Filled in with the fix
+         * @return true if a fix was returned, false at the end of the batch or on an error
+         */
+        bool next(Fix &fix);
+
+        /**
+         * @brief false if the version byte is wrong or the data ended in the middle of a fix
+         */
+        bool isValid() const { return valid; };
+
+    protected:
+        bool readVarint(uint64_t &value);
+
+        const uint8_t *buf;
+        size_t bufSize;
+        size_t offset = 0;
+        bool valid = true;
+        Fix prev = {};
+    };
+
+    /**
+     * @brief Map a signed value to unsigned so values near 0 of either sign are small
+     */
+    static uint64_t zigzagEncode(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); };
+
+    /**
+     * @brief Inverse of zigzagEncode()
+     */
+    static int64_t zigzagDecode(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); };
+
+    /**
+     * @brief Write a varint
+     *
+     * @param value Value to write
+     * @param buf Buffer with room for at least 10 bytes
+     * @return size_t Number of bytes written
+     */
+    static size_t writeVarint(uint64_t value, uint8_t *buf);
+
+    /**
+     * @brief Base64 encode binary data, null terminated
+     *
+     * @param src Data to encode
+     * @param srcLen Length of data
+     * @param dst Buffer to write to. Needs room for base64Size(srcLen) bytes.
+     * @param dstSize Size of dst
+     * @return size_t Length of the encoded string, or 0 if it does not fit
+     */
+    static size_t base64Encode(const uint8_t *src, size_t srcLen, char *dst, size_t dstSize);
+
+    /**
+     * @brief Base64 decode a string
+     *
+     * @param src Encoded string
+     * @param srcLen Length of the string
+     * @param dst Buffer to write to
+     * @param dstSize Size of dst
+     * @return size_t Number of bytes decoded, or 0 on an invalid character or if it does not fit
+     */
+    static size_t base64Decode(const char *src, size_t srcLen, uint8_t *dst, size_t dstSize);
+
+    /**
+     * @brief Buffer size needed by base64Encode(), including the null terminator
+     */
+    static size_t base64Size(size_t srcLen) { return ((srcLen + 2) / 3) * 4 + 1; };
+};
+
+#endif /* __LOCATIONBATCH_H */
@@ -25,15 +25,40 @@ constexpr system_tick_t LOCATION_PERIOD_SUCCESS_MS {1 * 1000};
 constexpr system_tick_t LOCATION_INACTIVE_PERIOD_SUCCESS_MS {120 * 1000};
 constexpr system_tick_t LOCATION_PERIOD_ACQUIRE_MS {1 * 1000};
 constexpr system_tick_t ANTENNA_POWER_SETTLING_MS {100};
-constexpr int LOCATION_REQUIRED_SETTLING_COUNT {2};  // Number of consecutive fixes
+constexpr double EARTH_RADIUS_M {6371000.0};
 
 Logger locationLog("loc");
 
+namespace {
+
+typedef QuectelResponseParser::Tokenizer ResponseTokenizer;
+
+// Convert NMEA ddmm.mmmm / dddmm.mmmm with hemisphere to signed decimal degrees
+bool nmeaCoordinate(const char *value, const char *hemisphere, double &result) {
+    double raw;
+    ResponseTokenizer tok(value);
+    if (!tok.doubleField(raw)) {
+        return false;
+    }
+    int degrees = (int)(raw / 100);
+    result = degrees + (raw - degrees * 100) / 60.0;
+    if ('S' == hemisphere[0] || 'W' == hemisphere[0]) {
+        result = -result;
+    }
+    return true;
+}
+
+} // namespace
+
 QuectelGnssRK *QuectelGnssRK::_instance = nullptr;
 
 QuectelGnssRK::QuectelGnssRK() {
-    os_queue_create(&_commandQueue, sizeof(LocationCommandContext), 1, nullptr);
-    os_queue_create(&_responseQueue, sizeof(LocationResults), 1, nullptr);
+    os_queue_create(&_commandQueue, sizeof(LocationCommandContext), 2, nullptr);
+    os_mutex_create(&_fixMutex);
+    os_mutex_create(&_waiterMutex);
+    for (auto &waiter : _waiters) {
+        os_semaphore_create(&waiter.semaphore, 1, 0);
+    }
     _thread = new Thread("gnss_cellular", [this]() {QuectelGnssRK::threadLoop();}, OS_THREAD_PRIORITY_DEFAULT);
 }
 
@@ -161,39 +186,58 @@ int QuectelGnssRK::begin(LocationConfiguration& configuration) {
     return 0;
 }
 
-QuectelGnssRK::LocationResults QuectelGnssRK::getLocation(LocationPoint& point, bool publish) {
-    memset(&point, 0, sizeof(LocationPoint));
-    
+bool QuectelGnssRK::checkModemReady() {
     if (!isModemOn()) {
         locationLog.trace("Modem is not on");
         lastResults = LocationResults::Unavailable;
-        return lastResults;
+        return false;
     }
     if (modemNotDetected()) {
         auto detected = detectModemType();
         if (!detected) {
             locationLog.trace("Modem is not supported");
             lastResults = LocationResults::Unsupported;
-            return lastResults;
+            return false;
         }
     }
+    return true;
+}
 
-    // Check if already running
-    if (_acquiring.load()) {
-        locationLog.trace("Acquisition is already underway");
-        lastResults = LocationResults::Pending;
+QuectelGnssRK::LocationResults QuectelGnssRK::getLocation(LocationPoint& point, const LocationRequest& request, bool publish) {
+    memset(&point, 0, sizeof(LocationPoint));
+    
+    if (!checkModemReady()) {
         return lastResults;
     }
+
+    if (getRecentFix(request.maximumAge(), point)) {
+        locationLog.trace("Using recent fix");
+        return LocationResults::Fixed;
+    }
+
     locationLog.trace("Starting synchronous acquisition");
-    
-    LocationCommandContext event;
-    
-    event.command = LocationCommand::Acquire;
-    event.point = &point;
-    event.sendResponse = true;
-    event.doneCallback = nullptr;
-    os_queue_put(_commandQueue, &event, 0, nullptr);
-    auto result = waitOnResponseEvent((system_tick_t)_conf.maximumFixTime() * 1000 + LOCATION_PERIOD_ACQUIRE_MS);
+    auto index = addWaiter(request, nullptr);
+    if (0 > index) {
+        locationLog.trace("Too many requests waiting");
+        return LocationResults::Pending;
+    }
+    auto& waiter = _waiters[index];
+
+    // The worker completes the request at its deadline, so this timeout is only a backstop
+    auto timeout = (system_tick_t)(waiter.deadline - System.millis()) + LOCATION_PERIOD_ACQUIRE_MS;
+    os_semaphore_take(waiter.semaphore, timeout, false);
+
+    os_mutex_lock(_waiterMutex);
+    auto result = LocationResults::TimedOut;
+    if (WaiterState::Done == waiter.state) {
+        // Clear the semaphore in case it was given after the take timed out
+        os_semaphore_take(waiter.semaphore, 0, false);
+        result = waiter.result;
+        point = waiter.point;
+    }
+    waiter.state = WaiterState::Free;
+    os_mutex_unlock(_waiterMutex);
+
     if (publish && (LocationResults::Fixed == result) && isConnected()) {
         locationLog.info("Publishing loc event");
         buildPublish(_publishBuffer, sizeof(_publishBuffer), point, _reqid);
@@ -205,55 +249,253 @@ QuectelGnssRK::LocationResults QuectelGnssRK::getLocation(LocationPoint& point,
     return result;
 }
 
-QuectelGnssRK::LocationResults QuectelGnssRK::getLocationAsync(LocationDoneCallback callback) {
-    if (!isModemOn()) {
-        locationLog.trace("Modem is not on");
-        lastResults = LocationResults::Unavailable;
+QuectelGnssRK::LocationResults QuectelGnssRK::getLocationAsync(LocationDoneCallback callback, const LocationRequest& request) {
+    if (!checkModemReady()) {
         return lastResults;
     }
-    if (modemNotDetected()) {
-        auto detected = detectModemType();
-        if (!detected) {
-            locationLog.trace("Modem is not supported");
-            lastResults = LocationResults::Unsupported;
-            return lastResults;
-        }
+
+    LocationPoint point;
+    if (getRecentFix(request.maximumAge(), point)) {
+        locationLog.trace("Using recent fix");
+        callback(LocationResults::Fixed, point);
+        return LocationResults::Fixed;
     }
 
-    // Check if already running
-    if (_acquiring.load()) {
-        locationLog.trace("Acquisition is already underway");
+    locationLog.trace("Starting asynchronous acquisition");
+    if (0 > addWaiter(request, callback)) {
+        locationLog.trace("Too many requests waiting");
         lastResults = LocationResults::Pending;
         return lastResults;
     }
-    
-    locationLog.trace("Starting asynchronous acquisition");
-    LocationCommandContext event {};
-    event.command = LocationCommand::Acquire;
-    event.point = nullptr;
-    event.sendResponse = false;
-    event.doneCallback = callback;
-    event.publish = false;
-    os_queue_put(_commandQueue, &event, 0, nullptr);
     return LocationResults::Acquiring;
 }
 
-QuectelGnssRK::LocationCommandContext QuectelGnssRK::waitOnCommandEvent(system_tick_t timeout) {
-    LocationCommandContext event = {};
-    auto ret = os_queue_take(_commandQueue, &event, timeout, nullptr);
-    if (ret) {
-        event.command = LocationCommand::None;
-        event.point = nullptr;
+bool QuectelGnssRK::getRecentFix(system_tick_t maximumAge, LocationPoint& point) {
+    bool found = false;
+
+    if (0 == maximumAge) {
+        return false;
     }
 
-    return event;
+    // lastLocation is only stable when no acquisition is writing to it
+    os_mutex_lock(_waiterMutex);
+    if (!_acquiring.load() && (LocationResults::Fixed == lastResults) && (System.millis() - _lastFixMs <= maximumAge)) {
+        point = lastLocation;
+        found = true;
+    }
+    os_mutex_unlock(_waiterMutex);
+
+    return found;
+}
+
+int QuectelGnssRK::addWaiter(const LocationRequest& request, LocationDoneCallback callback) {
+    int index = -1;
+
+    system_tick_t timeout = request.timeout();
+    if (0 == timeout) {
+        timeout = (system_tick_t)_conf.maximumFixTime() * 1000;
+    }
+    float hacc = (0.0 < request.horizontalAccuracy()) ? request.horizontalAccuracy() : _conf.haccThreshold();
+
+    os_mutex_lock(_waiterMutex);
+    for (size_t ii = 0; ii < MAX_LOCATION_WAITERS; ii++) {
+        auto& waiter = _waiters[ii];
+        if (WaiterState::Free == waiter.state) {
+            waiter.state = WaiterState::Waiting;
+            waiter.callback = callback;
+            waiter.deadline = System.millis() + timeout;
+            waiter.hacc = hacc;
+            waiter.result = LocationResults::Idle;
+            index = (int)ii;
+            break;
+        }
+    }
+
+    // Only start a new acquisition if none is running. A running acquisition picks up new waiters on its next
+    // poll, and _acquiring is only cleared under this lock once no waiters remain.
+    if ((0 <= index) && !_acquiring.load()) {
+        locationLog.trace("Queueing new acquisition");
+        _acquiring.store(true);
+        LocationCommandContext event;
+        event.command = LocationCommand::Acquire;
+        os_queue_put(_commandQueue, &event, 0, nullptr);
+    }
+    else if (0 <= index) {
+        locationLog.trace("Joining acquisition in progress");
+    }
+    os_mutex_unlock(_waiterMutex);
+
+    return index;
+}
+
+size_t QuectelGnssRK::serviceWaiters(unsigned int fixCount, bool finish, LocationResults finishResult, uint64_t& nextDeadline) {
+    struct {
+        LocationDoneCallback callback;
+        LocationResults result;
+    } due[MAX_LOCATION_WAITERS];
+    size_t numDue = 0;
+    size_t remaining = 0;
+    auto now = System.millis();
+
+    nextDeadline = UINT64_MAX;
+
+    os_mutex_lock(_waiterMutex);
+    for (auto &waiter : _waiters) {
+        if (WaiterState::Waiting != waiter.state) {
+            continue;
+        }
+
+        auto result = LocationResults::Idle;
+        if (finish) {
+            result = finishResult;
+        }
+        else if ((0 < fixCount) && hasConverged(lastLocation, fixCount, waiter.hacc)) {
+            result = LocationResults::Fixed;
+        }
+        else if (now >= waiter.deadline) {
+            result = LocationResults::TimedOut;
+        }
+
+        if (LocationResults::Idle == result) {
+            remaining++;
+            if (waiter.deadline < nextDeadline) {
+                nextDeadline = waiter.deadline;
+            }
+            continue;
+        }
+
+        _stats.requestCount++;
+        lastResults = result;
+        if (LocationResults::Fixed == result) {
+            _lastFixMs = now;
+        }
+        if (waiter.callback) {
+            due[numDue].callback = waiter.callback;
+            due[numDue++].result = result;
+            waiter.callback = nullptr;
+            waiter.state = WaiterState::Free;
+        }
+        else {
+            waiter.result = result;
+            waiter.point = lastLocation;
+            waiter.state = WaiterState::Done;
+            os_semaphore_give(waiter.semaphore, false);
+        }
+    }
+    if (0 == remaining) {
+        _acquiring.store(false);
+    }
+    os_mutex_unlock(_waiterMutex);
+
+    if (numDue) {
+        locationLog.trace("Sending %u asynchronous completions", (unsigned int)numDue);
+    }
+    for (size_t ii = 0; ii < numDue; ii++) {
+        due[ii].callback(due[ii].result, lastLocation);
+    }
+
+    return remaining;
+}
+
+QuectelGnssRK::LocationResults QuectelGnssRK::startTracking(system_tick_t periodMs) {
+    if (!checkModemReady()) {
+        return lastResults;
+    }
+    if (!concurrentGnssAndCellularSupported()) {
+        locationLog.info("Tracking requires concurrent GNSS and cellular (EG91)");
+        return LocationResults::Unsupported;
+    }
+
+    locationLog.trace("Starting tracking every %lu ms", periodMs);
+    _trackingPeriodMs = periodMs;
+    // The worker thread updates _trackingStats, so it also clears them, before its next poll
+    _trackingStatsReset.store(true);
+    _tracking.store(true);
+    return LocationResults::Acquiring;
+}
+
+void QuectelGnssRK::stopTracking() {
+    locationLog.trace("Stopping tracking");
+    _tracking.store(false);
+}
+
+int QuectelGnssRK::subscribe(LocationFixCallback callback, unsigned int rateDivisor) {
+    int id = -1;
+
+    os_mutex_lock(_fixMutex);
+    for (auto &sub : _subscribers) {
+        if (0 == sub.id) {
+            sub.id = _nextSubscriberId++;
+            sub.callback = callback;
+            sub.rateDivisor = (rateDivisor > 0) ? rateDivisor : 1;
+            sub.counter = 0;
+            id = sub.id;
+            break;
+        }
+    }
+    os_mutex_unlock(_fixMutex);
+
+    return id;
 }
 
-QuectelGnssRK::LocationResults QuectelGnssRK::waitOnResponseEvent(system_tick_t timeout) {
-    LocationResults event = {LocationResults::Idle};
-    auto ret = os_queue_take(_responseQueue, &event, timeout, nullptr);
+bool QuectelGnssRK::unsubscribe(int id) {
+    bool found = false;
+
+    os_mutex_lock(_fixMutex);
+    for (auto &sub : _subscribers) {
+        if (id > 0 && id == sub.id) {
+            sub.id = 0;
+            sub.callback = nullptr;
+            found = true;
+            break;
+        }
+    }
+    os_mutex_unlock(_fixMutex);
+
+    return found;
+}
+
+size_t QuectelGnssRK::getRecentFixes(LocationPoint *points, size_t maxPoints) const {
+    os_mutex_lock(_fixMutex);
+    size_t count = (maxPoints < _fixRingCount) ? maxPoints : _fixRingCount;
+    size_t index = (_fixRingNext + TRACKING_BUFFER_SIZE - count) % TRACKING_BUFFER_SIZE;
+    for (size_t ii = 0; ii < count; ii++) {
+        points[ii] = _fixRing[index];
+        index = (index + 1) % TRACKING_BUFFER_SIZE;
+    }
+    os_mutex_unlock(_fixMutex);
+
+    return count;
+}
+
+void QuectelGnssRK::cancel() {
+    // Checked under the waiter lock because _acquiring is cleared under it. Once it is clear the worker resets
+    // the flag, so a cancel can't leak into the next acquisition.
+    bool post = false;
+    os_mutex_lock(_waiterMutex);
+    if (_acquiring.load() && !_cancelRequested.load()) {
+        _cancelRequestMs.store(millis());
+        _cancelRequested.store(true);
+        post = true;
+    }
+    os_mutex_unlock(_waiterMutex);
+
+    if (post) {
+        locationLog.trace("Cancelling acquisition");
+
+        // Wakes the worker from its poll interval. Only one Cancel is outstanding at a time, so with a queue
+        // depth of 2 there is always room for the next Acquire.
+        LocationCommandContext event;
+        event.command = LocationCommand::Cancel;
+        os_queue_put(_commandQueue, &event, 0, nullptr);
+    }
+}
+
+QuectelGnssRK::LocationCommandContext QuectelGnssRK::waitOnCommandEvent(system_tick_t timeout) {
+    LocationCommandContext event = {};
+    auto ret = os_queue_take(_commandQueue, &event, timeout, nullptr);
     if (ret) {
-        event = LocationResults::Idle;
+        event.command = LocationCommand::None;
     }
 
     return event;
@@ -278,28 +520,38 @@ void QuectelGnssRK::stripLfCr(char* str) {
     *write = '\0';
 }
 
-int QuectelGnssRK::glocCallback(int type, const char* buf, int len, char* locBuffer) {
+int QuectelGnssRK::pollCallback(int type, const char* buf, int len, QuectelGnssRK* self) {
+    // A single poll may batch several commands (AT+QGPSLOC=2;+QGPSCFG="estimation_error") so the
+    // responses are routed by prefix. The modem stops at the first command that returns an error,
+    // so an error belongs to the position query unless that already responded.
     switch (type) {
         case TYPE_PLUS:
             // fallthrough
-        case TYPE_ERROR:
-            strlcpy(locBuffer, buf, min((size_t)len, sizeof(QuectelGnssRK::_locBuffer)));
-            stripLfCr(locBuffer);
-            locationLog.trace("glocCallback: (%06x) %s", type, locBuffer);
-            break;
-    }
-
-    return WAIT;
-}
+        case TYPE_ERROR: {
+            while (len > 0 && ('\r' == *buf || '\n' == *buf)) {
+                buf++;
+                len--;
+            }
+            if (TYPE_PLUS == type && 0 == strncmp(buf, "+QGPSGNMEA:", 11)) {
+                auto start = (const char *)memchr(buf, '$', len);
+                if (start) {
+                    self->_nmeaParser.feed(start, len - (start - buf));
+                }
+                break;
+            }
 
-int QuectelGnssRK::epeCallback(int type, const char* buf, int len, char* epeBuffer) {
-    switch (type) {
-        case TYPE_PLUS:
-            // fallthrough
-        case TYPE_ERROR:
-            strlcpy(epeBuffer, buf, min((size_t)len, sizeof(QuectelGnssRK::_epeBuffer)));
-            stripLfCr(epeBuffer);
+            char *dest;
+            if (TYPE_PLUS == type) {
+                dest = (0 == strncmp(buf, "+QGPSCFG:", 9)) ? self->_epeBuffer : self->_locBuffer;
+            }
+            else {
+                dest = ('\0' == self->_locBuffer[0]) ? self->_locBuffer : self->_epeBuffer;
+            }
+            strlcpy(dest, buf, min((size_t)len + 1, sizeof(QuectelGnssRK::_locBuffer)));
+            stripLfCr(dest);
+            locationLog.trace("pollCallback: (%06x) %s", type, dest);
             break;
+        }
     }
 
     return WAIT;
@@ -307,7 +559,7 @@ int QuectelGnssRK::epeCallback(int type, const char* buf, int len, char* epeBuff
 
 QuectelGnssRK::CME_Error QuectelGnssRK::parseCmeError(const char* buf) {
     unsigned int error_code = 0;
-    auto nargs = sscanf(buf," +CME ERROR: %u", &error_code);
+    auto nargs = QuectelResponseParser::parseCmeError(buf, error_code);
 
     if (0 == nargs) {
         return CME_Error::NONE;
@@ -337,12 +589,11 @@ QuectelGnssRK::CME_Error QuectelGnssRK::parseCmeError(const char* buf) {
 int QuectelGnssRK::parseQloc(const char* buf, QlocContext& context, LocationPoint& point) {
     // The general form of the AT command response is as follows
     // <UTC HHMMSS.hh>,<latitude (-)dd.ddddd>,<longitude (-)ddd.ddddd>,<HDOP>,<altitude>,<fix>,<COG ddd.mm>,<spkm>,<spkn>,<date DDmmyy>,<nsat>
-    auto nargs = sscanf(buf, " +QGPSLOC: %02u%02u%02u.%*03u,%lf,%lf,%f,%f,%u,%03u.%02u,%f,%f,%02u%02u%02u,%u",
-                        &context.tm_hour, &context.tm_min, &context.tm_sec,
-                        &context.latitude, &context.longitude, &context.hdop, &context.altitude,
-                        &context.fix, &context.cogDegrees, &context.cogMinutes, &context.speedKmph, &context.speedKnots,
-                        &context.tm_day, &context.tm_month, &context.tm_year,
-                        &context.nsat);
+    //
+    // Sample responses:
+    //   BG95-M5:  +QGPSLOC: 174512.00,42.35012,-71.06010,1.1,41.9,3,87.20,0.4,0.2,291025,09
+    //   EG91-NAX: +QGPSLOC: 174512.0,42.35012,-71.06010,0.8,41.9,3,087.20,0.4,0.2,291025,11
+    auto nargs = QuectelResponseParser::parseQloc(buf, context);
 
     if (0 == nargs) {
         return -1;
@@ -362,6 +613,7 @@ int QuectelGnssRK::parseQloc(const char* buf, QlocContext& context, LocationPoin
     context.timeinfo.tm_min = context.tm_min;
     context.timeinfo.tm_sec = context.tm_sec;
     point.epochTime = std::mktime(&context.timeinfo);
+    point.epochHundredths = context.tm_hundredths;
 
     point.fix = context.fix;
     point.latitude = context.latitude;
@@ -405,8 +657,9 @@ void QuectelGnssRK::parseEpeResponse(const char* buf, EpeContext& context, Locat
         return;  // module just may have not been initialized
     }
 
-    auto nargs = sscanf(buf, " +QGPSCFG: \"estimation_error\",%f,%f,%f,%f",
-                        &context.h_acc, &context.v_acc, &context.speed_acc, &context.head_acc);
+    // +QGPSCFG: "estimation_error",<h_acc>,<v_acc>,<speed_acc>,<head_acc>
+    //   e.g. +QGPSCFG: "estimation_error",3.2,5.8,0.4,12.6
+    auto nargs = QuectelResponseParser::parseEpe(buf, context);
 
     if (nargs) {
         point.horizontalAccuracy = context.h_acc;
@@ -416,103 +669,369 @@ void QuectelGnssRK::parseEpeResponse(const char* buf, EpeContext& context, Locat
     return;
 }
 
+QuectelGnssRK::CME_Error QuectelGnssRK::pollLocation(LocationPoint& point, AcquisitionStats& stats) {
+    // On BG95 the accuracy query is appended to the position query so both come back in one AT transaction.
+    // estimation_error is not supported on EG91 (CME Error 501).
+    bool queryEpe = (_ModemType::BG95_M5 == _modemType);
+    auto modemStart = millis();
+
+    _locBuffer[0] = 0;
+    _epeBuffer[0] = 0;
+
+    CME_Error ret;
+    if (AcquisitionMode::Nmea == _conf.acquisitionMode()) {
+        auto updates = _nmeaParser.getPositionUpdateCount();
+        if (queryEpe) {
+            Cellular.command(pollCallback, this, 1000, R"(AT+QGPSGNMEA="GGA";+QGPSGNMEA="RMC";+QGPSGNMEA="GSA";+QGPSCFG="estimation_error")");
+        }
+        else {
+            Cellular.command(pollCallback, this, 1000, R"(AT+QGPSGNMEA="GGA";+QGPSGNMEA="RMC";+QGPSGNMEA="GSA")");
+        }
+        ret = nmeaResult(point, updates);
+    }
+    else {
+        if (queryEpe) {
+            Cellular.command(pollCallback, this, 1000, R"(AT+QGPSLOC=2;+QGPSCFG="estimation_error")");
+        }
+        else {
+            Cellular.command(pollCallback, this, 1000, R"(AT+QGPSLOC=2)");
+        }
+        ret = parseQlocResponse(_locBuffer, _qlocContext, point);
+    }
+
+    if (CME_Error::FIX == ret && queryEpe) {
+        parseEpeResponse(_epeBuffer, _epeContext, point);
+    }
+
+    uint32_t modemMs = (uint32_t)(millis() - modemStart);
+    stats.pollCount++;
+    stats.atCommandCount++;
+    stats.modemTimeMs += modemMs;
+    if (modemMs > stats.maxPollModemTimeMs) {
+        stats.maxPollModemTimeMs = modemMs;
+    }
+    if (CME_Error::NO_FIX == ret) {
+        stats.noFixCount++;
+    }
+
+    return ret;
+}
+
+QuectelGnssRK::CME_Error QuectelGnssRK::nmeaResult(LocationPoint& point, unsigned int previousUpdates) {
+    if (previousUpdates == _nmeaParser.getPositionUpdateCount()) {
+        return CME_Error::UNKNOWN_ERROR; // nothing valid received
+    }
+    if (!_nmeaParser.hasFix()) {
+        point.fix = 0;
+        return CME_Error::NO_FIX;
+    }
+    const LocationPoint &nmeaPoint = _nmeaParser.getPoint();
+    point.fix = nmeaPoint.fix;
+    point.epochTime = nmeaPoint.epochTime;
+    point.epochHundredths = nmeaPoint.epochHundredths;
+    point.latitude = nmeaPoint.latitude;
+    point.longitude = nmeaPoint.longitude;
+    point.altitude = nmeaPoint.altitude;
+    point.speed = nmeaPoint.speed;
+    point.heading = nmeaPoint.heading;
+    point.horizontalDop = nmeaPoint.horizontalDop;
+    point.verticalDop = nmeaPoint.verticalDop;
+    point.satsInUse = nmeaPoint.satsInUse;
+
+    return CME_Error::FIX;
+}
+
+void QuectelGnssRK::SettlingWindow::add(double latitude, double longitude) {
+    _latitude[_next] = latitude;
+    _longitude[_next] = longitude;
+    _next = (_next + 1) % MAX_SETTLING_COUNT;
+    if (_count < MAX_SETTLING_COUNT) {
+        _count++;
+    }
+}
+
+float QuectelGnssRK::SettlingWindow::spreadMeters(unsigned int n) const {
+    if (n > _count) {
+        n = _count;
+    }
+    if (n < 2) {
+        return 0.0;
+    }
+
+    // Newest n entries, walking backwards from _next
+    auto index = [this](unsigned int ii) {
+        return (_next + MAX_SETTLING_COUNT - 1 - ii) % MAX_SETTLING_COUNT;
+    };
+
+    double meanLat = 0.0, meanLon = 0.0;
+    for (unsigned int ii = 0; ii < n; ii++) {
+        meanLat += _latitude[index(ii)];
+        meanLon += _longitude[index(ii)];
+    }
+    meanLat /= n;
+    meanLon /= n;
+
+    // Equirectangular approximation is plenty at the scale of a settling fix
+    double lonScale = cos(meanLat * M_PI / 180.0);
+    double maxSquared = 0.0;
+    for (unsigned int ii = 0; ii < n; ii++) {
+        double dy = (_latitude[index(ii)] - meanLat) * M_PI / 180.0;
+        double dx = (_longitude[index(ii)] - meanLon) * M_PI / 180.0 * lonScale;
+        double squared = dx * dx + dy * dy;
+        if (squared > maxSquared) {
+            maxSquared = squared;
+        }
+    }
+    return (float)(sqrt(maxSquared) * EARTH_RADIUS_M);
+}
+
+float QuectelGnssRK::fixQuality(const LocationPoint& point) {
+    // Lower is better. Prefer the modem's accuracy estimate, falling back to HDOP when there is none.
+    return (0.0 < point.horizontalAccuracy) ? point.horizontalAccuracy : point.horizontalDop * 10.0;
+}
+
+bool QuectelGnssRK::hasConverged(const LocationPoint& point, unsigned int fixCount, float haccThreshold) const {
+    if (fixCount < _conf.settlingCount()) {
+        return false;
+    }
+    if (point.horizontalDop > _conf.hdopThreshold()) {
+        return false;
+    }
+
+    float hacc = point.horizontalAccuracy;
+    if (0.0 >= hacc && 0.0 < _conf.hdopAccuracyFactor()) {
+        hacc = point.horizontalDop * _conf.hdopAccuracyFactor();
+    }
+    if (hacc > haccThreshold) {
+        return false;
+    }
+
+    if (0.0 < _conf.positionSpreadThreshold()) {
+        float spread = _settlingWindow.spreadMeters(_conf.settlingCount());
+        if (spread > _conf.positionSpreadThreshold()) {
+            locationLog.trace("spread %.1f m exceeds %.1f m", spread, _conf.positionSpreadThreshold());
+            return false;
+        }
+    }
+    return true;
+}
+
+void QuectelGnssRK::sessionCommand(const char* command, AcquisitionStats& stats) {
+    auto modemStart = millis();
+    Cellular.command("%s", command);
+    stats.atCommandCount++;
+    stats.modemTimeMs += (uint32_t)(millis() - modemStart);
+}
+
+void QuectelGnssRK::startSession(AcquisitionStats& stats) {
+    if (gnssStarted) {
+        return;
+    }
+    setAntennaPower();
+
+    locationLog.trace("Started acquisition");
+    sessionCommand(R"(AT+QGPS=1)", stats);
+    if (_ModemType::BG95_M5 == _modemType) {
+        sessionCommand(R"(AT+QGPSCFG="nmea_epe",1)", stats);
+    }
+    if (AcquisitionMode::Nmea == _conf.acquisitionMode()) {
+        sessionCommand(R"(AT+QGPSCFG="nmeasrc",1)", stats);
+        _nmeaParser.reset();
+    }
+    setConstellation(_conf.constellations());
+    gnssStarted = true;
+    timeToFirstFixMs = 0;
+}
+
+void QuectelGnssRK::endSession(AcquisitionStats& stats) {
+    if (!gnssStarted) {
+        return;
+    }
+    if (AcquisitionMode::Nmea == _conf.acquisitionMode()) {
+        sessionCommand(R"(AT+QGPSCFG="nmeasrc",0)", stats);
+    }
+    sessionCommand(R"(AT+QGPSEND)", stats);
+
+    clearAntennaPower();
+    gnssStarted = false;
+}
+
+void QuectelGnssRK::trackingPoll() {
+    if (!isModemOn()) {
+        return;
+    }
+    if (_trackingStatsReset.exchange(false)) {
+        _trackingStats = {};
+    }
+    startSession(_trackingStats);
+
+    LocationPoint point = {};
+    if (CME_Error::FIX == pollLocation(point, _trackingStats)) {
+        point.systemTime = Time.now();
+        publishFix(point);
+    }
+}
+
+void QuectelGnssRK::publishFix(const LocationPoint& point) {
+    struct {
+        LocationFixCallback callback;
+    } due[MAX_FIX_SUBSCRIBERS];
+    size_t numDue = 0;
+
+    os_mutex_lock(_fixMutex);
+    _fixRing[_fixRingNext] = point;
+    _fixRingNext = (_fixRingNext + 1) % TRACKING_BUFFER_SIZE;
+    if (_fixRingCount < TRACKING_BUFFER_SIZE) {
+        _fixRingCount++;
+    }
+    _fixCount++;
+
+    for (auto &sub : _subscribers) {
+        if (sub.id && (0 == (sub.counter++ % sub.rateDivisor))) {
+            due[numDue++].callback = sub.callback;
+        }
+    }
+    os_mutex_unlock(_fixMutex);
+
+    // Called without the lock held so a subscriber can unsubscribe from its callback
+    for (size_t ii = 0; ii < numDue; ii++) {
+        due[ii].callback(point);
+    }
+}
+
 void QuectelGnssRK::threadLoop()
 {
     auto loop = true;
     while (loop) {
-        // Look for requests and provide a loop delay
-        auto event = waitOnCommandEvent(LOCATION_PERIOD_SUCCESS_MS);
+        // Look for requests and provide a loop delay. When tracking, the delay is the tracking period.
+        auto event = waitOnCommandEvent(_tracking.load() ? _trackingPeriodMs : LOCATION_PERIOD_SUCCESS_MS);
 
         switch (event.command) {
             case LocationCommand::None:
-                // Do nothing
+                if (_tracking.load()) {
+                    trackingPoll();
+                }
+                break;
+
+            case LocationCommand::Cancel:
+                // Arrived after the acquisition finished
+                _cancelRequested.store(false);
                 break;
 
             case LocationCommand::Acquire: {
-                _acquiring.store(true);
-                SCOPE_GUARD({
-                    _acquiring.store(false);
-                });
-                memset(&lastLocation, 0, sizeof(lastLocation));
+                // Requests may have timed out while this command was queued
+                uint64_t nextDeadline = 0;
+                if (0 == serviceWaiters(0, false, LocationResults::Idle, nextDeadline)) {
+                    _cancelRequested.store(false);
+                    break;
+                }
 
-                if (!gnssStarted) {
-                    setAntennaPower();
+                memset(&lastLocation, 0, sizeof(lastLocation));
+                memset(&_stats, 0, sizeof(_stats));
 
-                    locationLog.trace("Started acquisition");
-                    Cellular.command(R"(AT+QGPS=1)");
-                    if (_ModemType::BG95_M5 == _modemType) {
-                        Cellular.command(R"(AT+QGPSCFG="nmea_epe",1)");
-                    }
-                    setConstellation(_conf.constellations());
-                    gnssStarted = true;
-                    timeToFirstFixMs = 0;
-                }
+                startSession(_stats);
 
+                // Best fix so far, returned if the acquisition is cancelled before converging
+                LocationPoint bestLocation = {};
 
-                auto maxTime = (uint64_t)_conf.maximumFixTime() * 1000;
-                int fixCount = {};
-                LocationResults response = LocationResults::TimedOut;
-                bool power = false;
+                unsigned int fixCount = {};
+                _settlingWindow.reset();
+                system_tick_t pollInterval = _conf.pollIntervalSearchMin();
+                unsigned int noFixRun = 0;
                 auto start = System.millis();
-                while ((power = isModemOn())) {
-                    auto now = System.millis();
-                    if ((now - start) >= maxTime)
+                while (true) {
+                    if (!isModemOn()) {
+                        serviceWaiters(0, true, LocationResults::Unavailable, nextDeadline);
                         break;
-                    Cellular.command(glocCallback, _locBuffer, 1000, R"(AT+QGPSLOC=2)");
-                    auto ret = parseQlocResponse(_locBuffer, _qlocContext, lastLocation);
+                    }
+                    auto ret = pollLocation(lastLocation, _stats);
                     if (CME_Error::FIX == ret) {
                         fixCount++;
                         lastLocation.systemTime = Time.now();
+                        _settlingWindow.add(lastLocation.latitude, lastLocation.longitude);
+                        publishFix(lastLocation);
 
+                        if (0 == _stats.ttffMs) {
+                            _stats.ttffMs = (uint32_t) (System.millis() - start);
+                        }
                         if (0 == timeToFirstFixMs) {
                             timeToFirstFixMs = (uint32_t) (System.millis() - start);
                             locationLog.info("timeToFirstFix %lu ms", timeToFirstFixMs);
                         }
-                        if (_ModemType::BG95_M5 == _modemType) {
-                            // This is not supported on EG91, returns CME Error 501
-                            Cellular.command(epeCallback, _epeBuffer, 1000, R"(AT+QGPSCFG="estimation_error")");
-                            parseEpeResponse(_epeBuffer, _epeContext, lastLocation);
+                        if (!bestLocation.fix || (fixQuality(lastLocation) <= fixQuality(bestLocation))) {
+                            bestLocation = lastLocation;
                         }
-                        if ((LOCATION_REQUIRED_SETTLING_COUNT == fixCount) &&
-                            (lastLocation.horizontalDop <= _conf.hdopThreshold()) &&
-                            (lastLocation.horizontalAccuracy <= _conf.haccThreshold())) {
+                    }
+                    else {
+                        // Settling requires consecutive fixes
+                        fixCount = 0;
+                        _settlingWindow.reset();
+                    }
+                    if (timeToFirstFixMs) {
+                        lastLocation.timeToFirstFix = (float)timeToFirstFixMs / 1000.0;
+                    }
 
-                            response = LocationResults::Fixed;
-                            break;
-                        }
+                    // Complete every request whose accuracy or deadline has been reached. Requests that arrived
+                    // during this acquisition are included, so the loop runs until the last one is satisfied.
+                    if (0 == serviceWaiters(fixCount, false, LocationResults::Idle, nextDeadline)) {
+                        break;
                     }
 
-                    delay(LOCATION_PERIOD_ACQUIRE_MS);
-                }
+                    // Poll quickly while settling, back off while the modem has no fix
+                    if (CME_Error::FIX == ret) {
+                        pollInterval = _conf.pollIntervalSettling();
+                    }
+                    else if (CME_Error::NO_FIX == ret) {
+                        pollInterval = (0 == noFixRun++) ? _conf.pollIntervalSearchMin() : min(pollInterval * 2, _conf.pollIntervalSearchMax());
+                    }
+                    if (CME_Error::NO_FIX != ret) {
+                        noFixRun = 0;
+                    }
 
-                if (!concurrentGnssAndCellularSupported()) {
-                    Cellular.command(R"(AT+QGPSEND)");
+                    if (!_cancelRequested.load() && _cellularPriorityCheck && _cellularPriorityCheck()) {
+                        locationLog.info("Cellular priority check requested preemption");
+                        _cancelRequestMs.store(millis());
+                        _cancelRequested.store(true);
+                    }
 
-                    clearAntennaPower();
-                    gnssStarted = false;
-                }
+                    // Do not sleep past the earliest request deadline. Waiting on the command queue rather than
+                    // delaying lets cancel() and Exit interrupt the poll interval.
+                    auto now = System.millis();
+                    if (!_cancelRequested.load() && (now < nextDeadline)) {
+                        auto command = waitOnCommandEvent((system_tick_t)min((uint64_t)pollInterval, nextDeadline - now));
+                        if (LocationCommand::Exit == command.command) {
+                            _cancelRequestMs.store(millis());
+                            _cancelRequested.store(true);
+                            loop = false;
+                        }
+                    }
 
-                if (!power && (LocationResults::Fixed != response)) {
-                    response = LocationResults::Unavailable;
+                    if (_cancelRequested.load()) {
+                        if (bestLocation.fix) {
+                            lastLocation = bestLocation;
+                        }
+                        _stats.cancelled = true;
+                        serviceWaiters(0, true, LocationResults::Cancelled, nextDeadline);
+                        break;
+                    }
                 }
 
-                if (timeToFirstFixMs) {
-                    lastLocation.timeToFirstFix = (float)timeToFirstFixMs / 1000.0;
+                if (!concurrentGnssAndCellularSupported() || _stats.cancelled) {
+                    endSession(_stats);
                 }
-                if (event.point) {
-                    *event.point = lastLocation;
+                _cancelRequested.store(false);
+                if (_stats.cancelled) {
+                    _stats.preemptLatencyMs = (uint32_t)(millis() - _cancelRequestMs.load());
+                    locationLog.info("acquisition cancelled, session released in %lu ms", _stats.preemptLatencyMs);
                 }
-                lastResults = response;
 
-                if (event.sendResponse) {
-                    locationLog.trace("Sending synchronous completion");
-                    os_queue_put(_responseQueue, &response, 0, nullptr);
+                _stats.durationMs = (uint32_t)(System.millis() - start);
+                if (!_stats.cancelled && (LocationResults::Fixed == lastResults)) {
+                    // Smoothed with a weight of 1/4 for the newest acquisition
+                    _convergeEstimateMs = _convergeEstimateMs ? (_convergeEstimateMs * 3 + _stats.durationMs) / 4 : _stats.durationMs;
                 }
-                else if (event.doneCallback) {
-                    locationLog.trace("Sending asynchronous completion");
-                    event.doneCallback(response, lastLocation);
-                }
-
+                locationLog.info("acquisition %lu ms, ttff %lu ms, %u requests, %u polls (%u no fix), %u AT commands, modem %lu ms (max %lu ms per poll)",
+                    _stats.durationMs, _stats.ttffMs, _stats.requestCount, _stats.pollCount, _stats.noFixCount, _stats.atCommandCount, _stats.modemTimeMs, _stats.maxPollModemTimeMs);
                 break;
             }
 
@@ -546,6 +1065,28 @@ bool QuectelGnssRK::publishLocationEvent(const LocationPoint *point) {
     return published;
 }    
 
+size_t QuectelGnssRK::publishBatchEvent(const LocationPoint *points, size_t numPoints) {
+    size_t consumed = 0;
+
+    if (Particle.connected()) {
+        buildBatchPublish(_publishBuffer, sizeof(_publishBuffer), points, numPoints, _reqid++, consumed);
+        locationLog.info("Publishing loc-delta event (%u bytes)", (unsigned)strlen(_publishBuffer));
+        if (!Particle.publish("loc-delta", _publishBuffer)) {
+            consumed = 0;
+        }
+    }
+
+    return consumed;
+}
+
+// [static]
+void QuectelGnssRK::toBatchFix(const LocationPoint &point, LocationBatch::Fix &fix) {
+    fix.time = (uint32_t)point.epochTime;
+    fix.lat = (int32_t)lround(point.latitude * 10000000.0);
+    fix.lon = (int32_t)lround(point.longitude * 10000000.0);
+    fix.alt = (int32_t)lround((double)point.altitude * 100.0);
+}
+
 #ifdef SYSTEM_VERSION_v620
 void QuectelGnssRK::getLocationEventVariant(Variant &obj, const LocationPoint *point) {
     if (!point) {
@@ -588,6 +1129,51 @@ String QuectelGnssRK::LocationPoint::toStringSimple() const {
 }
 
 
+size_t QuectelGnssRK::buildBatchPublish(char* buffer, size_t len, const LocationPoint *points, size_t numPoints, unsigned int seq, size_t &consumed) {
+    // Room left for the base64 data after the JSON around it, with a margin for the number of digits
+    const size_t overhead = 64;
+    uint8_t batchBuf[(particle::protocol::MAX_EVENT_DATA_LENGTH - overhead) / 4 * 3];
+    size_t batchSize = (len > overhead) ? (len - overhead) / 4 * 3 : 0;
+    if (batchSize > sizeof(batchBuf)) {
+        batchSize = sizeof(batchBuf);
+    }
+
+    LocationBatch::Encoder encoder(batchBuf, batchSize);
+    for(consumed = 0; consumed < numPoints; consumed++) {
+        if (points[consumed].fix == 0) {
+            continue;
+        }
+        LocationBatch::Fix fix;
+        toBatchFix(points[consumed], fix);
+        if (!encoder.add(fix)) {
+            break;
+        }
+    }
+
+    memset(buffer, 0, len);
+    JSONBufferWriter writer(buffer, len);
+    writer.beginObject();
+        writer.name("cmd").value("loc-delta");
+        writer.name("req_id").value(seq);
+        writer.name("n").value((unsigned int)encoder.count());
+        writer.name("d");
+    size_t prefixLen = writer.dataSize();
+
+    // The base64 string is written directly after the key, then the JSON is closed
+    size_t dataLen = 0;
+    if (prefixLen + 1 < len) {
+        buffer[prefixLen] = '"';
+        dataLen = LocationBatch::base64Encode(batchBuf, encoder.size(), &buffer[prefixLen + 1], len - prefixLen - 1);
+    }
+    size_t offset = prefixLen + 1 + dataLen;
+    if (offset + 3 <= len) {
+        strcpy(&buffer[offset], "\"}");
+        offset += 2;
+    }
+
+    return offset;
+}
+
 void QuectelGnssRK::LocationPoint::toJsonWriter(JSONWriter &writer, bool wrapInObject) const {
 
     if (wrapInObject) {
@@ -648,6 +1234,238 @@ void QuectelGnssRK::LocationPoint::toVariant(Variant &obj) const {
 }
 #endif // SYSTEM_VERSION_v620
 
+//
+// NmeaParser
+//
+void QuectelGnssRK::NmeaParser::reset() {
+    _state = State::Start;
+    _len = 0;
+    _checksum = 0;
+    _expected = 0;
+    memset(&_point, 0, sizeof(_point));
+    _day = _month = _year = 0;
+    _gsaMode = 0;
+    _positionUpdates = 0;
+    _errors = 0;
+}
+
+bool QuectelGnssRK::NmeaParser::feed(char c) {
+    auto hexValue = [](char h) -> int {
+        if (h >= '0' && h <= '9') return h - '0';
+        if (h >= 'A' && h <= 'F') return h - 'A' + 10;
+        if (h >= 'a' && h <= 'f') return h - 'a' + 10;
+        return -1;
+    };
+
+    if ('$' == c) {
+        // Always resynchronize on a start character, even mid-sentence
+        if (State::Start != _state) {
+            _errors++;
+        }
+        _state = State::Body;
+        _len = 0;
+        _checksum = 0;
+        return false;
+    }
+
+    switch (_state) {
+        case State::Start:
+            break;
+
+        case State::Body:
+            if ('*' == c) {
+                _state = State::Checksum1;
+            }
+            else if ('\r' == c || '\n' == c || _len >= MAX_SENTENCE_LEN) {
+                // Sentences without a checksum are not accepted
+                _errors++;
+                _state = State::Start;
+            }
+            else {
+                _checksum ^= (uint8_t)c;
+                _sentence[_len++] = c;
+            }
+            break;
+
+        case State::Checksum1: {
+            int value = hexValue(c);
+            if (value < 0) {
+                _errors++;
+                _state = State::Start;
+            }
+            else {
+                _expected = (uint8_t)(value << 4);
+                _state = State::Checksum2;
+            }
+            break;
+        }
+
+        case State::Checksum2: {
+            int value = hexValue(c);
+            _state = State::Start;
+            if (value < 0 || (_expected | value) != _checksum) {
+                _errors++;
+            }
+            else {
+                _sentence[_len] = 0;
+                processSentence();
+                return true;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+size_t QuectelGnssRK::NmeaParser::feed(const char *data, size_t len) {
+    size_t count = 0;
+    for (size_t ii = 0; ii < len; ii++) {
+        if (feed(data[ii])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void QuectelGnssRK::NmeaParser::processSentence() {
+    // Split in place on commas. _sentence is modified and only valid for this call.
+    char *fields[MAX_FIELDS];
+    int numFields = 0;
+    char *cur = _sentence;
+    fields[numFields++] = cur;
+    while (*cur && numFields < MAX_FIELDS) {
+        if (',' == *cur) {
+            *cur = 0;
+            fields[numFields++] = cur + 1;
+        }
+        cur++;
+    }
+
+    // Address field is a 2 character talker followed by the sentence type, like GPGGA or GNRMC
+    if (strlen(fields[0]) != 5) {
+        return;
+    }
+    const char *type = &fields[0][2];
+    if (0 == strcmp(type, "GGA")) {
+        processGga(fields, numFields);
+    }
+    else if (0 == strcmp(type, "RMC")) {
+        processRmc(fields, numFields);
+    }
+    else if (0 == strcmp(type, "GSA")) {
+        processGsa(fields, numFields);
+    }
+}
+
+void QuectelGnssRK::NmeaParser::updateEpochTime(const char *timeField) {
+    // hhmmss.ss
+    unsigned int hour, minute, second, fraction = 0;
+    int fracDigits = 0;
+    ResponseTokenizer tok(timeField);
+    if (!tok.uintField(hour, 2) || !tok.uintField(minute, 2) || !tok.uintField(second, 2)) {
+        return;
+    }
+    if (tok.expectChar('.')) {
+        tok.uintField(fraction, 3, &fracDigits);
+    }
+    _point.epochHundredths = (1 == fracDigits) ? fraction * 10 : ((3 == fracDigits) ? fraction / 10 : fraction);
+
+    if (0 == _day) {
+        // No RMC date yet
+        return;
+    }
+    std::tm timeinfo = {};
+    timeinfo.tm_year = _year + 2000 - 1900;
+    timeinfo.tm_mon = _month - 1;
+    timeinfo.tm_mday = _day;
+    timeinfo.tm_hour = hour;
+    timeinfo.tm_min = minute;
+    timeinfo.tm_sec = second;
+    _point.epochTime = std::mktime(&timeinfo);
+}
+
+void QuectelGnssRK::NmeaParser::processGga(char **fields, int numFields) {
+    // $xxGGA,time,lat,N/S,lon,E/W,quality,nsat,hdop,alt,M,sep,M,age,station*hh
+    if (numFields < 10) {
+        return;
+    }
+    _positionUpdates++;
+
+    unsigned int quality = 0;
+    ResponseTokenizer(fields[6]).uintField(quality);
+    if (0 == quality) {
+        _point.fix = 0;
+        return;
+    }
+
+    double lat, lon;
+    if (!nmeaCoordinate(fields[2], fields[3], lat) || !nmeaCoordinate(fields[4], fields[5], lon)) {
+        _point.fix = 0;
+        return;
+    }
+    _point.latitude = lat;
+    _point.longitude = lon;
+    _point.fix = (_gsaMode >= 2) ? _gsaMode : 2;
+    updateEpochTime(fields[1]);
+    ResponseTokenizer(fields[7]).uintField(_point.satsInUse);
+    ResponseTokenizer(fields[8]).floatField(_point.horizontalDop);
+    ResponseTokenizer(fields[9]).floatField(_point.altitude);
+}
+
+void QuectelGnssRK::NmeaParser::processRmc(char **fields, int numFields) {
+    // $xxRMC,time,status,lat,N/S,lon,E/W,speed knots,course,date ddmmyy,...*hh
+    if (numFields < 10) {
+        return;
+    }
+    _positionUpdates++;
+
+    ResponseTokenizer dateTok(fields[9]);
+    unsigned int day, month, year;
+    if (dateTok.uintField(day, 2) && dateTok.uintField(month, 2) && dateTok.uintField(year, 2)) {
+        _day = day;
+        _month = month;
+        _year = year;
+    }
+
+    if ('A' != fields[2][0]) {
+        _point.fix = 0;
+        return;
+    }
+
+    double lat, lon;
+    if (!nmeaCoordinate(fields[3], fields[4], lat) || !nmeaCoordinate(fields[5], fields[6], lon)) {
+        _point.fix = 0;
+        return;
+    }
+    _point.latitude = lat;
+    _point.longitude = lon;
+    if (0 == _point.fix) {
+        _point.fix = (_gsaMode >= 2) ? _gsaMode : 2;
+    }
+    updateEpochTime(fields[1]);
+
+    float knots;
+    if (ResponseTokenizer(fields[7]).floatField(knots)) {
+        _point.speed = knots * 0.514444f;
+    }
+    ResponseTokenizer(fields[8]).floatField(_point.heading);
+}
+
+void QuectelGnssRK::NmeaParser::processGsa(char **fields, int numFields) {
+    // $xxGSA,mode,fix 1-3,12 x prn,pdop,hdop,vdop*hh
+    if (numFields < 18) {
+        return;
+    }
+    unsigned int mode = 0;
+    ResponseTokenizer(fields[2]).uintField(mode);
+    _gsaMode = (mode >= 2) ? mode : 0;
+    if (_point.fix && _gsaMode) {
+        _point.fix = _gsaMode;
+    }
+    ResponseTokenizer(fields[16]).floatField(_point.horizontalDop);
+    ResponseTokenizer(fields[17]).floatField(_point.verticalDop);
+}
+
 bool QuectelGnssRK::concurrentGnssAndCellularSupported() const {
     if (_ModemType::BG95_M5 == _modemType) { // -M5 or -S5
         return false;
@@ -658,20 +1476,80 @@ bool QuectelGnssRK::concurrentGnssAndCellularSupported() const {
 }
 
 // [static]
-void QuectelGnssRK::addToEventHandler(Variant &eventData, Variant &locVariant) {
-    bool done = false;
+bool QuectelGnssRK::concurrentGatherSupported() {
+    auto& gnss = instance();
+
+    if (gnss.modemNotDetected() && !gnss.detectModemType()) {
+        return false;
+    }
+    return gnss.concurrentGnssAndCellularSupported();
+}
+
+// [static]
+void QuectelGnssRK::prefetchHandler() {
+    auto& gnss = instance();
+
+    locationLog.trace("prefetchHandler starting acquisition");
+    auto startMs = millis();
+    auto result = gnss.getLocationAsync([](LocationResults, const LocationPoint&) {});
+
+    // Only a started acquisition makes a later fix fresh enough for getEventLocation()
+    if (LocationResults::Acquiring == result || LocationResults::Fixed == result) {
+        gnss._prefetchStartMs.store(startMs);
+    }
+    else {
+        locationLog.trace("prefetchHandler could not start acquisition, result %d", (int)result);
+    }
+}
+
+std::chrono::milliseconds QuectelGnssRK::prefetchLeadTime() {
+    auto& gnss = instance();
+
+    uint32_t maxMs = gnss._conf.maximumFixTime() * 1000;
+    if (0 == gnss._convergeEstimateMs) {
+        return std::chrono::milliseconds(maxMs);
+    }
 
+    // Allow 25% over the recent average plus one settling poll, but never more than the acquisition could take
+    uint32_t leadMs = gnss._convergeEstimateMs + gnss._convergeEstimateMs / 4 + gnss._conf.pollIntervalSettling();
+    return std::chrono::milliseconds((leadMs < maxMs) ? leadMs : maxMs);
+}
+
+void QuectelGnssRK::addToEventHandler(Variant &eventData, Variant &locVariant) {
     locationLog.trace("addToEventHandler starting");
 
-    LocationResults result = instance().getLocationAsync([&done, &locVariant](LocationResults, const LocationPoint& point) {
-        point.toVariant(locVariant);
-        done = true;
-    });
+    LocationPoint point;
+    auto result = instance().getEventLocation(point);
+    point.toVariant(locVariant);
+
+    locationLog.trace("addToEventHandler complete, result %d", (int)result);
+}
+
+void QuectelGnssRK::addToEventWriterHandler(JSONWriter &writer, bool inLoc) {
+    if (!inLoc) {
+        return;
+    }
+    locationLog.trace("addToEventWriterHandler starting");
+
+    LocationPoint point;
+    auto result = instance().getEventLocation(point);
+    point.toJsonWriter(writer, false);
+
+    locationLog.trace("addToEventWriterHandler complete, result %d", (int)result);
+}
 
-    while(!done) {
-        delay(1);
+QuectelGnssRK::LocationResults QuectelGnssRK::getEventLocation(LocationPoint& point) {
+    // getLocation() waits on a per-request semaphore with the request deadline. If the acquisition completes
+    // after the deadline, the result is discarded by the worker rather than written to this stack frame.
+    // A fix from an acquisition started by prefetchHandler() is fresh enough to use
+    LocationRequest request;
+    request.timeout(_conf.eventHandlerBudget());
+    auto prefetchStart = _prefetchStartMs.exchange(0);
+    if (prefetchStart) {
+        request.maximumAge(millis() - prefetchStart);
     }
 
-    locationLog.trace("addToEventHandler getLocationAsync complete");
+    // If the budget expires the point is left zeroed, which produces lck:0
+    return getLocation(point, request);
 }
 
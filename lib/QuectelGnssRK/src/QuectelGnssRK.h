@@ -3,6 +3,9 @@
 
 #include "Particle.h"
 
+#include "LocationBatch.h"
+#include "QuectelResponseParser.h"
+
 // Repository: https://github.com/rickkas7/QuectelGnssRK
 // License: Apache 2.0
 // This library is a modified version of https://github.com/particle-iot/particle-som-gnss/ with a modified API and additional features.
@@ -31,6 +34,7 @@ public:
     struct LocationPoint {
         unsigned int fix;               /**< Indication of GNSS locked status */
         time_t epochTime;               /**< Epoch time from device sources */
+        unsigned int epochHundredths;   /**< Hundredths of a second past epochTime, 0 to 99 */
         time32_t systemTime;            /**< System epoch time */
         double latitude;                /**< Point latitude in degrees */
         double longitude;               /**< Point longitude in degrees */
@@ -85,6 +89,112 @@ public:
         LOCATION_CONST_GPS_QZSS         = (1 << 3),  //<! GPS and QZSS (not supported on EG91)
     };
 
+    /**
+     * @brief How the worker thread obtains position data from the modem during an acquisition
+     */
+    enum class AcquisitionMode {
+        Qloc,                   /**< Poll AT+QGPSLOC=2 (default) */
+        Nmea,                   /**< Enable nmeasrc and decode GGA, RMC, and GSA sentences with NmeaParser */
+    };
+
+    /**
+     * @brief Incremental, checksum-validating NMEA 0183 decoder
+     *
+     * Feed it bytes in any chunking (a whole sentence, part of one, or several at once). Each sentence is
+     * collected between '$' and its '*hh' checksum and only applied to the location point once the checksum
+     * matches. GGA, RMC, and GSA sentences from any talker (GP, GL, GA, GB, GQ, GN) are decoded; others
+     * are ignored.
+     *
+     * This is used by AcquisitionMode::Nmea but can also be used directly with an external GNSS receiver.
+     */
+    class NmeaParser {
+    public:
+        NmeaParser() { reset(); }
+
+        /**
+         * @brief Clear the decoded location and all parser state
+         */
+        void reset();
+
+        /**
+         * @brief Process one byte
+         *
+         * @param c Byte received
+         * @return true if this byte completed a valid sentence
+         */
+        bool feed(char c);
+
+        /**
+         * @brief Process a block of bytes
+         *
+         * @param data Bytes received, need not be null terminated
+         * @param len Number of bytes
+         * @return size_t Number of valid sentences completed
+         */
+        size_t feed(const char *data, size_t len);
+
+        /**
+         * @brief Location decoded from the sentences received so far
+         *
+         * fix is 0 if there is no fix, otherwise 2 (2D) or 3 (3D), the same values AT+QGPSLOC reports.
+         * horizontalAccuracy, verticalAccuracy, systemTime, and timeToFirstFix are not available from NMEA and are 0.
+         */
+        const LocationPoint &getPoint() const { return _point; };
+
+        /**
+         * @brief Returns true if the most recent GGA or RMC sentence reported a valid fix
+         */
+        bool hasFix() const { return 0 != _point.fix; };
+
+        /**
+         * @brief Incremented each time a GGA or RMC sentence updates the position or fix state
+         *
+         * Compare before and after feeding data to know whether anything new arrived.
+         */
+        unsigned int getPositionUpdateCount() const { return _positionUpdates; };
+
+        /**
+         * @brief Number of sentences dropped because of a bad checksum or overflow
+         */
+        unsigned int getErrorCount() const { return _errors; };
+
+    protected:
+        enum class State {
+            Start,              /**< Waiting for '$' */
+            Body,               /**< Collecting sentence, accumulating checksum */
+            Checksum1,          /**< First hex digit of checksum */
+            Checksum2,          /**< Second hex digit of checksum */
+        };
+
+        void processSentence();
+        void processGga(char **fields, int numFields);
+        void processRmc(char **fields, int numFields);
+        void processGsa(char **fields, int numFields);
+        void updateEpochTime(const char *timeField);
+
+        static constexpr size_t MAX_SENTENCE_LEN = 82;      /**< NMEA 0183 limit, excluding $ and checksum */
+        static constexpr int MAX_FIELDS = 24;
+
+        State _state;
+        char _sentence[MAX_SENTENCE_LEN + 1];
+        size_t _len;
+        uint8_t _checksum;
+        uint8_t _expected;
+
+        LocationPoint _point;
+        unsigned int _day;
+        unsigned int _month;
+        unsigned int _year;
+        unsigned int _gsaMode;
+        unsigned int _positionUpdates;
+        unsigned int _errors;
+    };
+
+
+    /**
+     * @brief Maximum value for LocationConfiguration::settlingCount()
+     */
+    static constexpr unsigned int MAX_SETTLING_COUNT = 10;
 
     /**
      * @brief LocationConfiguration class to configure Location class options
@@ -100,7 +210,15 @@ public:
             _antennaPin(PIN_INVALID),
             _hdop(100),
             _hacc(50.0),
-            _maxFixSeconds(90) {
+            _maxFixSeconds(90),
+            _acquisitionMode(AcquisitionMode::Qloc),
+            _settlingCount(2),
+            _spreadThreshold(0.0),
+            _hdopAccuracyFactor(0.0),
+            _pollSettlingMs(1000),
+            _pollSearchMinMs(1000),
+            _pollSearchMaxMs(1000),
+            _eventHandlerBudgetMs(0) {
         }
 
         /**
@@ -213,6 +331,162 @@ public:
             return _maxFixSeconds;
         }
 
+        /**
+         * @brief Set how positions are read from the modem during acquisition
+         *
+         * @param mode AcquisitionMode::Qloc (default) or AcquisitionMode::Nmea
+         * @return LocationConfiguration&
+         *
+         * In Nmea mode the modem's NMEA output is enabled with AT+QGPSCFG="nmeasrc",1 and the GGA, RMC, and GSA
+         * sentences are read in a single AT transaction and decoded with NmeaParser. This also yields GSA vertical
+         * DOP, which AT+QGPSLOC does not report.
+         */
+        LocationConfiguration& acquisitionMode(AcquisitionMode mode) {
+            _acquisitionMode = mode;
+            return *this;
+        }
+
+        /**
+         * @brief Get how positions are read from the modem during acquisition
+         *
+         * @return AcquisitionMode
+         */
+        AcquisitionMode acquisitionMode() const {
+            return _acquisitionMode;
+        }
+
+        /**
+         * @brief Set the number of consecutive fixes required before a position is accepted
+         *
+         * @param count Number of consecutive fixes, 1 to MAX_SETTLING_COUNT. Default is 2.
+         * @return LocationConfiguration&
+         *
+         * The acquisition ends as soon as the most recent count fixes are consecutive and the HDOP, horizontal
+         * accuracy, and position spread thresholds are all met. A poll without a fix restarts the count.
+         */
+        LocationConfiguration& settlingCount(unsigned int count) {
+            if (1 > count)
+                count = 1;
+            else if (MAX_SETTLING_COUNT < count)
+                count = MAX_SETTLING_COUNT;
+            _settlingCount = count;
+            return *this;
+        }
+
+        /**
+         * @brief Get the number of consecutive fixes required before a position is accepted
+         *
+         * @return unsigned int
+         */
+        unsigned int settlingCount() const {
+            return _settlingCount;
+        }
+
+        /**
+         * @brief Set the maximum position spread, in meters, of the settling fixes
+         *
+         * @param meters Maximum distance of any of the last settlingCount() fixes from their mean. 0 (default) disables the check.
+         * @return LocationConfiguration&
+         */
+        LocationConfiguration& positionSpreadThreshold(float meters) {
+            _spreadThreshold = meters;
+            return *this;
+        }
+
+        /**
+         * @brief Get the maximum position spread, in meters, of the settling fixes
+         *
+         * @return float Maximum spread, or 0 if the check is disabled
+         */
+        float positionSpreadThreshold() const {
+            return _spreadThreshold;
+        }
+
+        /**
+         * @brief Estimate horizontal accuracy from HDOP when the modem does not report it (EG91)
+         *
+         * @param factor Meters of horizontal error per unit of HDOP (user equivalent range error). 0 (default) disables the estimate.
+         * @return LocationConfiguration&
+         *
+         * The EG91 does not report horizontal accuracy, so haccThreshold() is never applied on that modem. When a factor
+         * is set, HDOP x factor is compared against haccThreshold() instead. The estimate is only used for the
+         * convergence decision; it is not stored in LocationPoint::horizontalAccuracy. A typical value is 5.0.
+         */
+        LocationConfiguration& hdopAccuracyFactor(float factor) {
+            _hdopAccuracyFactor = factor;
+            return *this;
+        }
+
+        /**
+         * @brief Get the HDOP to horizontal accuracy factor
+         *
+         * @return float Factor, or 0 if the estimate is disabled
+         */
+        float hdopAccuracyFactor() const {
+            return _hdopAccuracyFactor;
+        }
+
+        /**
+         * @brief Set the poll scheduling policy used during acquisition
+         *
+         * @param settlingMs Interval between polls once the modem is reporting fixes. Default is 1000.
+         * @param searchMinMs Interval after the first poll without a fix (CME error 516). Default is 1000.
+         * @param searchMaxMs The no-fix interval doubles on each consecutive no-fix poll up to this value. Default is 1000.
+         * @return LocationConfiguration&
+         *
+         * Backing off while searching reduces AT traffic before the first fix. A short settling interval reduces the
+         * time to collect settlingCount() fixes once they start arriving. The defaults poll once per second throughout.
+         */
+        LocationConfiguration& pollInterval(system_tick_t settlingMs, system_tick_t searchMinMs, system_tick_t searchMaxMs) {
+            _pollSettlingMs = settlingMs;
+            _pollSearchMinMs = searchMinMs;
+            _pollSearchMaxMs = (searchMaxMs < searchMinMs) ? searchMinMs : searchMaxMs;
+            return *this;
+        }
+
+        /**
+         * @brief Get the interval between polls once the modem is reporting fixes
+         */
+        system_tick_t pollIntervalSettling() const {
+            return _pollSettlingMs;
+        }
+
+        /**
+         * @brief Get the interval after the first poll without a fix
+         */
+        system_tick_t pollIntervalSearchMin() const {
+            return _pollSearchMinMs;
+        }
+
+        /**
+         * @brief Get the maximum interval between polls without a fix
+         */
+        system_tick_t pollIntervalSearchMax() const {
+            return _pollSearchMaxMs;
+        }
+
+        /**
+         * @brief Set the time budget for addToEventHandler() when used with LocationFusionRK
+         *
+         * @param budgetMs Milliseconds to wait for a fix before the loc event is published with lck:0. 0 (default)
+         * uses maximumFixTime().
+         * @return LocationConfiguration&
+         *
+         * The handler runs on the LocationFusionRK worker thread, so this bounds how long a publish can be held up
+         * waiting for GNSS.
+         */
+        LocationConfiguration& eventHandlerBudget(system_tick_t budgetMs) {
+            _eventHandlerBudgetMs = budgetMs;
+            return *this;
+        }
+
+        /**
+         * @brief Get the time budget for addToEventHandler() in milliseconds, 0 to use maximumFixTime()
+         */
+        system_tick_t eventHandlerBudget() const {
+            return _eventHandlerBudgetMs;
+        }
+
         /**
          * @brief Copy an existing configuration object
          * 
@@ -226,7 +500,16 @@ public:
             this->_constellations = rhs._constellations;
             this->_antennaPin = rhs._antennaPin;
             this->_hdop = rhs._hdop;
+            this->_hacc = rhs._hacc;
             this->_maxFixSeconds = rhs._maxFixSeconds;
+            this->_acquisitionMode = rhs._acquisitionMode;
+            this->_settlingCount = rhs._settlingCount;
+            this->_spreadThreshold = rhs._spreadThreshold;
+            this->_hdopAccuracyFactor = rhs._hdopAccuracyFactor;
+            this->_pollSettlingMs = rhs._pollSettlingMs;
+            this->_pollSearchMinMs = rhs._pollSearchMinMs;
+            this->_pollSearchMaxMs = rhs._pollSearchMaxMs;
+            this->_eventHandlerBudgetMs = rhs._eventHandlerBudgetMs;
 
             return *this;
         }
@@ -237,6 +520,14 @@ public:
         int _hdop;
         float _hacc;
         unsigned int _maxFixSeconds;
+        AcquisitionMode _acquisitionMode;
+        unsigned int _settlingCount;
+        float _spreadThreshold;
+        float _hdopAccuracyFactor;
+        system_tick_t _pollSettlingMs;
+        system_tick_t _pollSearchMinMs;
+        system_tick_t _pollSearchMaxMs;
+        system_tick_t _eventHandlerBudgetMs;
     };
 
 
@@ -247,6 +538,7 @@ public:
     enum class LocationCommand {
         None,                   /**< Do nothing */
         Acquire,                /**< Perform GNSS acquisition */
+        Cancel,                 /**< Abort the acquisition in progress */
         Exit,                   /**< Exit from thread */
     };
 
@@ -262,6 +554,7 @@ public:
         Pending,                /**< A previous GNSS acquisition is in progress */
         Fixed,                  /**< GNSS position has been aquired and fixed */
         TimedOut,               /**< GNSS has not fix */
+        Cancelled,              /**< Acquisition was cancelled or preempted, the point is the best fix so far if any */
     };
 
     /**
@@ -271,24 +564,133 @@ public:
     typedef std::function<void(LocationResults, const LocationPoint& point)> LocationDoneCallback;
 
     /**
-     * @brief State data passed to the worker thread for getLocation and getLocationAsync calls
+     * @brief Callback prototype for subscribe(). Called from the GNSS worker thread for each fix.
+     */
+    typedef std::function<void(const LocationPoint& point)> LocationFixCallback;
+
+    /**
+     * @brief Number of fixes kept by getRecentFixes()
+     */
+    static constexpr size_t TRACKING_BUFFER_SIZE = 16;
+
+    /**
+     * @brief Maximum number of simultaneous subscribe() registrations
+     */
+    static constexpr size_t MAX_FIX_SUBSCRIBERS = 8;
+
+    /**
+     * @brief Maximum number of getLocation() and getLocationAsync() requests that can wait on one acquisition
+     */
+    static constexpr size_t MAX_LOCATION_WAITERS = 8;
+
+    /**
+     * @brief Per-request requirements for getLocation() and getLocationAsync()
+     *
+     * Any value left at 0 uses the corresponding LocationConfiguration setting.
+     */
+    class LocationRequest {
+    public:
+        /**
+         * @brief Construct a new Location Request object with the configuration defaults
+         */
+        LocationRequest() {}
+
+        /**
+         * @brief How long this request will wait for a fix, in milliseconds
+         *
+         * @param timeoutMs Time from the request until TimedOut is returned. 0 uses maximumFixTime().
+         * @return LocationRequest&
+         */
+        LocationRequest& timeout(system_tick_t timeoutMs) {
+            _timeoutMs = timeoutMs;
+            return *this;
+        }
+
+        /**
+         * @brief Get the request timeout in milliseconds, 0 to use the configuration
+         *
+         * @return system_tick_t
+         */
+        system_tick_t timeout() const {
+            return _timeoutMs;
+        }
+
+        /**
+         * @brief Horizontal accuracy required to complete this request, in meters
+         *
+         * @param hacc Accuracy in meters. 0 uses haccThreshold().
+         * @return LocationRequest&
+         */
+        LocationRequest& horizontalAccuracy(float hacc) {
+            _hacc = hacc;
+            return *this;
+        }
+
+        /**
+         * @brief Get the required horizontal accuracy in meters, 0 to use the configuration
+         *
+         * @return float
+         */
+        float horizontalAccuracy() const {
+            return _hacc;
+        }
+
+        /**
+         * @brief Accept a fix from a previous acquisition if it is no older than this, in milliseconds
+         *
+         * @param maximumAgeMs Maximum age of a converged fix to return immediately. 0 (default) always waits for a
+         * new or in-progress acquisition.
+         * @return LocationRequest&
+         */
+        LocationRequest& maximumAge(system_tick_t maximumAgeMs) {
+            _maximumAgeMs = maximumAgeMs;
+            return *this;
+        }
+
+        /**
+         * @brief Get the maximum age of a previous fix to accept, 0 to always acquire
+         *
+         * @return system_tick_t
+         */
+        system_tick_t maximumAge() const {
+            return _maximumAgeMs;
+        }
+
+    private:
+        system_tick_t _timeoutMs {};
+        float _hacc {};
+        system_tick_t _maximumAgeMs {};
+    };
+
+    /**
+     * @brief Command passed to the worker thread. Request details are held in the waiter table, not the command.
      */
     struct LocationCommandContext {
         LocationCommand command;             /**< command request from user thread */ 
-        bool sendResponse;                   /**< send response back to user thread */ 
-        LocationDoneCallback doneCallback;   /**< call a callback function (if send response is not set) */ 
-        bool publish;                        /**< publish a loc event if a fix is obtained */ 
-        LocationPoint* point;                /**< where to store the location result if not null*/ 
 
         LocationCommandContext() {
             command = LocationCommand::None;
-            sendResponse = false;
-            doneCallback = nullptr;
-            publish = false;
-            point = nullptr;
         }
     };
 
+    /**
+     * @brief Modem usage for one getLocation() or getLocationAsync() acquisition
+     *
+     * Each poll is one AT transaction. On BG95 the position and estimation_error queries are batched together.
+     */
+    struct AcquisitionStats {
+        unsigned int pollCount;         /**< Number of position polls */
+        unsigned int atCommandCount;    /**< Number of AT transactions, including session start and end */
+        uint32_t modemTimeMs;           /**< Total time blocked in Cellular.command */
+        uint32_t maxPollModemTimeMs;    /**< Longest single poll transaction */
+        uint32_t durationMs;            /**< Total acquisition time */
+        uint32_t ttffMs;                /**< Time from the start of this acquisition to its first fix, 0 if none */
+        unsigned int noFixCount;        /**< Polls that returned CME error 516 (no fix) */
+        unsigned int requestCount;      /**< Number of getLocation() and getLocationAsync() requests this acquisition completed */
+        bool cancelled;                 /**< Acquisition ended by cancel() or the cellular priority check */
+        uint32_t preemptLatencyMs;      /**< Time from the cancel request until the GNSS session was released */
+    };
+
     /**
      * @brief Error codes returned from Cellular.command as CME errors.
      */
@@ -333,8 +735,23 @@ public:
      * @param point Location point with position
      * @param publish Publish location point after acquisition
      * @return LocationResults
+     *
+     * If an acquisition is already in progress this request joins it rather than starting another.
+     */
+    LocationResults getLocation(LocationPoint& point, bool publish = false) {
+        return getLocation(point, LocationRequest(), publish);
+    }
+
+    /**
+     * @brief Get GNSS position, synchronously, with a per-request timeout and accuracy
+     *
+     * @param point Location point with position
+     * @param request Timeout and accuracy for this request
+     * @param publish Publish location point after acquisition
+     * @return LocationResults Fixed, TimedOut, Unavailable, Unsupported, or Pending if MAX_LOCATION_WAITERS requests
+     * are already waiting
      */
-    LocationResults getLocation(LocationPoint& point, bool publish = false);
+    LocationResults getLocation(LocationPoint& point, const LocationRequest& request, bool publish = false);
 
     /**
      * @brief Get GNSS position, asynchronously, with given callback
@@ -343,9 +760,107 @@ public:
      * @return LocationResults
      * 
      * The results are not automatically published when using a callback, but you can use publishLocationEvent from your callback.
+     * If an acquisition is already in progress this request joins it rather than starting another.
+     */
+    LocationResults getLocationAsync(LocationDoneCallback callback) {
+        return getLocationAsync(callback, LocationRequest());
+    }
+
+    /**
+     * @brief Get GNSS position, asynchronously, with a per-request timeout and accuracy
+     *
+     * @param callback Callback function to call after acquisition completion. Called from the GNSS worker thread.
+     * @param request Timeout and accuracy for this request
+     * @return LocationResults Acquiring if the request was queued, Pending if MAX_LOCATION_WAITERS requests are
+     * already waiting, or Unavailable/Unsupported
+     *
+     * All requests made while an acquisition is running attach to it. The acquisition continues until every attached
+     * request has reached its accuracy or its timeout, and each request completes as soon as its own condition is met.
+     */
+    LocationResults getLocationAsync(LocationDoneCallback callback, const LocationRequest& request);
+
+
+    /**
+     * @brief Start continuous tracking, keeping the GNSS session open and polling for fixes
+     *
+     * @param periodMs How often to poll for a fix. Default is 1000 milliseconds.
+     * @return LocationResults Acquiring if tracking started, Unsupported on modems that cannot run GNSS and cellular
+     * concurrently (BG95), or Unavailable if the modem is off.
+     *
+     * Each fix is stored in the buffer read by getRecentFixes() and passed to the subscribe() callbacks. Fixes
+     * from getLocation() and getLocationAsync() acquisitions are delivered the same way, so subscribers do not need
+     * to start acquisitions of their own. getLocation() and getLocationAsync() still work while tracking and use the
+     * same GNSS session.
+     */
+    LocationResults startTracking(system_tick_t periodMs = 1000);
+
+    /**
+     * @brief Stop continuous tracking
+     *
+     * On EG91 the GNSS session is left open, the same as after getLocation().
+     */
+    void stopTracking();
+
+    /**
+     * @brief Returns true if continuous tracking is enabled
+     */
+    bool isTracking() const { return _tracking.load(); };
+
+    /**
+     * @brief Register a callback to be called with fixes as they are produced
+     *
+     * @param callback Function or lambda to call. It runs on the GNSS worker thread so it should not block.
+     * @param rateDivisor Call back on every Nth fix. Default is 1 (every fix).
+     * @return int Subscription ID (> 0) to pass to unsubscribe(), or -1 if MAX_FIX_SUBSCRIBERS are already registered
+     */
+    int subscribe(LocationFixCallback callback, unsigned int rateDivisor = 1);
+
+    /**
+     * @brief Remove a callback registered with subscribe(). It is safe to call this from the callback.
+     *
+     * @param id Subscription ID returned by subscribe()
+     * @return true if the subscription was found and removed
+     */
+    bool unsubscribe(int id);
+
+    /**
+     * @brief Copy the most recent fixes, oldest first
+     *
+     * @param points Array to copy into
+     * @param maxPoints Number of entries in points. At most TRACKING_BUFFER_SIZE are available.
+     * @return size_t Number of fixes copied
+     */
+    size_t getRecentFixes(LocationPoint *points, size_t maxPoints) const;
+
+    /**
+     * @brief Total number of fixes produced since boot
+     */
+    uint32_t getFixCount() const { return _fixCount; };
+
+    /**
+     * @brief Get the modem usage statistics for tracking polls since startTracking() was called
+     */
+    const AcquisitionStats &getTrackingStats() const { return _trackingStats; };
+
+    /**
+     * @brief Abort the acquisition in progress
+     *
+     * All waiting requests complete with LocationResults::Cancelled and the best fix collected so far, if any. On the
+     * BG95 the GNSS session is ended so cellular data is available again. The time from this call until the session
+     * is released is reported in AcquisitionStats::preemptLatencyMs. Does nothing if no acquisition is running.
      */
-    LocationResults getLocationAsync(LocationDoneCallback callback);
+    void cancel();
 
+    /**
+     * @brief Set a function that is checked between polls to decide whether cellular needs the modem
+     *
+     * @param check Function returning true when the acquisition should be preempted, such as when an OTA or urgent
+     * publish is pending. Pass nullptr to remove it. Called from the GNSS worker thread, so it should be fast.
+     *
+     * When the check returns true the acquisition is cancelled as if cancel() had been called. Set this before
+     * starting acquisitions.
+     */
+    void setCellularPriorityCheck(std::function<bool()> check) { _cellularPriorityCheck = check; };
 
     /**
      * @brief Get the current acquisition state
@@ -365,6 +880,27 @@ public:
      */
     bool publishLocationEvent(const LocationPoint *point = nullptr);
 
+    /**
+     * @brief Publish several fixes in one loc-delta event using the LocationBatch encoding
+     *
+     * @param points Fixes to publish, oldest first, such as from getRecentFixes(). Points without a fix are skipped.
+     * @param numPoints Number of points
+     * @return size_t Number of points consumed, including skipped points. If less than numPoints, the rest did not
+     * fit and can be passed to another call. 0 if not connected or the publish failed.
+     *
+     * The event data is {"cmd":"loc-delta","req_id":1,"n":10,"d":"..."} where d is the base64 encoded
+     * LocationBatch and n the number of fixes in it. Only time, latitude, longitude, and altitude are included.
+     */
+    size_t publishBatchEvent(const LocationPoint *points, size_t numPoints);
+
+    /**
+     * @brief Convert a point to the fixed-point form used by LocationBatch
+     *
+     * @param point Point to convert
+     * @param fix Filled in with the time, latitude and longitude to 10^-7 degrees, and altitude to centimeters
+     */
+    static void toBatchFix(const LocationPoint &point, LocationBatch::Fix &fix);
+
 #ifdef SYSTEM_VERSION_v620
     /**
      * @brief Get a Variant for a location, or the last location
@@ -418,14 +954,62 @@ public:
      */
     bool getHasFix() const { return lastResults == LocationResults::Fixed; };
 
+    /**
+     * @brief Get the modem usage statistics from the previous acquisition
+     *
+     * @return const AcquisitionStats&
+     *
+     * These are also logged at info level when each acquisition completes.
+     */
+    const AcquisitionStats &getLastAcquisitionStats() const { return _stats; };
+
     /**
      * @brief Handler function used with the LocationFusionRK library
      * 
      * @param eventData 
      * @param locVariant 
+     *
+     * Blocks the caller until a fix is obtained or the eventHandlerBudget() expires, in which case locVariant is set
+     * to lck:0 and the event is published without GNSS. The wait is on a semaphore, not a polling loop.
      */
     static void addToEventHandler(Variant &eventData, Variant &locVariant);
 
+    /**
+     * @brief Handler function used with LocationFusionRK::withAddToEventWriterHandler()
+     * 
+     * @param writer 
+     * @param inLoc true when called for the inner loc object, the only time it writes anything
+     *
+     * The same as addToEventHandler() but writes the location directly into the event instead of a Variant.
+     */
+    static void addToEventWriterHandler(JSONWriter &writer, bool inLoc);
+
+    /**
+     * @brief Prefetch handler used with LocationFusionRK::withPrefetchHandler()
+     *
+     * Starts an acquisition ahead of the scheduled publish. When addToEventHandler() runs it joins the acquisition if
+     * it is still in progress, or uses its fix if it has already converged.
+     */
+    static void prefetchHandler();
+
+    /**
+     * @brief Lead time handler used with LocationFusionRK::withPrefetchHandler()
+     *
+     * @return std::chrono::milliseconds How long before the publish to start the GNSS
+     *
+     * Learned from the time recent acquisitions took to converge. Until there is a converged acquisition this is
+     * maximumFixTime().
+     */
+    static std::chrono::milliseconds prefetchLeadTime();
+
+    /**
+     * @brief Check used with LocationFusionRK::withConcurrentGather()
+     *
+     * @return true if the modem can answer cellular queries while addToEventHandler() is acquiring (EG91), false if
+     * GNSS blocks cellular (BG95) or the modem type is not known yet
+     */
+    static bool concurrentGatherSupported();
+
 private:
     enum class _ModemType {
         Unavailable,                    /**< Modem type has not been read yet likely because the modem is off */
@@ -434,37 +1018,34 @@ private:
         EG91,                           /**< EG91 modem type */
     };
 
-    struct QlocContext {
-        // QLOC parsed fields
-        unsigned int tm_hour {};
-        unsigned int tm_min {};
-        unsigned int tm_sec {};
-        unsigned int tm_day {};
-        unsigned int tm_month {};
-        unsigned int tm_year {};
-        double latitude {};
-        double longitude {};
-        unsigned int fix {};
-        float hdop {};
-        float altitude {};
-        unsigned int cogDegrees {};
-        unsigned int cogMinutes {};
-        float speedKmph {};
-        float speedKnots {};
-        unsigned int nsat {};
-
+    struct QlocContext : QuectelResponseParser::Qloc {
         // Time related
         std::tm timeinfo = {};
     };
 
-    struct EpeContext {
-        // EPE parsed fields
-        float h_acc {};
-        float v_acc {};
-        float speed_acc {};
-        float head_acc {};
+    /**
+     * @brief Sliding window of the most recent consecutive fixes, used to decide when the position has settled
+     */
+    class SettlingWindow {
+    public:
+        void reset() { _count = 0; _next = 0; };
+        void add(double latitude, double longitude);
+        unsigned int size() const { return _count; };
+
+        /**
+         * @brief Largest distance in meters of any of the newest n fixes from their mean position
+         */
+        float spreadMeters(unsigned int n) const;
+
+    private:
+        double _latitude[MAX_SETTLING_COUNT] {};
+        double _longitude[MAX_SETTLING_COUNT] {};
+        unsigned int _count {};
+        unsigned int _next {};
     };
 
+    typedef QuectelResponseParser::Epe EpeContext;
+
     QuectelGnssRK();
 
     bool modemNotDetected() const {
@@ -486,28 +1067,84 @@ private:
     int setConstellation(LocationConstellation flags);
 
     LocationCommandContext waitOnCommandEvent(system_tick_t timeout);
-    LocationResults waitOnResponseEvent(system_tick_t timeout);
+    bool getRecentFix(system_tick_t maximumAge, LocationPoint& point);
+    int addWaiter(const LocationRequest& request, LocationDoneCallback callback);
+    size_t serviceWaiters(unsigned int fixCount, bool finish, LocationResults finishResult, uint64_t& nextDeadline);
     static void stripLfCr(char* str);
-    static int glocCallback(int type, const char* buf, int len, char* locBuffer);
-    static int epeCallback(int type, const char* buf, int len, char* epeBuffer);
+    static int pollCallback(int type, const char* buf, int len, QuectelGnssRK* self);
     CME_Error parseCmeError(const char* buf);
     int parseQloc(const char* buf, QlocContext& context, LocationPoint& point);
     CME_Error parseQlocResponse(const char* buf, QlocContext& context, LocationPoint& point);
     void parseEpeResponse(const char* buf, EpeContext& context, LocationPoint& point);
+    bool checkModemReady();
+    void sessionCommand(const char* command, AcquisitionStats& stats);
+    void startSession(AcquisitionStats& stats);
+    void endSession(AcquisitionStats& stats);
+    void trackingPoll();
+    void publishFix(const LocationPoint& point);
+    CME_Error pollLocation(LocationPoint& point, AcquisitionStats& stats);
+    static float fixQuality(const LocationPoint& point);
+    bool hasConverged(const LocationPoint& point, unsigned int fixCount, float haccThreshold) const;
+    CME_Error nmeaResult(LocationPoint& point, unsigned int previousUpdates);
     void threadLoop();
     size_t buildPublish(char* buffer, size_t len, const LocationPoint& point, unsigned int seq);
+    LocationResults getEventLocation(LocationPoint& point);
+    size_t buildBatchPublish(char* buffer, size_t len, const LocationPoint *points, size_t numPoints, unsigned int seq, size_t &consumed);
 
     static QuectelGnssRK* _instance;
+    enum class WaiterState {
+        Free,
+        Waiting,                            /**< Attached to the current or next acquisition */
+        Done,                               /**< Result is ready for a synchronous caller to collect */
+    };
+    struct LocationWaiter {
+        WaiterState state {WaiterState::Free};
+        LocationDoneCallback callback;      /**< nullptr for a synchronous getLocation() waiter */
+        os_semaphore_t semaphore {};        /**< Given when a synchronous waiter completes */
+        uint64_t deadline {};               /**< System.millis() at which the request times out */
+        float hacc {};                      /**< Required horizontal accuracy in meters */
+        LocationResults result {LocationResults::Idle};
+        LocationPoint point {};
+    };
+
     os_queue_t _commandQueue;
-    os_queue_t _responseQueue;
     Thread* _thread;
     std::atomic<bool> _acquiring{false};
+    std::atomic<bool> _cancelRequested{false};
+    std::atomic<system_tick_t> _cancelRequestMs{0};
+    std::function<bool()> _cellularPriorityCheck;
+    os_mutex_t _waiterMutex {};
+    LocationWaiter _waiters[MAX_LOCATION_WAITERS];
     char _locBuffer[256];
     char _epeBuffer[256];
     QlocContext _qlocContext {};
     EpeContext _epeContext {};
+    NmeaParser _nmeaParser;
+    AcquisitionStats _stats {};
+    SettlingWindow _settlingWindow;
+
+    struct FixSubscriber {
+        int id {};                          /**< 0 if this slot is free */
+        LocationFixCallback callback;
+        unsigned int rateDivisor {1};
+        unsigned int counter {};
+    };
+    std::atomic<bool> _tracking{false};
+    system_tick_t _trackingPeriodMs {1000};
+    AcquisitionStats _trackingStats {};
+    std::atomic<bool> _trackingStatsReset{false};   /**< Set by startTracking(), cleared by the worker when it resets _trackingStats */
+    os_mutex_t _fixMutex {};
+    LocationPoint _fixRing[TRACKING_BUFFER_SIZE] {};
+    size_t _fixRingNext {};
+    size_t _fixRingCount {};
+    uint32_t _fixCount {};
+    FixSubscriber _subscribers[MAX_FIX_SUBSCRIBERS];
+    int _nextSubscriberId {1};
     bool gnssStarted = false;
     uint32_t timeToFirstFixMs = 0;
+    uint64_t _lastFixMs {};                 /**< System.millis() when lastLocation last converged */
+    uint32_t _convergeEstimateMs {};        /**< Smoothed time for recent acquisitions to converge, 0 if none yet */
+    std::atomic<system_tick_t> _prefetchStartMs {0};  /**< millis() when prefetchHandler() ran, 0 if not pending */
     LocationPoint lastLocation = {0};
     LocationResults lastResults = LocationResults::Unavailable;
 
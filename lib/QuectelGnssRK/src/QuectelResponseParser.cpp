@@ -0,0 +1,74 @@
+#include "QuectelResponseParser.h"
+
+constexpr double QuectelResponseParser::Tokenizer::POW10[];
+
+// sscanf returns EOF instead of 0 when the line ends before the first conversion
+static int scanResult(const QuectelResponseParser::Tokenizer &tok, bool complete, int nargs) {
+    if (!complete && 0 == nargs && tok.inputEnded()) {
+        return -1;
+    }
+    return nargs;
+}
+
+int QuectelResponseParser::parseCmeError(const char *buf, unsigned int &errorCode) {
+    Tokenizer tok(buf);
+
+    bool complete = tok.expect("+CME ERROR: ") && tok.uintField(errorCode);
+
+    return scanResult(tok, complete, complete ? 1 : 0);
+}
+
+int QuectelResponseParser::parseQloc(const char *buf, Qloc &qloc) {
+    Tokenizer tok(buf);
+    int nargs = 0;
+    auto count = [&nargs](bool stored) {
+        if (stored) {
+            nargs++;
+        }
+        return stored;
+    };
+
+    // Fraction of the UTC time, which the format skips with %*03u
+    unsigned int fraction = 0;
+    int fracDigits = 0;
+
+    bool complete = tok.expect("+QGPSLOC: ") &&
+        count(tok.uintField(qloc.tm_hour, 2)) && count(tok.uintField(qloc.tm_min, 2)) && count(tok.uintField(qloc.tm_sec, 2)) &&
+        tok.expectChar('.') && tok.uintField(fraction, 3, &fracDigits) &&
+        tok.expectChar(',') && count(tok.doubleField(qloc.latitude)) &&
+        tok.expectChar(',') && count(tok.doubleField(qloc.longitude)) &&
+        tok.expectChar(',') && count(tok.floatField(qloc.hdop)) &&
+        tok.expectChar(',') && count(tok.floatField(qloc.altitude)) &&
+        tok.expectChar(',') && count(tok.uintField(qloc.fix)) &&
+        tok.expectChar(',') && count(tok.uintField(qloc.cogDegrees, 3)) && tok.expectChar('.') && count(tok.uintField(qloc.cogMinutes, 2)) &&
+        tok.expectChar(',') && count(tok.floatField(qloc.speedKmph)) &&
+        tok.expectChar(',') && count(tok.floatField(qloc.speedKnots)) &&
+        tok.expectChar(',') && count(tok.uintField(qloc.tm_day, 2)) && count(tok.uintField(qloc.tm_month, 2)) && count(tok.uintField(qloc.tm_year, 2)) &&
+        tok.expectChar(',') && count(tok.uintField(qloc.nsat));
+
+    if (fracDigits) {
+        // BG95 sends 2 digits, EG91 1
+        qloc.tm_hundredths = (1 == fracDigits) ? fraction * 10 : ((3 == fracDigits) ? fraction / 10 : fraction);
+    }
+
+    return scanResult(tok, complete, nargs);
+}
+
+int QuectelResponseParser::parseEpe(const char *buf, Epe &epe) {
+    Tokenizer tok(buf);
+    int nargs = 0;
+
+    bool complete = tok.expect("+QGPSCFG: \"estimation_error\",");
+    float *fields[] = {&epe.h_acc, &epe.v_acc, &epe.speed_acc, &epe.head_acc};
+    for (auto field : fields) {
+        if (!complete) {
+            break;
+        }
+        complete = (0 == nargs || tok.expectChar(',')) && tok.floatField(*field);
+        if (complete) {
+            nargs++;
+        }
+    }
+
+    return scanResult(tok, complete, nargs);
+}
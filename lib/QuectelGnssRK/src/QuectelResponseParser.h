@@ -0,0 +1,282 @@
+#ifndef __QUECTELRESPONSEPARSER_H
+#define __QUECTELRESPONSEPARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Repository: https://github.com/rickkas7/QuectelGnssRK
+// License: Apache 2.0
+
+/**
+ * @brief Parser for the +QGPSLOC, +QGPSCFG "estimation_error", and +CME ERROR responses
+ *
+ * This replaces sscanf, whose newlib float scanner is large and slow, for lines that are parsed on every poll of the
+ * acquisition loop. Each parse function takes the same fields in the same order as the sscanf format it replaces and
+ * returns what sscanf would: the number of fields stored, stopping at the first field that does not match, or -1 if
+ * the line ended before the first field. Fields after the one that did not match are left unchanged.
+ *
+ * This file does not depend on Device OS so the same code can be compiled on a computer to compare it with sscanf
+ * on captured modem responses.
+ */
+class QuectelResponseParser {
+public:
+    /**
+     * @brief Single pass, allocation-free cursor over one modem response line
+     *
+     * Decimal fields are accumulated as an integer mantissa and a count of fractional digits, then divided by
+     * an exact power of 10. As long as the mantissa and power are exactly representable this is a single
+     * correctly rounded operation, so the result is identical to strtod/strtof for modem output. Unlike sscanf,
+     * exponents, hexadecimal, and nan or inf are not accepted; the modems do not send them.
+     */
+    class Tokenizer {
+    public:
+        explicit Tokenizer(const char *buf) : _cur(buf) {}
+
+        void skipSpace() {
+            while (isSpace(*_cur)) {
+                _cur++;
+            }
+        }
+
+        /**
+         * @brief Skip leading whitespace, then consume literal if it matches
+         *
+         * A space in literal matches any amount of whitespace, including none, like a space in a scanf format.
+         */
+        bool expect(const char *literal) {
+            skipSpace();
+            auto p = _cur;
+            while (*literal) {
+                if (' ' == *literal) {
+                    while (isSpace(*p)) {
+                        p++;
+                    }
+                    literal++;
+                    continue;
+                }
+                if (*p != *literal) {
+                    _inputEnded = ('\0' == *p);
+                    return false;
+                }
+                p++;
+                literal++;
+            }
+            _cur = p;
+            return true;
+        }
+
+        bool expectChar(char c) {
+            if (c != *_cur) {
+                _inputEnded = ('\0' == *_cur);
+                return false;
+            }
+            _cur++;
+            return true;
+        }
+
+        /**
+         * @brief Equivalent to sscanf %Nu: an optional sign and up to maxDigits characters, at least one digit required
+         */
+        bool uintField(unsigned int &value, int maxDigits = 10, int *numDigits = nullptr) {
+            skipSpace();
+            auto p = _cur;
+            bool negative = false;
+            int width = maxDigits;
+            if ('-' == *p || '+' == *p) {
+                // Like sscanf, the sign counts toward the width and a negative value wraps around
+                negative = ('-' == *p);
+                p++;
+                width--;
+            }
+            unsigned int result = 0;
+            int count = 0;
+            while (count < width && isDigit(*p)) {
+                result = result * 10 + (unsigned int)(*p++ - '0');
+                count++;
+            }
+            if (numDigits) {
+                *numDigits = count;
+            }
+            if (0 == count) {
+                _inputEnded = ('\0' == *p);
+                return false;
+            }
+            _cur = p;
+            value = negative ? 0 - result : result;
+            return true;
+        }
+
+        bool doubleField(double &value) {
+            uint64_t mantissa;
+            int fracDigits;
+            bool negative;
+            if (!decimal(mantissa, fracDigits, negative)) {
+                return false;
+            }
+            double result = (double)mantissa;
+            if (fracDigits) {
+                result /= POW10[fracDigits];
+            }
+            value = negative ? -result : result;
+            return true;
+        }
+
+        bool floatField(float &value) {
+            uint64_t mantissa;
+            int fracDigits;
+            bool negative;
+            if (!decimal(mantissa, fracDigits, negative)) {
+                return false;
+            }
+            float result;
+            if (mantissa < (1ULL << 24) && fracDigits <= 10) {
+                // Both operands exact in single precision, so one correctly rounded division like strtof
+                result = (float)mantissa;
+                if (fracDigits) {
+                    result /= (float)POW10[fracDigits];
+                }
+            }
+            else {
+                result = (float)((double)mantissa / POW10[fracDigits]);
+            }
+            value = negative ? -result : result;
+            return true;
+        }
+
+        /**
+         * @brief true if the last field or literal that did not match failed because the line ended
+         */
+        bool inputEnded() const {
+            return _inputEnded;
+        }
+
+    private:
+        static bool isDigit(char c) {
+            return c >= '0' && c <= '9';
+        }
+
+        static bool isSpace(char c) {
+            return ' ' == c || '\t' == c || '\r' == c || '\n' == c;
+        }
+
+        bool decimal(uint64_t &mantissa, int &fracDigits, bool &negative) {
+            skipSpace();
+            auto p = _cur;
+            negative = false;
+            if ('-' == *p || '+' == *p) {
+                negative = ('-' == *p);
+                p++;
+            }
+            mantissa = 0;
+            fracDigits = 0;
+            int digits = 0;
+            bool anyDigits = false;
+            while (isDigit(*p)) {
+                if (digits < MAX_DIGITS) {
+                    mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                    digits++;
+                }
+                anyDigits = true;
+                p++;
+            }
+            if ('.' == *p) {
+                p++;
+                while (isDigit(*p)) {
+                    if (digits < MAX_DIGITS && fracDigits < MAX_FRAC_DIGITS) {
+                        mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                        digits++;
+                        fracDigits++;
+                    }
+                    anyDigits = true;
+                    p++;
+                }
+            }
+            if (!anyDigits) {
+                _inputEnded = ('\0' == *p);
+                return false;
+            }
+            _cur = p;
+            return true;
+        }
+
+        static constexpr int MAX_DIGITS = 18;
+        static constexpr int MAX_FRAC_DIGITS = 15;
+        static constexpr double POW10[MAX_FRAC_DIGITS + 1] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+        };
+
+        const char *_cur;
+        bool _inputEnded = false;
+    };
+
+    /**
+     * @brief Fields of a +QGPSLOC=2 response
+     */
+    struct Qloc {
+        unsigned int tm_hour {};
+        unsigned int tm_min {};
+        unsigned int tm_sec {};
+        unsigned int tm_hundredths {};  /**< Fraction of the UTC time in hundredths, not counted as a field */
+        unsigned int tm_day {};
+        unsigned int tm_month {};
+        unsigned int tm_year {};
+        double latitude {};
+        double longitude {};
+        unsigned int fix {};
+        float hdop {};
+        float altitude {};
+        unsigned int cogDegrees {};
+        unsigned int cogMinutes {};
+        float speedKmph {};
+        float speedKnots {};
+        unsigned int nsat {};
+    };
+
+    /**
+     * @brief Fields of a +QGPSCFG: "estimation_error" response
+     */
+    struct Epe {
+        float h_acc {};
+        float v_acc {};
+        float speed_acc {};
+        float head_acc {};
+    };
+
+    /**
+     * @brief Number of fields in a complete +QGPSLOC response
+     */
+    static const int QLOC_FIELDS = 16;
+
+    /**
+     * @brief Parse a +CME ERROR line, replacing sscanf(buf, " +CME ERROR: %u", &errorCode)
+     *
+     * @param buf Response line
+     * @param errorCode Set to the error code if it was parsed
+     * @return 1 if parsed, 0 if the line is not a +CME ERROR, or -1 if the line is empty
+     */
+    static int parseCmeError(const char *buf, unsigned int &errorCode);
+
+    /**
+     * @brief Parse a +QGPSLOC=2 line, replacing
+     * sscanf(buf, " +QGPSLOC: %02u%02u%02u.%*03u,%lf,%lf,%f,%f,%u,%03u.%02u,%f,%f,%02u%02u%02u,%u", ...)
+     *
+     * @param buf Response line, for example +QGPSLOC: 174512.00,42.35012,-71.06010,1.1,41.9,3,87.20,0.4,0.2,291025,09
+     * @param qloc Fields, in the order of the format
+     * @return Number of fields stored, QLOC_FIELDS if the line is complete
+     *
+     * The fraction of the time, which the format skipped, is kept as tm_hundredths.
+     */
+    static int parseQloc(const char *buf, Qloc &qloc);
+
+    /**
+     * @brief Parse a +QGPSCFG: "estimation_error" line, replacing
+     * sscanf(buf, " +QGPSCFG: \"estimation_error\",%f,%f,%f,%f", ...)
+     *
+     * @param buf Response line, for example +QGPSCFG: "estimation_error",3.2,5.8,0.4,12.6
+     * @param epe Fields, in the order of the format
+     * @return Number of fields stored, 4 if the line is complete
+     */
+    static int parseEpe(const char *buf, Epe &epe);
+};
+
+#endif /* __QUECTELRESPONSEPARSER_H */
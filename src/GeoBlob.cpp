@@ -0,0 +1,158 @@
+#include "GeoBlob.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static_assert(sizeof(GeoBlob::Header) == 96, "GeoBlob::Header must be 96 bytes");
+static_assert(sizeof(GeoBlob::AccessPoint) == 16, "GeoBlob::AccessPoint must be 16 bytes");
+
+bool GeoBlob::open(const char *path) {
+    close();
+
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < 0 || !checkHeader((size_t)size)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool GeoBlob::attach(const uint8_t *data, size_t size) {
+    close();
+
+    this->data = data;
+    dataSize = size;
+    if (!checkHeader(size)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void GeoBlob::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    data = nullptr;
+    dataSize = 0;
+    header = {};
+}
+
+bool GeoBlob::verify() const {
+    if (!isOpen()) {
+        return false;
+    }
+
+    // The crc field is taken as 0
+    Header copy = header;
+    copy.crc = 0;
+    uint32_t crc = crc32(&copy, sizeof(copy));
+
+    uint8_t buf[256];
+    for(uint32_t offset = sizeof(Header); offset < header.size; ) {
+        size_t len = (header.size - offset < sizeof(buf)) ? header.size - offset : sizeof(buf);
+        if (!read(offset, buf, len)) {
+            return false;
+        }
+        crc = crc32(buf, len, crc);
+        offset += (uint32_t)len;
+    }
+    return crc == header.crc;
+}
+
+bool GeoBlob::read(uint32_t offset, void *buf, size_t len) const {
+    if (data) {
+        if ((uint64_t)offset + len > dataSize) {
+            return false;
+        }
+        memcpy(buf, &data[offset], len);
+        return true;
+    }
+    if (fd < 0 || lseek(fd, offset, SEEK_SET) != (off_t)offset) {
+        return false;
+    }
+    return ::read(fd, buf, len) == (ssize_t)len;
+}
+
+bool GeoBlob::findAccessPoint(const uint8_t *bssid, AccessPoint &ap) const {
+    if (!isOpen() || header.numAccessPoints == 0) {
+        return false;
+    }
+
+    // The fan-out table narrows the search to the access points whose BSSID starts with the same byte
+    uint32_t range[2];
+    if (!read(header.fanoutOffset + bssid[0] * sizeof(uint32_t), range, sizeof(range))) {
+        return false;
+    }
+    uint32_t low = range[0], high = range[1];
+    if (high > header.numAccessPoints) {
+        return false;
+    }
+
+    while(low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (!read(header.accessPointsOffset + mid * sizeof(AccessPoint), &ap, sizeof(AccessPoint))) {
+            return false;
+        }
+        int cmp = memcmp(ap.bssid, bssid, sizeof(ap.bssid));
+        if (cmp == 0) {
+            return true;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return false;
+}
+
+// [static]
+uint32_t GeoBlob::crc32(const void *data, size_t len, uint32_t crc) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    crc = ~crc;
+    for(size_t ii = 0; ii < len; ii++) {
+        crc ^= p[ii];
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+bool GeoBlob::checkHeader(size_t size) {
+    if (size < sizeof(Header) || !read(0, &header, sizeof(Header))) {
+        return false;
+    }
+    if (header.magic != MAGIC || header.version != VERSION || header.headerSize != sizeof(Header) || header.size != size) {
+        return false;
+    }
+
+    // Every section must be inside the blob, so queries never need to check
+    uint64_t numCells = (uint64_t)header.gridRows * header.gridCols;
+    if ((header.numFences == 0) != (numCells == 0) || (numCells && (header.gridCellLat == 0 || header.gridCellLon == 0))) {
+        return false;
+    }
+    return sectionFits(header.fencesOffset, header.numFences, FENCE_SIZE, size) &&
+        sectionFits(header.verticesOffset, header.numVertices, VERTEX_SIZE, size) &&
+        sectionFits(header.cellStartOffset, numCells ? numCells + 1 : 0, sizeof(uint32_t), size) &&
+        sectionFits(header.cellFencesOffset, header.numCellFences, sizeof(uint16_t), size) &&
+        sectionFits(header.fanoutOffset, header.numAccessPoints ? 257 : 0, sizeof(uint32_t), size) &&
+        sectionFits(header.accessPointsOffset, header.numAccessPoints, sizeof(AccessPoint), size);
+}
+
+// [static]
+bool GeoBlob::sectionFits(uint32_t offset, uint64_t count, size_t recordSize, size_t size) {
+    if (count == 0) {
+        return true;
+    }
+    return (offset % 4) == 0 && offset >= sizeof(Header) && (uint64_t)offset + count * recordSize <= size;
+}
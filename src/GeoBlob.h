@@ -0,0 +1,177 @@
+#ifndef __GEOBLOB_H
+#define __GEOBLOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Precompiled database of geofences and known access point positions, queried in place
+ *
+ * The blob is built on a computer by tools/geoblob.py from GeoJSON and CSV files and delivered to the device by
+ * Asset OTA. Nothing is parsed into RAM: open() reads the 96-byte header and each query reads only the records it
+ * needs, from a file on the flash file system or from memory. The geofence sections are the same records and grid
+ * index Geofence::build() makes in RAM, so Geofence::attach() can use them directly.
+ *
+ * Layout, little-endian, each section 4-byte aligned:
+ * - Header
+ * - Fences: numFences Geofence::Fence records, 32 bytes each
+ * - Vertices: numVertices Geofence::Vertex records, 8 bytes each
+ * - Cell starts: gridRows * gridCols + 1 uint32_t offsets into the cell fences
+ * - Cell fences: numCellFences uint16_t fence indexes
+ * - Access point fan-out: 257 uint32_t, the index of the first access point whose BSSID starts with each byte value
+ * - Access points: numAccessPoints AccessPoint records sorted by BSSID, 16 bytes each
+ *
+ * The CRC covers the whole blob with the crc field taken as 0. It is checked by verify(), which reads the whole blob,
+ * so it is done once when a new blob is installed rather than at every boot.
+ *
+ * read() is not thread-safe when the blob is a file, because it seeks the file. Open the file once for each thread
+ * that queries it.
+ *
+ * This file does not depend on Device OS so the same code can be compiled on a computer to test it.
+ */
+class GeoBlob {
+public:
+    /**
+     * @brief First 4 bytes of a blob, "GEOB"
+     */
+    static const uint32_t MAGIC = 0x424f4547;
+
+    /**
+     * @brief Format version. Blobs with a different version are rejected.
+     */
+    static const uint16_t VERSION = 1;
+
+    /**
+     * @brief Size of a fence record
+     */
+    static const size_t FENCE_SIZE = 32;
+
+    /**
+     * @brief Size of a vertex record
+     */
+    static const size_t VERTEX_SIZE = 8;
+
+    /**
+     * @brief Blob header. 96 bytes.
+     */
+    struct Header {
+        uint32_t magic;                 /**< MAGIC */
+        uint16_t version;               /**< VERSION */
+        uint16_t headerSize;            /**< sizeof(Header) */
+        uint32_t size;                  /**< Size of the whole blob in bytes */
+        uint32_t crc;                   /**< CRC-32 of the whole blob, with this field taken as 0 */
+        uint32_t numFences;             /**< Number of fence records */
+        uint32_t fencesOffset;          /**< Offset of the first fence record */
+        uint32_t numVertices;           /**< Number of vertex records */
+        uint32_t verticesOffset;        /**< Offset of the first vertex record */
+        int32_t gridMinLat;             /**< South edge of the grid in degrees * 10^7 */
+        int32_t gridMinLon;             /**< West edge of the grid in degrees * 10^7 */
+        uint32_t gridCellLat;           /**< Cell height in degrees * 10^7 */
+        uint32_t gridCellLon;           /**< Cell width in degrees * 10^7 */
+        uint16_t gridRows;              /**< Number of rows, 0 if there are no fences */
+        uint16_t gridCols;              /**< Number of columns */
+        uint32_t cellStartOffset;       /**< Offset of the cell starts */
+        uint32_t numCellFences;         /**< Number of cell fence indexes */
+        uint32_t cellFencesOffset;      /**< Offset of the cell fence indexes */
+        uint32_t numAccessPoints;       /**< Number of access point records */
+        uint32_t accessPointsOffset;    /**< Offset of the first access point record */
+        uint32_t fanoutOffset;          /**< Offset of the access point fan-out table */
+        uint32_t buildTime;             /**< Unix time the blob was built */
+        uint32_t reserved[4];           /**< 0 */
+    };
+
+    /**
+     * @brief A known access point. 16 bytes.
+     */
+    struct AccessPoint {
+        uint8_t bssid[6];               /**< BSSID */
+        uint16_t hAcc;                  /**< Horizontal accuracy in meters */
+        int32_t lat;                    /**< Latitude in degrees * 10^7 */
+        int32_t lon;                    /**< Longitude in degrees * 10^7 */
+    };
+
+    /**
+     * @brief Destructor. Closes the file.
+     */
+    ~GeoBlob() { close(); };
+
+    /**
+     * @brief Open a blob file and check its header. The data is not read.
+     *
+     * @param path Path to the file
+     * @return true if the header is valid
+     */
+    bool open(const char *path);
+
+    /**
+     * @brief Use a blob that is already in memory, such as memory-mapped flash. The data is not copied.
+     *
+     * @param data Blob. Must stay valid until close().
+     * @param size Size of the blob in bytes
+     * @return true if the header is valid
+     */
+    bool attach(const uint8_t *data, size_t size);
+
+    /**
+     * @brief Close the file or detach the memory
+     */
+    void close();
+
+    /**
+     * @brief true if open() or attach() succeeded
+     */
+    bool isOpen() const { return fd >= 0 || data != nullptr; };
+
+    /**
+     * @brief Check the CRC of the whole blob. Reads all of it, in small pieces.
+     *
+     * @return true if the CRC matches
+     */
+    bool verify() const;
+
+    /**
+     * @brief Read bytes from the blob
+     *
+     * @param offset Offset from the start of the blob
+     * @param buf Buffer to read into
+     * @param len Number of bytes
+     * @return true if all of the bytes were read
+     */
+    bool read(uint32_t offset, void *buf, size_t len) const;
+
+    /**
+     * @brief The header, valid if isOpen()
+     */
+    const Header &getHeader() const { return header; };
+
+    /**
+     * @brief Look up a known access point
+     *
+     * @param bssid 6-byte BSSID
+     * @param ap Filled in if found
+     * @return true if found
+     *
+     * Uses the fan-out table and a binary search, so it takes about log2(numAccessPoints / 256) + 2 reads.
+     */
+    bool findAccessPoint(const uint8_t *bssid, AccessPoint &ap) const;
+
+    /**
+     * @brief Standard CRC-32 (the same as zlib)
+     *
+     * @param data Data
+     * @param len Length of data
+     * @param crc CRC of the data before this, to calculate it in pieces. Default is 0.
+     */
+    static uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+
+protected:
+    bool checkHeader(size_t size);
+    static bool sectionFits(uint32_t offset, uint64_t count, size_t recordSize, size_t size);
+
+    int fd = -1;
+    const uint8_t *data = nullptr;
+    size_t dataSize = 0;
+    Header header = {};
+};
+
+#endif /* __GEOBLOB_H */
@@ -0,0 +1,551 @@
+#include "Geofence.h"
+
+#include <math.h>
+
+bool Geofence::addCircle(uint32_t id, int32_t lat, int32_t lon, uint32_t radiusMeters) {
+    if (fenceStorage.size() >= MAX_FENCES || radiusMeters == 0 || radiusMeters > MAX_RADIUS ||
+        lat < -900000000 || lat > 900000000 || lon < -1800000000 || lon > 1800000000) {
+        return false;
+    }
+
+    Fence fence = {};
+    fence.id = id;
+    fence.radius = metersToUnits(radiusMeters);
+    fence.cosLat = cosLatitude(lat);
+    fence.firstVertex = (uint32_t)vertexStorage.size();
+    fence.numVertices = 1;
+
+    int64_t lonRadius = (int64_t)fence.radius * 32768 / fence.cosLat;
+    fence.minLat = (int32_t)((int64_t)lat - fence.radius < -900000000 ? -900000000 : (int64_t)lat - fence.radius);
+    fence.maxLat = (int32_t)((int64_t)lat + fence.radius > 900000000 ? 900000000 : (int64_t)lat + fence.radius);
+    fence.minLon = (int32_t)((int64_t)lon - lonRadius < -1800000000 ? -1800000000 : (int64_t)lon - lonRadius);
+    fence.maxLon = (int32_t)((int64_t)lon + lonRadius > 1800000000 ? 1800000000 : (int64_t)lon + lonRadius);
+
+    vertexStorage.push_back(Vertex{lat, lon});
+    fenceStorage.push_back(fence);
+    return true;
+}
+
+bool Geofence::addPolygon(uint32_t id, const Vertex *vertices, size_t numVertices) {
+    if (fenceStorage.size() >= MAX_FENCES || numVertices < 3 || numVertices > 65535) {
+        return false;
+    }
+
+    Fence fence = {};
+    fence.id = id;
+    fence.firstVertex = (uint32_t)vertexStorage.size();
+    fence.numVertices = (uint16_t)numVertices;
+    fence.minLat = fence.maxLat = vertices[0].lat;
+    fence.minLon = fence.maxLon = vertices[0].lon;
+    for(size_t ii = 0; ii < numVertices; ii++) {
+        const Vertex &v = vertices[ii];
+        if (v.lat < -900000000 || v.lat > 900000000 || v.lon < -1800000000 || v.lon > 1800000000) {
+            return false;
+        }
+        fence.minLat = (v.lat < fence.minLat) ? v.lat : fence.minLat;
+        fence.maxLat = (v.lat > fence.maxLat) ? v.lat : fence.maxLat;
+        fence.minLon = (v.lon < fence.minLon) ? v.lon : fence.minLon;
+        fence.maxLon = (v.lon > fence.maxLon) ? v.lon : fence.maxLon;
+    }
+    if ((int64_t)fence.maxLat - fence.minLat > MAX_POLYGON_SPAN || (int64_t)fence.maxLon - fence.minLon > MAX_POLYGON_SPAN) {
+        return false;
+    }
+    fence.cosLat = cosLatitude(fence.minLat / 2 + fence.maxLat / 2);
+
+    vertexStorage.insert(vertexStorage.end(), vertices, vertices + numVertices);
+    fenceStorage.push_back(fence);
+    return true;
+}
+
+bool Geofence::build() {
+    blob = nullptr;
+    fenceStorage.shrink_to_fit();
+    vertexStorage.shrink_to_fit();
+    fences = fenceStorage.data();
+    vertices = vertexStorage.data();
+    numFences = fenceStorage.size();
+    numActive = 0;
+    grid = {};
+    stats = {};
+
+    if (numFences == 0) {
+        cellStartStorage.clear();
+        cellFenceStorage.clear();
+        cellStart = nullptr;
+        cellFences = nullptr;
+        return false;
+    }
+
+    int32_t minLat = fences[0].minLat, maxLat = fences[0].maxLat;
+    int32_t minLon = fences[0].minLon, maxLon = fences[0].maxLon;
+    for(size_t ii = 1; ii < numFences; ii++) {
+        minLat = (fences[ii].minLat < minLat) ? fences[ii].minLat : minLat;
+        maxLat = (fences[ii].maxLat > maxLat) ? fences[ii].maxLat : maxLat;
+        minLon = (fences[ii].minLon < minLon) ? fences[ii].minLon : minLon;
+        maxLon = (fences[ii].maxLon > maxLon) ? fences[ii].maxLon : maxLon;
+    }
+
+    // Roughly square cells on the ground, about two per fence, so a fix usually tests only a few fences
+    double height = (double)maxLat - minLat + 1;
+    double width = (double)maxLon - minLon + 1;
+    double cosMid = cosLatitude(minLat / 2 + maxLat / 2) / 32768.0;
+    double targetCells = (2.0 * numFences < MAX_GRID_CELLS) ? 2.0 * numFences : MAX_GRID_CELLS;
+    double cellSize = sqrt(height * width * cosMid / targetCells);
+    if (cellSize < 1) {
+        cellSize = 1;
+    }
+    while(true) {
+        double cellLat = ceil(cellSize);
+        double cellLon = ceil(cellSize / cosMid);
+        double rows = floor(height / cellLat) + 1;
+        double cols = floor(width / cellLon) + 1;
+        if (rows * cols <= MAX_GRID_CELLS && cellLat < 4e9 && cellLon < 4e9) {
+            grid.cellLat = (uint32_t)cellLat;
+            grid.cellLon = (uint32_t)cellLon;
+            grid.rows = (uint16_t)rows;
+            grid.cols = (uint16_t)cols;
+            break;
+        }
+        cellSize *= 1.25;
+    }
+    grid.minLat = minLat;
+    grid.minLon = minLon;
+
+    // Count the fences in each cell, then fill them in (compressed sparse rows)
+    size_t numCells = (size_t)grid.rows * grid.cols;
+    cellStartStorage.assign(numCells + 1, 0);
+    for(int pass = 0; pass < 2; pass++) {
+        for(size_t ii = 0; ii < numFences; ii++) {
+            const Fence &fence = fences[ii];
+            size_t row0 = (size_t)(((int64_t)fence.minLat - grid.minLat) / grid.cellLat);
+            size_t row1 = (size_t)(((int64_t)fence.maxLat - grid.minLat) / grid.cellLat);
+            size_t col0 = (size_t)(((int64_t)fence.minLon - grid.minLon) / grid.cellLon);
+            size_t col1 = (size_t)(((int64_t)fence.maxLon - grid.minLon) / grid.cellLon);
+            for(size_t row = row0; row <= row1; row++) {
+                for(size_t col = col0; col <= col1; col++) {
+                    size_t cell = row * grid.cols + col;
+                    if (pass == 0) {
+                        cellStartStorage[cell + 1]++;
+                    }
+                    else {
+                        cellFenceStorage[cellStartStorage[cell]++] = (uint16_t)ii;
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            for(size_t cell = 0; cell < numCells; cell++) {
+                cellStartStorage[cell + 1] += cellStartStorage[cell];
+            }
+            cellFenceStorage.assign(cellStartStorage[numCells], 0);
+        }
+    }
+    // The fill pass advanced each start to the next cell's start, so shift them back
+    for(size_t cell = numCells; cell > 0; cell--) {
+        cellStartStorage[cell] = cellStartStorage[cell - 1];
+    }
+    cellStartStorage[0] = 0;
+
+    cellStart = cellStartStorage.data();
+    cellFences = cellFenceStorage.data();
+
+    stats.gridCells = (uint32_t)numCells;
+    stats.memoryBytes = (uint32_t)(fenceStorage.capacity() * sizeof(Fence) + vertexStorage.capacity() * sizeof(Vertex) +
+        cellStartStorage.capacity() * sizeof(uint32_t) + cellFenceStorage.capacity() * sizeof(uint16_t));
+
+    return true;
+}
+
+bool Geofence::attach(const GeoBlob &blob) {
+    static_assert(sizeof(Fence) == GeoBlob::FENCE_SIZE && sizeof(Vertex) == GeoBlob::VERTEX_SIZE, "GeoBlob record size");
+
+    const GeoBlob::Header &header = blob.getHeader();
+    if (!blob.isOpen() || header.numFences == 0 || header.numFences > MAX_FENCES) {
+        return false;
+    }
+
+    fenceStorage.clear();
+    fenceStorage.shrink_to_fit();
+    vertexStorage.clear();
+    vertexStorage.shrink_to_fit();
+    cellStartStorage.clear();
+    cellStartStorage.shrink_to_fit();
+    cellFenceStorage.clear();
+    cellFenceStorage.shrink_to_fit();
+    fences = nullptr;
+    vertices = nullptr;
+    cellStart = nullptr;
+    cellFences = nullptr;
+
+    this->blob = &blob;
+    numFences = header.numFences;
+    numActive = 0;
+    grid.minLat = header.gridMinLat;
+    grid.minLon = header.gridMinLon;
+    grid.cellLat = header.gridCellLat;
+    grid.cellLon = header.gridCellLon;
+    grid.rows = header.gridRows;
+    grid.cols = header.gridCols;
+
+    stats = {};
+    stats.gridCells = (uint32_t)grid.rows * grid.cols;
+    return true;
+}
+
+void Geofence::evaluate(const Fix &fix) {
+    if (maxAccuracy && fix.hAcc > maxAccuracy) {
+        stats.fixesIgnored++;
+        return;
+    }
+    stats.fixes++;
+
+    Vertex point = {fix.lat, fix.lon};
+    uint32_t testedBefore = stats.fencesTested;
+
+    for(size_t ii = 0; ii < numActive; ii++) {
+        active[ii].visited = false;
+    }
+
+    // Fences overlapping the grid cell the fix is in
+    if (grid.rows && point.lat >= grid.minLat && point.lon >= grid.minLon) {
+        uint64_t row = ((uint64_t)((int64_t)point.lat - grid.minLat)) / grid.cellLat;
+        uint64_t col = ((uint64_t)((int64_t)point.lon - grid.minLon)) / grid.cellLon;
+        uint32_t start, end;
+        if (row < grid.rows && col < grid.cols && getCell((size_t)(row * grid.cols + col), start, end)) {
+            uint16_t buf[BLOB_CHUNK];
+            while(start < end) {
+                size_t count = (end - start < BLOB_CHUNK) ? end - start : BLOB_CHUNK;
+                const uint16_t *indexes = getCellFences(start, count, buf);
+                if (!indexes) {
+                    break;
+                }
+                for(size_t ii = 0; ii < count; ii++) {
+                    evaluateFence(indexes[ii], point, fix);
+                }
+                start += (uint32_t)count;
+            }
+        }
+    }
+
+    // Fences the device is in but that do not overlap this cell, which is usually an exit
+    for(size_t ii = 0; ii < numActive; ) {
+        Active &entry = active[ii];
+        if (!entry.visited) {
+            stats.fencesTested++;
+            entry.visited = true;
+            Fence buf;
+            const Fence *fence = getFence(entry.fence, buf);
+            if (!fence || !update(entry, *fence, test(*fence, point, entry.inside), fix)) {
+                // Moves the last entry into this slot, so test the same index again
+                removeActive(&entry);
+                continue;
+            }
+        }
+        ii++;
+    }
+
+    uint32_t tested = stats.fencesTested - testedBefore;
+    if (tested > stats.maxFencesTested) {
+        stats.maxFencesTested = tested;
+    }
+}
+
+bool Geofence::takeEvent(Event &event) {
+    uint32_t tail = eventTail.load(std::memory_order_relaxed);
+    if (tail == eventHead.load(std::memory_order_acquire)) {
+        return false;
+    }
+    event = eventRing[tail % EVENT_QUEUE_SIZE];
+    eventTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+size_t Geofence::getInsideCount() const {
+    size_t count = 0;
+    for(size_t ii = 0; ii < numActive; ii++) {
+        if (active[ii].inside) {
+            count++;
+        }
+    }
+    return count;
+}
+
+template<class Fn>
+void Geofence::forEachEdge(const Fence &fence, Fn fn) {
+    // Calls fn(a, b) for each edge, starting with the closing edge from the last vertex to the first, until it returns false
+    if (!blob) {
+        const Vertex *v = &vertices[fence.firstVertex];
+        for(size_t ii = 0, jj = fence.numVertices - 1; ii < fence.numVertices; jj = ii++) {
+            if (!fn(v[jj], v[ii])) {
+                return;
+            }
+        }
+        return;
+    }
+
+    uint32_t offset = blob->getHeader().verticesOffset + fence.firstVertex * (uint32_t)sizeof(Vertex);
+    Vertex prev;
+    if (!blobRead(offset + (fence.numVertices - 1) * (uint32_t)sizeof(Vertex), &prev, sizeof(Vertex))) {
+        return;
+    }
+    Vertex buf[BLOB_CHUNK];
+    for(size_t ii = 0; ii < fence.numVertices; ) {
+        size_t count = (fence.numVertices - ii < BLOB_CHUNK) ? fence.numVertices - ii : BLOB_CHUNK;
+        if (!blobRead(offset + (uint32_t)(ii * sizeof(Vertex)), buf, count * sizeof(Vertex))) {
+            return;
+        }
+        for(size_t jj = 0; jj < count; jj++) {
+            if (!fn(prev, buf[jj])) {
+                return;
+            }
+            prev = buf[jj];
+        }
+        ii += count;
+    }
+}
+
+void Geofence::evaluateFence(size_t fenceIndex, const Vertex &point, const Fix &fix) {
+    Fence buf;
+    const Fence *fence = getFence(fenceIndex, buf);
+    if (!fence) {
+        return;
+    }
+    stats.fencesTested++;
+
+    Active *entry = numActive ? findActive(fenceIndex) : nullptr;
+    if (entry) {
+        entry->visited = true;
+        if (!update(*entry, *fence, test(*fence, point, entry->inside), fix)) {
+            removeActive(entry);
+        }
+    }
+    else
+    if (test(*fence, point, false) == Test::inside) {
+        if (numActive == MAX_ACTIVE) {
+            stats.activeFull++;
+            return;
+        }
+        entry = &active[numActive++];
+        *entry = {};
+        entry->fence = (uint16_t)fenceIndex;
+        entry->visited = true;
+        if (!update(*entry, *fence, Test::inside, fix)) {
+            removeActive(entry);
+        }
+    }
+}
+
+Geofence::Test Geofence::test(const Fence &fence, const Vertex &point, bool withMargin) {
+    if (fence.isCircle()) {
+        return testCircle(fence, point, withMargin);
+    }
+
+    if (point.lat >= fence.minLat && point.lat <= fence.maxLat && point.lon >= fence.minLon && point.lon <= fence.maxLon &&
+        insidePolygon(fence, point)) {
+        return Test::inside;
+    }
+    if (!withMargin) {
+        return Test::outside;
+    }
+
+    int64_t lonMargin = (int64_t)exitMargin * 32768 / fence.cosLat;
+    if (point.lat < (int64_t)fence.minLat - exitMargin || point.lat > (int64_t)fence.maxLat + exitMargin ||
+        point.lon < fence.minLon - lonMargin || point.lon > fence.maxLon + lonMargin) {
+        return Test::outside;
+    }
+    return nearPolygon(fence, point) ? Test::near : Test::outside;
+}
+
+bool Geofence::insidePolygon(const Fence &fence, const Vertex &point) {
+    // Crossing number: count the edges crossed by a ray from the point toward increasing longitude. The point is
+    // inside the bounding box, which is at most MAX_POLYGON_SPAN across, so the products fit in 64 bits.
+    bool inside = false;
+
+    forEachEdge(fence, [&](const Vertex &a, const Vertex &b) {
+        if ((a.lat > point.lat) != (b.lat > point.lat)) {
+            // Sign of (crossing longitude - point longitude) * dLat, without dividing
+            int64_t dLat = (int64_t)b.lat - a.lat;
+            int64_t cross = ((int64_t)b.lon - a.lon) * ((int64_t)point.lat - a.lat) - ((int64_t)point.lon - a.lon) * dLat;
+            if ((dLat > 0) ? (cross > 0) : (cross < 0)) {
+                inside = !inside;
+            }
+        }
+        return true;
+    });
+    return inside;
+}
+
+bool Geofence::nearPolygon(const Fence &fence, const Vertex &point) {
+    // Only used for fences the device is in, when a fix is outside, so floating point is fine here
+    double cosLat = fence.cosLat / 32768.0;
+    double margin2 = (double)exitMargin * exitMargin;
+    bool near = false;
+
+    forEachEdge(fence, [&](const Vertex &a, const Vertex &b) {
+        // Segment relative to the point, with longitude scaled to the same units as latitude
+        double ax = ((double)a.lon - point.lon) * cosLat;
+        double ay = (double)a.lat - point.lat;
+        double dx = ((double)b.lon - point.lon) * cosLat - ax;
+        double dy = ((double)b.lat - point.lat) - ay;
+        double len2 = dx * dx + dy * dy;
+        double t = (len2 > 0) ? -(ax * dx + ay * dy) / len2 : 0;
+        t = (t < 0) ? 0 : ((t > 1) ? 1 : t);
+        double cx = ax + t * dx;
+        double cy = ay + t * dy;
+        near = (cx * cx + cy * cy <= margin2);
+        return !near;
+    });
+    return near;
+}
+
+Geofence::Test Geofence::testCircle(const Fence &fence, const Vertex &point, bool withMargin) {
+    Vertex center;
+    if (blob) {
+        if (!blobRead(blob->getHeader().verticesOffset + fence.firstVertex * (uint32_t)sizeof(Vertex), &center, sizeof(Vertex))) {
+            return Test::outside;
+        }
+    }
+    else {
+        center = vertices[fence.firstVertex];
+    }
+    int64_t limit = (int64_t)fence.radius + (withMargin ? exitMargin : 0);
+
+    int64_t dy = (int64_t)point.lat - center.lat;
+    int64_t dx = (((int64_t)point.lon - center.lon) * fence.cosLat) >> 15;
+    if (dy > limit || dy < -limit || dx > limit || dx < -limit) {
+        return Test::outside;
+    }
+
+    int64_t dist2 = dx * dx + dy * dy;
+    if (dist2 <= (int64_t)fence.radius * fence.radius) {
+        return Test::inside;
+    }
+    return (dist2 <= limit * limit) ? Test::near : Test::outside;
+}
+
+bool Geofence::update(Active &entry, const Fence &fence, Test result, const Fix &fix) {
+    if (!entry.inside) {
+        // Entering needs confirmFixes in a row inside; anything else forgets the fence
+        if (result != Test::inside) {
+            return false;
+        }
+        if (++entry.count >= confirmFixes) {
+            entry.inside = true;
+            entry.count = 0;
+            entry.enterTime = fix.time;
+            queueEvent(EventType::enter, fence, fix);
+        }
+    }
+    else
+    if (result == Test::outside) {
+        if (++entry.count >= confirmFixes) {
+            queueEvent(EventType::exit, fence, fix);
+            return false;
+        }
+    }
+    else {
+        entry.count = 0;
+    }
+
+    if (entry.inside && dwellTime && !entry.dwellSent && result != Test::outside && fix.time - entry.enterTime >= dwellTime) {
+        entry.dwellSent = true;
+        queueEvent(EventType::dwell, fence, fix);
+    }
+    return true;
+}
+
+const Geofence::Fence *Geofence::getFence(size_t fenceIndex, Fence &buf) {
+    if (!blob) {
+        return &fences[fenceIndex];
+    }
+    if (fenceIndex >= numFences || !blobRead(blob->getHeader().fencesOffset + (uint32_t)(fenceIndex * sizeof(Fence)), &buf, sizeof(Fence))) {
+        return nullptr;
+    }
+    return &buf;
+}
+
+bool Geofence::getCell(size_t cell, uint32_t &start, uint32_t &end) {
+    if (!blob) {
+        start = cellStart[cell];
+        end = cellStart[cell + 1];
+        return true;
+    }
+    uint32_t range[2];
+    if (!blobRead(blob->getHeader().cellStartOffset + (uint32_t)(cell * sizeof(uint32_t)), range, sizeof(range))) {
+        return false;
+    }
+    start = range[0];
+    end = (range[1] <= blob->getHeader().numCellFences) ? range[1] : start;
+    return true;
+}
+
+const uint16_t *Geofence::getCellFences(uint32_t start, size_t count, uint16_t *buf) {
+    if (!blob) {
+        return &cellFences[start];
+    }
+    if (!blobRead(blob->getHeader().cellFencesOffset + start * (uint32_t)sizeof(uint16_t), buf, count * sizeof(uint16_t))) {
+        return nullptr;
+    }
+    return buf;
+}
+
+bool Geofence::blobRead(uint32_t offset, void *buf, size_t len) {
+    if (!blob->read(offset, buf, len)) {
+        stats.readErrors++;
+        return false;
+    }
+    return true;
+}
+
+void Geofence::queueEvent(EventType type, const Fence &fence, const Fix &fix) {
+    stats.events++;
+
+    // If the consumer has fallen a full queue behind, keep the older events and count the newer ones as dropped
+    uint32_t head = eventHead.load(std::memory_order_relaxed);
+    if (head - eventTail.load(std::memory_order_acquire) < EVENT_QUEUE_SIZE) {
+        Event &event = eventRing[head % EVENT_QUEUE_SIZE];
+        event.type = type;
+        event.fenceId = fence.id;
+        event.time = fix.time;
+        event.lat = fix.lat;
+        event.lon = fix.lon;
+        eventHead.store(head + 1, std::memory_order_release);
+    }
+    else {
+        eventsDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Geofence::Active *Geofence::findActive(size_t fenceIndex) {
+    for(size_t ii = 0; ii < numActive; ii++) {
+        if (active[ii].fence == fenceIndex) {
+            return &active[ii];
+        }
+    }
+    return nullptr;
+}
+
+void Geofence::removeActive(Active *entry) {
+    *entry = active[--numActive];
+}
+
+// [static]
+const char *Geofence::eventTypeName(EventType type) {
+    switch(type) {
+        case EventType::enter:
+            return "enter";
+        case EventType::exit:
+            return "exit";
+        default:
+            return "dwell";
+    }
+}
+
+// [static]
+uint16_t Geofence::cosLatitude(int32_t lat) {
+    double value = cos(lat * (3.14159265358979323846 / 1800000000.0)) * 32768.0;
+    if (value < 1) {
+        return 1;
+    }
+    return (value > 32768) ? 32768 : (uint16_t)(value + 0.5);
+}
@@ -0,0 +1,331 @@
+#ifndef __GEOFENCE_H
+#define __GEOFENCE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "GeoBlob.h"
+
+/**
+ * @brief On-device geofence engine for circles and polygons, evaluated on every fix
+ *
+ * Fences are added once, then build() indexes them in a uniform grid over their bounding boxes. Each fix looks up
+ * a single grid cell, so the cost depends on how many fences overlap that cell, not on the total number of fences.
+ * Coordinates are fixed-point degrees * 10^7, the same as LocationBatch::Fix, and the point-in-polygon and circle tests
+ * use integer arithmetic only.
+ *
+ * Hysteresis keeps a fix wandering along a boundary from producing a stream of events:
+ * - enter is reported after withConfirmFixes() consecutive fixes inside the fence
+ * - exit is reported after withConfirmFixes() consecutive fixes more than withExitMargin() meters outside it
+ * - dwell is reported once per visit after the device has been inside for withDwellTime() seconds
+ * - fixes with a horizontal accuracy worse than withMaxAccuracy() are ignored
+ *
+ * Per-fence state is only kept for the fences the device is in (or entering), at most MAX_ACTIVE, so RAM use does
+ * not grow with the number of fences.
+ *
+ * The fences can also be used in place from a GeoBlob with attach(), instead of adding them and calling build(). Each
+ * fix then reads the grid cell, the fences in it, and their vertices from the blob, and the fences take no RAM.
+ *
+ * evaluate() and takeEvent() can be called from different threads (the GNSS worker thread and loop()), but evaluate()
+ * must not be called from two threads at once. Adding fences and build(), or attach(), must be done before evaluate()
+ * is first called. Fences may not cross the antimeridian.
+ *
+ * This file does not depend on Device OS so the same code can be compiled on a computer to test and benchmark it.
+ */
+class Geofence {
+public:
+    /**
+     * @brief A point in degrees * 10^7
+     */
+    struct Vertex {
+        int32_t lat;                    /**< Latitude in degrees * 10^7 */
+        int32_t lon;                    /**< Longitude in degrees * 10^7 */
+    };
+
+    /**
+     * @brief A fix to evaluate
+     */
+    struct Fix {
+        uint32_t time;                  /**< Unix time in seconds, used for dwell and event times */
+        int32_t lat;                    /**< Latitude in degrees * 10^7 */
+        int32_t lon;                    /**< Longitude in degrees * 10^7 */
+        uint32_t hAcc;                  /**< Horizontal accuracy in meters, 0 if not known */
+    };
+
+    /**
+     * @brief One fence as stored in the index. 32 bytes.
+     */
+    struct Fence {
+        int32_t minLat;                 /**< Bounding box */
+        int32_t minLon;                 /**< Bounding box */
+        int32_t maxLat;                 /**< Bounding box */
+        int32_t maxLon;                 /**< Bounding box */
+        uint32_t id;                    /**< Caller's fence ID, reported in events */
+        uint32_t firstVertex;           /**< Index of the first polygon vertex, or of the circle center */
+        uint32_t radius;                /**< Circle radius in degrees * 10^7 of latitude, 0 for a polygon */
+        uint16_t numVertices;           /**< Number of polygon vertices, 1 for a circle */
+        uint16_t cosLat;                /**< Cosine of the latitude of the fence, 32768 = 1.0 */
+
+        /**
+         * @brief true if this fence is a circle
+         */
+        bool isCircle() const { return radius != 0; };
+    };
+
+    /**
+     * @brief Event type
+     */
+    enum class EventType : uint8_t {
+        enter,                          /**< Entered the fence */
+        exit,                           /**< Left the fence */
+        dwell                           /**< Inside the fence for the dwell time */
+    };
+
+    /**
+     * @brief An enter, exit, or dwell event, from takeEvent()
+     */
+    struct Event {
+        EventType type;                 /**< What happened */
+        uint32_t fenceId;               /**< ID passed to addCircle() or addPolygon() */
+        uint32_t time;                  /**< Time of the fix that caused the event */
+        int32_t lat;                    /**< Latitude of that fix in degrees * 10^7 */
+        int32_t lon;                    /**< Longitude of that fix in degrees * 10^7 */
+    };
+
+    /**
+     * @brief Counters from getStats()
+     */
+    struct Stats {
+        uint32_t fixes;                 /**< Fixes evaluated */
+        uint32_t fixesIgnored;          /**< Fixes ignored because of poor accuracy */
+        uint32_t fencesTested;          /**< Fences whose bounding box or shape was tested */
+        uint32_t maxFencesTested;       /**< Most fences tested for a single fix */
+        uint32_t events;                /**< Events queued */
+        uint32_t activeFull;            /**< Entries not tracked because MAX_ACTIVE fences were already active */
+        uint32_t gridCells;             /**< Number of cells in the grid */
+        uint32_t memoryBytes;           /**< RAM used by the fences, vertices, and grid, 0 when attached to a GeoBlob */
+        uint32_t readErrors;            /**< GeoBlob reads that failed */
+    };
+
+    /**
+     * @brief Maximum number of fences. Fence indexes in the grid are 16 bits.
+     */
+    static const size_t MAX_FENCES = 65535;
+
+    /**
+     * @brief Maximum number of fences the device can be in (or entering) at once
+     */
+    static const size_t MAX_ACTIVE = 16;
+
+    /**
+     * @brief Maximum number of grid cells. Each takes 4 bytes.
+     */
+    static const size_t MAX_GRID_CELLS = 16384;
+
+    /**
+     * @brief Events waiting for takeEvent(). More are counted as dropped.
+     */
+    static const size_t EVENT_QUEUE_SIZE = 16;
+
+    /**
+     * @brief Largest polygon in degrees * 10^7, in either direction. Keeps the crossing test within 64 bits.
+     */
+    static const int32_t MAX_POLYGON_SPAN = 900000000;
+
+    /**
+     * @brief Largest circle radius in meters
+     */
+    static const uint32_t MAX_RADIUS = 1000000;
+
+    /**
+     * @brief Add a circular fence
+     *
+     * @param id Fence ID reported in events
+     * @param lat Center latitude in degrees * 10^7
+     * @param lon Center longitude in degrees * 10^7
+     * @param radiusMeters Radius in meters, 1 to MAX_RADIUS
+     * @return true if added
+     */
+    bool addCircle(uint32_t id, int32_t lat, int32_t lon, uint32_t radiusMeters);
+
+    /**
+     * @brief Add a polygon fence
+     *
+     * @param id Fence ID reported in events
+     * @param vertices Vertices in order, either direction. The polygon is closed automatically.
+     * @param numVertices Number of vertices, at least 3
+     * @return true if added
+     */
+    bool addPolygon(uint32_t id, const Vertex *vertices, size_t numVertices);
+
+    /**
+     * @brief Build the grid index. Call after adding fences and before evaluate().
+     *
+     * @return true on success, false if there are no fences
+     */
+    bool build();
+
+    /**
+     * @brief Use the fences and grid in a blob in place, instead of adding fences and calling build()
+     *
+     * @param blob An open blob. Must stay open while this object is used.
+     * @return true if the blob has fences
+     *
+     * Fences added with addCircle() and addPolygon() are discarded.
+     */
+    bool attach(const GeoBlob &blob);
+
+    /**
+     * @brief Evaluate a fix against the fences and queue any events
+     *
+     * @param fix Position to test
+     */
+    void evaluate(const Fix &fix);
+
+    /**
+     * @brief Take the oldest queued event
+     *
+     * @param event Filled in with the event
+     * @return true if an event was returned, false if there are none
+     */
+    bool takeEvent(Event &event);
+
+    /**
+     * @brief Consecutive fixes needed to enter or exit. Default is 2.
+     */
+    Geofence &withConfirmFixes(uint8_t count) { confirmFixes = count ? count : 1; return *this; };
+
+    /**
+     * @brief Distance outside a fence before a fix counts toward exiting it. Default is 25 meters.
+     */
+    Geofence &withExitMargin(uint32_t meters) { exitMargin = metersToUnits(meters); return *this; };
+
+    /**
+     * @brief Time inside a fence before a dwell event. Default is 0, no dwell events.
+     */
+    Geofence &withDwellTime(uint32_t seconds) { dwellTime = seconds; return *this; };
+
+    /**
+     * @brief Ignore fixes with a horizontal accuracy worse than this. Default is 100 meters. 0 accepts all fixes.
+     */
+    Geofence &withMaxAccuracy(uint32_t meters) { maxAccuracy = meters; return *this; };
+
+    /**
+     * @brief Number of fences
+     */
+    size_t size() const { return numFences; };
+
+    /**
+     * @brief Number of fences the device is in, not counting fences it is still entering
+     */
+    size_t getInsideCount() const;
+
+    /**
+     * @brief Get counters. Not synchronized with evaluate(), so the values may be from different fixes.
+     */
+    Stats getStats() const { return stats; };
+
+    /**
+     * @brief Events that were dropped because the queue was full
+     */
+    uint32_t getEventsDropped() const { return eventsDropped.load(std::memory_order_relaxed); };
+
+    /**
+     * @brief Name of an event type as used in the geofence event: "enter", "exit", or "dwell"
+     */
+    static const char *eventTypeName(EventType type);
+
+    /**
+     * @brief Convert meters to degrees * 10^7 of latitude
+     */
+    static uint32_t metersToUnits(uint32_t meters) { return (uint32_t)(((uint64_t)meters * 8983 + 50) / 100); };
+
+protected:
+    /**
+     * @brief Result of testing a fix against one fence
+     */
+    enum class Test : uint8_t {
+        inside,                         /**< Inside */
+        near,                           /**< Outside but within the exit margin */
+        outside                         /**< Outside by more than the exit margin */
+    };
+
+    /**
+     * @brief State of a fence the device is in or entering
+     */
+    struct Active {
+        uint16_t fence;                 /**< Index into fences */
+        uint8_t count;                  /**< Consecutive fixes toward entering or exiting */
+        bool inside;                    /**< Enter was reported */
+        bool dwellSent;                 /**< Dwell was reported for this visit */
+        bool visited;                   /**< Tested for the current fix */
+        uint32_t enterTime;             /**< Time of the enter event */
+    };
+
+    /**
+     * @brief Grid over the bounding box of all fences
+     */
+    struct Grid {
+        int32_t minLat;                 /**< South edge */
+        int32_t minLon;                 /**< West edge */
+        uint32_t cellLat;               /**< Cell height in degrees * 10^7 */
+        uint32_t cellLon;               /**< Cell width in degrees * 10^7 */
+        uint16_t rows;                  /**< Number of rows, 0 if not built */
+        uint16_t cols;                  /**< Number of columns */
+    };
+
+    void evaluateFence(size_t fenceIndex, const Vertex &point, const Fix &fix);
+    Test test(const Fence &fence, const Vertex &point, bool withMargin);
+    bool insidePolygon(const Fence &fence, const Vertex &point);
+    bool nearPolygon(const Fence &fence, const Vertex &point);
+    Test testCircle(const Fence &fence, const Vertex &point, bool withMargin);
+    bool update(Active &entry, const Fence &fence, Test result, const Fix &fix);
+
+    const Fence *getFence(size_t fenceIndex, Fence &buf);
+    bool getCell(size_t cell, uint32_t &start, uint32_t &end);
+    const uint16_t *getCellFences(uint32_t start, size_t count, uint16_t *buf);
+    template<class Fn> void forEachEdge(const Fence &fence, Fn fn);
+    bool blobRead(uint32_t offset, void *buf, size_t len);
+    void queueEvent(EventType type, const Fence &fence, const Fix &fix);
+    Active *findActive(size_t fenceIndex);
+    void removeActive(Active *active);
+
+    static uint16_t cosLatitude(int32_t lat);
+
+    /**
+     * @brief Number of vertices or cell fence indexes read from a GeoBlob at a time
+     */
+    static const size_t BLOB_CHUNK = 16;
+
+    std::vector<Fence> fenceStorage;
+    std::vector<Vertex> vertexStorage;
+    std::vector<uint32_t> cellStartStorage;
+    std::vector<uint16_t> cellFenceStorage;
+
+    // The index is accessed through these or blob, so it does not need to be in the vectors above
+    const GeoBlob *blob = nullptr;
+    const Fence *fences = nullptr;
+    const Vertex *vertices = nullptr;
+    const uint32_t *cellStart = nullptr; //!< rows * cols + 1 offsets into cellFences
+    const uint16_t *cellFences = nullptr; //!< Fence indexes for each cell
+    size_t numFences = 0;
+    Grid grid = {};
+
+    Active active[MAX_ACTIVE];
+    size_t numActive = 0;
+
+    uint8_t confirmFixes = 2;
+    uint32_t exitMargin = metersToUnits(25);
+    uint32_t dwellTime = 0;
+    uint32_t maxAccuracy = 100;
+    Stats stats = {};
+
+    Event eventRing[EVENT_QUEUE_SIZE];
+    std::atomic<uint32_t> eventHead{0};
+    std::atomic<uint32_t> eventTail{0};
+    std::atomic<uint32_t> eventsDropped{0};
+};
+
+#endif /* __GEOFENCE_H */
@@ -11,6 +11,11 @@
 // inlcude libraries
 #include "LocationFusionRK.h"
 #include "QuectelGnssRK.h"
+#include "Geofence.h"
+#include "GeoBlob.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
 
 // turn on serial logger
 SerialLogHandler logHandler(LOG_LEVEL_TRACE);
@@ -117,9 +122,27 @@ public:
 // Instantiate the state machine
 LocationStateMachine appStateMachine;
 
+// Geofence engine, evaluated on every GNSS fix (see setupGeofences)
+Geofence geofence;
+std::atomic<uint32_t> geofenceEvalMicros{0};
+const int GEOFENCE_PUBLISH_ATTEMPTS = 5;                // attempts to publish an event before it is dropped
+uint32_t geofencePublishDropped = 0;                    // events dropped after GEOFENCE_PUBLISH_ATTEMPTS failed publishes
+
+// Geofence and known access point database from Asset OTA, built with tools/geoblob.py (see handleAssets)
+const char * const GEO_BLOB_PATH = "/usr/geo/geo.bin";
+GeoBlob geofenceBlob;                                   // read by the geofence engine on the GNSS worker thread
+GeoBlob accessPointBlob;                                // read by the BSSID lookup on the LocationFusionRK thread
+
 //forward function declarations
 void locEnhancedCallback(const Variant &variant);       // function for receiving enhanced location data from the cloud
 void updateStateMachine();                              // function for the FSM
+void handleStatusTransition(const LocationFusionRK::StatusTransition &transition);  // function for applying LocationFusionRK status changes to the FSM
+void setupGeofences();                                  // function for loading the geofences and subscribing to GNSS fixes
+void updateGeofences();                                 // function for publishing geofence events
+void handleAssets(spark::Vector<ApplicationAsset> assets);  // function for installing the geofence and access point database
+
+// Install a new database before setup() when an Asset OTA delivers one
+STARTUP(System.onAssetOta(handleAssets));
 
 // setup() runs once at startup, loop() runs continuously after
 void setup() {
@@ -142,14 +165,34 @@ void setup() {
     // Initialize Quectel GNSS RK with the specified configuration
     QuectelGnssRK::instance().begin(config);
 
+    // Load the geofences and evaluate them on every fix, so entry alerts do not wait for the next publish
+    setupGeofences();
+
     // Configure LocationFusionRK (using polling, not callbacks)
     LocationFusionRK::instance()
         .withAddTower(true)
+        .withAddNeighborCells()         // serving cell signal metrics and neighbor cells for a tighter tower fix
         .withAddWiFi(true)
         .withPublishPeriodic(5min)      //sets the publish frequency
         .withLocEnhancedHandler(locEnhancedCallback)
-        .withAddToEventHandler(QuectelGnssRK::addToEventHandler)
-        // .withAddToEventHandler() can add other data sources to the same event, like cellular or motion data in the future
+        .withBssidCache()               // answer from learned access point positions at places visited before
+        .withBssidLookup([](const uint8_t *bssid, LocationFusionRK::CachedPosition &position) {
+            // access points that have not been learned yet may be in the Asset OTA database
+            GeoBlob::AccessPoint ap;
+            if (!accessPointBlob.findAccessPoint(bssid, ap)) {
+                return false;
+            }
+            position.lat = ap.lat;
+            position.lon = ap.lon;
+            position.hAcc = ap.hAcc;
+            return true;
+        })
+        .withCellCache()                // learn cell positions for a coarse fix at boot and while offline
+        .withPrefetchHandler(QuectelGnssRK::prefetchHandler, QuectelGnssRK::prefetchLeadTime)  // start GNSS early so the publish is on time
+        .withConcurrentGather(true, QuectelGnssRK::concurrentGatherSupported)  // scan Wi-Fi while GNSS is acquiring
+        .withTrackLog()                 // keep fixes in flash while offline and replay them as loc-batch events
+        .withAddToEventWriterHandler(QuectelGnssRK::addToEventWriterHandler)  // writes the loc event without a Variant tree
+        // .withAddToEventWriterHandler() can add other data sources to the same event, like cellular or motion data in the future
         .setup();
 
     // explicitly turn on Wi-Fi for scanning (LocationFusionRK will manage it from here)
@@ -161,6 +204,12 @@ void setup() {
     // WiFi remains on for access point scanning (needed for location fusion)
     Cellular.prefer();
 
+    // Coarse position from the last cell seen before reset, available before GNSS or the cloud
+    LocationFusionRK::CachedPosition coarse;
+    if (LocationFusionRK::instance().getLastCellPosition(coarse)) {
+        Log.info("Last cell position: lat=%.5f, lon=%.5f, accuracy=%um", coarse.lat / 10000000.0, coarse.lon / 10000000.0, coarse.hAcc);
+    }
+
     // logging messages
     Log.info("State machine initialized - monitoring mode");
 
@@ -174,6 +223,9 @@ void loop() {
     // update the state machine to monitor LocationFusionRK status and manage app lifecycle
     updateStateMachine();
 
+    // publish geofence enter, exit, and dwell events
+    updateGeofences();
+
     //expand code base here for future features like motion detection, battery monitoring, geofencing, etc.
 }
 
@@ -206,7 +258,15 @@ void locEnhancedCallback(const Variant &variant) {
 
 // function for the FSM
 void updateStateMachine() {
-    // Rate limit - only run once per second to avoid overhead
+    // Drain every LocationFusionRK status transition since the last call. Each one is delivered exactly once and in
+    // order, so short-lived states like publishSuccess are never missed. This runs on every loop, not once per second.
+    LocationFusionRK::StatusTransition transition;
+    while (LocationFusionRK::instance().takeStatusTransition(transition)) {
+        Log.info("LocationFusionRK Status: %d req_id=%d error=%d", (int)transition.status, transition.reqId, transition.error);
+        handleStatusTransition(transition);
+    }
+
+    // Rate limit the time-based checks - only run once per second to avoid overhead
     static uint32_t lastUpdate = 0;
     if (millis() - lastUpdate < 1000) {
         return;
@@ -215,17 +275,7 @@ void updateStateMachine() {
     // Update the last update time
     lastUpdate = millis();
 
-    // Poll LocationFusionRK status (thread-safe from application loop)
-    static LocationFusionRK::Status lastStatus = LocationFusionRK::Status::idle;
-    LocationFusionRK::Status currentStatus = LocationFusionRK::instance().getStatus();
-
-    // Log status changes for debugging
-    if (currentStatus != lastStatus) {
-        lastStatus = currentStatus;
-        Log.info("LocationFusionRK Status: %d", (int)currentStatus);
-    }
-
-    // State machine logic - MONITORING mode (doesn't block operations)
+    // Time-based state logic - transitions driven by LocationFusionRK status are in handleStatusTransition()
     switch(appStateMachine.getState()) {
 
         // Initial state after boot - waiting for cloud connection
@@ -245,16 +295,10 @@ void updateStateMachine() {
             }
             break;
 
-        // After cloud connection, waiting for the first location publish to complete
+        // After cloud connection, waiting for the first location publish to start
         case LocationStateMachine::AppState::WAITING_FIRST_PUBLISH:
-            // Monitor first location publish attempt
-            if (currentStatus == LocationFusionRK::Status::publishing) {
-                Log.info("First location publish started");
-                appStateMachine.markFirstPublishComplete();
-                appStateMachine.setState(LocationStateMachine::AppState::LOCATION_BUILDING);
-            }
             // Log warning if taking too long
-            else if (appStateMachine.getTimeSinceBoot() > 120000) {
+            if (appStateMachine.getTimeSinceBoot() > 120000) {
                 static bool firstPublishWarned = false;
                 if (!firstPublishWarned) {
                     Log.warn("First publish taking longer than expected (120s since boot)");
@@ -263,63 +307,6 @@ void updateStateMachine() {
             }
             break;
 
-        // Normal operation - monitor for location publish cycles and handle transitions
-        case LocationStateMachine::AppState::IDLE:
-            // Normal operation - monitor for next location publish cycle
-            if (currentStatus == LocationFusionRK::Status::publishing) {
-                appStateMachine.setState(LocationStateMachine::AppState::LOCATION_BUILDING);
-                Log.info("Collecting location data (GNSS/WiFi/Cell)...");
-            }
-            break;
-
-        // LocationFusionRK is collecting data for a publish cycle
-        case LocationStateMachine::AppState::LOCATION_BUILDING:
-            // LocationFusionRK is collecting data
-            if (currentStatus == LocationFusionRK::Status::publishSuccess) {
-                appStateMachine.setState(LocationStateMachine::AppState::LOCATION_PUBLISHING);
-                Log.info("Location published successfully");
-            } else if (currentStatus == LocationFusionRK::Status::publishFail) {
-                appStateMachine.setState(LocationStateMachine::AppState::ERROR_RECOVERY);
-                Log.error("Location publish failed");
-            } else if (currentStatus == LocationFusionRK::Status::locEnhancedWait) {
-                // Status skipped ahead - publish succeeded but we missed it
-                Log.info("Location published, waiting for enhanced (skipped publishSuccess)");
-                appStateMachine.setState(LocationStateMachine::AppState::LOCATION_WAITING);
-            } else if (currentStatus == LocationFusionRK::Status::locEnhancedSuccess) {
-                // Status jumped all the way to success
-                Log.info("Enhanced location received (skipped intermediate states)");
-                appStateMachine.setState(LocationStateMachine::AppState::IDLE);
-            } else if (currentStatus == LocationFusionRK::Status::idle) {
-                // Publish completed and returned to idle - we missed the whole sequence!
-                Log.info("Location publish completed (missed intermediate states)");
-                appStateMachine.setState(LocationStateMachine::AppState::IDLE);
-            }
-            break;
-
-        // After publishing, waiting for confirmation and enhanced location response
-        case LocationStateMachine::AppState::LOCATION_PUBLISHING:
-            // Waiting for cloud-enhanced response
-            if (currentStatus == LocationFusionRK::Status::locEnhancedWait) {
-                appStateMachine.setState(LocationStateMachine::AppState::LOCATION_WAITING);
-                Log.info("Waiting for cloud-enhanced location...");
-            } else if (currentStatus == LocationFusionRK::Status::idle) {
-                // Published but no enhanced location expected
-                appStateMachine.setState(LocationStateMachine::AppState::IDLE);
-            }
-            break;
-
-        // Waiting for enhanced location response after publish
-        case LocationStateMachine::AppState::LOCATION_WAITING:
-            // Waiting for enhanced location callback
-            if (currentStatus == LocationFusionRK::Status::locEnhancedSuccess) {
-                Log.info("Enhanced location received successfully");
-                appStateMachine.setState(LocationStateMachine::AppState::IDLE);
-            } else if (currentStatus == LocationFusionRK::Status::locEnhancedFail) {
-                Log.warn("Enhanced location failed, but base location was sent");
-                appStateMachine.setState(LocationStateMachine::AppState::IDLE);
-            }
-            break;
-
         // Error recovery state - waits for a delay before allowing retries
         case LocationStateMachine::AppState::ERROR_RECOVERY:
             // Handle error recovery with retry delay
@@ -330,7 +317,17 @@ void updateStateMachine() {
             break;
 
         // Future expansion: Add motion detection, battery monitoring, geofencing, etc.
+        default:
+            break;
+    }
 
+    if (LocationFusionRK::instance().getStatusTransitionsDropped()) {
+        static uint32_t lastDropped = 0;
+        uint32_t dropped = LocationFusionRK::instance().getStatusTransitionsDropped();
+        if (dropped != lastDropped) {
+            Log.warn("%lu status transitions dropped", dropped - lastDropped);
+            lastDropped = dropped;
+        }
     }
 
     // Periodic state logging (every 30 seconds)
@@ -344,3 +341,207 @@ void updateStateMachine() {
     }
 
 }
+
+// function for applying one LocationFusionRK status transition to the FSM
+void handleStatusTransition(const LocationFusionRK::StatusTransition &transition) {
+    switch(transition.status) {
+
+        // LocationFusionRK started collecting data (GNSS/WiFi/Cell) for a publish cycle
+        case LocationFusionRK::Status::publishing:
+            if (!appStateMachine.isFirstPublishComplete()) {
+                Log.info("First location publish started");
+                appStateMachine.markFirstPublishComplete();
+            }
+            else {
+                Log.info("Collecting location data (GNSS/WiFi/Cell)...");
+            }
+            appStateMachine.setState(LocationStateMachine::AppState::LOCATION_BUILDING);
+            break;
+
+        case LocationFusionRK::Status::publishSuccess:
+            Log.info("Location published successfully");
+            appStateMachine.setState(LocationStateMachine::AppState::LOCATION_PUBLISHING);
+            break;
+
+        case LocationFusionRK::Status::publishFail:
+            Log.error("Location publish failed (error %d)", transition.error);
+            appStateMachine.setState(LocationStateMachine::AppState::ERROR_RECOVERY);
+            break;
+
+        // Waiting for cloud-enhanced response
+        case LocationFusionRK::Status::locEnhancedWait:
+            Log.info("Waiting for cloud-enhanced location...");
+            appStateMachine.setState(LocationStateMachine::AppState::LOCATION_WAITING);
+            break;
+
+        case LocationFusionRK::Status::locEnhancedSuccess:
+            Log.info("Enhanced location received successfully (req_id %d, rtt %lu ms)", transition.reqId, LocationFusionRK::instance().getLocEnhancedStats().lastRttMs);
+            appStateMachine.setState(LocationStateMachine::AppState::IDLE);
+            break;
+
+        case LocationFusionRK::Status::locEnhancedFail:
+            Log.warn("Enhanced location failed for req_id %d, but base location was sent", transition.reqId);
+            appStateMachine.setState(LocationStateMachine::AppState::IDLE);
+            break;
+
+        // Sending fixes logged while offline
+        case LocationFusionRK::Status::replaying:
+            Log.info("Replaying track log (%lu records written, %lu replayed)", 
+                LocationFusionRK::instance().getTrackLogStats().recordsWritten, LocationFusionRK::instance().getTrackLogStats().recordsReplayed);
+            break;
+
+        // Published but no enhanced location expected
+        case LocationFusionRK::Status::idle:
+            if (appStateMachine.getState() == LocationStateMachine::AppState::LOCATION_PUBLISHING) {
+                appStateMachine.setState(LocationStateMachine::AppState::IDLE);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// function for loading the geofences and subscribing to GNSS fixes
+void setupGeofences() {
+    // Enter or exit after 2 fixes in a row, exit only when 25 m outside, dwell after 10 minutes, ignore poor fixes
+    geofence.withConfirmFixes(2)
+        .withExitMargin(25)
+        .withDwellTime(10 * 60)
+        .withMaxAccuracy(50);
+
+    // Use the Asset OTA database in place. Only the header is read here, so any number of fences loads instantly.
+    accessPointBlob.open(GEO_BLOB_PATH);
+    if (geofenceBlob.open(GEO_BLOB_PATH) && geofence.attach(geofenceBlob)) {
+        const GeoBlob::Header &header = geofenceBlob.getHeader();
+        Log.info("Geofence: %lu fences and %lu access points from %s, built %lu", header.numFences, header.numAccessPoints, GEO_BLOB_PATH, header.buildTime);
+    }
+    else {
+        // Example fences, replace with your own or deliver a database with Asset OTA. The ID is reported in the geofence event.
+        geofence.addCircle(1, 421234567, -751234567, 200);     // depot, 200 m radius
+
+        static const Geofence::Vertex yard[] = {
+            {421300000, -751300000},
+            {421300000, -751250000},
+            {421340000, -751250000},
+            {421340000, -751300000},
+        };
+        geofence.addPolygon(2, yard, sizeof(yard) / sizeof(yard[0]));
+        geofence.build();
+
+        Geofence::Stats stats = geofence.getStats();
+        Log.info("Geofence: %u fences, %lu grid cells, %lu bytes", (unsigned)geofence.size(), stats.gridCells, stats.memoryBytes);
+    }
+
+    // Runs on the GNSS worker thread for every fix, including the fixes taken for LocationFusionRK publishes
+    QuectelGnssRK::instance().subscribe([](const QuectelGnssRK::LocationPoint &point) {
+        if (!point.fix) {
+            return;
+        }
+        Geofence::Fix fix;
+        fix.time = (uint32_t)point.epochTime;
+        fix.lat = (int32_t)lround(point.latitude * 10000000.0);
+        fix.lon = (int32_t)lround(point.longitude * 10000000.0);
+        fix.hAcc = (uint32_t)point.horizontalAccuracy;
+
+        unsigned long start = micros();
+        geofence.evaluate(fix);
+        geofenceEvalMicros = (uint32_t)(micros() - start);
+    });
+}
+
+// function for publishing geofence events
+void updateGeofences() {
+    // Fixes every second give entry alerts within seconds. The BG95 cannot track because cellular is blocked while
+    // GNSS is on, so there the fences are evaluated on the fixes taken for each publish.
+    static bool trackingRequested = false;
+    if (!trackingRequested && Cellular.isOn()) {
+        trackingRequested = true;
+        if (QuectelGnssRK::instance().startTracking(1000) == QuectelGnssRK::LocationResults::Acquiring) {
+            Log.info("Geofence: tracking started");
+        }
+        else {
+            Log.info("Geofence: tracking not supported, using publish fixes");
+        }
+    }
+
+    // Hold one event until it is published, at most one publish per second and 5 seconds after a failed publish
+    static Geofence::Event event;
+    static bool eventPending = false;
+    static int attempts = 0;
+    static uint32_t lastPublish = 0;
+    static uint32_t retryDelay = 1000;
+    if (!eventPending && geofence.takeEvent(event)) {
+        eventPending = true;
+        attempts = 0;
+        Log.info("Geofence %s fence %lu (evaluate %lu us)", Geofence::eventTypeName(event.type), event.fenceId, geofenceEvalMicros.load());
+    }
+    if (!eventPending || !Particle.connected() || millis() - lastPublish < retryDelay) {
+        return;
+    }
+
+    char buf[128];
+    JSONBufferWriter writer(buf, sizeof(buf) - 1);
+    writer.beginObject();
+    writer.name("type").value(Geofence::eventTypeName(event.type));
+    writer.name("id").value(event.fenceId);
+    writer.name("time").value(event.time);
+    writer.name("lat").value(event.lat / 10000000.0, 7);
+    writer.name("lon").value(event.lon / 10000000.0, 7);
+    writer.endObject();
+    writer.buffer()[std::min(writer.bufferSize(), writer.dataSize())] = 0;
+
+    bool published = Particle.publish("geofence", buf);
+    lastPublish = millis();
+    if (published) {
+        eventPending = false;
+        retryDelay = 1000;
+    }
+    else if (++attempts >= GEOFENCE_PUBLISH_ATTEMPTS) {
+        eventPending = false;
+        retryDelay = 1000;
+        geofencePublishDropped++;
+        Log.warn("Geofence %s fence %lu dropped after %d failed publishes, %lu dropped", Geofence::eventTypeName(event.type),
+                 event.fenceId, attempts, geofencePublishDropped);
+    }
+    else {
+        retryDelay = 5000;
+        Log.warn("Geofence publish failed, attempt %d of %d", attempts, GEOFENCE_PUBLISH_ATTEMPTS);
+    }
+}
+
+// function for installing the geofence and access point database when it changes in an Asset OTA
+void handleAssets(spark::Vector<ApplicationAsset> assets) {
+    for (ApplicationAsset &asset : assets) {
+        if (asset.name() != "geo.bin") {
+            continue;
+        }
+
+        // Copy to a temporary file and check the CRC before replacing the installed database, so a bad asset
+        // leaves the old one in place. Assets cannot be read in place, so this copy is what is queried.
+        const char *tempPath = "/usr/geo/geo.tmp";
+        mkdir("/usr/geo", 0777);
+        int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        bool written = (fd >= 0);
+        char buf[512];
+        while (written && asset.available() > 0) {
+            int len = asset.read(buf, sizeof(buf));
+            written = (len > 0 && write(fd, buf, len) == len);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        GeoBlob blob;
+        bool valid = written && blob.open(tempPath) && blob.verify();
+        blob.close();
+        if (valid && rename(tempPath, GEO_BLOB_PATH) == 0) {
+            Log.info("Installed %s, %u bytes", GEO_BLOB_PATH, (unsigned)asset.size());
+        }
+        else {
+            Log.error("geo.bin asset is not a valid GeoBlob, keeping the installed database");
+            unlink(tempPath);
+        }
+    }
+    System.assetsHandled(true);
+}
@@ -0,0 +1,538 @@
+#!/usr/bin/env python3
+"""Build and verify GeoBlob files: geofences and known access point positions, delivered to the device by Asset OTA.
+
+Build a blob from a GeoJSON file of fences and a CSV file of access points (either can be left out):
+
+    tools/geoblob.py build --fences fences.geojson --aps aps.csv -o assets/geo.bin
+
+Verify a blob, and optionally check it against the files it was built from:
+
+    tools/geoblob.py verify assets/geo.bin --fences fences.geojson --aps aps.csv
+
+Fences are GeoJSON features:
+- Polygon and MultiPolygon geometries. Only the outer ring is used; holes are ignored with a warning. Each polygon of
+  a MultiPolygon is a separate fence with the same ID.
+- Point geometries with a "radius" property in meters are circles.
+- The fence ID is properties.id, or the feature id, or the feature's position in the file starting at 1.
+
+Access points are CSV rows of bssid,lat,lon,h_acc with an optional header row. h_acc is in meters and defaults to 30.
+
+The layout is described in src/GeoBlob.h. The fence records and grid index are made exactly the way Geofence::build()
+makes them in RAM, including its integer arithmetic, so a blob behaves the same as adding the same fences on-device.
+Uses only the Python standard library.
+"""
+
+import argparse
+import csv
+import json
+import math
+import random
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = 0x424f4547
+VERSION = 1
+
+HEADER = struct.Struct('<IHHIIIIIIiiIIHHIIIIIII4I')
+FENCE = struct.Struct('<iiiiIIIHH')
+VERTEX = struct.Struct('<ii')
+ACCESS_POINT = struct.Struct('<6sHii')
+
+# Same limits as Geofence
+MAX_FENCES = 65535
+MAX_GRID_CELLS = 16384
+MAX_POLYGON_SPAN = 900000000
+MAX_RADIUS = 1000000
+MAX_LAT = 900000000
+MAX_LON = 1800000000
+
+DEFAULT_AP_ACCURACY = 30
+
+
+class BlobError(Exception):
+    pass
+
+
+def tdiv(a, b):
+    """Integer division that truncates toward zero, like C++"""
+    q = abs(a) // abs(b)
+    return q if (a < 0) == (b < 0) else -q
+
+
+def meters_to_units(meters):
+    return (meters * 8983 + 50) // 100
+
+
+def cos_latitude(lat):
+    value = math.cos(lat * (3.14159265358979323846 / 1800000000.0)) * 32768.0
+    if value < 1:
+        return 1
+    return 32768 if value > 32768 else int(value + 0.5)
+
+
+def to_units(degrees):
+    return int(round(degrees * 10000000))
+
+
+class Fence:
+    def __init__(self, id, min_lat, min_lon, max_lat, max_lon, first_vertex, radius, num_vertices, cos_lat):
+        self.id = id
+        self.min_lat = min_lat
+        self.min_lon = min_lon
+        self.max_lat = max_lat
+        self.max_lon = max_lon
+        self.first_vertex = first_vertex
+        self.radius = radius
+        self.num_vertices = num_vertices
+        self.cos_lat = cos_lat
+
+    def pack(self):
+        return FENCE.pack(self.min_lat, self.min_lon, self.max_lat, self.max_lon, self.id, self.first_vertex,
+                          self.radius, self.num_vertices, self.cos_lat)
+
+    @staticmethod
+    def unpack(data, offset):
+        min_lat, min_lon, max_lat, max_lon, id, first_vertex, radius, num_vertices, cos_lat = FENCE.unpack_from(data, offset)
+        return Fence(id, min_lat, min_lon, max_lat, max_lon, first_vertex, radius, num_vertices, cos_lat)
+
+
+class FenceSet:
+    """Fences and vertices, added the same way as Geofence::addCircle() and addPolygon()"""
+
+    def __init__(self):
+        self.fences = []
+        self.vertices = []
+
+    def add_circle(self, id, lat, lon, radius_meters):
+        if len(self.fences) >= MAX_FENCES:
+            raise BlobError('more than %d fences' % MAX_FENCES)
+        if radius_meters < 1 or radius_meters > MAX_RADIUS:
+            raise BlobError('fence %d: radius must be 1 to %d meters' % (id, MAX_RADIUS))
+        if abs(lat) > MAX_LAT or abs(lon) > MAX_LON:
+            raise BlobError('fence %d: center is out of range' % id)
+
+        radius = meters_to_units(radius_meters)
+        cos_lat = cos_latitude(lat)
+        lon_radius = radius * 32768 // cos_lat
+        self.fences.append(Fence(id, max(lat - radius, -MAX_LAT), max(lon - lon_radius, -MAX_LON),
+                                 min(lat + radius, MAX_LAT), min(lon + lon_radius, MAX_LON),
+                                 len(self.vertices), radius, 1, cos_lat))
+        self.vertices.append((lat, lon))
+
+    def add_polygon(self, id, vertices):
+        if len(self.fences) >= MAX_FENCES:
+            raise BlobError('more than %d fences' % MAX_FENCES)
+        if len(vertices) < 3 or len(vertices) > 65535:
+            raise BlobError('fence %d: polygons need 3 to 65535 vertices' % id)
+        for lat, lon in vertices:
+            if abs(lat) > MAX_LAT or abs(lon) > MAX_LON:
+                raise BlobError('fence %d: vertex is out of range' % id)
+
+        min_lat = min(v[0] for v in vertices)
+        max_lat = max(v[0] for v in vertices)
+        min_lon = min(v[1] for v in vertices)
+        max_lon = max(v[1] for v in vertices)
+        if max_lat - min_lat > MAX_POLYGON_SPAN or max_lon - min_lon > MAX_POLYGON_SPAN:
+            raise BlobError('fence %d: polygon is too large' % id)
+
+        cos_lat = cos_latitude(tdiv(min_lat, 2) + tdiv(max_lat, 2))
+        self.fences.append(Fence(id, min_lat, min_lon, max_lat, max_lon, len(self.vertices), 0, len(vertices), cos_lat))
+        self.vertices.extend(vertices)
+
+
+class Grid:
+    def __init__(self, min_lat=0, min_lon=0, cell_lat=0, cell_lon=0, rows=0, cols=0):
+        self.min_lat = min_lat
+        self.min_lon = min_lon
+        self.cell_lat = cell_lat
+        self.cell_lon = cell_lon
+        self.rows = rows
+        self.cols = cols
+
+    def cell_range(self, fence):
+        row0 = (fence.min_lat - self.min_lat) // self.cell_lat
+        row1 = (fence.max_lat - self.min_lat) // self.cell_lat
+        col0 = (fence.min_lon - self.min_lon) // self.cell_lon
+        col1 = (fence.max_lon - self.min_lon) // self.cell_lon
+        return row0, row1, col0, col1
+
+    def cell_of(self, lat, lon):
+        if self.rows == 0 or lat < self.min_lat or lon < self.min_lon:
+            return None
+        row = (lat - self.min_lat) // self.cell_lat
+        col = (lon - self.min_lon) // self.cell_lon
+        if row >= self.rows or col >= self.cols:
+            return None
+        return row * self.cols + col
+
+
+def build_grid(fences):
+    """Same as Geofence::build(): returns the grid, the cell starts, and the cell fence indexes"""
+    if not fences:
+        return Grid(), [], []
+
+    min_lat = min(f.min_lat for f in fences)
+    max_lat = max(f.max_lat for f in fences)
+    min_lon = min(f.min_lon for f in fences)
+    max_lon = max(f.max_lon for f in fences)
+
+    height = float(max_lat - min_lat + 1)
+    width = float(max_lon - min_lon + 1)
+    cos_mid = cos_latitude(tdiv(min_lat, 2) + tdiv(max_lat, 2)) / 32768.0
+    target_cells = min(2.0 * len(fences), float(MAX_GRID_CELLS))
+    cell_size = max(math.sqrt(height * width * cos_mid / target_cells), 1.0)
+    while True:
+        cell_lat = math.ceil(cell_size)
+        cell_lon = math.ceil(cell_size / cos_mid)
+        rows = math.floor(height / cell_lat) + 1
+        cols = math.floor(width / cell_lon) + 1
+        if rows * cols <= MAX_GRID_CELLS and cell_lat < 4e9 and cell_lon < 4e9:
+            break
+        cell_size *= 1.25
+    grid = Grid(min_lat, min_lon, int(cell_lat), int(cell_lon), int(rows), int(cols))
+
+    cells = [[] for _ in range(grid.rows * grid.cols)]
+    for index, fence in enumerate(fences):
+        row0, row1, col0, col1 = grid.cell_range(fence)
+        for row in range(row0, row1 + 1):
+            for col in range(col0, col1 + 1):
+                cells[row * grid.cols + col].append(index)
+
+    cell_start = [0]
+    cell_fences = []
+    for cell in cells:
+        cell_fences.extend(cell)
+        cell_start.append(len(cell_fences))
+    return grid, cell_start, cell_fences
+
+
+def load_fences(path):
+    with open(path) as f:
+        data = json.load(f)
+    if data.get('type') == 'FeatureCollection':
+        features = data.get('features', [])
+    elif data.get('type') == 'Feature':
+        features = [data]
+    else:
+        raise BlobError('%s: expected a GeoJSON Feature or FeatureCollection' % path)
+
+    fence_set = FenceSet()
+    for number, feature in enumerate(features, 1):
+        properties = feature.get('properties') or {}
+        id = properties.get('id', feature.get('id', number))
+        try:
+            id = int(id)
+        except (TypeError, ValueError):
+            raise BlobError('%s: feature %d: id must be an integer' % (path, number))
+        geometry = feature.get('geometry') or {}
+        kind = geometry.get('type')
+        coordinates = geometry.get('coordinates')
+
+        if kind == 'Point':
+            if 'radius' not in properties:
+                raise BlobError('%s: feature %d: Point needs a radius property' % (path, number))
+            fence_set.add_circle(id, to_units(coordinates[1]), to_units(coordinates[0]), int(round(properties['radius'])))
+        elif kind in ('Polygon', 'MultiPolygon'):
+            polygons = [coordinates] if kind == 'Polygon' else coordinates
+            for rings in polygons:
+                if len(rings) > 1:
+                    print('warning: %s: feature %d: holes are ignored' % (path, number), file=sys.stderr)
+                ring = [(to_units(p[1]), to_units(p[0])) for p in rings[0]]
+                if len(ring) > 1 and ring[0] == ring[-1]:
+                    ring.pop()
+                fence_set.add_polygon(id, ring)
+        else:
+            raise BlobError('%s: feature %d: unsupported geometry %s' % (path, number, kind))
+    return fence_set
+
+
+def parse_bssid(text):
+    parts = text.strip().replace('-', ':').split(':')
+    if len(parts) != 6:
+        raise ValueError(text)
+    return bytes(int(p, 16) for p in parts)
+
+
+def load_access_points(path):
+    """Returns a dict of bssid bytes to (h_acc, lat, lon)"""
+    access_points = {}
+    with open(path, newline='') as f:
+        for number, row in enumerate(csv.reader(f), 1):
+            if not row or row[0].strip().startswith('#'):
+                continue
+            try:
+                bssid = parse_bssid(row[0])
+            except ValueError:
+                if number == 1:
+                    continue
+                raise BlobError('%s:%d: invalid BSSID %s' % (path, number, row[0]))
+            try:
+                lat = to_units(float(row[1]))
+                lon = to_units(float(row[2]))
+                h_acc = int(row[3]) if len(row) > 3 and row[3].strip() else DEFAULT_AP_ACCURACY
+            except (IndexError, ValueError):
+                raise BlobError('%s:%d: expected bssid,lat,lon[,h_acc]' % (path, number))
+            if abs(lat) > MAX_LAT or abs(lon) > MAX_LON or not 0 <= h_acc <= 65535:
+                raise BlobError('%s:%d: out of range' % (path, number))
+            if bssid in access_points:
+                print('warning: %s:%d: duplicate BSSID %s, using the last one' % (path, number, row[0]), file=sys.stderr)
+            access_points[bssid] = (h_acc, lat, lon)
+    return access_points
+
+
+def align(data):
+    data.extend(b'\0' * (-len(data) % 4))
+
+
+def build_blob(fence_set, access_points, build_time):
+    grid, cell_start, cell_fences = build_grid(fence_set.fences)
+    data = bytearray(HEADER.size)
+
+    fences_offset = len(data)
+    for fence in fence_set.fences:
+        data += fence.pack()
+    vertices_offset = len(data)
+    for lat, lon in fence_set.vertices:
+        data += VERTEX.pack(lat, lon)
+    cell_start_offset = len(data)
+    data += struct.pack('<%dI' % len(cell_start), *cell_start)
+    cell_fences_offset = len(data)
+    data += struct.pack('<%dH' % len(cell_fences), *cell_fences)
+    align(data)
+
+    bssids = sorted(access_points)
+    fanout_offset = len(data)
+    if bssids:
+        fanout = [0] * 257
+        for bssid in bssids:
+            fanout[bssid[0] + 1] += 1
+        for ii in range(256):
+            fanout[ii + 1] += fanout[ii]
+        data += struct.pack('<257I', *fanout)
+    access_points_offset = len(data)
+    for bssid in bssids:
+        h_acc, lat, lon = access_points[bssid]
+        data += ACCESS_POINT.pack(bssid, h_acc, lat, lon)
+
+    header = HEADER.pack(MAGIC, VERSION, HEADER.size, len(data), 0,
+                         len(fence_set.fences), fences_offset, len(fence_set.vertices), vertices_offset,
+                         grid.min_lat, grid.min_lon, grid.cell_lat, grid.cell_lon, grid.rows, grid.cols,
+                         cell_start_offset, len(cell_fences), cell_fences_offset,
+                         len(bssids), access_points_offset, fanout_offset, build_time, 0, 0, 0, 0)
+    data[0:HEADER.size] = header
+    struct.pack_into('<I', data, 12, zlib.crc32(data) & 0xffffffff)
+    return bytes(data)
+
+
+class Blob:
+    """A blob read back from a file, checked the same way as GeoBlob::open() and verify()"""
+
+    FIELDS = ('magic', 'version', 'header_size', 'size', 'crc', 'num_fences', 'fences_offset', 'num_vertices',
+              'vertices_offset', 'grid_min_lat', 'grid_min_lon', 'grid_cell_lat', 'grid_cell_lon', 'grid_rows',
+              'grid_cols', 'cell_start_offset', 'num_cell_fences', 'cell_fences_offset', 'num_access_points',
+              'access_points_offset', 'fanout_offset', 'build_time')
+
+    def __init__(self, data):
+        if len(data) < HEADER.size:
+            raise BlobError('too small for a header')
+        self.data = data
+        self.__dict__.update(zip(self.FIELDS, HEADER.unpack_from(data)))
+        if self.magic != MAGIC or self.version != VERSION or self.header_size != HEADER.size:
+            raise BlobError('not a version %d GeoBlob' % VERSION)
+        if self.size != len(data):
+            raise BlobError('size is %d in the header but the file is %d bytes' % (self.size, len(data)))
+        crc = zlib.crc32(data[:12] + b'\0\0\0\0' + data[16:]) & 0xffffffff
+        if crc != self.crc:
+            raise BlobError('CRC is 0x%08x, expected 0x%08x' % (crc, self.crc))
+
+        self.num_cells = self.grid_rows * self.grid_cols
+        if (self.num_fences == 0) != (self.num_cells == 0):
+            raise BlobError('fences and grid do not match')
+        if self.num_cells and (self.grid_cell_lat == 0 or self.grid_cell_lon == 0):
+            raise BlobError('grid cell size is 0')
+        for name, offset, count, size in (
+                ('fences', self.fences_offset, self.num_fences, FENCE.size),
+                ('vertices', self.vertices_offset, self.num_vertices, VERTEX.size),
+                ('cell starts', self.cell_start_offset, self.num_cells + 1 if self.num_cells else 0, 4),
+                ('cell fences', self.cell_fences_offset, self.num_cell_fences, 2),
+                ('fan-out', self.fanout_offset, 257 if self.num_access_points else 0, 4),
+                ('access points', self.access_points_offset, self.num_access_points, ACCESS_POINT.size)):
+            if count and (offset % 4 or offset < HEADER.size or offset + count * size > len(data)):
+                raise BlobError('%s section is out of bounds' % name)
+
+        self.grid = Grid(self.grid_min_lat, self.grid_min_lon, self.grid_cell_lat, self.grid_cell_lon,
+                         self.grid_rows, self.grid_cols)
+        self.fences = [Fence.unpack(data, self.fences_offset + ii * FENCE.size) for ii in range(self.num_fences)]
+        self.vertices = [VERTEX.unpack_from(data, self.vertices_offset + ii * VERTEX.size)
+                         for ii in range(self.num_vertices)]
+        self.cell_start = list(struct.unpack_from('<%dI' % (self.num_cells + 1), data, self.cell_start_offset)) \
+            if self.num_cells else []
+        self.cell_fences = list(struct.unpack_from('<%dH' % self.num_cell_fences, data, self.cell_fences_offset))
+        self.fanout = list(struct.unpack_from('<257I', data, self.fanout_offset)) if self.num_access_points else []
+        self.access_points = [ACCESS_POINT.unpack_from(data, self.access_points_offset + ii * ACCESS_POINT.size)
+                              for ii in range(self.num_access_points)]
+
+    def cell_candidates(self, lat, lon):
+        cell = self.grid.cell_of(lat, lon)
+        if cell is None:
+            return []
+        return self.cell_fences[self.cell_start[cell]:self.cell_start[cell + 1]]
+
+    def find_access_point(self, bssid):
+        """Same search as GeoBlob::findAccessPoint()"""
+        low, high = self.fanout[bssid[0]], self.fanout[bssid[0] + 1]
+        while low < high:
+            mid = low + (high - low) // 2
+            entry = self.access_points[mid]
+            if entry[0] == bssid:
+                return entry
+            if entry[0] < bssid:
+                low = mid + 1
+            else:
+                high = mid
+        return None
+
+    def inside(self, fence, lat, lon):
+        """Same as Geofence::test() without the exit margin"""
+        if fence.radius:
+            center_lat, center_lon = self.vertices[fence.first_vertex]
+            dy = lat - center_lat
+            dx = ((lon - center_lon) * fence.cos_lat) >> 15
+            return abs(dy) <= fence.radius and abs(dx) <= fence.radius and dx * dx + dy * dy <= fence.radius * fence.radius
+        if not (fence.min_lat <= lat <= fence.max_lat and fence.min_lon <= lon <= fence.max_lon):
+            return False
+        vertices = self.vertices[fence.first_vertex:fence.first_vertex + fence.num_vertices]
+        inside = False
+        a = vertices[-1]
+        for b in vertices:
+            if (a[0] > lat) != (b[0] > lat):
+                d_lat = b[0] - a[0]
+                cross = (b[1] - a[1]) * (lat - a[0]) - (lon - a[1]) * d_lat
+                if (cross > 0) if d_lat > 0 else (cross < 0):
+                    inside = not inside
+            a = b
+        return inside
+
+
+def check_blob(blob, points):
+    """Checks the records and index, and that grid lookups find the same fences as testing every fence"""
+    for index, fence in enumerate(blob.fences):
+        if fence.num_vertices == 0 or fence.first_vertex + fence.num_vertices > blob.num_vertices:
+            raise BlobError('fence %d vertices are out of bounds' % index)
+        if fence.min_lat > fence.max_lat or fence.min_lon > fence.max_lon:
+            raise BlobError('fence %d bounding box is empty' % index)
+
+    if blob.num_cells:
+        if blob.cell_start[0] != 0 or blob.cell_start[-1] != blob.num_cell_fences or \
+                any(blob.cell_start[ii] > blob.cell_start[ii + 1] for ii in range(blob.num_cells)):
+            raise BlobError('cell starts are not in order')
+        if any(index >= blob.num_fences for index in blob.cell_fences):
+            raise BlobError('cell fence index is out of bounds')
+        # Every fence must be in every cell its bounding box overlaps
+        for index, fence in enumerate(blob.fences):
+            row0, row1, col0, col1 = blob.grid.cell_range(fence)
+            if row0 < 0 or col0 < 0 or row1 >= blob.grid_rows or col1 >= blob.grid_cols:
+                raise BlobError('fence %d is outside the grid' % index)
+            for row in range(row0, row1 + 1):
+                for col in range(col0, col1 + 1):
+                    cell = row * blob.grid_cols + col
+                    if index not in blob.cell_fences[blob.cell_start[cell]:blob.cell_start[cell + 1]]:
+                        raise BlobError('fence %d is missing from cell %d' % (index, cell))
+
+    bssids = [entry[0] for entry in blob.access_points]
+    if any(bssids[ii] >= bssids[ii + 1] for ii in range(len(bssids) - 1)):
+        raise BlobError('access points are not sorted or have duplicates')
+    if bssids:
+        first = 0
+        for value in range(257):
+            while first < len(bssids) and bssids[first][0] < value:
+                first += 1
+            if blob.fanout[value] != first:
+                raise BlobError('fan-out entry %d is wrong' % value)
+        for entry in blob.access_points:
+            if blob.find_access_point(entry[0]) != entry:
+                raise BlobError('access point %s not found by search' % entry[0].hex(':'))
+
+    # Random points in and around the fences, each tested against every fence
+    if blob.fences:
+        rng = random.Random(1)
+        for _ in range(points):
+            fence = blob.fences[rng.randrange(len(blob.fences))]
+            margin_lat = (fence.max_lat - fence.min_lat) // 4 + 1
+            margin_lon = (fence.max_lon - fence.min_lon) // 4 + 1
+            lat = rng.randint(fence.min_lat - margin_lat, fence.max_lat + margin_lat)
+            lon = rng.randint(fence.min_lon - margin_lon, fence.max_lon + margin_lon)
+            expected = {ii for ii, fence in enumerate(blob.fences)
+                        if fence.min_lat <= lat <= fence.max_lat and fence.min_lon <= lon <= fence.max_lon and
+                        blob.inside(fence, lat, lon)}
+            found = {ii for ii in blob.cell_candidates(lat, lon) if blob.inside(blob.fences[ii], lat, lon)}
+            if found != expected:
+                raise BlobError('grid lookup at %d,%d found fences %s, expected %s' %
+                                (lat, lon, sorted(found), sorted(expected)))
+
+
+def read_inputs(args):
+    fence_set = load_fences(args.fences) if args.fences else FenceSet()
+    access_points = load_access_points(args.aps) if args.aps else {}
+    return fence_set, access_points
+
+
+def command_build(args):
+    fence_set, access_points = read_inputs(args)
+    data = build_blob(fence_set, access_points, int(time.time()))
+    check_blob(Blob(data), 0)
+    with open(args.output, 'wb') as f:
+        f.write(data)
+    print('%s: %d fences, %d vertices, %d access points, %d bytes' %
+          (args.output, len(fence_set.fences), len(fence_set.vertices), len(access_points), len(data)))
+
+
+def command_verify(args):
+    with open(args.blob, 'rb') as f:
+        data = f.read()
+    blob = Blob(data)
+    check_blob(blob, args.points)
+    if args.fences or args.aps:
+        # Rebuilding from the same inputs must give the same records and index
+        fence_set, access_points = read_inputs(args)
+        expected = Blob(build_blob(fence_set, access_points, blob.build_time))
+        if args.fences and (blob.data[HEADER.size:blob.cell_fences_offset + 2 * blob.num_cell_fences] !=
+                            expected.data[HEADER.size:expected.cell_fences_offset + 2 * expected.num_cell_fences] or
+                            blob.grid.__dict__ != expected.grid.__dict__):
+            raise BlobError('fences do not match %s' % args.fences)
+        if args.aps and blob.access_points != expected.access_points:
+            raise BlobError('access points do not match %s' % args.aps)
+    print('%s: ok, %d fences, %d access points, built %s' %
+          (args.blob, blob.num_fences, blob.num_access_points,
+           time.strftime('%Y-%m-%d %H:%M:%S UTC', time.gmtime(blob.build_time))))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build and verify GeoBlob files')
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    build = commands.add_parser('build', help='build a blob from GeoJSON fences and CSV access points')
+    build.add_argument('--fences', help='GeoJSON file of fences')
+    build.add_argument('--aps', help='CSV file of bssid,lat,lon[,h_acc]')
+    build.add_argument('-o', '--output', required=True, help='blob file to write')
+    build.set_defaults(func=command_build)
+
+    verify = commands.add_parser('verify', help='check a blob, and optionally compare it to its inputs')
+    verify.add_argument('blob', help='blob file to check')
+    verify.add_argument('--fences', help='GeoJSON file the blob was built from')
+    verify.add_argument('--aps', help='CSV file the blob was built from')
+    verify.add_argument('--points', type=int, default=1000, help='random points to test the grid with, default 1000')
+    verify.set_defaults(func=command_verify)
+
+    args = parser.parse_args()
+    try:
+        args.func(args)
+    except (BlobError, OSError, json.JSONDecodeError) as e:
+        print('error: %s' % e, file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
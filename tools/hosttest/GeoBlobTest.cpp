@@ -0,0 +1,416 @@
+// Checks GeoBlob and Geofence::attach() against blobs made by tools/geoblob.py: the events from the blob, as a file
+// and in memory, must match those from adding the same fences and calling build(), findAccessPoint() must find every
+// access point in the CSV and nothing else, and damaged blobs must be rejected. Then measures the time per fix and per
+// lookup. The blobs are made by tools/hosttest/geoblobgen.py in $OUT/geoblob. Run with tools/hosttest/run.sh from the
+// top of the repository.
+
+#include "GeoBlob.h"
+#include "Geofence.h"
+#include "HostTest.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Fences and access points as geoblob.py read them, from the .txt file written by geoblobgen.py
+struct Inputs {
+    struct Circle {
+        uint32_t id;
+        int32_t lat;
+        int32_t lon;
+        uint32_t radius;
+    };
+    struct Polygon {
+        uint32_t id;
+        std::vector<Geofence::Vertex> vertices;
+    };
+    std::vector<Circle> circles;
+    std::vector<Polygon> polygons;
+    std::vector<GeoBlob::AccessPoint> accessPoints;
+    int32_t minLat = INT32_MAX, maxLat = INT32_MIN, minLon = INT32_MAX, maxLon = INT32_MIN;
+
+    void extend(int32_t lat, int32_t lon) {
+        minLat = std::min(minLat, lat);
+        maxLat = std::max(maxLat, lat);
+        minLon = std::min(minLon, lon);
+        maxLon = std::max(maxLon, lon);
+    }
+};
+
+static std::string blobDir() {
+    const char *out = getenv("OUT");
+    return std::string(out ? out : "/tmp/hosttest") + "/geoblob/";
+}
+
+static bool readInputs(const std::string &path, Inputs &inputs) {
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp) {
+        return false;
+    }
+    char kind;
+    while (1 == fscanf(fp, " %c", &kind)) {
+        if ('c' == kind) {
+            Inputs::Circle circle;
+            if (4 != fscanf(fp, "%u %d %d %u", &circle.id, &circle.lat, &circle.lon, &circle.radius)) {
+                break;
+            }
+            inputs.circles.push_back(circle);
+            inputs.extend(circle.lat, circle.lon);
+        }
+        else
+        if ('p' == kind) {
+            Inputs::Polygon polygon;
+            size_t numVertices;
+            if (2 != fscanf(fp, "%u %zu", &polygon.id, &numVertices)) {
+                break;
+            }
+            polygon.vertices.resize(numVertices);
+            for (auto &vertex : polygon.vertices) {
+                if (2 != fscanf(fp, "%d %d", &vertex.lat, &vertex.lon)) {
+                    break;
+                }
+                inputs.extend(vertex.lat, vertex.lon);
+            }
+            inputs.polygons.push_back(polygon);
+        }
+        else
+        if ('a' == kind) {
+            GeoBlob::AccessPoint ap = {};
+            unsigned hAcc;
+            char hex[13];
+            if (4 != fscanf(fp, "%12s %d %d %u", hex, &ap.lat, &ap.lon, &hAcc)) {
+                break;
+            }
+            for (int ii = 0; ii < 6; ii++) {
+                unsigned byte;
+                sscanf(hex + ii * 2, "%2x", &byte);
+                ap.bssid[ii] = (uint8_t)byte;
+            }
+            ap.hAcc = (uint16_t)hAcc;
+            inputs.accessPoints.push_back(ap);
+        }
+        else {
+            break;
+        }
+    }
+    bool ok = feof(fp);
+    fclose(fp);
+    return ok;
+}
+
+static std::vector<uint8_t> readFile(const std::string &path) {
+    std::vector<uint8_t> data;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp) {
+        uint8_t buf[4096];
+        size_t count;
+        while ((count = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            data.insert(data.end(), buf, buf + count);
+        }
+        fclose(fp);
+    }
+    return data;
+}
+
+static void writeFile(const std::string &path, const std::vector<uint8_t> &data) {
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp) {
+        fwrite(data.data(), 1, data.size(), fp);
+        fclose(fp);
+    }
+}
+
+static void addFences(Geofence &geofence, const Inputs &inputs) {
+    for (const auto &circle : inputs.circles) {
+        HOSTTEST_CHECK(geofence.addCircle(circle.id, circle.lat, circle.lon, circle.radius), "addCircle %u", circle.id);
+    }
+    for (const auto &polygon : inputs.polygons) {
+        HOSTTEST_CHECK(geofence.addPolygon(polygon.id, polygon.vertices.data(), polygon.vertices.size()), "addPolygon %u", polygon.id);
+    }
+    HOSTTEST_CHECK(geofence.build(), "build");
+}
+
+// Fixes that wander around the fences, with some jumps, so fences are entered, left, and dwelt in
+static std::vector<Geofence::Fix> randomWalk(const Inputs &inputs, int numFixes, std::mt19937 &rng) {
+    int32_t marginLat = (inputs.maxLat - inputs.minLat) / 10 + 20000, marginLon = (inputs.maxLon - inputs.minLon) / 10 + 20000;
+    std::uniform_int_distribution<int32_t> randLat(inputs.minLat - marginLat, inputs.maxLat + marginLat);
+    std::uniform_int_distribution<int32_t> randLon(inputs.minLon - marginLon, inputs.maxLon + marginLon);
+    std::uniform_int_distribution<int32_t> step(-500, 500);
+
+    std::vector<Geofence::Fix> fixes(numFixes);
+    int32_t lat = randLat(rng), lon = randLon(rng);
+    uint32_t t = 1000;
+    for (auto &fix : fixes) {
+        if (0 == rng() % 50) {
+            lat = randLat(rng);
+            lon = randLon(rng);
+        }
+        else {
+            lat += step(rng);
+            lon += step(rng);
+        }
+        t += 1 + rng() % 30;
+        fix = { t, lat, lon, (uint32_t)(rng() % 60) };
+    }
+    return fixes;
+}
+
+// Events for each fix, sorted, since the order within one fix depends on the order of the active entries
+static std::vector<std::vector<std::pair<int, uint32_t>>> runFixes(Geofence &geofence, const std::vector<Geofence::Fix> &fixes) {
+    std::vector<std::vector<std::pair<int, uint32_t>>> events(fixes.size());
+    for (size_t ii = 0; ii < fixes.size(); ii++) {
+        geofence.evaluate(fixes[ii]);
+        Geofence::Event event;
+        while (geofence.takeEvent(event)) {
+            events[ii].push_back({ (int)event.type, event.fenceId });
+        }
+        std::sort(events[ii].begin(), events[ii].end());
+        events[ii].push_back({ -1, (uint32_t)geofence.getInsideCount() });
+    }
+    return events;
+}
+
+static Geofence &configure(Geofence &geofence) {
+    return geofence.withConfirmFixes(2).withExitMargin(20).withDwellTime(300).withMaxAccuracy(50);
+}
+
+static void testEvents(const char *name, const GeoBlob &fileBlob, const GeoBlob &memoryBlob, const Inputs &inputs, int numFixes) {
+    Geofence ram, file, memory;
+    addFences(configure(ram), inputs);
+    HOSTTEST_CHECK(configure(file).attach(fileBlob), "%s: attach file", name);
+    HOSTTEST_CHECK(configure(memory).attach(memoryBlob), "%s: attach memory", name);
+    HOSTTEST_CHECK(file.size() == ram.size() && memory.size() == ram.size(),
+                   "%s: %zu fences attached, %zu added", name, file.size(), ram.size());
+
+    std::mt19937 rng(3);
+    std::vector<Geofence::Fix> fixes = randomWalk(inputs, numFixes, rng);
+    auto expected = runFixes(ram, fixes);
+    auto fromFile = runFixes(file, fixes);
+    auto fromMemory = runFixes(memory, fixes);
+
+    size_t numEvents = 0;
+    for (size_t ii = 0; ii < fixes.size(); ii++) {
+        numEvents += expected[ii].size() - 1;
+        HOSTTEST_CHECK(fromFile[ii] == expected[ii], "%s fix %zu: file blob events differ", name, ii);
+        HOSTTEST_CHECK(fromMemory[ii] == expected[ii], "%s fix %zu: memory blob events differ", name, ii);
+        if (HostTest::failures()) {
+            return;
+        }
+    }
+    HOSTTEST_CHECK(numEvents > 0, "%s: no events in %d fixes", name, numFixes);
+    HOSTTEST_CHECK(0 == file.getStats().readErrors && 0 == memory.getStats().readErrors, "%s: read errors", name);
+    HOSTTEST_CHECK(0 == file.getStats().memoryBytes, "%s: attached fences use RAM", name);
+    printf("%s: %zu fences, %zu events in %d fixes match\n", name, ram.size(), numEvents, numFixes);
+}
+
+static bool sameAccessPoint(const GeoBlob::AccessPoint &a, const GeoBlob::AccessPoint &b) {
+    return 0 == memcmp(a.bssid, b.bssid, 6) && a.hAcc == b.hAcc && a.lat == b.lat && a.lon == b.lon;
+}
+
+static void testAccessPoints(const char *name, const GeoBlob &blob, const Inputs &inputs) {
+    HOSTTEST_CHECK(blob.getHeader().numAccessPoints == inputs.accessPoints.size(), "%s: %u access points, expected %zu",
+                   name, blob.getHeader().numAccessPoints, inputs.accessPoints.size());
+
+    std::vector<std::vector<uint8_t>> known;
+    for (const auto &expected : inputs.accessPoints) {
+        GeoBlob::AccessPoint ap;
+        bool found = blob.findAccessPoint(expected.bssid, ap);
+        HOSTTEST_CHECK(found && sameAccessPoint(ap, expected), "%s: %02x%02x%02x%02x%02x%02x %s", name, expected.bssid[0],
+                       expected.bssid[1], expected.bssid[2], expected.bssid[3], expected.bssid[4], expected.bssid[5],
+                       found ? "differs" : "not found");
+        known.emplace_back(expected.bssid, expected.bssid + 6);
+    }
+    std::sort(known.begin(), known.end());
+
+    // The BSSIDs either side of each known one, all-0 and all-ff, and random ones
+    std::vector<std::vector<uint8_t>> probes = { std::vector<uint8_t>(6, 0x00), std::vector<uint8_t>(6, 0xff) };
+    for (const auto &bssid : known) {
+        for (int delta : { -1, 1 }) {
+            std::vector<uint8_t> probe = bssid;
+            probe[5] = (uint8_t)(probe[5] + delta);
+            probes.push_back(probe);
+        }
+    }
+    std::mt19937 rng(4);
+    for (int ii = 0; ii < 10000; ii++) {
+        std::vector<uint8_t> probe(6);
+        for (auto &byte : probe) {
+            byte = (uint8_t)rng();
+        }
+        probes.push_back(probe);
+    }
+    size_t misses = 0;
+    for (const auto &probe : probes) {
+        bool isKnown = std::binary_search(known.begin(), known.end(), probe);
+        GeoBlob::AccessPoint ap;
+        bool found = blob.findAccessPoint(probe.data(), ap);
+        HOSTTEST_CHECK(found == isKnown && (!found || 0 == memcmp(ap.bssid, probe.data(), 6)),
+                       "%s: %02x%02x%02x%02x%02x%02x found %d, expected %d", name, probe[0], probe[1], probe[2], probe[3],
+                       probe[4], probe[5], found, isKnown);
+        misses += !isKnown;
+    }
+    printf("%s: %zu access points found, %zu misses not found\n", name, known.size(), misses);
+}
+
+// The blob changed by fn must be rejected by open() and attach(), or if only the body is changed, by verify()
+template<class Fn> static void expectRejected(const char *what, std::vector<uint8_t> data, bool headerValid, Fn fn) {
+    fn(data);
+    std::string path = blobDir() + "damaged.bin";
+    writeFile(path, data);
+
+    GeoBlob file, memory;
+    bool opened = file.open(path.c_str());
+    bool attached = memory.attach(data.data(), data.size());
+    if (headerValid) {
+        HOSTTEST_CHECK(opened && attached, "%s: header rejected", what);
+        HOSTTEST_CHECK(!file.verify() && !memory.verify(), "%s: passed verify()", what);
+    }
+    else {
+        HOSTTEST_CHECK(!opened && !attached, "%s: open() %d, attach() %d", what, opened, attached);
+        HOSTTEST_CHECK(!file.isOpen() && !memory.isOpen(), "%s: isOpen() after failing", what);
+    }
+}
+
+static void setField(std::vector<uint8_t> &data, size_t offset, uint32_t value) {
+    memcpy(&data[offset], &value, sizeof(value));
+}
+
+static void testDamaged(const std::vector<uint8_t> &good) {
+    const GeoBlob::Header *header = (const GeoBlob::Header *)good.data();
+
+    expectRejected("flipped fence byte", good, true, [&](std::vector<uint8_t> &data) { data[header->fencesOffset + 5] ^= 0x10; });
+    expectRejected("flipped access point byte", good, true, [&](std::vector<uint8_t> &data) { data[header->accessPointsOffset + 9] ^= 1; });
+    expectRejected("flipped last byte", good, true, [&](std::vector<uint8_t> &data) { data.back() ^= 0x80; });
+    expectRejected("changed crc", good, true, [&](std::vector<uint8_t> &data) { setField(data, offsetof(GeoBlob::Header, crc), header->crc + 1); });
+
+    expectRejected("truncated by 1 byte", good, false, [&](std::vector<uint8_t> &data) { data.pop_back(); });
+    expectRejected("truncated to half", good, false, [&](std::vector<uint8_t> &data) { data.resize(data.size() / 2); });
+    expectRejected("truncated header", good, false, [&](std::vector<uint8_t> &data) { data.resize(sizeof(GeoBlob::Header) - 1); });
+    expectRejected("empty", good, false, [&](std::vector<uint8_t> &data) { data.clear(); });
+    expectRejected("extra byte", good, false, [&](std::vector<uint8_t> &data) { data.push_back(0); });
+    expectRejected("bad magic", good, false, [&](std::vector<uint8_t> &data) { data[0] ^= 1; });
+    expectRejected("bad version", good, false, [&](std::vector<uint8_t> &data) { data[offsetof(GeoBlob::Header, version)]++; });
+    expectRejected("bad header size", good, false, [&](std::vector<uint8_t> &data) { data[offsetof(GeoBlob::Header, headerSize)] += 4; });
+    expectRejected("fences past the end", good, false, [&](std::vector<uint8_t> &data) {
+        setField(data, offsetof(GeoBlob::Header, numFences), header->numFences + (header->size / GeoBlob::FENCE_SIZE));
+    });
+    expectRejected("unaligned vertices", good, false, [&](std::vector<uint8_t> &data) {
+        setField(data, offsetof(GeoBlob::Header, verticesOffset), header->verticesOffset + 2);
+    });
+    expectRejected("access points past the end", good, false, [&](std::vector<uint8_t> &data) {
+        setField(data, offsetof(GeoBlob::Header, accessPointsOffset), header->size);
+    });
+    expectRejected("cell starts past the end", good, false, [&](std::vector<uint8_t> &data) {
+        setField(data, offsetof(GeoBlob::Header, cellStartOffset), 0xfffffff0);
+    });
+
+    GeoBlob missing;
+    HOSTTEST_CHECK(!missing.open((blobDir() + "missing.bin").c_str()), "open() of a missing file");
+    Geofence geofence;
+    HOSTTEST_CHECK(!geofence.attach(missing), "attach() to a blob that is not open");
+}
+
+static void bench(const GeoBlob &fileBlob, const GeoBlob &memoryBlob, const Inputs &inputs, int numFixes) {
+    Geofence ram, file, memory;
+    addFences(ram, inputs);
+    file.attach(fileBlob);
+    memory.attach(memoryBlob);
+
+    std::mt19937 rng(5);
+    std::vector<Geofence::Fix> fixes = randomWalk(inputs, numFixes, rng);
+    auto nsPerFix = [&](Geofence &geofence) {
+        Geofence::Event event;
+        return HostTest::timeNs([&]() {
+            for (const auto &fix : fixes) {
+                geofence.evaluate(fix);
+                while (geofence.takeEvent(event)) {
+                }
+            }
+        }) / numFixes;
+    };
+    printf("ns/fix   RAM %.0f   file %.0f   memory %.0f\n", nsPerFix(ram), nsPerFix(file), nsPerFix(memory));
+
+    std::vector<GeoBlob::AccessPoint> probes(numFixes);
+    for (auto &probe : probes) {
+        probe = inputs.accessPoints[rng() % inputs.accessPoints.size()];
+        if (rng() % 2) {
+            probe.bssid[5] ^= 0x5a;
+        }
+    }
+    volatile size_t found = 0;
+    auto nsPerLookup = [&](const GeoBlob &blob) {
+        return HostTest::timeNs([&]() {
+            GeoBlob::AccessPoint ap;
+            for (const auto &probe : probes) {
+                found += blob.findAccessPoint(probe.bssid, ap);
+            }
+        }) / numFixes;
+    };
+    printf("ns/findAccessPoint   file %.0f   memory %.0f\n", nsPerLookup(fileBlob), nsPerLookup(memoryBlob));
+}
+
+int main(int argc, char **argv) {
+    std::string dir = blobDir();
+    Inputs example, large, apsOnly;
+    HOSTTEST_CHECK(readInputs(dir + "example.txt", example) && readInputs(dir + "large.txt", large) && readInputs(dir + "apsonly.txt", apsOnly),
+                   "cannot read the inputs in %s, run tools/hosttest/geoblobgen.py first", dir.c_str());
+    if (HostTest::failures()) {
+        return HostTest::finish();
+    }
+
+    // assets/geo.bin is the example blob shipped with the application
+    struct Set {
+        const char *name;
+        std::string path;
+        const Inputs &inputs;
+        int numFixes;
+    } sets[] = {
+        { "assets/geo.bin", "assets/geo.bin", example, 20000 },
+        { "example", dir + "example.bin", example, 20000 },
+        { "large", dir + "large.bin", large, 100000 },
+    };
+    std::vector<uint8_t> largeData;
+    for (const auto &set : sets) {
+        std::vector<uint8_t> data = readFile(set.path);
+        GeoBlob file, memory;
+        HOSTTEST_CHECK(file.open(set.path.c_str()), "%s: open", set.name);
+        HOSTTEST_CHECK(memory.attach(data.data(), data.size()), "%s: attach", set.name);
+        HOSTTEST_CHECK(file.verify() && memory.verify(), "%s: verify", set.name);
+        if (HostTest::failures()) {
+            break;
+        }
+        testEvents(set.name, file, memory, set.inputs, set.numFixes);
+        testAccessPoints(set.name, file, set.inputs);
+        testAccessPoints(set.name, memory, set.inputs);
+        if (&set.inputs == &large) {
+            largeData = data;
+        }
+    }
+
+    // A blob of only access points can be looked up in, but not attached to a Geofence
+    GeoBlob apsOnlyBlob;
+    HOSTTEST_CHECK(apsOnlyBlob.open((dir + "apsonly.bin").c_str()) && apsOnlyBlob.verify(), "apsonly: open");
+    testAccessPoints("apsonly", apsOnlyBlob, apsOnly);
+    Geofence geofence;
+    HOSTTEST_CHECK(!geofence.attach(apsOnlyBlob), "apsonly: attach() to a blob with no fences");
+
+    if (!largeData.empty()) {
+        testDamaged(largeData);
+    }
+
+    if (!HostTest::failures()) {
+        const int numFixes = HostTest::benchRounds(argc, argv, 200000);
+        GeoBlob file, memory;
+        file.open((dir + "large.bin").c_str());
+        memory.attach(largeData.data(), largeData.size());
+        bench(file, memory, large, numFixes);
+    }
+
+    return HostTest::finish();
+}
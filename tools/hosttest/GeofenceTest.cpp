@@ -0,0 +1,269 @@
+// Checks Geofence enter, exit, and dwell events, compares the grid index with a brute-force test of every fence, and
+// measures the time per fix for 1,000 to 20,000 fences. Run with tools/hosttest/run.sh from the top of the repository.
+
+#include "Geofence.h"
+#include "HostTest.h"
+
+#include <math.h>
+#include <random>
+#include <set>
+#include <vector>
+
+// Exposes the fences the device is inside, which are otherwise only reported as events
+class TestGeofence : public Geofence {
+public:
+    std::set<uint32_t> insideIds() const {
+        std::set<uint32_t> ids;
+        for (size_t ii = 0; ii < numActive; ii++) {
+            if (active[ii].inside) {
+                ids.insert(fences[active[ii].fence].id);
+            }
+        }
+        return ids;
+    }
+};
+
+// Longitude offset in degrees * 10^7 for a distance east at a latitude in degrees
+static int32_t metersEast(double meters, double latDegrees) {
+    return (int32_t)(meters * 89.83 / cos(latDegrees * M_PI / 180));
+}
+
+static void expectEvent(Geofence &geofence, Geofence::EventType type, uint32_t fenceId, const char *what) {
+    Geofence::Event event;
+    bool got = geofence.takeEvent(event);
+    HOSTTEST_CHECK(got && event.type == type && event.fenceId == fenceId, "%s: got %s %s %u", what, got ? "event" : "no event",
+                   got ? Geofence::eventTypeName(event.type) : "", got ? event.fenceId : 0);
+}
+
+static void expectNoEvent(Geofence &geofence, const char *what) {
+    Geofence::Event event;
+    bool got = geofence.takeEvent(event);
+    HOSTTEST_CHECK(!got, "%s: unexpected %s %u", what, Geofence::eventTypeName(event.type), event.fenceId);
+}
+
+static void testWalk() {
+    Geofence geofence;
+    geofence.withConfirmFixes(2).withExitMargin(25).withDwellTime(60);
+    // About 1.1 x 0.8 km
+    Geofence::Vertex square[] = { {420000000, -750000000}, {420000000, -749900000}, {420100000, -749900000}, {420100000, -750000000} };
+    HOSTTEST_CHECK(geofence.addPolygon(7, square, 4), "addPolygon");
+    HOSTTEST_CHECK(geofence.addCircle(9, 421000000, -750000000, 100), "addCircle");
+    HOSTTEST_CHECK(geofence.build(), "build");
+
+    uint32_t t = 1000;
+    auto fix = [&](int32_t lat, int32_t lon, uint32_t hAcc = 5) {
+        geofence.evaluate({ t++, lat, lon, hAcc });
+    };
+
+    fix(419990000, -749950000);
+    expectNoEvent(geofence, "outside");
+    fix(420050000, -749950000);
+    expectNoEvent(geofence, "first fix inside");
+    fix(420050000, -749950000);
+    expectEvent(geofence, Geofence::EventType::enter, 7, "second fix inside");
+
+    fix(430000000, -749950000, 500);
+    expectNoEvent(geofence, "poor accuracy");
+
+    // 10 m outside the north edge is within the exit margin
+    for (int ii = 0; ii < 3; ii++) {
+        fix(420100000 + 900, -749950000);
+    }
+    expectNoEvent(geofence, "within exit margin");
+
+    t += 100;
+    fix(420050000, -749950000);
+    expectEvent(geofence, Geofence::EventType::dwell, 7, "dwell");
+
+    fix(420100000 + 9000, -749950000);
+    expectNoEvent(geofence, "first fix 100 m outside");
+    fix(420100000 + 9000, -749950000);
+    expectEvent(geofence, Geofence::EventType::exit, 7, "second fix 100 m outside");
+
+    // Circle of 100 m: enter at 90 m, stay at 115 m (inside the margin), exit at 140 m
+    fix(421000000, -750000000 + metersEast(90, 42.1));
+    fix(421000000, -750000000 + metersEast(90, 42.1));
+    expectEvent(geofence, Geofence::EventType::enter, 9, "circle at 90 m");
+    fix(421000000, -750000000 + metersEast(115, 42.1));
+    fix(421000000, -750000000 + metersEast(115, 42.1));
+    expectNoEvent(geofence, "circle at 115 m");
+    fix(421000000, -750000000 + metersEast(140, 42.1));
+    fix(421000000, -750000000 + metersEast(140, 42.1));
+    expectEvent(geofence, Geofence::EventType::exit, 9, "circle at 140 m");
+
+    // A jump to a fix outside the grid still exits the active fence
+    fix(421000000, -750000000);
+    fix(421000000, -750000000);
+    expectEvent(geofence, Geofence::EventType::enter, 9, "circle center");
+    fix(-300000000, 1000000000);
+    fix(-300000000, 1000000000);
+    expectEvent(geofence, Geofence::EventType::exit, 9, "jump outside the grid");
+}
+
+static void testSpan() {
+    Geofence geofence;
+
+    // The longitude span does not fit in an int32_t, so it must not wrap to a negative span
+    Geofence::Vertex wide[] = { {100000000, -1700000000}, {100000000, 1700000000}, {110000000, 0} };
+    HOSTTEST_CHECK(!geofence.addPolygon(1, wide, 3), "polygon spanning 340 degrees of longitude accepted");
+    Geofence::Vertex tall[] = { {-890000000, 0}, {890000000, 0}, {0, 10000000} };
+    HOSTTEST_CHECK(!geofence.addPolygon(2, tall, 3), "polygon spanning 178 degrees of latitude accepted");
+
+    Geofence::Vertex largest[] = { {0, -450000000}, {0, 450000000}, {10000000, 0} };
+    HOSTTEST_CHECK(geofence.addPolygon(3, largest, 3), "polygon spanning MAX_POLYGON_SPAN rejected");
+}
+
+// Ray casting in floating point, for comparison with the integer test in Geofence
+static bool insidePolygon(const std::vector<Geofence::Vertex> &v, double lat, double lon) {
+    bool inside = false;
+    for (size_t ii = 0, jj = v.size() - 1; ii < v.size(); jj = ii++) {
+        if ((v[ii].lat > lat) != (v[jj].lat > lat) &&
+            lon < ((double)v[jj].lon - v[ii].lon) * (lat - v[ii].lat) / ((double)v[jj].lat - v[ii].lat) + v[ii].lon) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+// The fences found through the grid must be exactly those found by testing every fence
+static void testAgainstBruteForce(std::mt19937 &rng) {
+    const int numFences = 2000;
+    TestGeofence geofence;
+    geofence.withConfirmFixes(1).withExitMargin(0).withMaxAccuracy(0);
+
+    struct Shape {
+        std::vector<Geofence::Vertex> polygon;
+        Geofence::Vertex center;
+        uint32_t radius;
+    };
+    std::vector<Shape> shapes(numFences);
+    // Overlapping fences 2 to 30 km across in a 55 x 40 km area
+    std::uniform_int_distribution<int32_t> randLat(400000000, 405000000), randLon(-750000000, -745000000);
+    for (int ii = 0; ii < numFences; ii++) {
+        int32_t lat = randLat(rng), lon = randLon(rng);
+        Shape &shape = shapes[ii];
+        if (ii % 2) {
+            shape.center = { lat, lon };
+            shape.radius = 50 + rng() % 2000;
+            HOSTTEST_CHECK(geofence.addCircle(ii, lat, lon, shape.radius), "addCircle %d", ii);
+        }
+        else {
+            // Irregular polygons, which are concave when the radius changes sharply between vertices
+            int numVertices = 3 + rng() % 12;
+            for (int kk = 0; kk < numVertices; kk++) {
+                double angle = 2 * M_PI * kk / numVertices;
+                double radius = 2000 + rng() % 30000;
+                shape.polygon.push_back({ lat + (int32_t)(radius * sin(angle)), lon + (int32_t)(radius * cos(angle) * 1.3) });
+            }
+            HOSTTEST_CHECK(geofence.addPolygon(ii, shape.polygon.data(), shape.polygon.size()), "addPolygon %d", ii);
+        }
+    }
+    HOSTTEST_CHECK(geofence.build(), "build");
+
+    int compared = 0;
+    for (int fixIndex = 0; fixIndex < 5000; fixIndex++) {
+        int32_t lat = randLat(rng), lon = randLon(rng);
+        geofence.evaluate({ (uint32_t)fixIndex, lat, lon, 0 });
+        Geofence::Event event;
+        while (geofence.takeEvent(event)) {
+        }
+
+        std::set<uint32_t> expected, boundary;
+        for (int ii = 0; ii < numFences; ii++) {
+            const Shape &shape = shapes[ii];
+            if (shape.radius) {
+                double dy = (double)lat - shape.center.lat;
+                double dx = ((double)lon - shape.center.lon) * cos(shape.center.lat / 10000000.0 * M_PI / 180);
+                double distance = sqrt(dx * dx + dy * dy);
+                double radius = shape.radius * 89.83;
+                // The integer test rounds differently within a few units of the edge
+                if (fabs(distance - radius) < 3) {
+                    boundary.insert(ii);
+                }
+                else
+                if (distance <= radius) {
+                    expected.insert(ii);
+                }
+            }
+            else
+            if (insidePolygon(shape.polygon, lat, lon)) {
+                expected.insert(ii);
+            }
+        }
+        // More fences than MAX_ACTIVE are not all tracked, which is counted in activeFull instead
+        if (expected.size() + boundary.size() > Geofence::MAX_ACTIVE) {
+            continue;
+        }
+        compared++;
+
+        std::set<uint32_t> got = geofence.insideIds();
+        for (uint32_t id : expected) {
+            HOSTTEST_CHECK(got.count(id), "fix %d: missed fence %u", fixIndex, id);
+        }
+        for (uint32_t id : got) {
+            HOSTTEST_CHECK(expected.count(id) || boundary.count(id), "fix %d: fence %u is not inside", fixIndex, id);
+        }
+        if (HostTest::failures()) {
+            return;
+        }
+    }
+    HOSTTEST_CHECK(compared > 2500, "only %d fixes compared", compared);
+}
+
+// A fix at a random point in a 50 x 50 km area filled with circles and polygons 50 to 500 m across, as in the README
+static void benchFences(int numFences, int numFixes) {
+    std::mt19937 rng(2);
+    Geofence geofence;
+    std::uniform_int_distribution<int32_t> randLat(400000000, 404500000), randLon(-750000000, -744000000);
+    for (int ii = 0; ii < numFences; ii++) {
+        int32_t lat = randLat(rng), lon = randLon(rng);
+        if (ii % 2) {
+            geofence.addCircle(ii, lat, lon, 50 + rng() % 450);
+        }
+        else {
+            Geofence::Vertex vertices[16];
+            int numVertices = 4 + rng() % 9;
+            for (int kk = 0; kk < numVertices; kk++) {
+                double angle = 2 * M_PI * kk / numVertices;
+                double radius = (50 + rng() % 450) * 89.83;
+                vertices[kk] = { lat + (int32_t)(radius * sin(angle)), lon + (int32_t)(radius * cos(angle) * 1.3) };
+            }
+            geofence.addPolygon(ii, vertices, numVertices);
+        }
+    }
+    double buildMs = HostTest::timeNs([&]() { geofence.build(); }) / 1000000;
+
+    std::vector<Geofence::Fix> fixes(numFixes);
+    for (int ii = 0; ii < numFixes; ii++) {
+        fixes[ii] = { (uint32_t)ii, randLat(rng), randLon(rng), 5 };
+    }
+    Geofence::Event event;
+    double ns = HostTest::timeNs([&]() {
+        for (const auto &fix : fixes) {
+            geofence.evaluate(fix);
+            while (geofence.takeEvent(event)) {
+            }
+        }
+    }) / numFixes;
+
+    auto stats = geofence.getStats();
+    printf("%6d   %8.1f   %13.1f   %10u   %6.0f   %7u   %9u\n", numFences, buildMs, (double)stats.fencesTested / stats.fixes,
+           stats.maxFencesTested, ns, stats.gridCells, stats.memoryBytes / 1024);
+}
+
+int main(int argc, char **argv) {
+    testWalk();
+    testSpan();
+    std::mt19937 rng(1);
+    for (int round = 0; round < 3 && !HostTest::failures(); round++) {
+        testAgainstBruteForce(rng);
+    }
+
+    const int numFixes = HostTest::benchRounds(argc, argv, 1000000);
+    printf("fences   build ms   tested per fix   max tested   ns/fix   cells   RAM Kbytes\n");
+    for (int numFences : { 1000, 5000, 10000, 20000 }) {
+        benchFences(numFences, numFixes);
+    }
+
+    return HostTest::finish();
+}
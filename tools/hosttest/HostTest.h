@@ -0,0 +1,85 @@
+#ifndef __HOSTTEST_H
+#define __HOSTTEST_H
+
+// Minimal helpers shared by the host tests. Each test is a single program that checks, prints its benchmark
+// results, and returns non-zero if any check failed.
+
+#include <chrono>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define HOSTTEST_CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            HostTest::failures()++; \
+        } \
+    } while (0)
+
+namespace HostTest {
+
+inline int &failures() {
+    static int count = 0;
+    return count;
+}
+
+inline int finish() {
+    if (failures()) {
+        printf("%d checks failed\n", failures());
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
+
+/**
+ * @brief Read a corpus file, one entry per line. Empty lines and lines starting with # are skipped.
+ */
+inline std::vector<std::string> readCorpus(const char *path) {
+    std::vector<std::string> lines;
+    std::ifstream in(path);
+    if (!in) {
+        printf("FAIL cannot open %s (run from the top of the repository)\n", path);
+        exit(1);
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && '\r' == line.back()) {
+            line.pop_back();
+        }
+        if (line.empty() || '#' == line[0]) {
+            continue;
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/**
+ * @brief Benchmark iterations: --rounds N on the command line, or def. --rounds 1 makes a quick smoke run.
+ */
+inline int benchRounds(int argc, char **argv, int def) {
+    for (int ii = 1; ii + 1 < argc; ii++) {
+        if (!strcmp(argv[ii], "--rounds")) {
+            return atoi(argv[ii + 1]);
+        }
+    }
+    return def;
+}
+
+template<class Fn>
+double timeNs(Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace HostTest
+
+#endif /* __HOSTTEST_H */
@@ -0,0 +1,246 @@
+// Checks that LocationBatch round trips exactly through the encoder, base64, and decoder, including the first fix,
+// negative differences, extreme values, and an empty batch, then reports fixes per event and bytes per fix for a
+// simulated vehicle track compared with the loc event. Run with tools/hosttest/run.sh from the top of the repository.
+
+#include "LocationBatch.h"
+#include "HostTest.h"
+
+#include <math.h>
+#include <random>
+
+// Same sizes as QuectelGnssRK::buildBatchPublish() for a maximum size event
+static const size_t MAX_EVENT_DATA_LENGTH = 1024;
+static const size_t EVENT_OVERHEAD = 64;
+static const size_t BATCH_SIZE = (MAX_EVENT_DATA_LENGTH - EVENT_OVERHEAD) / 4 * 3;
+
+static bool sameFix(const LocationBatch::Fix &a, const LocationBatch::Fix &b) {
+    return a.time == b.time && a.lat == b.lat && a.lon == b.lon && a.alt == b.alt;
+}
+
+// Encode, base64 encode, base64 decode, and decode, checking every fix comes back exactly. Returns the encoded size.
+static size_t roundTrip(const char *name, const LocationBatch::Fix *fixes, size_t count) {
+    uint8_t buf[BATCH_SIZE];
+    LocationBatch::Encoder encoder(buf, sizeof(buf));
+    for (size_t ii = 0; ii < count; ii++) {
+        HOSTTEST_CHECK(encoder.add(fixes[ii]), "%s: add %zu", name, ii);
+    }
+    HOSTTEST_CHECK(encoder.count() == count, "%s: count %zu", name, encoder.count());
+
+    char b64[BATCH_SIZE * 4 / 3 + 8];
+    size_t b64Len = LocationBatch::base64Encode(buf, encoder.size(), b64, sizeof(b64));
+    HOSTTEST_CHECK(b64Len == LocationBatch::base64Size(encoder.size()) - 1 && strlen(b64) == b64Len, "%s: base64 length %zu", name, b64Len);
+
+    uint8_t decoded[BATCH_SIZE];
+    size_t decodedLen = LocationBatch::base64Decode(b64, b64Len, decoded, sizeof(decoded));
+    HOSTTEST_CHECK(decodedLen == encoder.size() && !memcmp(decoded, buf, decodedLen), "%s: base64 round trip", name);
+
+    LocationBatch::Decoder decoder(decoded, decodedLen);
+    LocationBatch::Fix fix;
+    size_t numDecoded = 0;
+    while (decoder.next(fix)) {
+        HOSTTEST_CHECK(numDecoded < count && sameFix(fix, fixes[numDecoded]), "%s: fix %zu differs", name, numDecoded);
+        numDecoded++;
+    }
+    HOSTTEST_CHECK(decoder.isValid() && numDecoded == count, "%s: decoded %zu of %zu, valid %d", name, numDecoded, count, decoder.isValid());
+
+    return encoder.size();
+}
+
+static void testEmptyBatch() {
+    size_t size = roundTrip("empty", nullptr, 0);
+    HOSTTEST_CHECK(1 == size, "empty batch is %zu bytes", size);
+
+    char b64[8];
+    uint8_t version = LocationBatch::FORMAT_VERSION;
+    LocationBatch::base64Encode(&version, 1, b64, sizeof(b64));
+    HOSTTEST_CHECK(!strcmp(b64, "AQ=="), "empty batch base64 %s", b64);
+
+    // No room for the version byte: nothing can be added and the decoder rejects it
+    LocationBatch::Encoder encoder(nullptr, 0);
+    LocationBatch::Fix fix = {1, 2, 3, 4};
+    HOSTTEST_CHECK(!encoder.add(fix) && 0 == encoder.size(), "zero size buffer");
+    LocationBatch::Decoder decoder(nullptr, 0);
+    HOSTTEST_CHECK(!decoder.next(fix) && !decoder.isValid(), "decoder of zero bytes");
+}
+
+static void testFirstFix() {
+    // The first fix is relative to 0, so it is stored in full
+    LocationBatch::Fix first = {1760000000, 423601000, -710589000, 2000};
+    size_t size = roundTrip("first", &first, 1);
+    uint8_t temp[10];
+    size_t expected = 1 + LocationBatch::writeVarint(LocationBatch::zigzagEncode(first.time), temp) +
+        LocationBatch::writeVarint(LocationBatch::zigzagEncode(first.lat), temp) +
+        LocationBatch::writeVarint(LocationBatch::zigzagEncode(first.lon), temp) +
+        LocationBatch::writeVarint(LocationBatch::zigzagEncode(first.alt), temp);
+    HOSTTEST_CHECK(size == expected, "first fix %zu bytes, expected %zu", size, expected);
+
+    // A second identical fix is four zero differences, one byte each
+    LocationBatch::Fix two[2] = {first, first};
+    size_t size2 = roundTrip("repeat", two, 2);
+    HOSTTEST_CHECK(size2 == size + 4, "repeated fix %zu bytes", size2 - size);
+}
+
+static void testNegativeDeltas() {
+    // Moving south-west and downhill, with time going backward, as after a clock correction
+    LocationBatch::Fix fixes[] = {
+        {1760000100, 423601000, -710589000, 2000},
+        {1760000099, 423600990, -710589010, 1990},
+        {1760000050, 423500000, -710600000, -500},
+        {1760000051, 423500001, -710599999, -499},
+    };
+    roundTrip("negative", fixes, sizeof(fixes) / sizeof(fixes[0]));
+
+    // Small differences of either sign take one byte each
+    HOSTTEST_CHECK(1 == LocationBatch::zigzagEncode(-1) && 2 == LocationBatch::zigzagEncode(1) && 127 == LocationBatch::zigzagEncode(-64),
+                   "zigzag of small values");
+    uint8_t temp[10];
+    HOSTTEST_CHECK(1 == LocationBatch::writeVarint(LocationBatch::zigzagEncode(-64), temp) &&
+                   2 == LocationBatch::writeVarint(LocationBatch::zigzagEncode(64), temp), "varint length");
+}
+
+static void testExtremes() {
+    // Differences of up to 2^32 need 64-bit arithmetic
+    LocationBatch::Fix fixes[] = {
+        {0, INT32_MIN, INT32_MAX, 0},
+        {UINT32_MAX, INT32_MAX, INT32_MIN, -5},
+        {0, 0, 0, INT32_MIN},
+        {UINT32_MAX, -900000000, 1800000000, INT32_MAX},
+    };
+    roundTrip("extremes", fixes, sizeof(fixes) / sizeof(fixes[0]));
+}
+
+static void testInvalid() {
+    uint8_t buf[64];
+    LocationBatch::Encoder encoder(buf, sizeof(buf));
+    LocationBatch::Fix fix = {1760000000, 423601000, -710589000, 2000};
+    encoder.add(fix);
+
+    // Truncated in the middle of a fix
+    LocationBatch::Decoder truncated(buf, encoder.size() - 1);
+    LocationBatch::Fix out;
+    HOSTTEST_CHECK(!truncated.next(out) && !truncated.isValid(), "truncated batch");
+
+    // Unknown version
+    buf[0] = LocationBatch::FORMAT_VERSION + 1;
+    LocationBatch::Decoder version(buf, encoder.size());
+    HOSTTEST_CHECK(!version.next(out) && !version.isValid(), "wrong version");
+
+    // A fix that does not fit leaves the batch unchanged
+    uint8_t small[24];
+    LocationBatch::Encoder full(small, sizeof(small));
+    HOSTTEST_CHECK(full.add(fix), "first fix fits");
+    size_t before = full.size();
+    uint8_t copy[sizeof(small)];
+    memcpy(copy, small, sizeof(small));
+    LocationBatch::Fix far = {1760000000, -423601000, 710589000, -2000};
+    HOSTTEST_CHECK(!full.add(far) && full.size() == before && 1 == full.count() && !memcmp(copy, small, sizeof(small)), "full batch unchanged");
+
+    // base64 errors
+    uint8_t decoded[16];
+    HOSTTEST_CHECK(0 == LocationBatch::base64Decode("AQ*=", 4, decoded, sizeof(decoded)), "invalid base64 character");
+    HOSTTEST_CHECK(0 == LocationBatch::base64Decode("AAAAAAAA", 8, decoded, 5), "base64 decode overflow");
+    char b64[4];
+    HOSTTEST_CHECK(0 == LocationBatch::base64Encode(buf, 3, b64, sizeof(b64)), "base64 encode overflow");
+}
+
+static void testRandom() {
+    std::mt19937 rng(1);
+    for (int round = 0; round < 1000; round++) {
+        // Each fix is at most MAX_FIX_SIZE bytes, so this many always fit
+        LocationBatch::Fix fixes[(BATCH_SIZE - 1) / LocationBatch::MAX_FIX_SIZE];
+        size_t count = rng() % (sizeof(fixes) / sizeof(fixes[0]) + 1);
+        int shift = (int)(rng() % 32);
+        for (size_t ii = 0; ii < count; ii++) {
+            // Differences from tiny to full range
+            fixes[ii].time = (uint32_t)rng() >> shift;
+            fixes[ii].lat = (int32_t)rng() >> shift;
+            fixes[ii].lon = (int32_t)rng() >> shift;
+            fixes[ii].alt = (int32_t)rng() >> shift;
+        }
+        roundTrip("random", fixes, count);
+    }
+}
+
+// Size of the loc event for one fix, as written by QuectelGnssRK::buildPublish()
+static size_t locEventSize(const LocationBatch::Fix &fix) {
+    char json[512];
+    return (size_t)snprintf(json, sizeof(json),
+        "{\"cmd\":\"loc\",\"time\":%u,\"loc\":{\"lck\":1,\"time\":%u,\"lat\":%.8f,\"lon\":%.8f,\"alt\":%.3f,\"hd\":%.2f,\"spd\":%.2f,"
+        "\"hdop\":%.1f,\"h_acc\":%.3f,\"v_acc\":%.3f,\"nsat\":%u,\"ttff\":%.1f},\"req_id\":%u}",
+        fix.time, fix.time, fix.lat / 10000000.0, fix.lon / 10000000.0, fix.alt / 100.0, 87.33, 6.94, 0.9, 3.456, 5.678, 9u, 23.4, 123u);
+}
+
+int main(int argc, char **argv) {
+    testEmptyBatch();
+    testFirstFix();
+    testNegativeDeltas();
+    testExtremes();
+    testInvalid();
+    testRandom();
+
+    // Vehicle at about 25 km/h heading north-east, with GNSS noise of about 20 cm
+    printf("| Fix interval | Fixes per event | Encoded bytes per fix | loc-delta event bytes per fix | loc event bytes per fix |\n");
+    for (int interval : {1, 10, 60}) {
+        std::mt19937 rng(1);
+        std::normal_distribution<double> noise(0, 1);
+        LocationBatch::Fix fixes[400];
+        double lat = 42.3601, lon = -71.0589, alt = 20;
+        uint32_t time = 1760000000;
+        for (auto &fix : fixes) {
+            lat += interval * 5.0 / 111000.0 + noise(rng) * 2e-6;
+            lon += interval * 5.0 / 82000.0 + noise(rng) * 2e-6;
+            alt += noise(rng) * 0.3;
+            fix = {time, (int32_t)lround(lat * 1e7), (int32_t)lround(lon * 1e7), (int32_t)lround(alt * 100)};
+            time += interval;
+        }
+
+        uint8_t buf[BATCH_SIZE];
+        LocationBatch::Encoder encoder(buf, sizeof(buf));
+        size_t count = 0;
+        while (count < 400 && encoder.add(fixes[count])) {
+            count++;
+        }
+        roundTrip("track", fixes, count);
+
+        char prefix[64];
+        size_t eventSize = (size_t)snprintf(prefix, sizeof(prefix), "{\"cmd\":\"loc-delta\",\"req_id\":%u,\"n\":%u,\"d\":\"", 123u, (unsigned)count) +
+            LocationBatch::base64Size(encoder.size()) - 1 + 2;
+        HOSTTEST_CHECK(eventSize <= MAX_EVENT_DATA_LENGTH, "event %zu bytes", eventSize);
+        printf("| %d second%s | %zu | %.1f | %.1f | %zu |\n", interval, (1 == interval) ? "" : "s", count,
+               (double)encoder.size() / count, (double)eventSize / count, locEventSize(fixes[count - 1]));
+    }
+
+    // Encode and decode time, which matters less than size but should not be noticeable
+    const int rounds = HostTest::benchRounds(argc, argv, 20000);
+    LocationBatch::Fix fixes[100];
+    for (uint32_t ii = 0; ii < 100; ii++) {
+        fixes[ii] = {1760000000 + ii, 423601000 + (int32_t)ii * 90, -710589000 + (int32_t)ii * 120, 2000 + (int32_t)(ii % 7)};
+    }
+    uint8_t buf[BATCH_SIZE];
+    volatile size_t sink = 0;
+    double encodeNs = HostTest::timeNs([&]() {
+        for (int round = 0; round < rounds; round++) {
+            LocationBatch::Encoder encoder(buf, sizeof(buf));
+            for (const auto &fix : fixes) {
+                encoder.add(fix);
+            }
+            sink += encoder.size();
+        }
+    }) / ((double)rounds * 100);
+    LocationBatch::Encoder encoder(buf, sizeof(buf));
+    for (const auto &fix : fixes) {
+        encoder.add(fix);
+    }
+    double decodeNs = HostTest::timeNs([&]() {
+        for (int round = 0; round < rounds; round++) {
+            LocationBatch::Decoder decoder(buf, encoder.size());
+            LocationBatch::Fix fix;
+            while (decoder.next(fix)) {
+                sink += fix.lat;
+            }
+        }
+    }) / ((double)rounds * 100);
+    printf("per fix: encode %.1f ns, decode %.1f ns\n", encodeNs, decodeNs);
+
+    return HostTest::finish();
+}
@@ -0,0 +1,187 @@
+// Checks LocationCache lookups and least recently used eviction against a reference model and the save and load
+// round trip, then measures the memory and lookup time of the cell cache. Run with tools/hosttest/run.sh from the
+// top of the repository.
+
+#include "LocationCache.h"
+#include "HostTest.h"
+
+#include <fcntl.h>
+#include <map>
+#include <unistd.h>
+
+// Same layout as LocationFusionRK::CellKey and LocationFusionRK::CachedPosition, which need Device OS to include
+struct CellKey {
+    uint16_t mcc;
+    uint16_t mnc;
+    uint16_t lac;
+    uint16_t reserved;
+    uint32_t cid;
+};
+
+struct CachedPosition {
+    int32_t lat;
+    int32_t lon;
+    uint16_t hAcc;
+    uint16_t samples;
+    uint32_t time;
+};
+
+static const uint32_t MAGIC = 0x4c434331;
+
+// A truck route: a few hundred cells in a few location areas
+static CellKey makeKey(uint32_t ii) {
+    CellKey key = { 310, 410, (uint16_t)(11000 + ii / 16), 0, 169640000 + ii * 7 };
+    return key;
+}
+
+static uint64_t refKey(const CellKey &key) {
+    return ((uint64_t)key.lac << 32) | key.cid;
+}
+
+static void testLeastRecentlyUsed(const char *path) {
+    typedef LocationCache<CellKey, CachedPosition, 64> Cache;
+    Cache *cache = new Cache();
+
+    // Reference model: key to value and key to the time it was last used
+    std::map<uint64_t, int32_t> values;
+    std::map<uint64_t, uint32_t> used;
+    uint32_t now = 0;
+
+    srand(1);
+    for (int ii = 0; ii < 100000; ii++) {
+        CellKey key = makeKey(rand() % 200);
+        uint64_t k = refKey(key);
+        if (rand() % 2) {
+            bool isNew;
+            Cache::Stats before = cache->getStats();
+            cache->insert(key, isNew).lat = ii;
+            HOSTTEST_CHECK(isNew == !values.count(k), "insert %d isNew %d", ii, isNew);
+            values[k] = ii;
+            used[k] = ++now;
+            if (values.size() > Cache::CAPACITY) {
+                auto oldest = used.begin();
+                for (auto it = used.begin(); it != used.end(); it++) {
+                    if (it->second < oldest->second) {
+                        oldest = it;
+                    }
+                }
+                values.erase(oldest->first);
+                used.erase(oldest);
+                HOSTTEST_CHECK(cache->getStats().evictions == before.evictions + 1, "insert %d did not evict", ii);
+            }
+        }
+        else {
+            CachedPosition value = {};
+            bool found = cache->find(key, value);
+            HOSTTEST_CHECK(found == (values.count(k) > 0), "find %d found %d", ii, found);
+            if (found) {
+                HOSTTEST_CHECK(value.lat == values[k], "find %d value %d, expected %d", ii, value.lat, values[k]);
+                used[k] = ++now;
+            }
+        }
+        HOSTTEST_CHECK(cache->size() == values.size(), "size %zu, expected %zu", cache->size(), values.size());
+        if (HostTest::failures()) {
+            break;
+        }
+    }
+
+    // The most recently used entry is what getLastCellPosition() returns after a reset
+    auto newest = used.begin();
+    for (auto it = used.begin(); it != used.end(); it++) {
+        if (it->second > newest->second) {
+            newest = it;
+        }
+    }
+
+    HOSTTEST_CHECK(0 == cache->save(path, MAGIC) && !cache->isDirty(), "save");
+    Cache *loaded = new Cache();
+    HOSTTEST_CHECK(0 == loaded->load(path, MAGIC), "load");
+    HOSTTEST_CHECK(loaded->size() == values.size(), "loaded %zu, expected %zu", loaded->size(), values.size());
+    CellKey key;
+    CachedPosition value = {};
+    HOSTTEST_CHECK(loaded->mostRecent(key, value) && refKey(key) == newest->first, "most recent after load");
+    for (const auto &entry : values) {
+        CellKey key = makeKey(0);
+        key.lac = (uint16_t)(entry.first >> 32);
+        key.cid = (uint32_t)entry.first;
+        HOSTTEST_CHECK(loaded->find(key, value) && value.lat == entry.second, "loaded value for cid %u", key.cid);
+    }
+
+    // A file with a different magic or a damaged record leaves the cache empty
+    HOSTTEST_CHECK(0 != loaded->load(path, MAGIC + 1) && 0 == loaded->size(), "wrong magic accepted");
+    int fd = open(path, O_RDWR);
+    lseek(fd, -3, SEEK_END);
+    write(fd, "x", 1);
+    close(fd);
+    HOSTTEST_CHECK(0 != loaded->load(path, MAGIC) && 0 == loaded->size(), "damaged file accepted");
+
+    delete cache;
+    delete loaded;
+}
+
+// Lookup time with the table full and half of the lookups missing, as the cell cache is on a route with more cells
+// than it holds
+template<size_t SLOTS>
+static void benchCellCache(int rounds) {
+    typedef LocationCache<CellKey, CachedPosition, SLOTS> Cache;
+    Cache *cache = new Cache();
+    bool isNew;
+    for (uint32_t ii = 0; ii < Cache::CAPACITY; ii++) {
+        cache->insert(makeKey(ii), isNew).lat = (int32_t)ii;
+    }
+
+    const uint32_t numKeys = Cache::CAPACITY * 2;
+    CellKey *keys = new CellKey[numKeys];
+    for (uint32_t ii = 0; ii < numKeys; ii++) {
+        keys[ii] = makeKey((ii * 7919) % numKeys);
+    }
+
+    volatile int32_t sink = 0;
+    const long lookups = (long)rounds * numKeys;
+    double findNs = HostTest::timeNs([&]() {
+        CachedPosition value = {};
+        for (int round = 0; round < rounds; round++) {
+            for (uint32_t ii = 0; ii < numKeys; ii++) {
+                if (cache->find(keys[ii], value)) {
+                    sink += value.lat;
+                }
+            }
+        }
+    }) / lookups;
+
+    // Inserting a new cell into a full table scans for the least recently used entry
+    const int inserts = rounds > 10 ? rounds / 10 : 1;
+    double insertNs = HostTest::timeNs([&]() {
+        for (int ii = 0; ii < inserts; ii++) {
+            cache->insert(makeKey(numKeys + ii), isNew).lat = ii;
+        }
+    }) / inserts;
+
+    printf("%5zu   %8zu   %6zu   %9zu   %7.1f   %9.0f\n", SLOTS, Cache::CAPACITY, sizeof(Cache),
+           sizeof(Cache) / Cache::CAPACITY, findNs, insertNs);
+
+    delete[] keys;
+    delete cache;
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/locationcachetestXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("FAIL mkstemp\n");
+        return 1;
+    }
+    close(fd);
+
+    testLeastRecentlyUsed(path);
+    unlink(path);
+
+    const int rounds = HostTest::benchRounds(argc, argv, 5000);
+    printf("slots   capacity   bytes    per entry   find ns   insert ns\n");
+    benchCellCache<64>(rounds);
+    // The size LocationFusionRK uses for the cell and BSSID caches
+    benchCellCache<256>(rounds);
+    benchCellCache<1024>(rounds);
+
+    return HostTest::finish();
+}
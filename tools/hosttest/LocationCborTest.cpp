@@ -0,0 +1,176 @@
+// Encodes loc events the way LocationFusionRK::variantToCbor() does, checks LocationCbor::toJson() gives back the
+// JSON event, then compares the sizes and times the decode. Run with tools/hosttest/run.sh from the top of the repository.
+
+#include "LocationCbor.h"
+#include "HostTest.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// Same rule as variantToCbor(): fixed-point keys are scaled integers, other numbers stay floating point
+static void number(LocationCbor::Writer &writer, const char *key, double value) {
+    writer.text(key);
+    int decimals = LocationCbor::fixedPointDecimals(key);
+    if (decimals >= 0) {
+        writer.integer(llround(value * pow(10, decimals)));
+    }
+    else {
+        writer.floating(value);
+    }
+}
+
+static void integer(LocationCbor::Writer &writer, const char *key, int64_t value) {
+    writer.text(key);
+    writer.integer(value);
+}
+
+static void bssidOf(int ii, uint8_t *bssid, char *str) {
+    const uint8_t b[6] = { (uint8_t)(0xa0 + ii), 0x1b, 0x22, 0x3c, 0x4d, (uint8_t)(0x50 + ii) };
+    memcpy(bssid, b, sizeof(b));
+    sprintf(str, "%02x:%02x:%02x:%02x:%02x:%02x", b[0], b[1], b[2], b[3], b[4], b[5]);
+}
+
+/**
+ * @brief Encode a loc event with a GNSS fix, one LTE tower, and numWaps access points. Returns the JSON the
+ * device would have published, with values at the precision the CBOR event keeps.
+ */
+static std::string encodeLocEvent(LocationCbor::Writer &writer, int numWaps) {
+    writer.beginMap(7);
+    writer.text("cmd").text("loc");
+    integer(writer, "time", 1760000000);
+    integer(writer, "loc_cb", 1);
+
+    writer.text("loc").beginMap(12);
+    integer(writer, "lck", 1);
+    integer(writer, "time", 1760000000);
+    number(writer, "lat", 42.3601235);
+    number(writer, "lon", -71.0589123);
+    number(writer, "alt", 23.456);
+    number(writer, "hd", 271.25);
+    number(writer, "spd", 12.34);
+    number(writer, "hdop", 0.9);
+    number(writer, "h_acc", 3.456);
+    number(writer, "v_acc", 5.678);
+    integer(writer, "nsat", 9);
+    number(writer, "ttff", 23.4);
+
+    writer.text("towers").beginArray(1).beginMap(5);
+    writer.text("rat").text("lte");
+    integer(writer, "mcc", 310);
+    integer(writer, "mnc", 410);
+    integer(writer, "lac", 11298);
+    integer(writer, "cid", 169642506);
+
+    std::string json = "{\"cmd\":\"loc\",\"time\":1760000000,\"loc_cb\":1,\"loc\":{\"lck\":1,\"time\":1760000000,"
+        "\"lat\":42.3601235,\"lon\":-71.0589123,\"alt\":23.456,\"hd\":271.25,\"spd\":12.34,\"hdop\":0.9,"
+        "\"h_acc\":3.456,\"v_acc\":5.678,\"nsat\":9,\"ttff\":23.4},"
+        "\"towers\":[{\"rat\":\"lte\",\"mcc\":310,\"mnc\":410,\"lac\":11298,\"cid\":169642506}],\"wps\":[";
+
+    writer.text("wps").beginArray(numWaps);
+    for (int ii = 0; ii < numWaps; ii++) {
+        uint8_t bssid[6];
+        char str[18], entry[80];
+        bssidOf(ii, bssid, str);
+        writer.beginMap(3);
+        writer.text("bssid").bytes(bssid, sizeof(bssid));
+        integer(writer, "ch", 1 + ii % 11);
+        integer(writer, "str", -40 - ii * 2);
+        snprintf(entry, sizeof(entry), "%s{\"bssid\":\"%s\",\"ch\":%d,\"str\":%d}", ii ? "," : "", str, 1 + ii % 11, -40 - ii * 2);
+        json += entry;
+    }
+    integer(writer, "req_id", 7);
+    json += "],\"req_id\":7}";
+    return json;
+}
+
+static void testRoundTrip() {
+    uint8_t cbor[2048];
+    char json[4096];
+    for (int numWaps : { 0, 1, 10, 30 }) {
+        LocationCbor::Writer writer(cbor, sizeof(cbor));
+        std::string expected = encodeLocEvent(writer, numWaps);
+        HOSTTEST_CHECK(!writer.overflow(), "overflow with %d access points", numWaps);
+
+        size_t len = LocationCbor::toJson(cbor, writer.size(), json, sizeof(json));
+        HOSTTEST_CHECK(len == expected.size() && expected == json, "%d access points:\n  got  %s\n  want %s", numWaps, json, expected.c_str());
+    }
+}
+
+static void testValues() {
+    uint8_t cbor[256];
+    char json[512];
+    LocationCbor::Writer writer(cbor, sizeof(cbor));
+    writer.beginMap(9);
+    number(writer, "lat", -33.8688197);
+    number(writer, "lon", 0.0);
+    integer(writer, "cid", 4294967295LL);
+    integer(writer, "neg", -1000000);
+    number(writer, "temp", 21.5);
+    writer.text("ok").boolean(true);
+    writer.text("none").null();
+    writer.text("name").text("a\"b\\c");
+    // A bssid that is not 6 bytes is left as text
+    writer.text("bssid").text("not-a-bssid");
+
+    // Fixed-point values always have all of their decimal places
+    const char *expected = "{\"lat\":-33.8688197,\"lon\":0.0000000,\"cid\":4294967295,\"neg\":-1000000,\"temp\":21.5,"
+        "\"ok\":true,\"none\":null,\"name\":\"a\\\"b\\\\c\",\"bssid\":\"not-a-bssid\"}";
+    size_t len = LocationCbor::toJson(cbor, writer.size(), json, sizeof(json));
+    HOSTTEST_CHECK(len == strlen(expected) && !strcmp(json, expected), "values:\n  got  %s\n  want %s", json, expected);
+}
+
+static void testInvalid() {
+    uint8_t cbor[1024];
+    char json[2048];
+    LocationCbor::Writer writer(cbor, sizeof(cbor));
+    std::string expected = encodeLocEvent(writer, 10);
+
+    // Every truncation of the event is rejected rather than decoded as part of it
+    for (size_t cborLen = 0; cborLen < writer.size(); cborLen++) {
+        HOSTTEST_CHECK(0 == LocationCbor::toJson(cbor, cborLen, json, sizeof(json)), "truncated to %zu bytes accepted", cborLen);
+    }
+
+    // The output needs room for the null terminator
+    for (size_t jsonSize = 0; jsonSize <= expected.size(); jsonSize++) {
+        HOSTTEST_CHECK(0 == LocationCbor::toJson(cbor, writer.size(), json, jsonSize), "%zu byte buffer accepted", jsonSize);
+    }
+    HOSTTEST_CHECK(expected.size() == LocationCbor::toJson(cbor, writer.size(), json, expected.size() + 1), "exact size buffer");
+
+    // Nesting deeper than MAX_DEPTH
+    uint8_t nested[LocationCbor::MAX_DEPTH + 2];
+    memset(nested, 0x81, sizeof(nested) - 1);
+    nested[sizeof(nested) - 1] = 0x01;
+    HOSTTEST_CHECK(0 == LocationCbor::toJson(nested, sizeof(nested), json, sizeof(json)), "nesting deeper than MAX_DEPTH accepted");
+
+    // Trailing bytes after the event
+    cbor[writer.size()] = 0x00;
+    HOSTTEST_CHECK(0 == LocationCbor::toJson(cbor, writer.size() + 1, json, sizeof(json)), "trailing byte accepted");
+}
+
+int main(int argc, char **argv) {
+    testRoundTrip();
+    testValues();
+    testInvalid();
+
+    const int rounds = HostTest::benchRounds(argc, argv, 20000);
+    volatile size_t sink = 0;
+
+    printf("access points   JSON bytes   CBOR bytes   toJson ns\n");
+    for (int numWaps : { 0, 10, 20, 30 }) {
+        uint8_t cbor[2048];
+        char json[4096];
+        LocationCbor::Writer writer(cbor, sizeof(cbor));
+        std::string expected = encodeLocEvent(writer, numWaps);
+
+        double ns = HostTest::timeNs([&]() {
+            for (int ii = 0; ii < rounds; ii++) {
+                sink += LocationCbor::toJson(cbor, writer.size(), json, sizeof(json));
+            }
+        }) / rounds;
+        printf("%13d   %10zu   %10zu   %9.0f\n", numWaps, expected.size(), writer.size(), ns);
+    }
+
+    return HostTest::finish();
+}
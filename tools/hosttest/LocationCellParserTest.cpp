@@ -0,0 +1,109 @@
+// Feeds the AT+QENG responses in corpus/quectel-qeng.txt to LocationCellParser and checks the serving and neighbor
+// cells against the expected fields in the corpus, then times parsing. Run with tools/hosttest/run.sh from the top
+// of the repository.
+
+#include "LocationCellParser.h"
+#include "HostTest.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static std::string cellString(const LocationCellParser::Cell &cell) {
+    auto value = [](int16_t v) {
+        return (LocationCellParser::UNKNOWN == v) ? std::string("-") : std::to_string(v);
+    };
+    char buf[160];
+    snprintf(buf, sizeof(buf), "%s %s %u %u %x %x %u %u ", cell.serving ? "serving" : "neighbor",
+             LocationCellParser::ratName(cell.rat), cell.mcc, cell.mnc, (unsigned)cell.lac, (unsigned)cell.cid,
+             (unsigned)cell.ch, cell.nid);
+    return buf + value(cell.str) + " " + value(cell.rsrq) + " " + value(cell.ta);
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> lines = HostTest::readCorpus("tools/hosttest/corpus/quectel-qeng.txt");
+
+    // Responses of each block, for the benchmark
+    std::vector<std::vector<std::string>> blocks(1);
+
+    LocationCellParser parser;
+    parser.clear();
+    std::vector<std::string> expected;
+    int numBlocks = 0;
+    for (const auto &line : lines) {
+        if ('=' == line[0]) {
+            expected.push_back(line.substr(2));
+            continue;
+        }
+        size_t dropped;
+        if (1 == sscanf(line.c_str(), "dropped %zu", &dropped)) {
+            parser.finish();
+            numBlocks++;
+            HOSTTEST_CHECK(parser.size() == expected.size(), "block %d: %zu cells, expected %zu", numBlocks, parser.size(), expected.size());
+            for (size_t ii = 0; ii < parser.size() && ii < expected.size(); ii++) {
+                std::string got = cellString(parser.at(ii));
+                HOSTTEST_CHECK(got == expected[ii], "block %d cell %zu:\n  got  %s\n  want %s", numBlocks, ii, got.c_str(), expected[ii].c_str());
+            }
+            HOSTTEST_CHECK(parser.dropped() == dropped, "block %d: dropped %zu, expected %zu", numBlocks, parser.dropped(), dropped);
+            HOSTTEST_CHECK(parser.hasServing() == (!expected.empty() && 0 == expected[0].compare(0, 7, "serving")), "block %d: hasServing", numBlocks);
+
+            parser.clear();
+            expected.clear();
+            if (!blocks.back().empty()) {
+                blocks.emplace_back();
+            }
+            continue;
+        }
+
+        // Anything that is not a +QENG: line, and lines marked with !, must be rejected
+        bool reject = ('!' == line[0]);
+        const char *response = reject ? line.c_str() + 1 : line.c_str();
+        bool wantParsed = !reject && 0 == strncmp(response, "+QENG:", 6);
+        bool parsed = parser.parseLine((std::string(response) + "\r\n").c_str());
+        HOSTTEST_CHECK(parsed == wantParsed, "parseLine returned %d: %s", parsed, response);
+        if (wantParsed) {
+            blocks.back().push_back(response);
+        }
+    }
+    if (blocks.back().empty()) {
+        blocks.pop_back();
+    }
+    HOSTTEST_CHECK(expected.empty(), "corpus ends without a dropped line");
+    printf("%d response blocks match\n", numBlocks);
+
+    // A list that is full when the serving cell arrives drops the weakest neighbor for it
+    parser.clear();
+    char buf[LocationCellParser::MAX_LINE_LENGTH];
+    for (int ii = 0; ii < (int)LocationCellParser::MAX_CELLS; ii++) {
+        snprintf(buf, sizeof(buf), "+QENG: \"neighbourcell intra\",\"LTE\",5110,%d,-10,%d,-70,0", 10 + ii, -100 - ii);
+        parser.parseLine(buf);
+    }
+    parser.parseLine("+QENG: \"servingcell\",\"NOCONN\",\"LTE\",\"FDD\",310,410,A1B2C03,123,5110,12,3,3,2CB3,-98,-11,-68,9,-");
+    parser.finish();
+    HOSTTEST_CHECK(parser.hasServing() && LocationCellParser::MAX_CELLS == parser.size() && 1 == parser.dropped(), "serving cell after full neighbor list");
+    HOSTTEST_CHECK(-100 - (int)LocationCellParser::MAX_CELLS + 2 == parser.at(parser.size() - 1).str, "weakest kept %d", parser.at(parser.size() - 1).str);
+
+    // Parse time for all the responses of a block, as read for each loc event
+    const int rounds = HostTest::benchRounds(argc, argv, 20000);
+    volatile size_t sink = 0;
+    size_t numLines = 0;
+    for (const auto &block : blocks) {
+        numLines += block.size();
+    }
+    double ns = HostTest::timeNs([&]() {
+        for (int ii = 0; ii < rounds; ii++) {
+            for (const auto &block : blocks) {
+                parser.clear();
+                for (const auto &line : block) {
+                    parser.parseLine(line.c_str());
+                }
+                parser.finish();
+                sink += parser.size();
+            }
+        }
+    }) / rounds;
+    printf("parse %zu blocks, %zu lines: %.0f ns per line\n", blocks.size(), numLines, ns / numLines);
+
+    return HostTest::finish();
+}
@@ -0,0 +1,188 @@
+// Checks LocationTrackLog ordering, wrap-around, and recovery from a torn record or ack, then measures records
+// per second written and replayed. Run with tools/hosttest/run.sh from the top of the repository.
+
+#include "LocationTrackLog.h"
+#include "HostTest.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static LocationTrackLog::Record makeRecord(uint32_t ii) {
+    LocationTrackLog::Record rec = {};
+    rec.time = 1760000000 + ii;
+    rec.lat = 423501200 + (int32_t)ii * 37;
+    rec.lon = -710601000 - (int32_t)ii * 53;
+    rec.alt = 4190 + (int32_t)(ii % 100);
+    rec.hAcc = 35;
+    rec.spd = 700;
+    rec.hd = 8720;
+    return rec;
+}
+
+static bool sameFix(const LocationTrackLog::Record &a, const LocationTrackLog::Record &b) {
+    return a.time == b.time && a.lat == b.lat && a.lon == b.lon && a.alt == b.alt && a.hAcc == b.hAcc && a.spd == b.spd && a.hd == b.hd;
+}
+
+// Read and acknowledge everything pending, checking it is the expected consecutive fixes
+static void replayAll(LocationTrackLog &log, uint32_t firstIndex, size_t expected, size_t batchSize) {
+    LocationTrackLog::Record records[64];
+    size_t total = 0;
+    while (log.pending()) {
+        size_t count = log.read(records, batchSize);
+        HOSTTEST_CHECK(count > 0, "read returned 0 with %zu pending", log.pending());
+        if (0 == count) {
+            return;
+        }
+        for (size_t ii = 0; ii < count; ii++) {
+            auto want = makeRecord(firstIndex + (uint32_t)(total + ii));
+            HOSTTEST_CHECK(sameFix(records[ii], want), "record %zu time %u, expected %u", total + ii, records[ii].time, want.time);
+        }
+        HOSTTEST_CHECK(0 == log.ack(records[count - 1].seq), "ack %u", records[count - 1].seq);
+        total += count;
+    }
+    HOSTTEST_CHECK(total == expected, "replayed %zu, expected %zu", total, expected);
+}
+
+static void testOrderAndWrap(const char *dir) {
+    LocationTrackLog log;
+    HOSTTEST_CHECK(0 == log.begin(dir, 100), "begin");
+    for (uint32_t ii = 0; ii < 40; ii++) {
+        auto rec = makeRecord(ii);
+        log.append(rec);
+    }
+    HOSTTEST_CHECK(40 == log.pending(), "pending %zu", log.pending());
+    replayAll(log, 0, 40, 16);
+
+    // 250 more without a replay keeps only the newest 100
+    for (uint32_t ii = 40; ii < 290; ii++) {
+        auto rec = makeRecord(ii);
+        log.append(rec);
+    }
+    HOSTTEST_CHECK(100 == log.pending(), "pending after wrap %zu", log.pending());
+    HOSTTEST_CHECK(150 == log.getStats().recordsOverwritten, "overwritten %u", log.getStats().recordsOverwritten);
+    replayAll(log, 190, 100, 16);
+}
+
+static void testReopen(const char *dir) {
+    {
+        LocationTrackLog log;
+        log.begin(dir, 100);
+        for (uint32_t ii = 0; ii < 30; ii++) {
+            auto rec = makeRecord(ii);
+            log.append(rec);
+        }
+        LocationTrackLog::Record records[10];
+        size_t count = log.read(records, 10);
+        log.ack(records[count - 1].seq);
+    }
+
+    // The replay position survives a reset
+    LocationTrackLog log;
+    log.begin(dir, 100);
+    HOSTTEST_CHECK(20 == log.pending(), "pending after reopen %zu", log.pending());
+    replayAll(log, 10, 20, 7);
+}
+
+static void testTornRecord(const char *dir) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/track.bin", dir);
+
+    {
+        LocationTrackLog log;
+        log.begin(dir, 100);
+        for (uint32_t ii = 0; ii < 20; ii++) {
+            auto rec = makeRecord(ii);
+            log.append(rec);
+        }
+    }
+
+    // A reset part way through writing the 20th record (seq 20) leaves half of it
+    int fd = open(path, O_RDWR);
+    lseek(fd, 20 * sizeof(LocationTrackLog::Record) + 12, SEEK_SET);
+    uint8_t garbage[20];
+    memset(garbage, 0xff, sizeof(garbage));
+    write(fd, garbage, sizeof(garbage));
+    close(fd);
+
+    LocationTrackLog log;
+    log.begin(dir, 100);
+    HOSTTEST_CHECK(19 == log.pending(), "pending with torn record %zu", log.pending());
+    replayAll(log, 0, 19, 16);
+
+    // The next record reuses the torn sequence number
+    auto rec = makeRecord(500);
+    log.append(rec);
+    LocationTrackLog::Record read;
+    HOSTTEST_CHECK(1 == log.read(&read, 1) && 20 == read.seq && sameFix(read, rec), "append after torn record");
+}
+
+static void testCorruptAck(const char *dir) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/track.ack", dir);
+
+    {
+        LocationTrackLog log;
+        log.begin(dir, 100);
+        for (uint32_t ii = 0; ii < 20; ii++) {
+            auto rec = makeRecord(ii);
+            log.append(rec);
+        }
+        LocationTrackLog::Record records[5];
+        log.read(records, 5);
+        log.ack(records[4].seq);
+    }
+
+    // A bad ack file replays everything rather than losing records
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    write(fd, "xy", 2);
+    close(fd);
+
+    LocationTrackLog log;
+    log.begin(dir, 100);
+    HOSTTEST_CHECK(20 == log.pending(), "pending with corrupt ack %zu", log.pending());
+}
+
+static void makeDir(char *dir, size_t size, const char *base, const char *name) {
+    snprintf(dir, size, "%s/%s", base, name);
+}
+
+int main(int argc, char **argv) {
+    char base[] = "/tmp/tracklogtestXXXXXX";
+    if (!mkdtemp(base)) {
+        printf("FAIL mkdtemp\n");
+        return 1;
+    }
+    char dir[256];
+
+    makeDir(dir, sizeof(dir), base, "wrap");
+    testOrderAndWrap(dir);
+    makeDir(dir, sizeof(dir), base, "reopen");
+    testReopen(dir);
+    makeDir(dir, sizeof(dir), base, "torn");
+    testTornRecord(dir);
+    makeDir(dir, sizeof(dir), base, "ack");
+    testCorruptAck(dir);
+
+    // Throughput, with the same 1000 record file and 16 record batches as withTrackLog() uses by default
+    const int rounds = HostTest::benchRounds(argc, argv, 5);
+    makeDir(dir, sizeof(dir), base, "bench");
+    LocationTrackLog log;
+    log.begin(dir, 1000);
+    for (int round = 0; round < rounds; round++) {
+        for (uint32_t ii = 0; ii < 1000; ii++) {
+            auto rec = makeRecord(ii);
+            log.append(rec);
+        }
+        replayAll(log, 0, 1000, 16);
+    }
+    const auto &stats = log.getStats();
+    printf("%u records: write %u records/s, replay %u records/s (host file system, fsync per record)\n",
+           stats.recordsWritten, stats.writeRecordsPerSec, stats.replayRecordsPerSec);
+
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", base);
+    system(cmd);
+
+    return HostTest::finish();
+}
@@ -0,0 +1,124 @@
+// Compares QuectelResponseParser with the sscanf formats it replaced on modem responses, then times both.
+// Run with tools/hosttest/run.sh from the top of the repository.
+
+#include "QuectelResponseParser.h"
+#include "HostTest.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static const char *QLOC_FORMAT = " +QGPSLOC: %02u%02u%02u.%*03u,%lf,%lf,%f,%f,%u,%03u.%02u,%f,%f,%02u%02u%02u,%u";
+static const char *EPE_FORMAT = " +QGPSCFG: \"estimation_error\",%f,%f,%f,%f";
+static const char *CME_FORMAT = " +CME ERROR: %u";
+
+static int scanQloc(const char *buf, QuectelResponseParser::Qloc &q) {
+    return sscanf(buf, QLOC_FORMAT, &q.tm_hour, &q.tm_min, &q.tm_sec,
+                  &q.latitude, &q.longitude, &q.hdop, &q.altitude,
+                  &q.fix, &q.cogDegrees, &q.cogMinutes, &q.speedKmph, &q.speedKnots,
+                  &q.tm_day, &q.tm_month, &q.tm_year,
+                  &q.nsat);
+}
+
+static int scanEpe(const char *buf, QuectelResponseParser::Epe &e) {
+    return sscanf(buf, EPE_FORMAT, &e.h_acc, &e.v_acc, &e.speed_acc, &e.head_acc);
+}
+
+// Fields are compared bit for bit, so a float that rounds differently from strtof is a failure
+static bool sameQloc(const QuectelResponseParser::Qloc &a, const QuectelResponseParser::Qloc &b) {
+    // tm_hundredths is not in the sscanf format
+    return a.tm_hour == b.tm_hour && a.tm_min == b.tm_min && a.tm_sec == b.tm_sec &&
+        !memcmp(&a.latitude, &b.latitude, sizeof(double)) && !memcmp(&a.longitude, &b.longitude, sizeof(double)) &&
+        !memcmp(&a.hdop, &b.hdop, sizeof(float)) && !memcmp(&a.altitude, &b.altitude, sizeof(float)) &&
+        a.fix == b.fix && a.cogDegrees == b.cogDegrees && a.cogMinutes == b.cogMinutes &&
+        !memcmp(&a.speedKmph, &b.speedKmph, sizeof(float)) && !memcmp(&a.speedKnots, &b.speedKnots, sizeof(float)) &&
+        a.tm_day == b.tm_day && a.tm_month == b.tm_month && a.tm_year == b.tm_year && a.nsat == b.nsat;
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> lines = HostTest::readCorpus("tools/hosttest/corpus/quectel-responses.txt");
+    // Blank lines are comments in the corpus file, but an empty response is common
+    lines.push_back("");
+    lines.push_back("   ");
+
+    int fixes = 0;
+    for (const auto &line : lines) {
+        const char *buf = line.c_str();
+
+        // Start from the same non-zero values so fields that are not stored are compared too
+        QuectelResponseParser::Qloc q1, q2;
+        memset(static_cast<void *>(&q1), 0xa5, sizeof(q1));
+        memset(static_cast<void *>(&q2), 0xa5, sizeof(q2));
+        int n1 = QuectelResponseParser::parseQloc(buf, q1);
+        int n2 = scanQloc(buf, q2);
+        HOSTTEST_CHECK(n1 == n2 && sameQloc(q1, q2), "QGPSLOC parser %d sscanf %d: \"%s\"", n1, n2, buf);
+        if (QuectelResponseParser::QLOC_FIELDS == n1) {
+            fixes++;
+            HOSTTEST_CHECK(q1.tm_hundredths == 0, "hundredths %u: \"%s\"", q1.tm_hundredths, buf);
+        }
+
+        QuectelResponseParser::Epe e1, e2;
+        memset(static_cast<void *>(&e1), 0xa5, sizeof(e1));
+        memset(static_cast<void *>(&e2), 0xa5, sizeof(e2));
+        n1 = QuectelResponseParser::parseEpe(buf, e1);
+        n2 = scanEpe(buf, e2);
+        HOSTTEST_CHECK(n1 == n2 && !memcmp(&e1, &e2, sizeof(e1)), "QGPSCFG parser %d sscanf %d: \"%s\"", n1, n2, buf);
+
+        unsigned int c1 = 12345, c2 = 12345;
+        n1 = QuectelResponseParser::parseCmeError(buf, c1);
+        n2 = sscanf(buf, CME_FORMAT, &c2);
+        HOSTTEST_CHECK(n1 == n2 && c1 == c2, "CME ERROR parser %d (%u) sscanf %d (%u): \"%s\"", n1, c1, n2, c2, buf);
+    }
+    HOSTTEST_CHECK(fixes >= 10, "only %d complete fixes in corpus", fixes);
+
+    // The fraction of the time is not in the sscanf format, so check it separately
+    QuectelResponseParser::Qloc q;
+    QuectelResponseParser::parseQloc("+QGPSLOC: 174512.37,42.35012,-71.06010,1.1,41.9,3,87.20,0.4,0.2,291025,09", q);
+    HOSTTEST_CHECK(37 == q.tm_hundredths, "BG95 hundredths %u", q.tm_hundredths);
+    QuectelResponseParser::parseQloc("+QGPSLOC: 174512.4,42.35012,-71.06010,0.8,41.9,3,087.20,0.4,0.2,291025,11", q);
+    HOSTTEST_CHECK(40 == q.tm_hundredths, "EG91 hundredths %u", q.tm_hundredths);
+
+    printf("%zu lines match sscanf\n", lines.size());
+
+    // Parse time per line, for the complete fix and accuracy lines only
+    std::vector<std::string> bench;
+    for (const auto &line : lines) {
+        if (line.find("+QGPSLOC:") != std::string::npos || line.find("+QGPSCFG:") != std::string::npos) {
+            bench.push_back(line);
+        }
+    }
+    const int rounds = HostTest::benchRounds(argc, argv, 20000);
+    volatile unsigned int sink = 0;
+
+    double parserNs = HostTest::timeNs([&]() {
+        for (int ii = 0; ii < rounds; ii++) {
+            for (const auto &line : bench) {
+                QuectelResponseParser::Qloc q;
+                QuectelResponseParser::Epe e;
+                unsigned int code;
+                if (QuectelResponseParser::parseCmeError(line.c_str(), code) == 0) {
+                    sink += QuectelResponseParser::parseQloc(line.c_str(), q) + QuectelResponseParser::parseEpe(line.c_str(), e);
+                }
+            }
+        }
+    }) / ((double)rounds * bench.size());
+
+    double sscanfNs = HostTest::timeNs([&]() {
+        for (int ii = 0; ii < rounds; ii++) {
+            for (const auto &line : bench) {
+                QuectelResponseParser::Qloc q;
+                QuectelResponseParser::Epe e;
+                unsigned int code;
+                if (sscanf(line.c_str(), CME_FORMAT, &code) == 0) {
+                    sink += scanQloc(line.c_str(), q) + scanEpe(line.c_str(), e);
+                }
+            }
+        }
+    }) / ((double)rounds * bench.size());
+
+    printf("parse CME + QGPSLOC + QGPSCFG per line: parser %.0f ns, sscanf %.0f ns (%.1fx)\n",
+           parserNs, sscanfNs, sscanfNs / parserNs);
+
+    return HostTest::finish();
+}
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Make the inputs for GeoBlobTest.
+
+Usage: tools/hosttest/geoblobgen.py OUTDIR
+
+For the example inputs in tools/example, the example access points alone, and a generated set of 5,000 fences and
+20,000 access points, writes:
+- NAME.bin, the blob built by tools/geoblob.py build
+- NAME.txt, the fences and access points as the integers geoblob.py read from the GeoJSON and CSV, one per line:
+    c ID LAT LON RADIUS_METERS
+    p ID N LAT LON LAT LON ...
+    a BSSID LAT LON H_ACC
+  so the test can add the same fences with Geofence::addCircle() and addPolygon() without parsing GeoJSON.
+"""
+
+import json
+import math
+import os
+import random
+import subprocess
+import sys
+
+TOOLS = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+sys.path.insert(0, TOOLS)
+import geoblob
+
+
+class RecordingFenceSet(geoblob.FenceSet):
+    """FenceSet that also keeps the arguments of each add, in order"""
+    adds = []
+
+    def add_circle(self, id, lat, lon, radius_meters):
+        super().add_circle(id, lat, lon, radius_meters)
+        RecordingFenceSet.adds.append('c %d %d %d %d' % (id, lat, lon, radius_meters))
+
+    def add_polygon(self, id, vertices):
+        super().add_polygon(id, vertices)
+        RecordingFenceSet.adds.append('p %d %d ' % (id, len(vertices)) + ' '.join('%d %d' % v for v in vertices))
+
+
+def generate(fences_path, aps_path):
+    """5,000 fences 20 to 500 m across in a 55 x 40 km area, and 20,000 access points"""
+    rng = random.Random(7)
+    features = []
+    for ii in range(5000):
+        lat = 42 + rng.random() * 0.5
+        lon = -75 - rng.random() * 0.5
+        if ii % 2:
+            features.append({'type': 'Feature', 'properties': {'id': ii + 1, 'radius': rng.randint(20, 500)},
+                             'geometry': {'type': 'Point', 'coordinates': [lon, lat]}})
+        else:
+            points = []
+            n = rng.randint(3, 40)
+            for kk in range(n):
+                angle = 2 * math.pi * kk / n
+                radius = 0.001 + rng.random() * 0.003
+                points.append([lon + radius * math.cos(angle) * 1.3, lat + radius * math.sin(angle)])
+            features.append({'type': 'Feature', 'properties': {'id': ii + 1},
+                             'geometry': {'type': 'Polygon', 'coordinates': [points + [points[0]]]}})
+    with open(fences_path, 'w') as f:
+        json.dump({'type': 'FeatureCollection', 'features': features}, f)
+
+    with open(aps_path, 'w') as f:
+        f.write('bssid,lat,lon,h_acc\n')
+        for ii in range(20000):
+            bssid = ':'.join('%02x' % rng.randrange(256) for _ in range(6))
+            f.write('%s,%.7f,%.7f,%d\n' % (bssid, 42 + rng.random(), -75 - rng.random(), rng.randint(5, 100)))
+
+
+def write_set(out_dir, name, fences_path, aps_path):
+    command = [sys.executable, os.path.join(TOOLS, 'geoblob.py'), 'build', '--aps', aps_path,
+               '-o', os.path.join(out_dir, name + '.bin')]
+    if fences_path:
+        command += ['--fences', fences_path]
+    subprocess.run(command, check=True, stdout=subprocess.DEVNULL)
+
+    RecordingFenceSet.adds = []
+    if fences_path:
+        geoblob.FenceSet = RecordingFenceSet
+        geoblob.load_fences(fences_path)
+    lines = RecordingFenceSet.adds
+    for bssid, (h_acc, lat, lon) in sorted(geoblob.load_access_points(aps_path).items()):
+        lines.append('a %s %d %d %d' % (bssid.hex(), lat, lon, h_acc))
+    with open(os.path.join(out_dir, name + '.txt'), 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+def main():
+    out_dir = sys.argv[1]
+    os.makedirs(out_dir, exist_ok=True)
+    example = os.path.join(TOOLS, 'example')
+    write_set(out_dir, 'example', os.path.join(example, 'fences.geojson'), os.path.join(example, 'aps.csv'))
+    write_set(out_dir, 'apsonly', None, os.path.join(example, 'aps.csv'))
+
+    fences_path = os.path.join(out_dir, 'large.geojson')
+    aps_path = os.path.join(out_dir, 'large.csv')
+    generate(fences_path, aps_path)
+    write_set(out_dir, 'large', fences_path, aps_path)
+
+
+if __name__ == '__main__':
+    main()
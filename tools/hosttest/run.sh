@@ -0,0 +1,40 @@
+#!/bin/sh
+# Build and run the host tests for the parts of the libraries and application that do not depend on Device OS.
+#
+# Usage: tools/hosttest/run.sh [--rounds N]
+#   --rounds N    Benchmark iterations passed to each test; --rounds 1 only checks
+#
+# CXX selects the compiler (default g++) and OUT the build directory (default /tmp/hosttest). GeoBlobTest needs python3.
+
+set -e
+cd "$(dirname "$0")/../.."
+
+CXX=${CXX:-g++}
+OUT=${OUT:-/tmp/hosttest}
+CXXFLAGS="-std=gnu++17 -O2 -Wall -Itools/hosttest -Itools/hosttest/stub -Ilib/QuectelGnssRK/src -Ilib/LocationFusionRK/src -Isrc"
+
+mkdir -p "$OUT"
+failed=0
+
+# runTest <name> <sources...>
+runTest() {
+    name=$1
+    shift
+    echo "== $name"
+    $CXX $CXXFLAGS -o "$OUT/$name" "tools/hosttest/$name.cpp" "$@"
+    "$OUT/$name" $ARGS || failed=1
+}
+
+ARGS="$*"
+
+runTest QuectelResponseParserTest lib/QuectelGnssRK/src/QuectelResponseParser.cpp
+runTest LocationBatchTest lib/QuectelGnssRK/src/LocationBatch.cpp
+runTest LocationTrackLogTest lib/LocationFusionRK/src/LocationTrackLog.cpp lib/LocationFusionRK/src/LocationCache.cpp
+runTest LocationCborTest lib/LocationFusionRK/src/LocationCbor.cpp
+runTest LocationCacheTest lib/LocationFusionRK/src/LocationCache.cpp
+runTest LocationCellParserTest lib/LocationFusionRK/src/LocationCellParser.cpp
+runTest GeofenceTest src/Geofence.cpp src/GeoBlob.cpp
+python3 tools/hosttest/geoblobgen.py "$OUT/geoblob"
+runTest GeoBlobTest src/Geofence.cpp src/GeoBlob.cpp
+
+exit $failed
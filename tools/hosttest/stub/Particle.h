@@ -0,0 +1,51 @@
+#ifndef __HOSTTEST_PARTICLE_H
+#define __HOSTTEST_PARTICLE_H
+
+// The few Device OS declarations used by the library files that are tested on a computer. Only those files may be
+// compiled against this; anything else should fail to build rather than silently run with different behavior.
+
+#include <chrono>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#define SYSTEM_ERROR_NONE 0
+#define SYSTEM_ERROR_NOT_FOUND -170
+#define SYSTEM_ERROR_INVALID_STATE -210
+#define SYSTEM_ERROR_FILE -225
+#define SYSTEM_ERROR_NO_MEMORY -260
+#define SYSTEM_ERROR_INVALID_ARGUMENT -270
+#define SYSTEM_ERROR_BAD_DATA -280
+
+class String {
+public:
+    String(const char *str = "") : str(str) {}
+
+    const char *c_str() const { return str.c_str(); }
+
+    static String format(const char *fmt, ...) {
+        char buf[256];
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        return String(buf);
+    }
+
+private:
+    std::string str;
+};
+
+class SystemClass {
+public:
+    uint64_t millis() const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+inline SystemClass System;
+
+#endif /* __HOSTTEST_PARTICLE_H */